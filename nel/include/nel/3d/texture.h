@@ -32,7 +32,7 @@
 #include "nel/misc/rect.h"
 #include "nel/misc/bitmap.h"
 #include "nel/misc/bitmap.h"
-#include "nel/misc/object_arena_allocator.h"
+#include "nel/misc/thread_cached_allocator.h"
 #include <string>
 #include <list>
 #include <map>
@@ -115,7 +115,7 @@ public:
 class ITexture : public CBitmap, public NLMISC::CRefCount, public NLMISC::IStreamable
 {
 public:		
-	NL_USES_DEFAULT_ARENA_OBJECT_ALLOCATOR // for fast alloc
+	NL_USES_DEFAULT_THREAD_CACHED_ALLOCATOR // for fast alloc, the textures are also created by the async loading
 	// Those enums MUST be the same than in UTexture!!
 	enum	TWrapMode
 	{
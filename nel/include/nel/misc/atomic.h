@@ -0,0 +1,126 @@
+/** \file atomic.h
+ * OS independant atomic operations on 32-bit integers and pointers
+ *
+ * $Id$
+ */
+
+/* Copyright, 2000 Nevrax Ltd.
+ *
+ * This file is part of NEVRAX NEL.
+ * NEVRAX NEL is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+
+ * NEVRAX NEL is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with NEVRAX NEL; see the file COPYING. If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#ifndef NL_ATOMIC_H
+#define NL_ATOMIC_H
+
+#include "types_nl.h"
+
+#ifdef NL_OS_WINDOWS
+#	define NOMINMAX
+#	include <windows.h>
+#elif defined(NL_OS_UNIX)
+#	include <sched.h>
+#endif
+
+
+namespace NLMISC {
+
+
+/*
+ * Atomic operations used by the lock-free containers (CLockFreeBufFIFO...).
+ * All of them are full memory barriers.
+ * Windows: Interlocked functions. Unix: GCC __sync builtins (GCC 4.1 or later).
+ */
+
+/// Atomically adds value to *ptr and returns the previous value
+inline uint32	atomicFetchAdd( volatile uint32 *ptr, uint32 value )
+{
+#ifdef NL_OS_WINDOWS
+	return (uint32)InterlockedExchangeAdd( (volatile LONG*)ptr, (LONG)value );
+#else
+	return __sync_fetch_and_add( ptr, value );
+#endif
+}
+
+/// Atomically subtracts value from *ptr and returns the previous value
+inline uint32	atomicFetchSub( volatile uint32 *ptr, uint32 value )
+{
+	return atomicFetchAdd( ptr, (uint32)(-(sint32)value) );
+}
+
+/// Atomically sets *ptr to desired if it equals expected. Returns true if the swap was done.
+inline bool		atomicCompareAndSwap( volatile uint32 *ptr, uint32 expected, uint32 desired )
+{
+#ifdef NL_OS_WINDOWS
+	return (uint32)InterlockedCompareExchange( (volatile LONG*)ptr, (LONG)desired, (LONG)expected ) == expected;
+#else
+	return __sync_bool_compare_and_swap( ptr, expected, desired );
+#endif
+}
+
+/// Atomically sets *ptr to desired if it equals expected. Returns true if the swap was done.
+inline bool		atomicCompareAndSwapPtr( void * volatile *ptr, void *expected, void *desired )
+{
+#ifdef NL_OS_WINDOWS
+	return InterlockedCompareExchangePointer( ptr, desired, expected ) == expected;
+#else
+	return __sync_bool_compare_and_swap( ptr, expected, desired );
+#endif
+}
+
+/// Atomically sets *ptr to value and returns the previous value
+inline void		*atomicExchangePtr( void * volatile *ptr, void *value )
+{
+#ifdef NL_OS_WINDOWS
+	return InterlockedExchangePointer( ptr, value );
+#else
+	void *previous;
+	do
+	{
+		previous = *ptr;
+	}
+	while ( ! __sync_bool_compare_and_swap( ptr, previous, value ) );
+	return previous;
+#endif
+}
+
+/// Full memory barrier (orders the loads and stores issued before and after it)
+inline void		memoryBarrier()
+{
+#ifdef NL_OS_WINDOWS
+	MemoryBarrier();
+#else
+	__sync_synchronize();
+#endif
+}
+
+/// Lets another thread run (to use in a spin loop)
+inline void		yieldThread()
+{
+#ifdef NL_OS_WINDOWS
+	SwitchToThread();
+#else
+	sched_yield();
+#endif
+}
+
+
+} // NLMISC
+
+
+#endif // NL_ATOMIC_H
+
+/* End of atomic.h */
@@ -41,6 +41,10 @@ namespace NLMISC {
 
 const uint32 BF_ALWAYS_OPENED		=	0x00000001;
 const uint32 BF_CACHE_FILE_ON_OPEN	=	0x00000002;
+/** The whole big file is mapped in memory once: the files are read through CIFile without any handle or
+  * system call (falls back to the FILE mode if the mapping fails, for example if the address space is too small)
+  */
+const uint32 BF_MEMORY_MAPPED		=	0x00000004;
 
 // ***************************************************************************
 class CBigFile
@@ -81,9 +85,12 @@ public:
 	void currentThreadFinished();
 
 
-	// Used by CIFile to get information about the files within the big file
+	/** Used by CIFile to get information about the files within the big file.
+	  * If the big file is memory mapped and pMappedData is not NULL, *pMappedData is set to the file data
+	  * and NULL is returned (no FILE is opened). Else *pMappedData is set to NULL.
+	  */
 	FILE* getFile (const std::string &sFileName, uint32 &rFileSize, uint32 &rBigFileOffset, 
-					bool &rCacheFileOnOpen, bool &rAlwaysOpened);
+					bool &rCacheFileOnOpen, bool &rAlwaysOpened, const uint8 **pMappedData = NULL);
 
 	// Used by Sound to get information for async loading of mp3 in .bnp. Return false if file not found in registered bnps
 	bool getFileInfo (const std::string &sFileName, uint32 &rFileSize, uint32 &rBigFileOffset);
@@ -144,7 +151,7 @@ private:
 	// A BNP structure
 	struct BNP
 	{
-		BNP() : FileNames(NULL) { }
+		BNP() : FileNames(NULL), MappedData(NULL), MappedSize(0) { }
 
 		// FileName of the BNP. important to open it in getFile() (for other threads or if not always opened).
 		std::string						BigFileName;
@@ -155,6 +162,9 @@ private:
 		uint32							ThreadFileId;
 		bool							CacheFileOnOpen;
 		bool							AlwaysOpened;
+		// The whole BNP if it is memory mapped (BF_MEMORY_MAPPED), NULL else
+		const uint8						*MappedData;
+		uint32							MappedSize;
 	};
 private:
 
@@ -169,6 +179,13 @@ private:
 
 	// common for getFile and getFileInfo
 	bool getFileInternal (const std::string &sFileName, BNP *&zeBnp, BNPFile *&zeBnpFile);
+
+	// Fill the files of the bnp from its directory (the end of the bnp, from the file count), dataSize is the size before the directory
+	static bool readDirectory (BNP &bnp, const uint8 *dir, uint32 dirSize, uint32 dataSize);
+
+	// Map the whole bnp in memory
+	static bool mapBigFile (BNP &bnp);
+	static void unmapBigFile (BNP &bnp);
 };
 
 } // NLMISC
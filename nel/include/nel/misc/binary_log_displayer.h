@@ -0,0 +1,184 @@
+/** \file binary_log_displayer.h
+ * Displayer that writes the logs in a binary file, and the reader of these files
+ *
+ * $Id$
+ */
+
+/* Copyright, 2001 Nevrax Ltd.
+ *
+ * This file is part of NEVRAX NEL.
+ * NEVRAX NEL is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+
+ * NEVRAX NEL is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with NEVRAX NEL; see the file COPYING. If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#ifndef NL_BINARY_LOG_DISPLAYER_H
+#define NL_BINARY_LOG_DISPLAYER_H
+
+#include "types_nl.h"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdarg>
+
+#include "displayer.h"
+#include "mem_stream.h"
+#include "file.h"
+
+
+namespace NLMISC {
+
+
+/**
+ * Binary file displayer. The lines of CLog::displayNL() (nldebug, nlinfo, nlwarning...) are not formatted:
+ * the displayer writes the id of their format string and their arguments. The format strings, source file
+ * and function names are written once by file, the first time they are used. The other lines (display(),
+ * displayRaw(), errors, asserts, lines of the async logs) are written as text.
+ *
+ * The line is formatted anyway if another displayer of the log or a filter needs it.
+ *
+ * As CFileDisplayer, each line is flushed, and the file is renamed when it is bigger than 5 MB.
+ * CBinaryLogReader (and the log_decoder tool) renders the files in the format of CFileDisplayer.
+ *
+ * \code
+	CBinaryLogDisplayer bld ("service.blog");
+	InfoLog->addDisplayer (&bld);
+ * \endcode
+ */
+class CBinaryLogDisplayer : virtual public IDisplayer
+{
+public:
+
+	/// Constructor
+	CBinaryLogDisplayer (const std::string &filename, bool eraseLastLog = false, const char *displayerName = "");
+
+	CBinaryLogDisplayer ();
+
+	~CBinaryLogDisplayer ();
+
+	/// Set the file of the displayer
+	void setParam (const std::string &filename, bool eraseLastLog = false);
+
+	virtual bool canDisplayFormat () const { return true; }
+
+protected:
+
+	/// Write the id of the format and the arguments
+	virtual void doDisplayFormat (const CLog::TDisplayInfo& args, const char *format, va_list vargs);
+
+	/// Write the line as text
+	virtual void doDisplay (const CLog::TDisplayInfo& args, const char *message);
+
+private:
+
+	// Open the file if needed (renaming it if it's too big), returns false if it can't be opened
+	bool		openFile ();
+
+	// Returns the id of a string, written in the record before if it's new in the file (0 for NULL)
+	uint32		getStringId (const char *str);
+
+	// Write a new string in the record, returns its id
+	uint32		addString (const char *str);
+
+	// Serial the header of a line in the record
+	void		serialLineHeader (uint8 recordType, const CLog::TDisplayInfo& args);
+
+	// Write the record in the file
+	void		writeRecord ();
+
+	struct CStringId
+	{
+		uint32		Id;
+		std::string	Value;
+	};
+
+	// The strings written in the file, by address (the address of a string can be reused for another one,
+	// so the value is compared too)
+	typedef std::map<const char *, CStringId>	TStringIds;
+
+	std::string		_FileName;
+
+	FILE			*_FilePointer;
+
+	uint			_LastLogSizeChecked;
+
+	CMemStream		_Record;
+
+	TStringIds		_StringIds;
+
+	uint32			_NbStrings;
+
+	// The fields of the previous line (only the changes are written)
+	bool			_HasLastLine;
+	uint32			_LastDate;
+	uint32			_LastThreadId;
+	std::string		_LastProcessName;
+	uint32			_LastProcessId;
+};
+
+
+/**
+ * Reader of the files of CBinaryLogDisplayer. The lines are rendered as text.
+ *
+ * \code
+	CBinaryLogReader reader;
+	if (reader.open ("service.blog"))
+	{
+		CLog::TDisplayInfo args;
+		string message;
+		while (reader.readLine (args, message))
+			printf ("%s%s", CFileDisplayer::lineHeader (args).c_str(), message.c_str());
+	}
+ * \endcode
+ */
+class CBinaryLogReader
+{
+public:
+
+	CBinaryLogReader ();
+
+	/// Open a file, returns false if it can't be opened or it's not a binary log file
+	bool	open (const std::string &filename);
+
+	void	close ();
+
+	/** Read the next line, returns false at the end of the file (or where it is truncated).
+	 * message ends with a new line if the line was displayed with one. The file and function names of args
+	 * are valid until the next call.
+	 */
+	bool	readLine (CLog::TDisplayInfo &args, std::string &message);
+
+private:
+
+	const char	*getString (uint32 id) const;
+
+	CIFile						_File;
+
+	// The strings by id (0 is NULL)
+	std::vector<std::string>	_Strings;
+
+	// The fields of the previous line
+	time_t						_Date;
+	uint						_ThreadId;
+	uint32						_ProcessId;
+};
+
+
+} // NLMISC
+
+
+#endif // NL_BINARY_LOG_DISPLAYER_H
+
+/* End of binary_log_displayer.h */
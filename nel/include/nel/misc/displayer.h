@@ -29,6 +29,7 @@
 #include "types_nl.h"
 
 #include <string>
+#include <cstdarg>
 
 #include "log.h"
 
@@ -59,6 +60,12 @@ public:
 	/// Display the string where it does.
 	void display( const CLog::TDisplayInfo& args, const char *message );
 
+	/// Display a line from its format and arguments, before formatting. Only called if canDisplayFormat().
+	void displayFormat( const CLog::TDisplayInfo& args, const char *format, va_list vargs );
+
+	/// Returns true if the displayer takes the lines of CLog::displayNL() before their formatting
+	virtual bool canDisplayFormat() const { return false; }
+
 	/// This is the identifier for a displayer, it is used to find or remove a displayer
 	std::string DisplayerName;
 
@@ -67,6 +74,9 @@ protected:
 	/// Method to implement in the derived class
 	virtual void doDisplay( const CLog::TDisplayInfo& args, const char *message) = 0;
 
+	/// Method to implement in the derived classes that can display the lines before their formatting
+	virtual void doDisplayFormat( const CLog::TDisplayInfo& /* args */, const char * /* format */, va_list /* vargs */) {}
+
 	
 	// Return the header string with date (for the first line of the log)
 	static const char *HeaderString ();
@@ -133,6 +143,9 @@ public:
 	/// Set Parameter of the displayer if not set at the ctor time
 	void setParam (const std::string &filename, bool eraseLastLog = false);
 
+	/// Returns the beginning of a line of the log file: "2000/01/15 12:05:30 <LogType> <ThreadId> <ProcessName> <FileName> <Line> <FuncName> : "
+	static std::string lineHeader (const CLog::TDisplayInfo& args);
+
 protected:
 	/// Put the string into the file.
     virtual void doDisplay ( const CLog::TDisplayInfo& args, const char *message );
@@ -193,6 +193,8 @@ private:
 	bool	_IsInXMLPackFile;
 	//// Offset in bnp or xml pack
 	uint32	_BigFileOffset;
+	/// Flag true if file is read in a memory mapped big file (the data is in _Cache, not owned)
+	bool	_IsMapped;
 
 	// Load async if needed in the cache.
 	void	loadIntoCache();
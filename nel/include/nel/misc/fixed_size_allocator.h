@@ -39,6 +39,7 @@ namespace NLMISC
   *     size isn't a fixed parameter of template. A fixed size allocator implemented as a template for type T can be layered on this implementation.
   *
   * NB : number of blocks per chunks must be at least 3
+  * NB : it is not thread-safe, see CThreadCachedAllocator for a thread-safe arena allocator
   * 
   * \author Nicolas Vizerie
   * \author Nevrax France
@@ -58,6 +59,12 @@ public:
 	uint getNumBlockPerChunk() const { return _NumBlockPerChunk; }
 	//
 	uint getNumAllocatedBlocks() const { return _NumAlloc; }
+	/// number of chunks currently allocated
+	uint getNumChunks() const { return _NumChunks; }
+	/// number of free blocks in the allocated chunks
+	uint getNumFreeBlocks() const { return _NumChunks * _NumBlockPerChunk - _NumAlloc; }
+	/// size of a block in a chunk, header included
+	uint getBlockSizeWithOverhead() const;
 private:	
 	class CChunk;
 	class CNode
@@ -0,0 +1,208 @@
+/** \file lock_free_buf_fifo.h
+ * Multi-producer single-consumer FIFO of variable size buffers, without mutex
+ *
+ * $Id$
+ */
+
+/* Copyright, 2001 Nevrax Ltd.
+ *
+ * This file is part of NEVRAX NEL.
+ * NEVRAX NEL is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+
+ * NEVRAX NEL is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with NEVRAX NEL; see the file COPYING. If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#ifndef NL_LOCK_FREE_BUF_FIFO_H
+#define NL_LOCK_FREE_BUF_FIFO_H
+
+#include "types_nl.h"
+
+#include <vector>
+
+#include "mem_stream.h"
+#include "log.h"
+
+
+namespace NLMISC {
+
+
+/**
+ * Lock-free variant of CBufFIFO, for one consumer thread and any number of producer threads.
+ * It's used in the layer1 network as the receive queue: the receive threads push the blocks
+ * and the user thread reads them, without sharing any mutex.
+ *
+ * The blocks are stored in a ring of slots (its capacity is a number of blocks, rounded up to a
+ * power of 2). A producer reserves a slot with a compare-and-swap on the push position, then
+ * publishes the block by writing the sequence number of the slot. The consumer only reads the
+ * sequence numbers. When the ring is full, the producers yield until the consumer pops a block
+ * (or tryPush() returns false). If the FIFO has a name, a warning is logged once per stall, when
+ * a producer starts waiting (an unnamed FIFO, such as the queue of the asynchronous log, never logs).
+ *
+ * The blocks are stored as CMemStreamBuffer::TBuffer, so that they can be passed from a producer to
+ * a CMemStream without copy (see pushNoCopy(), pop(TBlock&) and CMemStream::swapBuffer()).
+ *
+ * push() and pushNoCopy() can be called by any thread. All other methods, except size() and nbBlocks() which
+ * return approximate values, must be called by the consumer thread only.
+ *
+ * \code
+	CLockFreeBufFIFO fifo;
+	// in the producer threads
+	fifo.push( vec );
+	// in the consumer thread
+	uint8 *blocks [16];
+	uint32 sizes [16];
+	uint nb = fifo.frontBatch( blocks, sizes, 16 );
+	// ... use the blocks
+	fifo.popBatch( nb );
+ * \endcode
+ */
+class CLockFreeBufFIFO
+{
+public:
+
+	/// Default number of slots
+	enum { DefaultCapacity = 65536 };
+
+	/// Type of a block (same as the buffer of a CMemStream)
+	typedef CMemStreamBuffer::TBuffer TBlock;
+
+	/// Constructor (capacity is a number of blocks, name is used by the warning when the FIFO is full)
+	explicit CLockFreeBufFIFO( uint32 capacity=DefaultCapacity, const char *name=NULL );
+
+	/// Destructor (the remaining blocks are deleted)
+	~CLockFreeBufFIFO();
+
+	/// Push a copy of 'buffer' in the head of the FIFO (any thread)
+	void	push( const std::vector<uint8> &buffer ) { push( &buffer[0], (uint32)buffer.size() ); }
+
+	void	push( const NLMISC::CMemStream &buffer ) { push( buffer.buffer(), buffer.length() ); }
+
+	void	push( const uint8 *buffer, uint32 size );
+
+	/// Push a copy of 'buffer' if the FIFO is not full (any thread). Returns false if it is full.
+	bool	tryPush( const uint8 *buffer, uint32 size );
+
+	/// Push 'block' in the head of the FIFO without copying it (any thread). block is left empty.
+	void	pushNoCopy( TBlock &block );
+
+	/// Push 'block' without copying it if the FIFO is not full (any thread). Returns false if it is full (block is kept).
+	bool	tryPushNoCopy( TBlock &block );
+
+	/// Return true if the FIFO is empty
+	bool	empty() const;
+
+	/// Get the buffer in the tail of the FIFO (valid until pop())
+	void	front( uint8 *&buffer, uint32 &size );
+
+	void	front( std::vector<uint8> &buffer );
+
+	void	front( NLMISC::CMemStream &buffer );
+
+	/// This function returns the last byte of the front message
+	/// It is used by the network to know a value quickly without doing front()
+	uint8	frontLast();
+
+	/// Pop the buffer in the tail of the FIFO
+	void	pop();
+
+	/// Pop the buffer in the tail of the FIFO into 'block', without copying it
+	void	pop( TBlock &block );
+
+	/** Get up to maxNb buffers from the tail of the FIFO in one call (valid until popBatch()).
+	 * Returns the number of buffers got.
+	 */
+	uint	frontBatch( uint8 **buffers, uint32 *sizes, uint maxNb );
+
+	/// Pop nb buffers from the tail of the FIFO (nb must not exceed the result of frontBatch())
+	void	popBatch( uint nb );
+
+	/// Erase the FIFO
+	void	clear();
+
+	/// Returns the number of bytes in the FIFO (approximate if some producers are pushing)
+	uint32	size() const { return _NbBytes; }
+
+	/// Returns the number of blocks in the FIFO (approximate if some producers are pushing)
+	uint32	nbBlocks() const { return _PushPos - _PopPos; }
+
+	/// Returns the max number of blocks
+	uint32	capacity() const { return _Mask + 1; }
+
+	/// display the FIFO to stdout (used to debug the FIFO)
+	void	display();
+
+	/// display the FIFO statistics to the log
+	void	displayStats( CLog *log = InfoLog );
+
+private:
+
+	struct CSlot
+	{
+		// Equals to the position for which the slot is free, or to the position + 1 when filled
+		volatile uint32	Sequence;
+		TBlock			Block;
+	};
+
+	// Returns the slot of the tail if it is filled, otherwise NULL
+	CSlot	*tailSlot( uint32 offset=0 ) const;
+
+	// Reserves a slot for a producer, waiting for the consumer if the ring is full (else returns NULL)
+	CSlot	*reserveSlot( uint32 &pos, bool wait=true );
+
+	// Publishes a reserved slot filled by a producer
+	void	publishSlot( CSlot *slot, uint32 pos );
+
+	// Frees the tail slot for the producers
+	void	releaseTailSlot( CSlot *slot );
+
+	// The ring of slots
+	CSlot			*_Slots;
+
+	// Number of slots - 1
+	uint32			_Mask;
+
+	// Padding to keep the producer and consumer positions in different cache lines
+	uint8			_Pad0 [64];
+
+	// Next position to push to (shared by the producers)
+	volatile uint32	_PushPos;
+
+	uint8			_Pad1 [64];
+
+	// Next position to pop from (consumer only)
+	uint32			_PopPos;
+
+	// Number of bytes in the FIFO
+	volatile uint32	_NbBytes;
+
+	// Name for the warning when full (NULL: no warning)
+	const char		*_Name;
+
+	// 1 from the first wait of a producer until the consumer has emptied half of the ring
+	volatile uint32	_Stalled;
+
+	// Statistics
+	volatile uint32	_NbFullWaits;
+	uint32			_Popped;
+	uint32			_BiggestBlock;
+	uint32			_BiggestBatch;
+};
+
+
+} // NLMISC
+
+
+#endif // NL_LOCK_FREE_BUF_FIFO_H
+
+/* End of lock_free_buf_fifo.h */
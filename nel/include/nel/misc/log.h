@@ -31,6 +31,7 @@
 
 #include <string>
 #include <list>
+#include <cstdarg>
 
 
 namespace NLMISC
@@ -72,6 +73,9 @@ public:
 
 	CLog (TLogType logType = LOG_NO);
 
+	/// Destructor (waits for the lines queued in async mode)
+	~CLog ();
+
 	/// Add a new displayer in the log. You have to create the displayer, remove it and delete it when you have finish with it.
 	/// For example, in a 3dDisplayer, you can add the displayer when you want, and the displayer displays the string if the 3d
 	/// screen is available and do nothing otherwise. In this case, if you want, you could leave the displayer all the time.
@@ -102,6 +106,27 @@ public:
 	/// If !noDisplayer(), sets line and file parameters, and enters the mutex. If !noDisplayer(), don't forget to call display...() after, to release the mutex.
 	void setPosition (sint line, const char *fileName, const char *funcName = NULL);
 
+	/** Async mode: display...() only formats the line and pushes it in a lock-free queue shared by the async logs, without
+	 * entering the mutex. A background thread sends the queued lines to the displayers by batches. The errors and asserts
+	 * are still displayed at once, after the queued lines. The beginning of a line without new line is kept by thread (and by
+	 * log type) until the end of the line.
+	 * Switch it when no other thread uses the log. A displayer removed by removeDisplayer() is not used after the call.
+	 */
+	void setAsync (bool async);
+
+	bool isAsync () const { return _Async; }
+
+	/** Set the capacity (in lines) of the queue of the async logs, and what happens when it is full: the lines are dropped
+	 * or the callers wait for the background thread (default). Call it before the first setAsync(true).
+	 */
+	static void setAsyncQueue (uint32 capacity, bool dropWhenFull);
+
+	/// Wait until the lines queued by the async logs are displayed
+	static void flushAsync ();
+
+	/// Returns the number of lines dropped because the queue of the async logs was full
+	static uint32 getNbAsyncDropped ();
+
 
 #ifdef NL_OS_WINDOWS
 
@@ -192,9 +217,20 @@ public:
 
 protected:
 
+	friend class CAsyncLog;
+
 	/// Symetric to setPosition(). Automatically called by display...(). Do not call if noDisplayer().
 	void unsetPosition();
 
+	/// In async mode, queue the line or display it at once. Returns false if not in async mode.
+	bool displayAsync (const char *str, bool raw);
+
+	/// Send a line of the async queue to the displayers (in the async log thread, with the mutex)
+	void displayAsyncLine (TDisplayInfo &args, const char *str);
+
+	/// displayNL() when some displayers take the format: the line is formatted only for the others and the filters
+	void displayFormatNL (const char *format, va_list args);
+
 	/// Returns true if the string must be logged, according to the current filter
 	bool passFilter( const char *filter );
 
@@ -211,10 +247,15 @@ protected:
 
 	CDisplayers							 _BypassFilterDisplayers;	// these displayers always log info (by pass filter system)
 
+	// Number of displayers that take the lines before formatting (IDisplayer::canDisplayFormat())
+	uint								 _NbFormatDisplayers;
+
 	CMutex								 _Mutex;
 
 	uint32								 _PosSet;
 
+	bool								 _Async;
+
 	/// "Discard" filter
 	std::list<std::string>				 _NegativeFilter;
 
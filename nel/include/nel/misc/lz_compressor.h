@@ -0,0 +1,114 @@
+/** \file lz_compressor.h
+ * Fast LZ77 compression of a stream of messages, keeping the dictionary from one message to the next
+ *
+ * $Id$
+ */
+
+/* Copyright, 2001 Nevrax Ltd.
+ *
+ * This file is part of NEVRAX NEL.
+ * NEVRAX NEL is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+
+ * NEVRAX NEL is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with NEVRAX NEL; see the file COPYING. If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#ifndef NL_LZ_COMPRESSOR_H
+#define NL_LZ_COMPRESSOR_H
+
+#include "types_nl.h"
+
+#include <vector>
+
+
+namespace NLMISC {
+
+
+/**
+ * Compressor of a stream of messages, with the speed of LZ4 (same sequence format: a token with
+ * the literal and match lengths, the literals, a 16-bit offset).
+ * The messages are compressed one by one, but the last 64 KB of the previous messages are used as
+ * dictionary, so that the small redundant messages of a connection compress well.
+ *
+ * The messages must be decompressed in the same order by a CLZDecompressor. Both sides must be
+ * reset() at the same time (e.g. on a new connection).
+ *
+ * \code
+	CLZCompressor compressor;
+	std::vector<uint8> dest( CLZCompressor::maxCompressedSize( size ) );
+	uint32 compressedSize = compressor.compress( src, size, &dest[0] );
+	// on the other side, with the uncompressed size sent along
+	decompressor.decompress( &dest[0], compressedSize, result, size );
+ * \endcode
+ */
+class CLZCompressor
+{
+public:
+
+	/// Size of the dictionary (max offset of a match + 1)
+	enum { WindowSize = 65536 };
+
+	/// Constructor
+	CLZCompressor();
+
+	/// Forget the previous messages
+	void				reset();
+
+	/// Returns the size of the buffer to pass to compress()
+	static uint32		maxCompressedSize( uint32 size ) { return size + size/255 + 16; }
+
+	/// Compress a message into dest (of maxCompressedSize(size) bytes at least) and return the compressed size
+	uint32				compress( const uint8 *src, uint32 size, uint8 *dest );
+
+private:
+
+	// The previous messages and the current one
+	std::vector<uint8>	_History;
+
+	// Position in the whole stream of _History[0]
+	uint32				_Base;
+
+	// Last position in the whole stream of each hashed 4-byte sequence
+	std::vector<uint32>	_HashTable;
+};
+
+
+/**
+ * Decompressor of a stream of messages compressed by CLZCompressor.
+ */
+class CLZDecompressor
+{
+public:
+
+	/// Forget the previous messages
+	void				reset() { _History.clear(); }
+
+	/** Decompress a message of size bytes (uncompressed) into dest.
+	 * Returns false if the compressed data is corrupted, then the decompressor
+	 * must be reset (as well as the compressor on the other side).
+	 */
+	bool				decompress( const uint8 *src, uint32 srcSize, uint8 *dest, uint32 size );
+
+private:
+
+	// The previous messages and the current one
+	std::vector<uint8>	_History;
+};
+
+
+} // NLMISC
+
+
+#endif // NL_LZ_COMPRESSOR_H
+
+/* End of lz_compressor.h */
@@ -108,6 +108,18 @@ public:
 		std::swap(Pos, other.Pos);
 	}
 
+	/** Exchange the content of the buffer with a raw buffer (just swap memory pointer).
+	 *	If the buffer is shared, the sharing is broken without copy and other receives an empty buffer.
+	 */
+	void swapBuffer(TBuffer &other)
+	{
+		if (_SharedBuffer->getRefCount() > 1)
+		{
+			_SharedBuffer = new TMemStreamBuffer;
+		}
+		_SharedBuffer->_Buffer.swap(other);
+	}
+
 };
 
 
@@ -264,7 +276,9 @@ public:
 	virtual void	clear()
 	{
 		resetPtrTable();
-		_Buffer.getBufferWrite().clear();
+		// Release the buffer without copying it if it is shared (e.g. with a send queue)
+		CMemStreamBuffer::TBuffer previous;
+		_Buffer.swapBuffer( previous );
 		if (!isReading())
 		{
 			_Buffer.getBufferWrite().resize (_DefaultCapacity);
@@ -339,6 +353,27 @@ public:
 	 */
 	void			resize (uint32 size);
 
+	/**
+	 * Take the content of the specified buffer as the stream, without copying it. The previous content
+	 * of the stream is given back in buffer (or an empty buffer if it was shared with another stream).
+	 * It is used by the network to pass a received block from the receive queue to a CMessage.
+	 * Input stream: the current position is set at the beginning.
+	 * Output stream: the current position is set after the data (as with fill()).
+	 */
+	void			swapBuffer( CMemStreamBuffer::TBuffer &buffer )
+	{
+		resetPtrTable();
+		_Buffer.swapBuffer( buffer );
+		if (isReading())
+		{
+			_Buffer.Pos = 0;
+		}
+		else
+		{
+			_Buffer.Pos = _Buffer.getBuffer().size();
+		}
+	}
+
 	/**
 	 * Resize the stream with the specified size, set the current position at the beginning
 	 * of the stream and return a pointer to the stream buffer.
@@ -37,6 +37,7 @@ class CFixedSizeAllocator;
   * For a given block size, a fixed size allocator is used.
   * One possible use is with a family of class for which new and delete have been redefined at the top of the hierarchy  
   * (which the NL_USES_DEFAULT_ARENA_OBJECT_ALLOCATOR macro does)
+  * NB: it is not thread-safe, use CThreadCachedAllocator for the objects created or deleted in several threads
   *
   * \author Nicolas Vizerie
   * \author Nevrax France
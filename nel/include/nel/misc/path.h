@@ -38,6 +38,8 @@
 
 namespace NLMISC {
 
+class IStream;
+
 /// Exception throwed when a find is not found in a lookup() call
 struct EPathNotFound : public Exception
 {
@@ -65,6 +67,7 @@ public:
 	CFileContainer()
 	{
 		_MemoryCompressed = false;
+		_MemoryMappedBigFiles = false;
 		_AllFileNames = NULL;
 	}
 
@@ -85,6 +88,21 @@ public:
 	/** Same as AddSearchPath but with a big file "c:/test.nbf" all files name contained in the big file will be included  (the extention (Nel Big File) is used to know that it's a big file) */
 	void			addSearchBigFile (const std::string &filename, bool recurse, bool alternative, class NLMISC::IProgressCallback *progressCallBack = NULL);
 
+	/** The big files added after are memory mapped (BF_MEMORY_MAPPED): their files are read without handle nor system call.
+	 *	Default is false. Needs the address space for the whole big files.
+	 */
+	void			setMemoryMappedBigFiles (bool mapped) { _MemoryMappedBigFiles = mapped; }
+
+	/** Load the scans of the search paths saved by savePathCache(). The next addSearchPath() (not alternative) of a cached
+	 *	path uses the files found by the previous scan if none of its directories was modified since: it only gets the
+	 *	modification date of each directory instead of listing them and checking each file.
+	 *	Returns false if the file can't be read (the paths are scanned as usual).
+	 */
+	bool			loadPathCache (const std::string &filename);
+
+	/** Save the scans of the search paths added since the creation (read from the disk or from the loaded cache) */
+	bool			savePathCache (const std::string &filename);
+
 	/** Same as AddSearchPath but with a xml pack file "c:/test.xml_pack" all files name contained in the xml pack will be included   */
 	void			addSearchXmlpackFile (const std::string &sXmlpackFilename, bool recurse, bool alternative, class NLMISC::IProgressCallback *progressCallBack = NULL);
 
@@ -202,12 +220,13 @@ public:
 	 */
 	bool setCurrentPath (const char *);
 
-	/** Create a list of file having the requested extension.
+	/** Create a list of file having the requested extension (appended to filenames, sorted).
 	 */
 	void getFileList(const std::string &extension, std::vector<std::string> &filenames);
 
 #ifndef NL_DONT_USE_EXTERNAL_CODE
-	/** Create a list of file having the requested string in the filename and the requested extention.
+	/** Create a list of file having the requested string in the filename and the requested extention
+	 *	(appended to filenames, sorted).
 	 */
 	void getFileListByName(const std::string &extension, const std::string &name, std::vector<std::string> &filenames);
 #endif
@@ -249,6 +268,7 @@ private:
 	// ----------------------------------------------
 
 	bool _MemoryCompressed;
+	bool _MemoryMappedBigFiles;
 	CStaticStringMapper	SSMext;
 	CStaticStringMapper	SSMpath;
 
@@ -263,7 +283,7 @@ private:
 		uint32	Remapped : 1;
 	};
 
-	typedef std::map<std::string, CFileEntry>	TFiles;
+	typedef CHashMap<std::string, CFileEntry>	TFiles;
 	TFiles	 _Files; // first is the filename in lowercase (can be with a remapped extension)
 
 
@@ -284,6 +304,9 @@ private:
 	// first is the filename that can be with a remapped extension
 	std::vector<CMCFileEntry> _MCFiles;
 
+	// Open addressing index of _MCFiles by lowered file name (size is a power of 2): index in _MCFiles + 1, 0 if empty
+	std::vector<uint32> _MCIndex;
+
 	// Compare a MCFileEntry with a lowered string (usefull for MCfind)
 	class CMCFileComp
 	{
@@ -319,6 +342,34 @@ private:
 	/// first ext1, second ext2 (ext1 could remplace ext2)
 	std::vector<std::pair<std::string, std::string> > _Extensions;
 
+	// ----------------------------------------------
+	// PATH CACHE
+	// ----------------------------------------------
+
+	/// The result of the scan of a search path
+	struct CPathCacheEntry
+	{
+		/// The scanned directories (the search path first) and their modification date
+		std::vector<std::string>	Dirs;
+		std::vector<uint32>			DirDates;
+		/// The files found, relative to the search path
+		std::vector<std::string>	Files;
+		/// Date of the scan: a directory modified in the same second may have changed after it
+		uint32						ScanDate;
+
+		void	serial (IStream &f);
+	};
+
+	/// The key is the standardized path, with a '*' at the end if recursive
+	typedef std::map<std::string, CPathCacheEntry>	TPathCache;
+	TPathCache		_LoadedPathCache;
+	TPathCache		_PathCache;
+
+	/// Get the files of a search path from the loaded cache if its directories are not modified, else scan it
+	void			getSearchPathFiles (const std::string &path, bool recurse, std::vector<std::string> &files, class IProgressCallback *progressCallBack);
+	/// addSearchFile() without the checks, for the files found by addSearchPath()
+	void			insertSearchFile (const std::string &newFile, bool remap, const std::string &virtual_ext, class IProgressCallback *progressCallBack);
+
 	CMCFileEntry	*MCfind (const std::string &filename);
 	sint			findExtension (const std::string &ext1, const std::string &ext2);
 	void			insertFileInMap (const std::string &filename, const std::string &filepath, bool remap, const std::string &extension);
@@ -372,6 +423,26 @@ public:
 	/** Same as AddSearchPath but with a big file "c:/test.nbf" all files name contained in the big file will be included  (the extention (Nel Big File) is used to know that it's a big file) */
 	static void			addSearchBigFile (const std::string &filename, bool recurse, bool alternative, class NLMISC::IProgressCallback *progressCallBack = NULL);
 
+	/** The big files added after are memory mapped (BF_MEMORY_MAPPED): their files are read without handle nor system call.
+	 *	Default is false. Needs the address space for the whole big files.
+	 */
+	static void			setMemoryMappedBigFiles (bool mapped) { getInstance()->_FileContainer.setMemoryMappedBigFiles(mapped); }
+
+	/** Load the scans of the search paths saved by savePathCache(). The next addSearchPath() (not alternative) of a cached
+	 *	path uses the files found by the previous scan if none of its directories was modified since: it only gets the
+	 *	modification date of each directory instead of listing them and checking each file.
+	 *	Returns false if the file can't be read (the paths are scanned as usual).
+	 * \code
+		CPath::loadPathCache ("path.cache");
+		CPath::addSearchPath ("data", true, false);
+		CPath::savePathCache ("path.cache");
+	 * \endcode
+	 */
+	static bool			loadPathCache (const std::string &filename) { return getInstance()->_FileContainer.loadPathCache(filename); }
+
+	/** Save the scans of the search paths added since the start (read from the disk or from the loaded cache) */
+	static bool			savePathCache (const std::string &filename) { return getInstance()->_FileContainer.savePathCache(filename); }
+
 	/** Same as AddSearchPath but with a xml pack file "c:/test.xml_pack" all files name contained in the xml pack will be included   */
 	static void			addSearchXmlpackFile (const std::string &sXmlpackFilename, bool recurse, bool alternative, class NLMISC::IProgressCallback *progressCallBack = NULL);
 
@@ -489,12 +560,13 @@ public:
 	 */
 	static bool setCurrentPath (const char *);
 
-	/** Create a list of file having the requested extension.
+	/** Create a list of file having the requested extension (appended to filenames, sorted).
 	 */
 	static void getFileList(const std::string &extension, std::vector<std::string> &filenames);
 
 #ifndef NL_DONT_USE_EXTERNAL_CODE
-	/** Create a list of file having the requested string in the filename and the requested extention.
+	/** Create a list of file having the requested string in the filename and the requested extention
+	 *	(appended to filenames, sorted).
 	 */
 	static void getFileListByName(const std::string &extension, const std::string &name, std::vector<std::string> &filenames);
 #endif
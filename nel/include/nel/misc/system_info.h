@@ -76,6 +76,10 @@ public:
 	/** true if the Processor has HyperThreading
 	  */
 	static bool hasHyperThreading();
+
+	/** Returns the number of processors (or cores) currently online, at least 1
+	  */
+	static uint getNumberOfProcessors();
 	
 	/** true if running under NT
 	  */
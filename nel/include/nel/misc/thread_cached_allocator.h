@@ -0,0 +1,154 @@
+/** \file thread_cached_allocator.h
+ * Thread-safe object arena allocator with a cache of blocks by thread
+ *
+ * $Id$
+ */
+
+/* Copyright, 2000, 2001, 2002, 2003 Nevrax Ltd.
+ *
+ * This file is part of NEVRAX NEL.
+ * NEVRAX NEL is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+
+ * NEVRAX NEL is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with NEVRAX NEL; see the file COPYING. If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#ifndef NL_THREAD_CACHED_ALLOCATOR_H
+#define NL_THREAD_CACHED_ALLOCATOR_H
+
+#include "types_nl.h"
+
+#include <vector>
+
+#include "mutex.h"
+#include "tds.h"
+
+
+namespace NLMISC
+{
+
+
+class CFixedSizeAllocator;
+class CLog;
+
+/** A thread-safe version of CObjectArenaAllocator. A block can be allocated in a thread and freed in another one.
+  *
+  * As in CObjectArenaAllocator, the sizes up to maxAllocSize are rounded to the granularity, and each size class uses
+  * a CFixedSizeAllocator. Each thread keeps for each size class two magazines (small stacks) of free blocks:
+  * alloc() and free() only use the magazines of the calling thread, without any lock. When they are empty (or full),
+  * the thread exchanges a whole magazine with the depot of the size class, which is protected by a CFastMutex, and
+  * the depot gets its blocks from the CFixedSizeAllocator.
+  *
+  * The cache of a thread is released by the destructor of the allocator, or by releaseThreadCache() called by
+  * the thread before it ends (the blocks of a thread that ends before are kept until the destructor).
+  */
+class CThreadCachedAllocator
+{
+public:
+
+	/// Usage of a size class
+	struct CSizeClassStats
+	{
+		uint	BlockSize;			// size of the blocks given by alloc()
+		uint	NumUsedBlocks;		// blocks allocated and not freed
+		uint	NumCachedBlocks;	// free blocks kept in the magazines of the threads and of the depot
+		uint	NumFreeBlocks;		// free blocks in the chunks of the CFixedSizeAllocator
+		uint	NumChunks;
+	};
+
+	/// Usage of the allocator (the counters of the threads are read without lock, so they are approximative)
+	struct CStats
+	{
+		std::vector<CSizeClassStats>	SizeClasses;	// only the size classes used
+		uint							NumLargeBlocks;	// blocks bigger than the max size (allocated with new)
+		uint64							UsedBytes;		// bytes of the used blocks of the size classes
+		uint64							ReservedBytes;	// bytes of the chunks of the size classes
+		uint							NumThreadCaches;
+
+		/// Part of the reserved bytes that is not used (free or cached blocks, headers)
+		float	getFragmentation () const { return ReservedBytes == 0 ? 0.f : 1.f - (float)((double)UsedBytes / (double)ReservedBytes); }
+	};
+
+	/** ctor
+	  * \param maxAllocSize maximum intended size of allocation (the bigger blocks use new).
+	  * \param granularity the sizes are rounded up to this value, multiple of 8
+	  */
+	CThreadCachedAllocator (uint maxAllocSize, uint granularity = 8);
+
+	/// dtor. All the blocks must have been freed, and no other thread may use the allocator.
+	~CThreadCachedAllocator ();
+
+	/// Allocate a block with the given size
+	void	*alloc (uint size);
+
+	/// Free a block allocated with alloc(), in any thread
+	void	free (void *block);
+
+	/// Give back the magazines of the calling thread to the depot, and delete its cache
+	void	releaseThreadCache ();
+
+	/// Get the usage of each size class
+	void	getStats (CStats &stats) const;
+
+	/// Display the stats in a log
+	void	displayStats (CLog *log) const;
+
+	// for convenience, a default allocator is available
+	static CThreadCachedAllocator	&getDefaultAllocator ();
+
+private:
+
+	class CMagazine;
+	class CSizeClass;
+	class CThreadCache;
+
+	// Get the cache of the calling thread (create it if needed)
+	CThreadCache	*getThreadCache ();
+
+	// Slow paths of alloc() and free(), when the magazines of the thread are empty or full
+	void	*allocFromDepot (CThreadCache &cache, uint sizeClass);
+	void	freeToDepot (CThreadCache &cache, uint sizeClass, void *block);
+
+	// Give back the magazines of a cache to the depots (the cache is not used by another thread)
+	void	flushThreadCache (CThreadCache &cache);
+
+	uint						_MaxAllocSize;
+	uint						_Granularity;
+	uint						_NumSizeClasses;
+
+	// The depot of each size class (index 0 is not used)
+	CSizeClass					*_SizeClasses;
+
+	// The cache of each thread
+	CTDS						_ThreadCache;
+
+	// All the caches, for the stats and the destructor
+	mutable CFastMutex			_CachesMutex;
+	std::vector<CThreadCache*>	_ThreadCaches;
+
+	volatile uint32				_NumLargeBlocks;
+
+	static CThreadCachedAllocator	*_DefaultAllocator;
+};
+
+// Same as NL_USES_DEFAULT_ARENA_OBJECT_ALLOCATOR, with the default thread cached allocator, for the classes whose
+// objects are created in several threads (for example during the loading by the CAsyncFileManager).
+#	define NL_USES_DEFAULT_THREAD_CACHED_ALLOCATOR \
+		void *operator new(size_t size) { return NLMISC::CThreadCachedAllocator::getDefaultAllocator().alloc((uint) size); }\
+		void operator delete(void *block) { NLMISC::CThreadCachedAllocator::getDefaultAllocator().free(block); }
+
+} // NLMISC
+
+#endif // NL_THREAD_CACHED_ALLOCATOR_H
+
+/* End of thread_cached_allocator.h */
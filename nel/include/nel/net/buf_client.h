@@ -30,6 +30,10 @@
 #include "buf_net_base.h"
 #include "tcp_sock.h"
 #include "buf_sock.h"
+#include "nel/misc/mutex.h"
+
+#include <map>
+#include <set>
 
 
 namespace NLNET {
@@ -68,6 +72,80 @@ private:
 };
 
 
+#ifdef NL_NET_HAS_EPOLL
+/**
+ * Receive thread shared by client connections (Linux only).
+ * The connections are registered into one edge-triggered epoll set, so that a
+ * process with thousands of outgoing connections needs only a few threads.
+ * The methods are called by the user thread (watch(), unwatch()) or by the
+ * shared thread (run()), _Clients is mutexed between them. The mutex is not
+ * held while a socket is read: the client is pinned by _ClientInUse instead,
+ * and unwatch() waits until it is released.
+ *
+ * A socket is never read when the receive queue of its client is full: the last
+ * block is kept and the socket is retried periodically until the user thread
+ * makes room, so that a slow client does not stop the other ones.
+ */
+class CClientReceiveLoop : public NLMISC::IRunnable
+{
+public:
+
+	/// Constructor
+	CClientReceiveLoop();
+
+	/// Destructor (call after the thread has exited)
+	virtual ~CClientReceiveLoop();
+
+	/// Create the epoll set and the wake-up pipe, returns false if the system refused
+	bool	init();
+
+	/// Run (exits when requireExit() is called)
+	virtual void run();
+
+	/// Tells the thread to exit and wakes it up
+	void	requireExit();
+
+	/// Add the connection of the client into the epoll set (the socket must be connected)
+	void	watch( CBufClient *client );
+
+	/// Remove the connection of the client from the epoll set, if not already done. When it returns, the thread does not use the client anymore.
+	void	unwatch( CBufClient *client );
+
+	/// Returns the number of connections handled by the thread (mutexed)
+	uint	numberOfConnections();
+
+	uint32	NbLoop;
+
+private:
+
+	/// Read the socket of a client and remove it if it is disconnected
+	void	receive( uint64 key );
+
+	/** Read everything the socket of the client holds (needed by edge-triggering), returns false if it is disconnected.
+	 * stalled is true if the last received block is waiting for room in the receive queue (in and out).
+	 */
+	bool	drain( CBufClient *client, bool& stalled );
+
+	/// Connections by key (a key is never reused, so that an event can't reach another client)
+	typedef std::map<uint64, CBufClient*>	TClients;
+
+	NLMISC::CMutex	_Mutex;
+	TClients		_Clients;
+
+	/// Client being read by the thread, NULL if none (mutexed)
+	CBufClient		*_ClientInUse;
+
+	/// Keys of the connections whose receive queue is full (shared thread only)
+	std::set<uint64>	_StalledKeys;
+
+	uint64			_NextKey;
+	int				_EpollHandle;
+	int				_WakeUpPipeHandle [2];
+	volatile bool	_ExitRequired;
+};
+#endif
+
+
 
 /**
  * Client class for layer 1
@@ -94,9 +172,17 @@ class CBufClient : public CBufNetBase
 {
 public:
 
+	/** How the data is received.
+	 * ThreadEngine runs a receive thread by connection.
+	 * SharedEngine multiplexes the connections of all the clients of the process on a few threads
+	 * waiting with epoll() (Linux only, see setNbSharedReceiveThreads()).
+	 */
+	enum TReceiveEngine { ThreadEngine, SharedEngine };
+
 	/** Constructor. Set nodelay to true to disable the Nagle buffering algorithm (see CTcpSock documentation)
 	 * initPipeForDataAvailable is for Linux only. Set it to false if you provide an external pipe with
 	 * setExternalPipeForDataAvailable().
+	 * The receive engine is the default one (see setDefaultReceiveEngine()).
 	 */
 	CBufClient( bool nodelay=true, bool replaymode=false, bool initPipeForDataAvailable=true );
 
@@ -140,6 +226,12 @@ public:
 	//void	receive( std::vector<uint8>& buffer );
 	void	receive( NLMISC::CMemStream& buffer );
 
+	/** Receives up to maxNb blocks of data in one call, appending them to buffers. It pops the
+	 * contiguous user blocks of the receive queue at once. Returns the number of blocks received
+	 * (0 if the receive queue is empty). Do not call dataAvailable() before.
+	 */
+	uint	receiveBatch( std::vector<NLMISC::CMemStream>& buffers, uint maxNb );
+
 	/// Update the network (call this method evenly)
 	void	update();
 
@@ -213,10 +305,30 @@ public:
 	/// Returns the id of the connection
 	TSockId	id() const { return _BufSock; /*_RecvTask->sockId();*/ }
 
+	/// Returns the receive engine of this client
+	TReceiveEngine	receiveEngine() const { return _ReceiveEngine; }
+
+	/** Set the receive engine of the clients created from now on (done by CService with the
+	 * "NetClientReceiveEngine" config file variable, either "shared" or "thread").
+	 * SharedEngine is the default where available, ThreadEngine otherwise.
+	 */
+	static void		setDefaultReceiveEngine( TReceiveEngine engine );
+
+	/// Returns the receive engine of the clients created from now on
+	static TReceiveEngine	defaultReceiveEngine() { return _DefaultReceiveEngine; }
+
+	/** Set the number of shared receive threads (1 by default, "NetClientReceiveThreads" config file variable).
+	 * Taken into account when the threads are started, i.e. when there is no client of SharedEngine.
+	 */
+	static void		setNbSharedReceiveThreads( uint nb );
+
 
 protected:
 
 	friend class CClientReceiveTask;
+#ifdef NL_NET_HAS_EPOLL
+	friend class CClientReceiveLoop;
+#endif
 
 	/// Send buffer and connection
 	CNonBlockingBufSock *_BufSock; // ADDED: non-blocking client connection
@@ -240,12 +352,31 @@ protected:
 
 private:
 
+#ifdef NL_NET_HAS_EPOLL
+	/// Remove the connection from its shared receive thread, if any (before closing or reconnecting it)
+	void				unwatchConnection();
+#endif
+
 	/// Receive task
 	CClientReceiveTask	*_RecvTask;
 
 	/// Receive thread
 	NLMISC::IThread		*_RecvThread;
 
+	/// Engine of this client
+	TReceiveEngine		_ReceiveEngine;
+
+#ifdef NL_NET_HAS_EPOLL
+	/// Shared receive thread of the connection (NULL if not connected or ThreadEngine)
+	CClientReceiveLoop	*_SharedLoop;
+
+	/// Key of the connection in _SharedLoop
+	uint64				_SharedKey;
+#endif
+
+	/// Engine used by the clients created from now on
+	static TReceiveEngine	_DefaultReceiveEngine;
+
 };
 
 
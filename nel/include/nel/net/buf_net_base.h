@@ -29,10 +29,13 @@
 #include "nel/misc/types_nl.h"
 #include "nel/misc/mutex.h"
 #include "nel/misc/buf_fifo.h"
+#include "nel/misc/lock_free_buf_fifo.h"
 #include "nel/misc/thread.h"
 #include "nel/misc/debug.h"
 #include "nel/misc/common.h"
 
+#include <deque>
+
 namespace NLNET {
 
 
@@ -55,6 +58,9 @@ typedef NLMISC::CSynchronized<NLMISC::CBufFIFO> CSynchronizedFIFO;
 /// Accessor of mutexed FIFO buffer
 typedef CSynchronizedFIFO::CAccessor CFifoAccessor;
 
+/// Receive queue: pushed by the receive threads, popped by the user thread, without mutex
+typedef NLMISC::CLockFreeBufFIFO CReceiveFIFO;
+
 /// Size of a block
 typedef uint32 TBlockSize;
 
@@ -65,6 +71,11 @@ extern uint32 	NbNetworkTask;
 enum TPipeWay { PipeRead, PipeWrite };
 #endif
 
+#if defined(NL_OS_UNIX) && defined(__linux__)
+/// The receive threads can use epoll() instead of select() (Linux only)
+#	define NL_NET_HAS_EPOLL
+#endif
+
 
 /**
  * Layer 1
@@ -103,17 +114,15 @@ public:
 	/// Sets callback for detecting a disconnection (or NULL to disable callback)
 	void	setDisconnectionCallback( TNetCallback cb, void* arg ) { _DisconnectionCallback = cb; _DisconnectionCbArg = arg; }
 
-	/// Returns the size of the receive queue (mutexed)
+	/// Returns the size of the receive queue (approximate if the receive threads are pushing)
 	uint32	getReceiveQueueSize()
 	{
-		CFifoAccessor syncfifo( &_RecvFifo );
-		return syncfifo.value().size();
+		return _RecvFifo.size();
 	}
 
 	void displayReceiveQueueStat (NLMISC::CLog *log = NLMISC::InfoLog)
 	{
-		CFifoAccessor syncfifo( &_RecvFifo );
-		syncfifo.value().displayStats(log);
+		_RecvFifo.displayStats(log);
 	}
 	
 	/**
@@ -176,20 +185,25 @@ public:
 	/// The value that will be used if setMaxSentBlockSize() is not called (or called with a negative argument)
 	static uint32 DefaultMaxSentBlockSize;
 
+	/** Max number of blocks in the receive queue of a client and of a server. The slots of the
+	 * queue are allocated by the constructor: a process may have many clients, but few servers.
+	 */
+	enum { ClientReceiveQueueCapacity = 1024, ServerReceiveQueueCapacity = CReceiveFIFO::DefaultCapacity };
+
 protected:
 
 	friend class NLNET::CBufSock;
 
 #ifdef NL_OS_UNIX
-	/// Constructor
-	CBufNetBase( bool isDataAvailablePipeSelfManaged );
+	/// Constructor (receiveQueueCapacity is a number of blocks)
+	CBufNetBase( bool isDataAvailablePipeSelfManaged, uint32 receiveQueueCapacity );
 #else
-	/// Constructor
-	CBufNetBase();
+	/// Constructor (receiveQueueCapacity is a number of blocks)
+	CBufNetBase( uint32 receiveQueueCapacity );
 #endif
 
-	/// Access to the receive queue
-	CSynchronizedFIFO&	receiveQueue() { return _RecvFifo; }
+	/// Access to the receive queue (pop only in the user thread)
+	CReceiveFIFO&		receiveQueue() { return _RecvFifo; }
 
 	/// Returns the disconnection callback
 	TNetCallback		disconnectionCallback() const { return _DisconnectionCallback; }
@@ -197,18 +211,44 @@ protected:
 	/// Returns the argument of the disconnection callback
 	void*				argOfDisconnectionCallback() const { return _DisconnectionCbArg; }
 
-	/// Push message into receive queue (mutexed)
+	/// Push message into receive queue (lock-free, called by the receive threads)
 	// TODO OPTIM never use this function
 	void				pushMessageIntoReceiveQueue( const std::vector<uint8>& buffer );
 
-	/// Push message into receive queue (mutexed)
+	/// Push message into receive queue (lock-free, called by the receive threads)
 	void				pushMessageIntoReceiveQueue( const uint8 *buffer, uint32 size );
 
-	/// Sets _DataAvailable
-	void				setDataAvailableFlag( bool da ) { _DataAvailable = da; }
+	/// Push message into receive queue without copying it (lock-free, called by the receive threads). buffer is left empty.
+	void				pushMessageIntoReceiveQueue( CReceiveFIFO::TBlock& buffer );
+
+	/** Same as pushMessageIntoReceiveQueue( TBlock& ) but never waits: returns false if the receive
+	 * queue is full, buffer is then left unchanged.
+	 */
+	bool				tryPushMessageIntoReceiveQueue( CReceiveFIFO::TBlock& buffer );
+
+	/** Push a system event into receive queue from the user thread. It never waits: if the receive
+	 * queue is full, the event is kept in _PendingEvents until flushPendingEvents() finds room for it.
+	 * As the user thread does not write into the data available pipe, a select() on the pipe may
+	 * see the event only at the next wake-up.
+	 */
+	void				pushEventIntoReceiveQueue( const std::vector<uint8>& buffer );
+
+	/// Move the pending system events into the receive queue, as long as it is not full (user thread)
+	void				flushPendingEvents();
 
-	/// Return _DataAvailable
-	volatile bool		dataAvailableFlag() const { return _DataAvailable; }
+	/// Erase the pending system events (user thread)
+	void				clearPendingEvents() { _PendingEvents.clear(); }
+
+	/// Return true if the receive queue or the pending system events are not empty (no locking)
+	bool				dataAvailableFlag() const { return (! _RecvFifo.empty()) || (! _PendingEvents.empty()); }
+
+	/// Max number of blocks popped at a time by receiveBatch()
+	enum { MaxReceiveBatch = 64 };
+
+#ifdef NL_OS_UNIX
+	/// Consumes nb bytes of the data available pipe (one per block popped, see receiveBatch()), except the missing ones
+	void				readDataAvailablePipe( uint nb );
+#endif
 
 #ifdef NL_OS_UNIX
 	/// Pipe to select() on data available
@@ -217,8 +257,18 @@ protected:
 
 private:
 
-	/// The receive queue, protected by a mutex-like device
-	CSynchronizedFIFO	_RecvFifo;
+	/// The receive queue, multi-producer single-consumer without mutex
+	CReceiveFIFO		_RecvFifo;
+
+	/** The system events pushed by the user thread when the receive queue was full. The user thread
+	 * is the only one that can make room in the queue, so it must not wait for it (see pushEventIntoReceiveQueue()).
+	 */
+	std::deque< std::vector<uint8> >	_PendingEvents;
+
+#ifdef NL_OS_UNIX
+	/// Number of blocks of the receive queue that have no byte in the pipe (the system events moved by flushPendingEvents())
+	uint				_NbPipeBytesMissing;
+#endif
 
 	/// Callback for disconnection
 	TNetCallback		_DisconnectionCallback;
@@ -232,9 +282,6 @@ private:
 	/// Max size of sent messages (limited by the user)
 	uint32				_MaxSentBlockSize;
 
-	/// True if there is data available (avoids locking a mutex)
-	volatile bool		_DataAvailable;
-
 #ifdef NL_OS_UNIX
 	bool _IsDataAvailablePipeSelfManaged;
 #endif
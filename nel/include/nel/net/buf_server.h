@@ -76,6 +76,19 @@ protected:
 	int		        _WakeUpPipeHandle [2];
 #endif
 
+#ifdef NL_NET_HAS_EPOLL
+	/** Create the epoll set and register the read end of the wake-up pipe into it.
+	 * Returns false (and leaves the task in select mode) if the system refused to create it.
+	 */
+	bool	initEpoll();
+
+	/// Returns true if the task waits with epoll() instead of select()
+	bool	usingEpoll() const { return _EpollHandle != -1; }
+
+	/// Epoll set (-1 when the task uses select())
+	int				_EpollHandle;
+#endif
+
 private:
 
 	volatile bool	_ExitRequired;	
@@ -93,11 +106,16 @@ public:
 	CListenTask( CBufServer *server ) : CServerTask(), _Server(server) {}
 
 	/// Begins to listen on the specified port (call before running thread)
-	void			init( uint16 port, sint32 maxExpectedBlockSize );
+	void			init( uint16 port, sint32 maxExpectedBlockSize, bool reusePort=false );
 
 	/// Run (exits when the listening socket disconnects)
 	virtual void	run();
 
+#ifdef NL_NET_HAS_EPOLL
+	/// Switch the accept loop to epoll() (call after init() and before running thread)
+	void			useEpoll();
+#endif
+
 	/// Close listening socket
 	void			close();
 
@@ -160,6 +178,14 @@ public:
 
 	enum TThreadStategy { SpreadSockets, FillThreads };
 
+	/** Way the listen and receive threads wait for incoming data.
+	 * EpollEngine keeps a persistent, edge-triggered interest set per receive thread, so that a
+	 * wake-up costs in proportion to the number of active sockets instead of connected ones,
+	 * and is not limited by FD_SETSIZE. It is only available on Linux; elsewhere, or if the
+	 * epoll set cannot be created, the select() engine is used.
+	 */
+	enum TReceiveEngine { SelectEngine, EpollEngine };
+
 	/** Constructor
 	 * Set nodelay to true to disable the Nagle buffering algorithm (see CTcpSock documentation)
 	 * initPipeForDataAvailable is for Linux only. Set it to false if you provide an external pipe with
@@ -173,8 +199,11 @@ public:
 	/// Destructor
 	virtual ~CBufServer();
 
-	/// Listens on the specified port
-	void	init( uint16 port );
+	/** Listens on the specified port.
+	 * If reusePort is true, other servers can listen on the same port at the same time, and
+	 * the system spreads the incoming connections among them (see CShardedBufServer).
+	 */
+	void	init( uint16 port, bool reusePort=false );
 
 	/** Disconnect a connection
 	 * Set hostid to InvalidSockId to disconnect all connections.
@@ -215,6 +244,14 @@ public:
 	 */
 	void	receive( NLMISC::CMemStream& buffer, TSockId* hostid );
 
+	/** Receives up to maxNb blocks of data in one call, appending them to buffers and their
+	 * senders to hostids. It pops the contiguous user blocks of the receive queue at once, and
+	 * processes the connection/disconnection events in between as dataAvailable() does.
+	 * Returns the number of blocks received (0 if the receive queue is empty).
+	 * Do not call dataAvailable() before.
+	 */
+	uint	receiveBatch( std::vector<NLMISC::CMemStream>& buffers, std::vector<TSockId>& hostids, uint maxNb );
+
 	/// Update the network (call this method evenly)
 	void	update();
 
@@ -283,6 +320,20 @@ public:
 	/// Returns the number of connections (at the last update())
 	uint32	nbConnections() const { return _NbConnections; }
 
+	/// Returns the engine used by the listen and receive threads
+	TReceiveEngine	receiveEngine() const { return _ReceiveEngine; }
+
+	/// Returns the server that accepted the specified connection
+	static CBufServer	*ownerOf( TSockId hostid );
+
+	/** Sets the engine used by the servers created afterwards (set by IService from the
+	 * "NetReceiveEngine" config file variable, either "epoll" or "select").
+	 */
+	static void		setDefaultReceiveEngine( TReceiveEngine engine );
+
+	/// Returns the engine used by the servers created from now on
+	static TReceiveEngine	defaultReceiveEngine() { return _DefaultReceiveEngine; }
+
 protected:
 
 	friend class CServerBufSock;
@@ -391,6 +442,12 @@ private:
 	/// Replay mode flag
 	bool							_ReplayMode;
 
+	/// Engine of the listen and receive threads of this server
+	TReceiveEngine					_ReceiveEngine;
+
+	/// Engine used by the servers created from now on
+	static TReceiveEngine			_DefaultReceiveEngine;
+
   /*
 	/// Number of bytes pushed into the receive queue (by the receive threads) since the beginning.
 	NLMISC::CSynchronized<uint32>	_BytesPushedIn;
@@ -428,7 +485,7 @@ class CServerReceiveTask : public NLMISC::IRunnable, public CServerTask
 public:
 
 	/// Constructor
-	CServerReceiveTask( CBufServer *server ) : CServerTask(), _Server(server), _Connections("CServerReceiveTask::_Connections"), _RemoveSet("CServerReceiveTask::_RemoveSet") {}
+	CServerReceiveTask( CBufServer *server, CBufServer::TReceiveEngine engine );
 
 	/// Run
 	virtual void run();
@@ -454,6 +511,12 @@ public:
 			connectionssync.value().insert( sockid );
 		}
 		// POLL3
+#ifdef NL_NET_HAS_EPOLL
+		if ( usingEpoll() )
+		{
+			watchSocket( sockid );
+		}
+#endif
 	}
 
 // POLL4
@@ -495,6 +558,23 @@ public:
 
 private:
 
+	/// Receive loop waiting with select() on a copy of _Connections
+	void	runSelect();
+
+#ifdef NL_NET_HAS_EPOLL
+	/// Receive loop waiting with epoll() on the persistent interest set
+	void	runEpoll();
+
+	/// Add the socket into the epoll set (edge-triggered)
+	void	watchSocket( TSockId sockid );
+
+	/// Remove the socket from the epoll set (before deleting it)
+	void	unwatchSocket( TSockId sockid );
+
+	/// Read everything the socket holds (needed by edge-triggering)
+	void	drainSocket( TSockId sockid );
+#endif
+
 	CBufServer								*_Server;
 
 	/* List of sockets and send buffer.
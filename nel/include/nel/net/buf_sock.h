@@ -33,7 +33,7 @@
 #include "tcp_sock.h"
 #include "net_log.h"
 
-//#include <deque>
+#include <deque>
 
 namespace NLNET {
 
@@ -46,6 +46,71 @@ class CServerReceiveTask;
 class CBufNetBase;
 
 
+/**
+ * Send queue of a CBufSock.
+ * The queued messages are not copied: each block keeps a copy of the CMemStream passed to push(),
+ * which shares its buffer (see CMemStreamBuffer), so that the same message sent to several
+ * connections exists only once in memory. CBufSock::flush() sends the blocks with their length
+ * prefix in one scatter/gather system call (see CSock::sendv()).
+ * As CMemStream buffers are not thread-safe, the queue must be accessed by the thread that
+ * builds the messages.
+ */
+class CSendQueue
+{
+public:
+
+	/// A queued block
+	struct CBlock
+	{
+		/// Length prefix, in network byte order
+		TBlockSize			NetLength;
+		/// Payload (points into Stream)
+		const uint8			*Data;
+		/// Length of payload
+		uint32				Length;
+		/// Holds the buffer of the payload
+		NLMISC::CMemStream	Stream;
+	};
+
+	/// Constructor
+	CSendQueue() : _Size( 0 ), _BiggestBlock( 0 ), _Pushed( 0 ) {}
+
+	/// Push a message (its buffer is shared, not copied)
+	void			push( const NLMISC::CMemStream& buffer );
+
+	/// Pop the first block
+	void			pop();
+
+	/// Return true if the queue is empty
+	bool			empty() const { return _Blocks.empty(); }
+
+	/// Returns the number of blocks
+	uint32			nbBlocks() const { return (uint32)_Blocks.size(); }
+
+	/// Returns the block at the specified index (0 is the first one to send)
+	const CBlock&	block( uint32 i ) const { return _Blocks[i]; }
+
+	/// Returns the number of bytes to send (length prefixes included)
+	uint32			size() const { return _Size; }
+
+	/// Erase the queue
+	void			clear() { _Blocks.clear(); _Size = 0; }
+
+	/// display the queue statistics
+	void			displayStats( NLMISC::CLog *log = NLMISC::InfoLog );
+
+private:
+
+	std::deque<CBlock>	_Blocks;
+
+	uint32				_Size;
+
+	uint32				_BiggestBlock;
+
+	uint32				_Pushed;
+};
+
+
 /**
  * CBufSock
  * A socket and its sending buffer
@@ -78,6 +143,7 @@ protected:
 	friend class CBufClient;
 	friend class CBufServer;
 	friend class CClientReceiveTask;
+	friend class CClientReceiveLoop;
 	friend class CServerReceiveTask;
 
 	friend class CCallbackClient;
@@ -120,7 +186,8 @@ protected:
 	virtual std::string typeStr() const { return "CLT "; }
 
 	/** Pushes a disconnection message into bnb's receive queue, if it has not already been done
-	 * (returns true in this case). You can either specify a sockid (for server) or InvalidSockId (for client)
+	 * (returns true in this case). You can either specify a sockid (for server) or InvalidSockId (for client).
+	 * Called by the user thread only (see CBufNetBase::pushEventIntoReceiveQueue()).
 	 */
 	bool advertiseDisconnection( CBufNetBase *bnb, TSockId sockid )
 	{
@@ -130,15 +197,17 @@ protected:
 			nlassert( sockid == this );
 		}
 #endif
-		return advertiseSystemEvent( bnb, sockid, _KnowConnected, true, CBufNetBase::Disconnection );
+		return advertiseSystemEvent( bnb, sockid, _KnowConnected, true, CBufNetBase::Disconnection, true );
 	}
 
 	
 	/** Pushes a system message into bnb's receive queue, if the flags meets the condition, then
 	 * resets the flag and returns true. You can either specify a sockid (for server) or InvalidSockId (for client).
+	 * Set userThread to true when called by the thread that pops the receive queue: it must not wait
+	 * for room in the queue.
 	 */
 	bool advertiseSystemEvent(
-		CBufNetBase *bnb, TSockId sockid, bool& flag, bool condition, CBufNetBase::TEventType event )
+		CBufNetBase *bnb, TSockId sockid, bool& flag, bool condition, CBufNetBase::TEventType event, bool userThread=false )
 	{
 #ifdef NL_DEBUG
 		if ( sockid != InvalidSockId )
@@ -165,7 +234,10 @@ protected:
 				buffer[sizeof(TSockId)] = event;
 			}
 			// Push
-			bnb->pushMessageIntoReceiveQueue( buffer );
+			if ( userThread )
+				bnb->pushEventIntoReceiveQueue( buffer );
+			else
+				bnb->pushMessageIntoReceiveQueue( buffer );
 
 			// Reset flag
 			flag = !condition;
@@ -242,7 +314,7 @@ protected:
 	bool connectedState() const { return _ConnectedState; }
 
 	// Send queue
-	NLMISC::CBufFIFO	SendFifo;
+	CSendQueue			SendFifo;
 
 	// Socket (pointer because it can be allocated by an accept())
 	CTcpSock			*Sock;
@@ -261,7 +333,7 @@ private:
 	NLMISC::TTime		_TriggerTime;
 	sint32				_TriggerSize;
 
-	NLMISC::CObjectVector<uint8> _ReadyToSendBuffer;
+	// Number of bytes of the first block of the send queue already sent (length prefix included)
 	TBlockSize			_RTSBIndex;
 
 	uint64				_AppId;
@@ -281,6 +353,7 @@ protected:
 
 	friend class CBufClient;
 	friend class CClientReceiveTask;
+	friend class CClientReceiveLoop;
 
 	/** Constructor
      * \param sock To provide an external socket. Set it to NULL to create it internally.
@@ -302,6 +375,12 @@ protected:
 	 */
 	bool						receivePart( uint32 nbExtraBytes );
 
+	/** Returns true if the last call to receivePart() got less than requested from the socket,
+	 * i.e. its input buffer was emptied (or the connection was closed). An edge-triggered
+	 * receive loop must call receivePart() until then.
+	 */
+	bool						receiveDrained() const { return _ReceiveDrained; }
+
 	/// Fill the event type byte at pos length()(for a client connection)
 	void						fillEventTypeOnly() { _ReceiveBuffer[_Length] = (uint8)CBufNetBase::User; }
 
@@ -311,12 +390,13 @@ protected:
 	uint32						length() const { return _Length; }
 
 	/** Returns the filled buffer (call after receivePart() returns true).
-	 * Its size is length()+1.
+	 * Its size is length() + nbExtraBytes. It is passed to the receive queue without copy
+	 * (see CBufNetBase::pushMessageIntoReceiveQueue()), the next block is received in a new buffer.
 	 */
-	const std::vector<uint8>	receivedBuffer() const { nlnettrace( "CServerBufSock::receivedBuffer" ); return _ReceiveBuffer; }
+	CReceiveFIFO::TBlock&		receivedBuffer() { nlnettrace( "CServerBufSock::receivedBuffer" ); return _ReceiveBuffer; }
 
 	// Buffer for nonblocking receives
-	std::vector<uint8>			_ReceiveBuffer;
+	CReceiveFIFO::TBlock		_ReceiveBuffer;
 
 	// Max payload size than can be received in a block
 	uint32						_MaxExpectedBlockSize;
@@ -332,6 +412,9 @@ private:
 	// Length of buffer to read
 	TBlockSize					_Length;
 
+	// True if the last receivePart() emptied the socket input buffer
+	bool						_ReceiveDrained;
+
 };
 
 
@@ -361,6 +444,12 @@ protected:
 	/// Returns the task that "owns" the CServerBufSock object
 	CServerReceiveTask			*ownerTask() { return _OwnerTask; }
 
+	/// Sets the server that accepted the connection (before advertising it)
+	void						setOwnerServer( CBufServer *owner ) { _OwnerServer = owner; }
+
+	/// Returns the server that accepted the connection
+	CBufServer					*ownerServer() { return _OwnerServer; }
+
 	/** Pushes a connection message into bnb's receive queue, if it has not already been done
 	 * (returns true in this case).
 	 */
@@ -375,7 +464,7 @@ protected:
 	/// Fill the sockid and the event type byte at the end of the buffer
 	void						fillSockIdAndEventType( TSockId sockId )
 	{
-		memcpy( (&*_ReceiveBuffer.begin()) + length(), &sockId, sizeof(TSockId) );
+		memcpy( _ReceiveBuffer.getPtr() + length(), &sockId, sizeof(TSockId) );
 		_ReceiveBuffer[length() + sizeof(TSockId)] = (uint8)CBufNetBase::User;
 	}
 
@@ -387,6 +476,9 @@ private:
 	// The task that "owns" the CServerBufSock object
 	CServerReceiveTask	*_OwnerTask;
 
+	// The server that accepted the connection
+	CBufServer			*_OwnerServer;
+
 };
 
 
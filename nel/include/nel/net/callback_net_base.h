@@ -182,6 +182,10 @@ protected:
 
 	// contains callbacks
 	std::vector<TCallbackItem>	_CallbackArray;
+
+	// index in _CallbackArray by message type id (see CMessage::getTypeId())
+	typedef CHashMap<uint32, uint>	TCallbackIndex;
+	TCallbackIndex				_CallbackIndex;
 	
 	// called if the received message is not found in the callback array
 	TMsgCallback				_DefaultCallback;
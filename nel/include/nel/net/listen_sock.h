@@ -66,6 +66,15 @@ public:
 	/// Returns the pending connections queue.
 	sint			backlog() const { return _BackLog; }
 
+	/** Allows several sockets (of this process or another one) to listen on the same port,
+	 * the system spreading the incoming connections among them (SO_REUSEPORT). Call before init().
+	 * An exception ESocket is thrown if the system does not support it (see reusePortSupported()).
+	 */
+	void			setReusePort( bool enabled );
+
+	/// Returns true if setReusePort() is supported by the system
+	static bool		reusePortSupported();
+
 	//@}
 
 	/// Blocks until an incoming connection is requested, accepts it, and creates a new socket (you have to delete it after use)
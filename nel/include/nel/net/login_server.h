@@ -109,6 +109,14 @@ public:
 	/// (i.e. cookies for users that never connect)
 	static void refreshPendingList();
 
+	/** Report the load of the frontend to the Welcome Service, that places the new users on the least loaded one.
+	 * Call it every few seconds.
+	 * \param cpuLoad the part of the cpu used by the frontend, from 0 to 1
+	 * \param bandwidth the bytes by second sent to the clients
+	 * \param tickLag the ms the frontend is late on the ticks
+	 */
+	static void reportLoad (float cpuLoad, uint32 bandwidth, uint32 tickLag);
+
 private:
 
 	/// This function is used by init() to create the connection to the Welcome Service
@@ -44,6 +44,11 @@ extern const char *LockedSubMessageError;
  * If MESSAGES_PLAIN_TEXT is defined, the messages will be serialized to/from plain text (human-readable),
  * instead of binary.
  *
+ * The type of the message is carried in the header as its name (long format), or, if the id mode is
+ * enabled (see setDefaultIdMode()), as a 32-bit id which is a hash of the name (short format).
+ * Both formats are always accepted when receiving. The name of a message received with an id is found in
+ * the names registered with registerTypeName() (the callback arrays of the layers 3 and 5 are registered).
+ *
  * \author Vianney Lecroart
  * \author Nevrax France
  * \date 2001
@@ -58,7 +63,7 @@ public:
 	struct TFormat
 	{
 		uint8	StringMode : 1,	// true if the message body is string encoded, binary encoded if false otherwise
-				LongFormat : 1, // true if the message format is long (d'ho ? all message are long !?!, always true)
+				LongFormat : 1, // true if the message type is a name, false if it is a 32-bit id (see setDefaultIdMode())
 				MessageType : 2; // type of the message (from TMessageType), classical message are 'OneWay'
 
 		void serial(NLMISC::IStream &s)
@@ -110,6 +115,25 @@ public:
 	/// Get the message name (input message only) and advance the current pos
 	std::string readTypeAtCurrentPos() const;
 
+	/// Returns the 32-bit id of the message type (the hash of the name, even if the name is in the header)
+	uint32 getTypeId () const;
+
+	/** Returns false if the name of the type is known and is not name. Used to check the callback
+	 * found by getTypeId(), as two names can have the same id (a message received with an id matches).
+	 */
+	bool typeNameMatches (const char *name) const;
+
+	/// Returns the 32-bit id of a message name
+	static uint32 hashTypeName (const std::string &name);
+
+	/** Register a message name, so that the name of the messages received with an id can be found.
+	 * It can be called by any thread. Returns the id.
+	 */
+	static uint32 registerTypeName (const std::string &name);
+
+	/// Returns the registered name of a type id, or "#XXXXXXXX" if the id is unknown
+	static std::string getTypeNameFromId (uint32 id);
+
 	// Returns true if the message type was already set
 	bool typeIsSet () const;
 
@@ -290,6 +314,11 @@ public:
 	/// Set default stream mode
 	static void	setDefaultStringMode( bool stringmode ) { _DefaultStringMode = stringmode; }
 
+	/** Set the default type mode: if true, the header of the new output messages contains the id
+	 * of the type instead of its name. All the receivers must be able to read it.
+	 */
+	static void	setDefaultIdMode( bool idmode ) { _DefaultIdMode = idmode; }
+
 	/// Return an input stream containing the stream beginning in the message at the specified pos
 	NLMISC::CMemStream	extractStreamFromPos( sint32 pos );
 
@@ -310,7 +339,14 @@ protected:
 	}
 
 private:
-	std::string							_Name;
+	// Name of the type (empty until getName() is called, for a message received with an id)
+	mutable std::string					_Name;
+
+	// Hash of the name (see getTypeId())
+	mutable uint32						_TypeId;
+
+	// False until getTypeId() is called, for a message received with a name
+	mutable bool						_TypeIdSet;
 
 	mutable TMessageType				_Type;
 	
@@ -327,6 +363,9 @@ private:
 
 	// Default stream format
 	static bool							_DefaultStringMode;
+
+	// Default type format
+	static bool							_DefaultIdMode;
 };
 
 }
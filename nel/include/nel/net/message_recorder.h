@@ -33,17 +33,26 @@
 #include "nel/misc/time_nl.h"
 #include "nel/misc/mem_stream.h"
 
-#include <fstream>
+#include <stdio.h>
 #include <queue>
 #include <string>
+#include <vector>
+#include <map>
 
 using namespace std;
 
 
+namespace NLMISC
+{
+	class IThread;
+}
+
+
 namespace NLNET {
 
 
 class CInetAddress;
+class CRecordWriterTask;
 
 /// Type of network events (if changed, don't forget to change EventToString() and StringToEvent()
 enum TNetworkEvent { Sending, Receiving, Connecting, ConnFailing, Accepting, Disconnecting, Error };
@@ -62,53 +71,164 @@ TNetworkEvent StringToEvent( string& s );
 struct TMessageRecord
 {
 	/// Default constructor
-	TMessageRecord( bool input = false ) : UpdateCounter(0), SockId(InvalidSockId), Message( "", input ) {}
+	TMessageRecord( bool input = false ) : UpdateCounter(0), Time(0), Event(Error), SockId(InvalidSockId), Message( "", input ) {}
 
 	/// Alt. constructor
 	TMessageRecord( TNetworkEvent event, TSockId sockid, CMessage& msg, sint64 updatecounter ) :
-		UpdateCounter(updatecounter), Event(event), SockId(sockid), Message(msg) {}
-
-	/// Serial to string stream
-	void serial( NLMISC::CMemStream& stream )
-	{
-		nlassert( stream.stringMode() );
-		
-		uint32 len;
-		string s_event;
-		stream.serial( UpdateCounter );
-		if ( stream.isReading() )
-		{
-			stream.serial( s_event );
-			Event = StringToEvent( s_event );
-			stream.serialHex( (uint32&)SockId );
-			stream.serial( len );
-			stream.serialBuffer( Message.bufferToFill( len ), len );
-		}
-		else
-		{
-			s_event = EventToString( Event );
-			stream.serial( s_event );
-			stream.serialHex( (uint32&)SockId );
-			len = Message.length();
-			stream.serial( len );
-			stream.serialBuffer( const_cast<uint8*>(Message.buffer()), len ); // assumes the message contains plain text
-		}
-	}
+		UpdateCounter(updatecounter), Time(NLMISC::CTime::getLocalTime()), Event(event), SockId(sockid), Message(msg) {}
 
-	//NLMISC::TTime		Time;
 	sint64				UpdateCounter;
+	NLMISC::TTime		Time;
 	TNetworkEvent		Event;
 	TSockId				SockId;
 	CMessage			Message;
 };
 
 
+/**
+ * Writer of a record file.
+ *
+ * The file is binary: a header, then blocks of records, then an index of the blocks.
+ * A block starts with the update counter and time of its first record and can be read
+ * alone, so that a replay can start at any update counter. The records of a block
+ * are delta coded (update counter, time, socket number) and optionally compressed
+ * with CLZCompressor.
+ *
+ * The records are packed by the calling thread, the full blocks are compressed and
+ * written by a background thread, so that recording does not slow the service down.
+ * If the service stops without calling close(), the index is missing but the
+ * complete blocks can still be read (CMessageRecordReader scans them).
+ */
+class CMessageRecordWriter
+{
+public:
+
+	/// Default size of the blocks before compression
+	enum { DefaultBlockSize = 64*1024 };
+
+	/// Constructor
+	CMessageRecordWriter();
+
+	/// Destructor (closes the file)
+	~CMessageRecordWriter();
+
+	/// Create the file and start the writing thread
+	bool	open( const std::string& filename, bool compress=true, uint32 blockSize=DefaultBlockSize );
+
+	/// Add a record
+	void	write( sint64 updatecounter, NLMISC::TTime time, TNetworkEvent event, TSockId sockid, const CMessage& message );
+
+	/// Write the pending records and the index, and close the file
+	void	close();
+
+	/// Returns true if the file is open
+	bool	isOpen() const { return _Task != NULL; }
+
+	/// Returns the number of records written since open()
+	uint32	getNbRecords() const { return _NbRecords; }
+
+private:
+
+	/// Give the current block to the writing thread
+	void	flushBlock();
+
+	// Writing thread (owns the file)
+	CRecordWriterTask			*_Task;
+	NLMISC::IThread				*_Thread;
+
+	// Block being filled
+	std::vector<uint8>			_Block;
+	uint32						_BlockSize;
+	uint32						_BlockNbRecords;
+	sint64						_BlockFirstCounter;
+	sint64						_PrevCounter;
+	NLMISC::TTime				_BlockFirstTime;
+	NLMISC::TTime				_PrevTime;
+
+	// Small numbers instead of the socket pointers
+	std::map<TSockId,uint32>	_SockNumbers;
+
+	uint32						_NbRecords;
+};
+
+
+/**
+ * Reader of a record file written by CMessageRecordWriter.
+ * The socket ids of the records are numbers (1 for the first socket of the file,
+ * 2 for the next one...), not the CBufSock objects of the recording service.
+ */
+class CMessageRecordReader
+{
+public:
+
+	/// Constructor
+	CMessageRecordReader();
+
+	/// Destructor
+	~CMessageRecordReader() { close(); }
+
+	/// Open the file and load the index (or rebuild it if the file was not closed)
+	bool	open( const std::string& filename );
+
+	/// Close the file
+	void	close();
+
+	/// Returns true if the file is open
+	bool	isOpen() const { return _File != NULL; }
+
+	/// Go to the first record of which the update counter is updatecounter or more. Returns false if there is none.
+	bool	seek( sint64 updatecounter );
+
+	/// Read the next record. Returns false at the end of the file.
+	bool	readNext( TMessageRecord& record );
+
+	/// Update counter of the first record (0 if the file is empty)
+	sint64	getFirstUpdateCounter() const { return _Index.empty() ? 0 : _Index.front().FirstCounter; }
+
+	/// Update counter of the last record (0 if the file is empty)
+	sint64	getLastUpdateCounter() const { return _Index.empty() ? 0 : _Index.back().LastCounter; }
+
+	/// Number of blocks of the file
+	uint32	getNbBlocks() const { return (uint32)_Index.size(); }
+
+	/// Index of a block
+	struct TBlockEntry
+	{
+		sint64	Offset;
+		sint64	FirstCounter;
+		sint64	LastCounter;
+	};
+
+private:
+
+	/// Load the index written at the end of the file
+	bool	loadIndex( sint64 fileSize );
+
+	/// Rebuild the index by reading the block headers
+	void	scanBlocks( sint64 fileSize );
+
+	/// Read and decompress a block
+	bool	loadBlock( uint32 block );
+
+	FILE						*_File;
+	std::string					_Filename;
+	std::vector<TBlockEntry>	_Index;
+
+	// Current block
+	uint32						_NextBlock;
+	std::vector<uint8>			_Block;
+	uint32						_BlockPos;
+	uint32						_BlockNbRecords;
+	sint64						_PrevCounter;
+	NLMISC::TTime				_PrevTime;
+};
+
 
 /**
  * Message recorder.
  * The service performs sends normally. They are intercepted and the recorder
  * plays the receives back. No communication with other hosts.
- * Warning: it works only with messages as plain text.
+ * The records are written by a CMessageRecordWriter, see it for the file format.
  * \author Olivier Cado
  * \author Nevrax France
  * \date 2001
@@ -124,7 +244,7 @@ public:
 	~CMessageRecorder();
 
 	/// Start recording
-	bool	startRecord( const std::string& filename, bool recordall=true );
+	bool	startRecord( const std::string& filename, bool recordall=true, bool compress=true );
 
 	/// Add a record
 	void	recordNext( sint64 updatecounter, TNetworkEvent event, TSockId sockid, CMessage& message );
@@ -135,6 +255,11 @@ public:
 	/// Start replaying
 	bool	startReplay( const std::string& filename );
 
+	/** Skip the records before updatecounter. The update counter of the caller
+	 * must then start at updatecounter. Returns false if there is no record left.
+	 */
+	bool	seekReplay( sint64 updatecounter );
+
 	/// Push the received blocks for this counter into the receive queue
 	void	replayNextDataAvailable( sint64 updatecounter );
 
@@ -155,7 +280,7 @@ public:
 
 protected:
 
-	/// Load the next record from the file (throws EStreamOverflow)
+	/// Load the next record from the file
 	bool	loadNext( TMessageRecord& record );
 
 	/// Get the next record (from the preloaded records, or from the file)
@@ -163,8 +288,11 @@ protected:
 
 private:
 
-	// Input/output file
-	std::fstream								_File;
+	// Output file
+	CMessageRecordWriter						_Writer;
+
+	// Input file
+	CMessageRecordReader						_Reader;
 
 	// Filename
 	std::string									_Filename;
@@ -180,6 +308,71 @@ private:
 };
 
 
+/**
+ * Replay driver for load tests: reads a record file and gives its records back
+ * with the timing of the recording, or faster.
+ *
+ * With a speed of 1, a record is given when the time elapsed since the start of the replay
+ * reaches the time elapsed since the first replayed record in the recording; with a speed
+ * of 10, the replay is 10 times faster. With a speed of 0, there is no wait: each call to
+ * update() gives the records of the next update counter.
+ *
+ * \code
+	CMessageReplayer replayer;
+	replayer.open( "session.nmr" );
+	replayer.seek( 100000 );
+	replayer.setSpeed( 4.0f );
+	while ( ! replayer.finished() )
+	{
+		replayer.update( cbRecord, &myLoadClient );
+		nlSleep( 1 );
+	}
+ * \endcode
+ */
+class CMessageReplayer
+{
+public:
+
+	/// Callback called for each replayed record
+	typedef void (*TRecordCallback) ( const TMessageRecord& record, void *arg );
+
+	/// Constructor
+	CMessageReplayer() : _Speed( 1.0f ), _Started( false ), _HasNext( false ), _StartTime( 0 ), _RecordStartTime( 0 ), _Next( true ) {}
+
+	/// Open a record file
+	bool	open( const std::string& filename );
+
+	/// Restart the replay at the first record of which the update counter is updatecounter or more
+	bool	seek( sint64 updatecounter );
+
+	/// Set the replay speed (1 for the speed of the recording, 0 for no wait)
+	void	setSpeed( float speed ) { _Speed = speed; _Started = false; }
+
+	/// Call the callback for the records that are due. Returns the number of records replayed.
+	uint32	update( TRecordCallback cb, void *arg );
+
+	/// Returns true when all the records have been replayed
+	bool	finished() const { return ! _HasNext; }
+
+	/// Access to the file (first and last update counters...)
+	const CMessageRecordReader	&getReader() const { return _Reader; }
+
+private:
+
+	CMessageRecordReader	_Reader;
+	float					_Speed;
+
+	// Times of the first replayed record, in real time and in the recording
+	bool					_Started;
+	bool					_HasNext;
+	NLMISC::TTime			_StartTime;
+	NLMISC::TTime			_RecordStartTime;
+
+	// Next record to replay
+	TMessageRecord			_Next;
+};
+
+
 } // NLNET
 
 
@@ -32,6 +32,7 @@
 #include "nel/misc/string_mapper.h"
 #include "nel/misc/co_task.h"
 #include "nel/misc/algo.h"
+#include "nel/misc/time_nl.h"
 #include "nel/net/message.h"
 #include "nel/net/unified_network.h"
 #include "module_common.h"
@@ -128,6 +129,29 @@ namespace NLNET
 		{
 		};
 
+		/// Identifier of an asynchronous request (see CModuleBase::sendModuleRequest())
+		typedef uint32	TRequestId;
+		enum { InvalidRequestId = 0 };
+		/// Default timeout of an asynchronous request, in milliseconds
+		enum { DefaultRequestTimeout = 60000 };
+
+		/// State of an asynchronous request
+		enum TRequestState
+		{
+			/// The request id is unknown (never sent, cancelled or response already retrieved)
+			rs_unknown,
+			/// The request is waiting for its response
+			rs_pending,
+			/// The response is received
+			rs_response,
+			/// The addressee returned an exception (or no module processed the request)
+			rs_except,
+			/// No response was received before the timeout
+			rs_timeout,
+			/// The addressee module is down
+			rs_module_down,
+		};
+
 		// Module management =====================
 
 		virtual ~IModule() {}
@@ -665,6 +689,7 @@ namespace NLNET
 		// Module manager is our friend coz it need to feed some field here
 		friend class CModuleManager;
 		friend class CModuleTask;
+		friend class CModuleProxy;
 
 		typedef std::set<IModuleSocket *> 	TModuleSockets;
 		/// This is the sockets where the module is plugged in
@@ -698,6 +723,32 @@ namespace NLNET
 		CModuleTask				*_MessageDispatchTask;
 		//@}
 
+		//@{
+		//@name Asynchronous requests
+		/// A request sent with sendModuleRequest()
+		struct TPendingRequest
+		{
+			/// The module that must answer
+			IModuleProxy		*Addressee;
+			/// Local time after which the request times out (0 for never)
+			NLMISC::TTime		Deadline;
+			/// Current state
+			TRequestState		State;
+			/// The response or the exception message
+			CMessage			Response;
+		};
+		typedef std::map<TRequestId, TPendingRequest>	TPendingRequests;
+		/// The requests sent by this module, by request id
+		TPendingRequests		_PendingRequests;
+		/// The last request id used
+		TRequestId				_LastRequestId;
+
+		/// The sender of the request being processed, the responses sent to it meanwhile are tagged with the request id
+		IModuleProxy			*_CurrentRequestSender;
+		/// The id of the request being processed
+		TRequestId				_CurrentRequestId;
+		//@}
+
 		virtual void setFactory(IModuleFactory *factory);
 		virtual IModuleFactory *getFactory();
 	protected:
@@ -792,10 +843,46 @@ namespace NLNET
 		void				unplugModule(IModuleSocket *moduleSocket)  throw (EModuleNotPluggedHere);
 		void				getPluggedSocketList(std::vector<IModuleSocket*> &resultList);
 		void				invokeModuleOperation(IModuleProxy *destModule, const NLNET::CMessage &opMsg, NLNET::CMessage &resultMsg) throw (EInvokeFailed);
+
+		/** Send a request message (of type CMessage::Request) without waiting for the response.
+		 *	Any number of requests can be outstanding at the same time, the responses are matched
+		 *	with their request by the returned id. The addressee processes the request
+		 *	as any other request and sends back a CMessage::Response (or CMessage::Except),
+		 *	either while processing it or later with sendModuleResponse().
+		 *	The request times out after timeout milliseconds (never if timeout is 0).
+		 *	The result must be retrieved with pollModuleResponse() or awaitModuleResponse(),
+		 *	or discarded with cancelModuleRequest().
+		 */
+		TRequestId			sendModuleRequest(IModuleProxy *destModule, const NLNET::CMessage &requestMsg, uint32 timeout = DefaultRequestTimeout);
+		/** Return the id of the request being processed (InvalidRequestId if none).
+		 *	A module that answers a request after having processed it must keep this id
+		 *	and the sender proxy, and send the response with sendModuleResponse().
+		 */
+		TRequestId			getCurrentRequestId() const { return _CurrentRequestId; }
+		/// Send the response (CMessage::Response or CMessage::Except) to a request received from requester
+		void				sendModuleResponse(IModuleProxy *requester, TRequestId requestId, const NLNET::CMessage &responseMsg);
+		/// Return the state of a request without changing it
+		TRequestState		getModuleRequestState(TRequestId requestId);
+		/** If the request is complete (i.e. not rs_pending), fill responseMsg (for rs_response and rs_except)
+		 *	and forget the request. Return the state of the request.
+		 */
+		TRequestState		pollModuleResponse(TRequestId requestId, NLNET::CMessage &responseMsg);
+		/** Wait for the response of a request.
+		 *	Caller MUST be in a module task to call this method. The task yields
+		 *	until the response is received, the messages received in the mean
+		 *	time are dispatched normally.
+		 *	Throw EInvokeFailed if the request fails, times out or is cancelled.
+		 */
+		void				awaitModuleResponse(TRequestId requestId, NLNET::CMessage &responseMsg) throw (EInvokeFailed);
+		/// Forget a request, its response will be discarded
+		void				cancelModuleRequest(TRequestId requestId);
+
 		void				_onModuleUp(IModuleProxy *removedProxy);
 		void				_onModuleDown(IModuleProxy *removedProxy);
 
 		bool				_onProcessModuleMessage(IModuleProxy *senderModuleProxy, const CMessage &message);
+		bool				_onProcessModuleRequest(IModuleProxy *senderModuleProxy, const CMessage &envelope);
+		void				_onReceiveModuleResponse(IModuleProxy *senderModuleProxy, const CMessage &envelope);
 
 
 
@@ -0,0 +1,151 @@
+/** \file sharded_buf_server.h
+ * Network engine, layer 1, server split into independent shards
+ *
+ * $Id$
+ */
+
+/* Copyright, 2001 Nevrax Ltd.
+ *
+ * This file is part of NEVRAX NEL.
+ * NEVRAX NEL is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+
+ * NEVRAX NEL is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with NEVRAX NEL; see the file COPYING. If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#ifndef NL_SHARDED_BUF_SERVER_H
+#define NL_SHARDED_BUF_SERVER_H
+
+#include "nel/misc/types_nl.h"
+#include "nel/misc/thread.h"
+#include "buf_server.h"
+
+#include <vector>
+
+
+namespace NLNET {
+
+
+class CShardedBufServer;
+
+/** Callback function for the messages received by a shard thread (see CShardedBufServer::startThreads()).
+ * It is called in the thread of the shard, so it must only access data owned by this shard
+ * (or protected by a mutex). Replies can be sent with shard->send().
+ */
+typedef void (*TShardMessageCallback) ( CBufServer *shard, NLMISC::CMemStream& buffer, TSockId from, void *arg );
+
+
+/**
+ * Server class for layer 1, split into independent shards.
+ *
+ * Each shard is a full CBufServer: it has its own listening socket, bound to the common port with
+ * SO_REUSEPORT so that the system spreads the incoming connections among the shards, its own receive
+ * threads, its own receive queue and its own send queues flushed by its own update(). No lock is
+ * shared between two shards, so the message ingestion scales with the number of shards, provided
+ * each shard is processed by its own thread (see startThreads()).
+ *
+ * If SO_REUSEPORT is not supported by the system, there is only one shard.
+ *
+ * Usage without threads (all shards processed by the calling thread):
+ * \code
+ * CShardedBufServer server;
+ * server.init( port );
+ * for (;;)
+ * {
+ *     for ( uint i=0; i!=server.nbShards(); ++i )
+ *         while ( server.shard( i )->dataAvailable() )
+ *             server.shard( i )->receive( msg, &from ); // ...
+ *     server.update();
+ * }
+ * \endcode
+ */
+class CShardedBufServer
+{
+public:
+
+	/** Constructor
+	 * \param nbShards Number of shards, or 0 for the number of processors.
+	 * \param nodelay Set to true to disable the Nagle buffering algorithm (see CTcpSock documentation)
+	 */
+	CShardedBufServer( uint nbShards=0, bool nodelay=true );
+
+	/// Destructor (stops the shard threads if any)
+	virtual ~CShardedBufServer();
+
+	/// Listens on the specified port with all the shards
+	void		init( uint16 port );
+
+	/// Returns the number of shards
+	uint		nbShards() const { return (uint)_Shards.size(); }
+
+	/// Returns the specified shard
+	CBufServer	*shard( uint i ) { nlassert( i < _Shards.size() ); return _Shards[i]; }
+
+	/// Returns the shard that owns the specified connection
+	CBufServer	*shardOf( TSockId hostid ) { return CBufServer::ownerOf( hostid ); }
+
+	/// Sets the connection callback of every shard
+	void		setConnectionCallback( TNetCallback cb, void* arg );
+
+	/// Sets the disconnection callback of every shard
+	void		setDisconnectionCallback( TNetCallback cb, void* arg );
+
+	/** Sends a message to the specified host (through its shard), or to all hosts of all shards if
+	 * hostid is InvalidSockId. Do not call it while the shard threads are running, use the
+	 * shard passed to the message callback instead.
+	 */
+	void		send( const NLMISC::CMemStream& buffer, TSockId hostid );
+
+	/** Disconnects a connection, or all connections of all shards if hostid is InvalidSockId.
+	 * Do not call it while the shard threads are running, use the shard passed to the message
+	 * callback instead.
+	 */
+	void		disconnect( TSockId hostid, bool quick=false );
+
+	/// Updates (flushes) every shard. Do not call it while the shard threads are running.
+	void		update();
+
+	/// Returns the number of connections of all shards (at their last update())
+	uint32		nbConnections() const;
+
+	/** Starts one thread per shard. Each thread receives the messages of its shard, passes them to
+	 * the callback and updates its shard at least every updatePeriod milliseconds.
+	 * The connection and disconnection callbacks are then called in the shard threads as well.
+	 */
+	void		startThreads( TShardMessageCallback cb, void *arg, uint32 updatePeriod=10 );
+
+	/// Stops the shard threads and waits for them
+	void		stopThreads();
+
+	/// Returns true if the shard threads are running
+	bool		threadsRunning() const { return ! _Threads.empty(); }
+
+private:
+
+	/// The shards
+	std::vector<CBufServer*>		_Shards;
+
+	/// The tasks of the shard threads
+	std::vector<NLMISC::IRunnable*>	_Tasks;
+
+	/// The shard threads (empty when not running)
+	std::vector<NLMISC::IThread*>	_Threads;
+};
+
+
+} // NLNET
+
+
+#endif // NL_SHARDED_BUF_SERVER_H
+
+/* End of sharded_buf_server.h */
@@ -124,6 +124,9 @@ public:
 
 	enum TSockResult { Ok, WouldBlock, ConnectionClosed, Error };
 
+	/// Max number of buffers passed to sendv() (within the IOV_MAX of all systems)
+	enum { MaxSendBuffers = 64 };
+
 	/// Initialize the network engine, if it is not already done
 	static void			initNetwork();
 
@@ -224,6 +227,15 @@ public:
      */
 	CSock::TSockResult	send( const uint8 *buffer, uint32& len, bool throw_exception=true );
 
+	/** Sends several buffers, in this order, in one system call (scatter/gather: writev() or WSASend()).
+	 * The buffers are not concatenated in memory. 'len' must be the total length of the buffers and
+	 * is reset to the number of bytes actually sent, as in send(). nbBuffers must not exceed MaxSendBuffers.
+	 *
+	 * \return CSock::Ok or CSock::Error (in case of failure).
+	 * When throw_exception is true, the method throws an ESocket exception in case of failure.
+	 */
+	CSock::TSockResult	sendv( const uint8 * const *buffers, const uint32 *lengths, uint nbBuffers, uint32& len, bool throw_exception=true );
+
 	//@}
 
 	
@@ -60,6 +60,7 @@ namespace NLNET {
 #define NETTC_INFO if (!VerboseNETTC.get()) {} else nlinfo
 #define NETTC_DEBUG if (!VerboseNETTC.get()) {} else nldebug
 extern NLMISC::CVariable<bool> VerboseNETTC;
+extern NLMISC::CVariable<bool> TransportClassCodec;
 
 
 //
@@ -69,6 +70,13 @@ extern NLMISC::CVariable<bool> VerboseNETTC;
 /**
  * You have to inherit this class and implement description() and callback() method.
  * For an example of use, take a look at nel/samples/class_transport sample.
+ *
+ * The description() is called only when the class is registered. The properties are then
+ * sent and received by codecs compiled from the descriptions: one to write the class, and
+ * one to read it for each service, compiled when the service sends its descriptions.
+ * A service that has received our descriptions is sent the classes by index (CT_MSGI)
+ * instead of by name (CT_MSG). Set the variable TransportClassCodec to false to call
+ * description() for each send and receive, as before.
  * \author Vianney Lecroart
  * \author Nevrax France
  * \date 2002
@@ -76,6 +84,7 @@ extern NLMISC::CVariable<bool> VerboseNETTC;
 class CTransportClass
 {
 public:
+	CTransportClass() : Codec(NULL) {}
 	virtual ~CTransportClass() {}
 	/** Different types that we can use in a Transport class
 	 * warning: if you add/change a prop, change also in CTransportClass::init()
@@ -261,6 +270,14 @@ protected:
 		virtual void serialValue (NLMISC::IStream &f) { }
 
 		virtual void setDefaultValue () { }
+
+		// Address of the value in the registered instance
+		virtual void *getValue () { return NULL; }
+
+		// Serialize a value at the same place in another instance
+		virtual void serialValueAt (NLMISC::IStream &f, void *value) { }
+
+		virtual bool isContainer () { return false; }
 	};
 
 	typedef std::vector<std::pair<std::string, std::vector <CRegisteredBaseProp> > > TOtherSideRegisteredClass;
@@ -301,6 +318,16 @@ protected:
 			nlassert (Value != NULL);
 			*Value = DefaultValue;
 		}
+
+		virtual void *getValue ()
+		{
+			return Value;
+		}
+
+		virtual void serialValueAt (NLMISC::IStream &f, void *value)
+		{
+			f.serial (*(T *)value);
+		}
 	};
 
 	template <class T> struct CRegisteredPropCont : public CRegisteredBaseProp
@@ -328,6 +355,67 @@ protected:
 			nlassert (Value != NULL);
 			Value->clear ();
 		}
+
+		virtual void *getValue ()
+		{
+			return Value;
+		}
+
+		virtual void serialValueAt (NLMISC::IStream &f, void *value)
+		{
+			f.serialCont (*(T *)value);
+		}
+
+		virtual bool isContainer () { return true; }
+	};
+
+
+	// One step of a compiled codec
+	struct CCodecStep
+	{
+		enum TKind { Flat, ByProp, Skip };
+
+		CCodecStep (TKind kind, TProp type, sint32 offset, CRegisteredBaseProp *prop) : Kind(kind), Type(type), Offset(offset), Prop(prop) { }
+
+		// Flat: a value of Type serialized directly, ByProp: a value serialized by Prop (containers...),
+		// Skip: a value of the stream that is not in the local class, read by Prop (a DummyProp)
+		TKind				Kind;
+		TProp				Type;
+
+		// Offset of the value in the instance (the codecs work with a copy of the registered instance)
+		sint32				Offset;
+
+		CRegisteredBaseProp	*Prop;
+	};
+
+	typedef std::vector<CCodecStep> TCodec;
+
+	// Codec to read the class sent by a service
+	struct CReadCodec
+	{
+		CReadCodec () : Valid(false) { }
+
+		// The values in the order of the other side
+		TCodec								Steps;
+
+		// The local props that the other side does not send
+		std::vector<CRegisteredBaseProp *>	Defaults;
+
+		// False until the other side has sent its description
+		bool								Valid;
+	};
+
+	// Codecs of a registered class, shared with the copies of the registered instance
+	struct CClassCodec
+	{
+		// Codec to write the class (from Prop)
+		TCodec						Write;
+
+		// Codecs to read the class, by service id (from States)
+		std::vector<CReadCodec>		Read;
+
+		// Index of the class in the other side, by service id (-1 if the service can't receive it by index)
+		std::vector<sint32>			RemoteIndex;
 	};
 
 
@@ -344,6 +432,9 @@ protected:
 	// Contains all propterties for this class
 	std::vector<CRegisteredBaseProp *> Prop;
 
+	// Codecs of the class (NULL if the instance is not registered or a copy of it)
+	CClassCodec	*Codec;
+
 
 	//
 	// Methods
@@ -352,8 +443,23 @@ protected:
 	// Read the TempMessage and call the callback
 	bool read (const std::string &name, NLNET::TServiceId sid);
 
+	// Read the class from msgin with the codec of the service and call the callback
+	bool readCompiled (NLNET::CMessage &msgin, const std::string &name, NLNET::TServiceId sid);
+
 	// Used to create a TempMessage with this class
 	NLNET::CMessage &write ();
+
+	// Used to create a TempMessage with this class for a specified service (by index if possible)
+	NLNET::CMessage &write (NLNET::TServiceId sid);
+
+	// Create the Codec and build its write codec from Prop
+	void compileWriteCodec ();
+
+	// Build the read codec of a service from its States
+	void compileReadCodec (NLNET::TServiceId sid);
+
+	// Serialize the values of this instance with a codec
+	void serialCodec (NLNET::CMessage &msg, const TCodec &codec);
 	
 
 	//
@@ -369,6 +475,9 @@ protected:
 	// Contains all registered transport class
 	static TRegisteredClass						LocalRegisteredClass;	// registered class that are in my program
 
+	// The registered classes in the order of registration (the index used in CT_MSGI)
+	static std::vector<CTransportClass *>		LocalClassByIndex;
+
 	// The registered class that is currently filled (before put in LocalRegisteredClass)
 	static CRegisteredClass						TempRegisteredClass;
 
@@ -409,7 +518,9 @@ protected:
 	//
 
 	friend void cbTCReceiveMessage (NLNET::CMessage &msgin, const std::string &name, NLNET::TServiceId sid);
+	friend void cbTCReceiveIndexedMessage (NLNET::CMessage &msgin, const std::string &name, NLNET::TServiceId sid);
 	friend void cbTCUpService (const std::string &serviceName, NLNET::TServiceId sid, void *arg);
+	friend void cbTCDownService (const std::string &serviceName, NLNET::TServiceId sid, void *arg);
 	friend void cbTCReceiveOtherSideClass (NLNET::CMessage &msgin, const std::string &name, NLNET::TServiceId sid);
 };
 
@@ -459,7 +570,7 @@ inline void CTransportClass::className (const std::string &name)
 inline void CTransportClass::send (NLNET::TServiceId sid)
 {
 	nlassert (Init);
-	NLNET::CUnifiedNetwork::getInstance()->send (sid, write ());
+	NLNET::CUnifiedNetwork::getInstance()->send (sid, write (sid));
 }
 
 
@@ -487,25 +598,59 @@ inline NLNET::CMessage &CTransportClass::write ()
 	nlassert (Init);
 	nlassert (Mode == 0);
 
+	TempMessage.clear ();
+	if (TempMessage.isReading())
+		TempMessage.invert();
+	TempMessage.setType ("CT_MSG");
+
+	if (TransportClassCodec.get() && Codec != NULL)
+	{
+		TempMessage.serial (Name);
+		serialCodec (TempMessage, Codec->Write);
+
+		if (VerboseNETTC.get())
+			display ();
+	}
+	else
+	{
 #ifndef FINAL_VERSION
-	// Did the programmer forget to register the transport class? Forbid sending then.
-	nlassert( LocalRegisteredClass.find( className() ) != LocalRegisteredClass.end() );
+		// Did the programmer forget to register the transport class? Forbid sending then.
+		nlassert( LocalRegisteredClass.find( className() ) != LocalRegisteredClass.end() );
 #endif
 
-	// set the mode to register
-	Mode = 2;
+		// set the mode to write
+		Mode = 2;
+
+		description ();
+
+		// set to mode none
+		Mode = 0;
+
+		display ();
+	}
+
+	return TempMessage;
+}
+
+inline NLNET::CMessage &CTransportClass::write (NLNET::TServiceId sid)
+{
+	if (!TransportClassCodec.get() || Codec == NULL || sid.get() >= Codec->RemoteIndex.size() || Codec->RemoteIndex[sid.get()] < 0)
+		return write ();
+
+	nlassert (Init);
+	nlassert (Mode == 0);
 
 	TempMessage.clear ();
 	if (TempMessage.isReading())
 		TempMessage.invert();
-	TempMessage.setType ("CT_MSG");
+	TempMessage.setType ("CT_MSGI");
 
-	description ();
+	uint32 index = (uint32)Codec->RemoteIndex[sid.get()];
+	TempMessage.serial (index);
+	serialCodec (TempMessage, Codec->Write);
 
-	// set to mode none
-	Mode = 0;
-
-	display ();
+	if (VerboseNETTC.get())
+		display ();
 
 	return TempMessage;
 }
@@ -58,11 +58,15 @@ public:
 	// this function is to call to set the simulation values
 	static void			setSimValues (NLMISC::CConfigFile &cf);
 
+	// same without config file (lags in ms, the others in percent)
+	static void			setSimValues (uint32 inLag, uint8 inPacketLoss, uint32 outLag, uint8 outPacketLoss, uint8 outPacketDuplication, uint8 outPacketDisordering);
+
 	// CUdpSock functions wrapping
 	void				connect( const CInetAddress& addr );
 	void				close();
 	bool				dataAvailable();
 	bool				receive( uint8 *buffer, uint32& len, bool throw_exception=true );
+	bool				receivedFrom( uint8 *buffer, uint& len, CInetAddress& addr, bool throw_exception=true );
 	CSock::TSockResult	send( const uint8 *buffer, uint32& len, bool throw_exception=true );
 	void				sendTo (const uint8 *buffer, uint32& len, const CInetAddress& addr);
 	bool				connected();
@@ -0,0 +1,298 @@
+/** \file udp_transport.h
+ * Channels with reliability and congestion control over UDP
+ *
+ * $Id$
+ */
+
+/* Copyright, 2001 Nevrax Ltd.
+ *
+ * This file is part of NEVRAX NEL.
+ * NEVRAX NEL is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+
+ * NEVRAX NEL is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with NEVRAX NEL; see the file COPYING. If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#ifndef NL_UDP_TRANSPORT_H
+#define NL_UDP_TRANSPORT_H
+
+#include "nel/misc/types_nl.h"
+#include "nel/misc/mem_stream.h"
+#include "nel/misc/time_nl.h"
+
+#include <map>
+#include <set>
+#include <deque>
+#include <vector>
+
+#include "inet_address.h"
+#include "udp_sim_sock.h"
+
+
+namespace NLNET {
+
+
+class CUdpTransport;
+
+
+/**
+ * CUdpConnection: the messages exchanged with a peer through a CUdpTransport.
+ *
+ * The messages are sent on one of the channels:
+ * - ReliableOrdered: retransmitted until acknowledged, received in the order of send()
+ * - ReliableUnordered: retransmitted until acknowledged, received as soon as they arrive
+ * - UnreliableSequenced: sent once, the ones older than the last received are dropped
+ *
+ * update() coalesces the messages in datagrams of at most MaxDatagramSize bytes. Each
+ * datagram has a sequence number and acknowledges the highest sequence received with the
+ * 32 previous ones (selective acks), at each update() or as soon as AckFrequency datagrams
+ * are received. A datagram not acknowledged when 3 newer ones are, or 9/8 of the round trip
+ * after a newer one is, or after the retransmission timeout (RFC 2988 estimation of the
+ * round trip time), is lost: its reliable messages go in the next datagrams. The bytes in flight are limited
+ * by a congestion window, that grows with the acks (slow start, then congestion avoidance)
+ * and is halved once by loss event.
+ *
+ * A message must fit in a datagram (MaxMessageSize bytes); the bigger ones go through TCP.
+ */
+class CUdpConnection
+{
+public:
+
+	enum TChannel { ReliableOrdered, ReliableUnordered, UnreliableSequenced, NbChannels };
+
+	enum
+	{
+		MaxDatagramSize = 1200,
+		HeaderSize = 20,
+		MessageHeaderSize = 7,
+		MaxMessageSize = MaxDatagramSize - HeaderSize - MessageHeaderSize,
+		/** Reliable messages not acknowledged yet by channel, the next ones wait in the send queue.
+		 * It is the receive window as well: the messages further from the oldest missing one are dropped.
+		 */
+		MaxUnackedMessages = 1024,
+		/// Datagrams received before acknowledging them without waiting for update()
+		AckFrequency = 16,
+		/// Milliseconds
+		InitialRTO = 500, MinRTO = 50, MaxRTO = 3000,
+		KeepAlivePeriod = 1000,
+		Timeout = 10000
+	};
+
+	/// Queue a message, sent by the next update(). Returns false if it's bigger than MaxMessageSize.
+	bool			send (const NLMISC::CMemStream &buffer, TChannel channel);
+	bool			send (const uint8 *buffer, uint32 len, TChannel channel);
+
+	/// Get a received message, returns false if there is none
+	bool			receive (NLMISC::CMemStream &buffer, TChannel *channel = NULL);
+	bool			dataAvailable () const { return !_Received.empty(); }
+
+	const CInetAddress	&remoteAddress () const { return _Addr; }
+
+	/// Smoothed round trip time in ms (0 before the first ack)
+	float			getRTT () const { return _SmoothedRTT; }
+	/// Retransmission timeout in ms
+	uint32			getRTO () const { return _RTO; }
+	/// Congestion window and bytes sent but not acknowledged
+	uint32			getCongestionWindow () const { return (uint32)_CongestionWindow; }
+	uint32			getBytesInFlight () const { return _BytesInFlight; }
+	/// Messages waiting to be sent (reliable ones not sent or to retransmit, unreliable ones)
+	uint32			getSendQueueSize () const;
+
+	uint32			getNbDatagramsSent () const { return _NbDatagramsSent; }
+	uint32			getNbDatagramsLost () const { return _NbDatagramsLost; }
+	uint32			getNbRetransmissions () const { return _NbRetransmissions; }
+
+private:
+
+	friend class CUdpTransport;
+
+	enum TFlag { AckEliciting = 1, Close = 2 };
+
+	typedef std::pair<uint8, uint32>	TMessageId;
+
+	struct CInFlight
+	{
+		NLMISC::TTime				SentTime;
+		uint32						Size;
+		std::vector<TMessageId>		Messages;
+	};
+
+	struct CReceived
+	{
+		TChannel					Channel;
+		std::vector<uint8>			Data;
+	};
+
+	CUdpConnection (CUdpTransport *transport, const CInetAddress &addr, uint32 session, NLMISC::TTime now);
+
+	/// Process a datagram of the peer
+	void			receiveDatagram (NLMISC::CMemStream &datagram, uint8 flags, uint32 seq, NLMISC::TTime now);
+	/// Detect the losses and send the datagrams allowed by the congestion window
+	void			update (NLMISC::TTime now);
+	/// Tell the peer we leave
+	void			sendClose ();
+
+	void			processAck (uint32 ackSeq, uint32 ackBits, uint16 ackDelay, NLMISC::TTime now);
+	void			acknowledge (uint32 seq);
+	void			lose (std::map<uint32, CInFlight>::iterator it);
+	/// Lose the datagrams older than the largest acknowledged, by reordering or time thresholds
+	void			detectLosses (NLMISC::TTime now);
+	void			updateRTT (float sample);
+	void			deliver (uint8 channel, uint32 msgSeq, const uint8 *data, uint16 len);
+
+	/// Put the messages that fit in _Datagram, returns false if there was none
+	bool			fillDatagram (std::vector<TMessageId> &messages);
+	void			clearDatagram () { _Datagram.clear(); _DatagramNbMessages = 0; }
+	/// Send _Datagram, kept in flight with its reliable messages if it is AckEliciting
+	void			sendDatagram (uint8 flags, std::vector<TMessageId> *messages, NLMISC::TTime now);
+
+	CUdpTransport	*_Transport;
+	CInetAddress	_Addr;
+	uint32			_Session;
+	bool			_Closed;
+
+	// Sending
+	uint32			_NextDatagramSeq;
+	/// Reliable messages not acknowledged, by sequence; those from _NextToSend are not sent yet
+	std::map<uint32, std::vector<uint8> >	_Unacked [2];
+	uint32			_NextMessageSeq [NbChannels];
+	uint32			_NextToSend [2];
+	std::deque<TMessageId>					_Retransmissions;
+	std::deque<std::pair<uint32, std::vector<uint8> > >	_Unreliable;
+	std::map<uint32, CInFlight>				_InFlight;
+	uint32			_BytesInFlight;
+	uint32			_LargestAcked;
+	NLMISC::TTime	_LastSentTime;
+	NLMISC::CMemStream	_Datagram;
+	uint8			_DatagramNbMessages;
+
+	// Congestion control
+	float			_CongestionWindow;
+	float			_SlowStartThreshold;
+	/// The losses of the datagrams before it belong to the current loss event
+	uint32			_RecoverySeq;
+	float			_SmoothedRTT;
+	float			_RTTVariation;
+	uint32			_RTO;
+
+	// Receiving
+	uint32			_HighestReceived;
+	uint32			_ReceivedBits;
+	NLMISC::TTime	_HighestReceivedTime;
+	NLMISC::TTime	_LastReceivedTime;
+	/// Ack-eliciting datagrams received since our last datagram
+	uint32			_NbAckPending;
+	uint32			_NextExpected [2];
+	std::map<uint32, std::vector<uint8> >	_OutOfOrder;
+	std::set<uint32>						_ReceivedUnordered;
+	uint32			_LastUnreliable;
+	std::deque<CReceived>					_Received;
+
+	// Stats
+	uint32			_NbDatagramsSent;
+	uint32			_NbDatagramsLost;
+	uint32			_NbRetransmissions;
+};
+
+
+/// Callback of the connection or disconnection of a peer
+typedef void (*TUdpConnectionCallback) (CUdpConnection *connection, void *arg);
+
+
+/**
+ * CUdpTransport: the CUdpConnection to the peers, over a UDP socket.
+ *
+ * The socket is a CUdpSimSock, to test the channels with the lag and losses of
+ * CUdpSimSock::setSimValues() (it sends and receives directly without simulation values).
+ *
+ * It is not thread safe: call update() evenly (every frame) from the thread that uses it.
+ * A connection is created by connect(), or by the first datagram of a new peer if the
+ * transport accepts the connections. It is deleted by disconnect(), or after the
+ * disconnection callback when the peer leaves or is silent for CUdpConnection::Timeout ms.
+ * When a peer restarts, its new connection replaces the previous one only once the latter
+ * is silent for a few keep-alive periods.
+ *
+ * Example:
+ * \code
+	CUdpTransport server;
+	server.init (port, true);
+	...
+	server.update ();
+	CMemStream msg;
+	CUdpConnection *from;
+	while (server.receive (msg, &from))
+		from->send (msg, CUdpConnection::ReliableOrdered); // echo
+ * \endcode
+ */
+class CUdpTransport
+{
+public:
+
+	CUdpTransport ();
+	~CUdpTransport ();
+
+	/// Bind the socket on port (0 for any port), accepting the connections of new peers or not
+	void			init (uint16 port, bool acceptConnections);
+	/// Close the connections (the peers are told) and the socket
+	void			release ();
+
+	/// Get the connection to the peer, created if needed
+	CUdpConnection	*connect (const CInetAddress &addr);
+	/// Tell the peer we leave and delete the connection (without calling the disconnection callback)
+	void			disconnect (CUdpConnection *connection);
+
+	/// Receive the datagrams, then send the acks, retransmissions and new messages of the connections
+	void			update ();
+
+	/// Get a message received from a connection, returns false if there is none
+	bool			receive (NLMISC::CMemStream &buffer, CUdpConnection **from, CUdpConnection::TChannel *channel = NULL);
+
+	/// The connection callback is called for the connections created by a new peer
+	void			setConnectionCallback (TUdpConnectionCallback cb, void *arg) { _ConnectionCallback = cb; _ConnectionCbArg = arg; }
+	/// The disconnection callback is called before deleting a connection, don't call disconnect() in it
+	void			setDisconnectionCallback (TUdpConnectionCallback cb, void *arg) { _DisconnectionCallback = cb; _DisconnectionCbArg = arg; }
+
+	uint			getNbConnections () const { return (uint)_Connections.size(); }
+	CUdpSimSock		&sock () { return _Sock; }
+
+private:
+
+	friend class CUdpConnection;
+
+	typedef std::map<CInetAddress, CUdpConnection*>	TConnections;
+
+	void			receiveDatagram (const CInetAddress &addr, const uint8 *buffer, uint32 len, NLMISC::TTime now);
+	void			sendDatagram (const CInetAddress &addr, const uint8 *buffer, uint32 len);
+	/// Call the disconnection callback and delete the connection
+	void			removeConnection (TConnections::iterator it);
+
+	CUdpSimSock		_Sock;
+	bool			_AcceptConnections;
+	TConnections	_Connections;
+	/// Connections with received messages, in the order they received them
+	std::deque<CUdpConnection*>	_ReadyConnections;
+	std::vector<uint8>			_ReceiveBuffer;
+
+	TUdpConnectionCallback	_ConnectionCallback;
+	void			*_ConnectionCbArg;
+	TUdpConnectionCallback	_DisconnectionCallback;
+	void			*_DisconnectionCbArg;
+};
+
+
+} // NLNET
+
+
+#endif // NL_UDP_TRANSPORT_H
+
+/* End of udp_transport.h */
@@ -33,6 +33,8 @@
 #include <string>
 
 #include "nel/misc/time_nl.h"
+#include "nel/misc/smart_ptr.h"
+#include "nel/misc/lz_compressor.h"
 #include "callback_client.h"
 #include "callback_server.h"
 //#include "service.h"
@@ -445,8 +447,15 @@ private:
 	/// A map of service ids, referred by a service name
 	struct TNameMappedConnection : public CHashMultiMap<std::string, TServiceId> {};
 
-	/// A map of callbacks, referred by message name
-	typedef std::map<std::string, TUnifiedMsgCallback>			TMsgMappedCallback;
+	/// A callback with the name of its message type
+	struct TMsgCallbackItem
+	{
+		std::string				Name;
+		TUnifiedMsgCallback		Callback;
+	};
+
+	/// A map of callbacks, referred by message type id (see CMessage::getTypeId())
+	typedef CHashMap<uint32, TMsgCallbackItem>					TMsgMappedCallback;
 
 	/// A callback and its user data
 	typedef std::pair<TUnifiedNetCallback, void *>				TCallbackArgItem;
@@ -464,6 +473,33 @@ private:
 		/// Ready      = we can use the unified connection
 		enum TState { NotUsed, Ready };
 
+		/** The compression state of a connection, when it has been negotiated at identification (see NetCompression).
+		 * There is one dictionary per direction, kept from one message to the next.
+		 */
+		class CCompression : public NLMISC::CRefCount
+		{
+		public:
+			CCompression() : SendCompressed(false), NbCompressed(0), NbDecompressed(0), BytesBeforeCompression(0), BytesAfterCompression(0),
+				BytesBeforeDecompression(0), BytesAfterDecompression(0), CompressionTicks(0), DecompressionTicks(0) { }
+
+			NLMISC::CLZCompressor	Compressor;
+			NLMISC::CLZDecompressor	Decompressor;
+			/// True when the other side has accepted to receive compressed messages
+			bool					SendCompressed;
+
+			/// Statistics
+			uint32					NbCompressed;
+			uint32					NbDecompressed;
+			uint64					BytesBeforeCompression;
+			uint64					BytesAfterCompression;
+			uint64					BytesBeforeDecompression;
+			uint64					BytesAfterDecompression;
+			NLMISC::TTicks			CompressionTicks;
+			NLMISC::TTicks			DecompressionTicks;
+
+			void display (NLMISC::CLog *log) const;
+		};
+
 		/// The connection structure
 		struct TConnection
 		{
@@ -473,6 +509,8 @@ private:
 			CCallbackNetBase	*CbNetBase;
 			/// If it s a server connection, it's the host id, it s InvalidId if it s a client
 			TSockId				 HostId;
+			/// The compression state, NULL if the messages are not compressed on this connection
+			NLMISC::CSmartPtr<CCompression>	Compression;
 
 			TConnection() : IsServerConnection(false), CbNetBase(NULL), HostId(InvalidSockId) { }
 			TConnection(CCallbackClient *cbc) : IsServerConnection(false), CbNetBase(cbc), HostId(InvalidSockId) { }
@@ -480,6 +518,9 @@ private:
 
 			void setAppId (uint64 appid) { CbNetBase->getSockId (HostId)->setAppId (appid); }
 			uint64 getAppId () { return CbNetBase->getSockId (HostId)->appId (); }
+
+			/// Send a message, compressed if it is enabled on the connection and the message is big enough
+			void send (const CMessage &msgout);
 			
 			bool valid ()
 			{
@@ -507,6 +548,7 @@ private:
 				CbNetBase = 0;
 				IsServerConnection = false;
 				HostId = InvalidSockId;
+				Compression = NULL;
 			}
 		};
 
@@ -743,6 +785,9 @@ private:
 	// with a sid and a nid, find a good connection to send a message
 	uint8 findConnectionId (TServiceId sid, uint8 nid);
 
+	// find the connection of a socket, or NULL
+	CUnifiedConnection::TConnection *findConnection (TSockId from, CCallbackNetBase &netbase);
+
 	void callServiceUpCallback (const std::string &serviceName, TServiceId sid, bool callGlobalCallback = true);
 	void callServiceDownCallback (const std::string &serviceName, TServiceId sid, bool callGlobalCallback = true);
 	
@@ -750,11 +795,14 @@ private:
 	friend void	uncbDisconnection(TSockId from, void *arg);
 	friend void	uncbServiceIdentification(CMessage &msgin, TSockId from, CCallbackNetBase &netbase);
 	friend void	uncbMsgProcessing(CMessage &msgin, TSockId from, CCallbackNetBase &netbase);
+	friend void	uncbCompressionAccepted(CMessage &msgin, TSockId from, CCallbackNetBase &netbase);
+	friend void	uncbCompressedMessage(CMessage &msgin, TSockId from, CCallbackNetBase &netbase);
 	friend void	uNetRegistrationBroadcast(const std::string &name, TServiceId sid, const std::vector<CInetAddress> &addr);
 	friend void	uNetUnregistrationBroadcast(const std::string &name, TServiceId sid, const std::vector<CInetAddress> &addr);
 	friend struct nel_isServiceLocalClass;
 	friend struct nel_l5CallbackClass;
 	friend struct nel_l5QueuesStatsClass;
+	friend struct nel_l5CompressionStatsClass;
 };
 
 
@@ -28,6 +28,17 @@
 #include "nel/misc/big_file.h"
 #include "nel/misc/path.h"
 
+#ifdef NL_OS_WINDOWS
+#	define NOMINMAX
+#	include <windows.h>
+#else
+#	include <errno.h>
+#	include <fcntl.h>
+#	include <unistd.h>
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#endif
+
 using namespace std;
 using namespace NLMISC;
 
@@ -116,163 +127,221 @@ void CBigFile::CThreadFileArray::currentThreadFinished()
 //}
 
 // ***************************************************************************
-bool CBigFile::add (const std::string &sBigFileName, uint32 nOptions)
+bool CBigFile::readDirectory (BNP &bnp, const uint8 *dir, uint32 dirSize, uint32 dataSize)
 {
-	// Is already the same bigfile name ?
-	string bigfilenamealone = toLower(CFile::getFilename (sBigFileName));
-	if (_BNPs.find(bigfilenamealone) != _BNPs.end())
-	{
-		nlwarning ("CBigFile::add : bigfile %s already added.", bigfilenamealone.c_str());
+	const uint8 *ptr = dir;
+	const uint8 *end = dir + dirSize;
+
+	uint32 nNbFile;
+	if (end - ptr < (sint)sizeof(uint32))
 		return false;
-	}
+	memcpy (&nNbFile, ptr, sizeof(uint32));
+	ptr += sizeof(uint32);
+
+	// The names are read in place, then copied at once in FileNames
+	vector<BNPFile> files;
+	vector<const uint8 *> names;
+	files.reserve (min (nNbFile, dirSize / 9));
+	names.reserve (files.capacity());
+	uint32 nSize = 0;
+	for (uint32 i = 0; i < nNbFile; ++i)
+	{
+		if (ptr == end)
+			return false;
+		uint8 nStringSize = *ptr;
+		if (end - ptr < 1 + nStringSize + 2*(sint)sizeof(uint32))
+			return false;
 
-	// Create the new bnp entry
-	BNP &bnp = _BNPs[bigfilenamealone];
+		BNPFile bnpfTmp;
+		names.push_back (ptr);
+		ptr += 1 + nStringSize;
+		memcpy (&bnpfTmp.Size, ptr, sizeof(uint32));
+		memcpy (&bnpfTmp.Pos, ptr + sizeof(uint32), sizeof(uint32));
+		ptr += 2*sizeof(uint32);
+
+		// a file outside the bnp data would be read outside the mapping
+		if (bnpfTmp.Pos > dataSize || bnpfTmp.Size > dataSize - bnpfTmp.Pos)
+		{
+			nlwarning ("BF: File %u of '%s' is outside the bnp, skip it", i, bnp.BigFileName.c_str());
+			names.pop_back ();
+			continue;
+		}
+		files.push_back (bnpfTmp);
+		nSize += nStringSize + 1;
+	}
 
-	bnp.BigFileName= sBigFileName;
+	if (files.empty())
+		return true;
 
+	bnp.FileNames = new char[nSize];
+	nSize = 0;
+	for (uint i = 0; i < files.size(); ++i)
+	{
+		uint8 nStringSize = *names[i];
+		files[i].Name = bnp.FileNames + nSize;
+		memcpy (files[i].Name, names[i] + 1, nStringSize);
+		files[i].Name[nStringSize] = 0;
+		toLower (files[i].Name);
+		nSize += nStringSize + 1;
+	}
 
-	// Allocate a new ThreadSafe FileId for this bnp.
-	bnp.ThreadFileId= _ThreadFileArray.allocate();
+	// sorted for the lookups, the first of the same names is kept
+	stable_sort (files.begin(), files.end(), CBNPFileComp());
+	vector<BNPFile>::iterator itLast = files.begin();
+	for (vector<BNPFile>::iterator it = files.begin() + 1; it != files.end(); ++it)
+	{
+		if (strcmp (it->Name, itLast->Name) != 0)
+			*(++itLast) = *it;
+	}
+	files.erase (itLast + 1, files.end());
 
-	// Get a ThreadSafe handle on the file
-	CHandleFile		&handle= _ThreadFileArray.get(bnp.ThreadFileId);
-	// Open the big file.
-	handle.File = fopen (sBigFileName.c_str(), "rb");
-	if (handle.File == NULL)
-		return false;	
-	uint32 nFileSize=CFile::getFileSize (handle.File);
-	//nlfseek64 (handle.File, 0, SEEK_END);
-	//uint32 nFileSize = ftell (handle.File);
+	bnp.Files.swap (files);
+	return true;
+}
 
-	// Result
-	if (nlfseek64 (handle.File, nFileSize-4, SEEK_SET) != 0)
-	{
-		fclose (handle.File);		
-		handle.File = NULL;
+// ***************************************************************************
+bool CBigFile::mapBigFile (BNP &bnp)
+{
+#ifdef NL_OS_WINDOWS
+	HANDLE file = CreateFileA (bnp.BigFileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
 		return false;
+	DWORD sizeHigh = 0;
+	DWORD size = GetFileSize (file, &sizeHigh);
+	void *data = NULL;
+	if (size != INVALID_FILE_SIZE && sizeHigh == 0 && size != 0)
+	{
+		// the view keeps a reference on the mapping and the file, they can be closed
+		HANDLE mapping = CreateFileMappingA (file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping != NULL)
+		{
+			data = MapViewOfFile (mapping, FILE_MAP_READ, 0, 0, 0);
+			CloseHandle (mapping);
+		}
 	}
-
-	uint32 nOffsetFromBegining;
-	if (fread (&nOffsetFromBegining, sizeof(uint32), 1, handle.File) != 1)
+	CloseHandle (file);
+	if (data == NULL)
 	{
-		fclose (handle.File);		
-		handle.File = NULL;
+		nlwarning ("BF: Can't map '%s' in memory, error %u", bnp.BigFileName.c_str(), (uint)GetLastError());
 		return false;
 	}
-
-	if (nlfseek64 (handle.File, nOffsetFromBegining, SEEK_SET) != 0)
+#else
+	int fd = open (bnp.BigFileName.c_str(), O_RDONLY);
+	if (fd == -1)
+		return false;
+	struct stat st;
+	void *data = MAP_FAILED;
+	if (fstat (fd, &st) == 0 && st.st_size != 0 && (uint64)st.st_size <= 0xFFFFFFFF)
 	{
-		fclose (handle.File);		
-		handle.File = NULL;
+		// the mapping stays valid once the file is closed
+		data = mmap (NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	}
+	::close (fd);
+	if (data == MAP_FAILED)
+	{
+		nlwarning ("BF: Can't map '%s' in memory, error %u : %s", bnp.BigFileName.c_str(), errno, strerror(errno));
 		return false;
 	}
+	uint32 size = (uint32)st.st_size;
+#endif
 
-	// Read the file count
-	uint32 nNbFile;
-	if (fread (&nNbFile, sizeof(uint32), 1, handle.File) != 1)
+	bnp.MappedData = (const uint8 *)data;
+	bnp.MappedSize = size;
+	return true;
+}
+
+// ***************************************************************************
+void CBigFile::unmapBigFile (BNP &bnp)
+{
+	if (bnp.MappedData == NULL)
+		return;
+#ifdef NL_OS_WINDOWS
+	UnmapViewOfFile (bnp.MappedData);
+#else
+	munmap ((void *)bnp.MappedData, bnp.MappedSize);
+#endif
+	bnp.MappedData = NULL;
+	bnp.MappedSize = 0;
+}
+
+// ***************************************************************************
+bool CBigFile::add (const std::string &sBigFileName, uint32 nOptions)
+{
+	// Is already the same bigfile name ?
+	string bigfilenamealone = toLower(CFile::getFilename (sBigFileName));
+	if (_BNPs.find(bigfilenamealone) != _BNPs.end())
 	{
-		fclose (handle.File);		
-		handle.File = NULL;
+		nlwarning ("CBigFile::add : bigfile %s already added.", bigfilenamealone.c_str());
 		return false;
 	}
-	map<string,BNPFile> tempMap;
-	for (uint32 i = 0; i < nNbFile; ++i)
-	{
-		char FileName[256];
-		uint8 nStringSize;
-		if (fread (&nStringSize, 1, 1, handle.File) != 1)
-		{
-			fclose (handle.File);			
-			handle.File = NULL;
-			return false;
-		}
 
-		if (fread (FileName, nStringSize, 1, handle.File) != 1)
-		{
-			fclose (handle.File);			
-			handle.File = NULL;
-			return false;
-		}
+	// Create the new bnp entry
+	BNP &bnp = _BNPs[bigfilenamealone];
 
-		FileName[nStringSize] = 0;
-		uint32 nFileSize2;
-		if (fread (&nFileSize2, sizeof(uint32), 1, handle.File) != 1)
-		{
-			fclose (handle.File);			
-			handle.File = NULL;
-			return false;
-		}
+	bnp.BigFileName= sBigFileName;
+	bnp.CacheFileOnOpen = (nOptions&BF_CACHE_FILE_ON_OPEN) != 0;
+	bnp.AlwaysOpened = (nOptions&BF_ALWAYS_OPENED) != 0;
 
-		uint32 nFilePos;
-		if (fread (&nFilePos, sizeof(uint32), 1, handle.File) != 1)
+	// Allocate a new ThreadSafe FileId for this bnp.
+	bnp.ThreadFileId= _ThreadFileArray.allocate();
+
+	// The directory of a mapped bnp is read in place
+	if ((nOptions&BF_MEMORY_MAPPED) && mapBigFile(bnp))
+	{
+		uint32 nOffsetFromBegining = 0;
+		if (bnp.MappedSize >= 2*sizeof(uint32))
+			memcpy (&nOffsetFromBegining, bnp.MappedData + bnp.MappedSize - sizeof(uint32), sizeof(uint32));
+
+		if (bnp.MappedSize < 2*sizeof(uint32) || nOffsetFromBegining > bnp.MappedSize - 2*sizeof(uint32) ||
+			!readDirectory (bnp, bnp.MappedData + nOffsetFromBegining, bnp.MappedSize - sizeof(uint32) - nOffsetFromBegining, nOffsetFromBegining))
 		{
-			fclose (handle.File);			
-			handle.File = NULL;
+			nlwarning ("BF: Invalid directory in '%s'", sBigFileName.c_str());
+			unmapBigFile (bnp);
+			_BNPs.erase (bigfilenamealone);
 			return false;
 		}
 
-		BNPFile bnpfTmp;
-		bnpfTmp.Pos = nFilePos;
-		bnpfTmp.Size = nFileSize2;
-		tempMap.insert (make_pair(toLower(string(FileName)), bnpfTmp));
+		nldebug("BigFile : added bnp '%s' to the collection (memory mapped)", bigfilenamealone.c_str());
+		return true;
 	}
 
-	if (nlfseek64 (handle.File, 0, SEEK_SET) != 0)
+	// Get a ThreadSafe handle on the file
+	CHandleFile		&handle= _ThreadFileArray.get(bnp.ThreadFileId);
+	// Open the big file.
+	handle.File = fopen (sBigFileName.c_str(), "rb");
+	if (handle.File == NULL)
 	{
-		fclose (handle.File);		
-		handle.File = NULL;
+		_BNPs.erase (bigfilenamealone);
 		return false;
 	}
+	uint32 nFileSize=CFile::getFileSize (handle.File);
 
-	// Convert temp map
-	if (nNbFile > 0)
+	// Read the directory at once
+	uint32 nOffsetFromBegining;
+	bool ok = nFileSize >= 2*sizeof(uint32)
+		&& nlfseek64 (handle.File, nFileSize-sizeof(uint32), SEEK_SET) == 0
+		&& fread (&nOffsetFromBegining, sizeof(uint32), 1, handle.File) == 1
+		&& nOffsetFromBegining <= nFileSize - 2*sizeof(uint32);
+	if (ok)
 	{
-		uint nSize = 0, nNb = 0;
-		map<string,BNPFile>::iterator it = tempMap.begin();
-		while (it != tempMap.end())
-		{
-			nSize += it->first.size() + 1;
-			nNb++;
-			it++;
-		}
-
-		bnp.FileNames = new char[nSize];
-		memset(bnp.FileNames, 0, nSize);
-		bnp.Files.resize(nNb);
-
-		it = tempMap.begin();
-		nSize = 0;
-		nNb = 0;
-		while (it != tempMap.end())
-		{
-			strcpy(bnp.FileNames+nSize, it->first.c_str());
-			
-			bnp.Files[nNb].Name = bnp.FileNames+nSize;
-			bnp.Files[nNb].Size = it->second.Size;
-			bnp.Files[nNb].Pos = it->second.Pos;
-
-			nSize += it->first.size() + 1;
-			nNb++;
-			it++;
-		}
+		vector<uint8> dir (nFileSize - sizeof(uint32) - nOffsetFromBegining);
+		ok = nlfseek64 (handle.File, nOffsetFromBegining, SEEK_SET) == 0
+			&& fread (&dir[0], dir.size(), 1, handle.File) == 1
+			&& readDirectory (bnp, &dir[0], (uint32)dir.size(), nOffsetFromBegining)
+			&& nlfseek64 (handle.File, 0, SEEK_SET) == 0;
 	}
-	// End of temp map conversion
 
-	if (nOptions&BF_CACHE_FILE_ON_OPEN)
-		bnp.CacheFileOnOpen = true;
-	else
-		bnp.CacheFileOnOpen = false;
-
-	if (!(nOptions&BF_ALWAYS_OPENED))
+	if (!ok || !bnp.AlwaysOpened)
 	{
 		fclose (handle.File);		
 		handle.File = NULL;
-		bnp.AlwaysOpened = false;
 	}
-	else
+
+	if (!ok)
 	{
-		bnp.AlwaysOpened = true;
+		delete [] bnp.FileNames;
+		_BNPs.erase (bigfilenamealone);
+		return false;
 	}
 
 	nldebug("BigFile : added bnp '%s' to the collection", bigfilenamealone.c_str());
@@ -295,6 +364,7 @@ void CBigFile::remove (const std::string &sBigFileName)
 			fclose (handle.File);
 			handle.File= NULL;
 		}
+		unmapBigFile (rbnp);
 		delete [] rbnp.FileNames;
 		_BNPs.erase (it);
 	}
@@ -390,8 +460,11 @@ bool CBigFile::getFileInternal (const std::string &sFileName, BNP *&zeBnp, BNPFi
 
 // ***************************************************************************
 FILE* CBigFile::getFile (const std::string &sFileName, uint32 &rFileSize, 
-						 uint32 &rBigFileOffset, bool &rCacheFileOnOpen, bool &rAlwaysOpened)
+						 uint32 &rBigFileOffset, bool &rCacheFileOnOpen, bool &rAlwaysOpened, const uint8 **pMappedData)
 {
+	if (pMappedData != NULL)
+		*pMappedData = NULL;
+
 	BNP		*bnp= NULL;
 	BNPFile	*bnpFile= NULL;
 	if(!getFileInternal(sFileName, bnp, bnpFile))
@@ -400,6 +473,18 @@ FILE* CBigFile::getFile (const std::string &sFileName, uint32 &rFileSize,
 		return NULL;
 	}
 	nlassert(bnp && bnpFile);
+
+	rCacheFileOnOpen = bnp->CacheFileOnOpen;
+	rAlwaysOpened = bnp->AlwaysOpened;
+	rBigFileOffset = bnpFile->Pos;
+	rFileSize = bnpFile->Size;
+
+	// No handle for the mapped bnp, the file is read in memory
+	if (bnp->MappedData != NULL && pMappedData != NULL)
+	{
+		*pMappedData = bnp->MappedData + bnpFile->Pos;
+		return NULL;
+	}
 	
 	// Get a ThreadSafe handle on the file
 	CHandleFile		&handle= _ThreadFileArray.get(bnp->ThreadFileId);
@@ -413,10 +498,6 @@ FILE* CBigFile::getFile (const std::string &sFileName, uint32 &rFileSize,
 			return NULL;		
 	}
 
-	rCacheFileOnOpen = bnp->CacheFileOnOpen;
-	rAlwaysOpened = bnp->AlwaysOpened;
-	rBigFileOffset = bnpFile->Pos;
-	rFileSize = bnpFile->Size;
 	return handle.File;
 }
 
@@ -0,0 +1,812 @@
+/** \file binary_log_displayer.cpp
+ * Displayer that writes the logs in a binary file, and the reader of these files
+ *
+ * $Id$
+ */
+
+/* Copyright, 2001 Nevrax Ltd.
+ *
+ * This file is part of NEVRAX NEL.
+ * NEVRAX NEL is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+
+ * NEVRAX NEL is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with NEVRAX NEL; see the file COPYING. If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#include "stdmisc.h"
+
+#include <cstdio>
+#include <cerrno>
+
+#include "nel/misc/binary_log_displayer.h"
+#include "nel/misc/path.h"
+
+using namespace std;
+
+
+namespace NLMISC
+{
+
+
+/*
+ * File format ('*' marks the integers written on 1 to 5 bytes, 7 bits by byte):
+ * - 'NLBL' check and version
+ * - records, starting with their type:
+ *   RecordString: id*, length*, characters
+ *   RecordLine: line header, format id*, arguments
+ *   RecordText: line header, message (length*, characters), callstack (length*, characters)
+ * - line header: flags, log type, [date (uint32) if NewDate], [thread id (uint32) if NewThread],
+ *   [process name id* if NewProcess], file name id*, line+1*, function name id*
+ * - arguments, in the order of the conversions of the format: int, char and short as sint32/uint32,
+ *   the longer integers and the pointers as sint64/uint64, the floats as double, the strings as length*
+ *   and characters (at most MaxStringArg). A '*' width or precision is a sint32 before its argument.
+ *
+ * The strings are numbered from 1 in each file (0 is NULL). When a file is reopened, its strings are
+ * written again with new ids.
+ */
+
+enum TRecordType { RecordString, RecordLine, RecordText };
+
+enum TLineFlag { NewDate = 1, NewThread = 2, NewProcess = 4 };
+
+// Longest string argument written (CLog cuts the lines at 256 characters)
+static const uint32 MaxStringArg = 256;
+
+
+static void serialVarUInt (IStream &s, uint32 &value)
+{
+	if (s.isReading ())
+	{
+		value = 0;
+		for (uint shift = 0; shift < 35; shift += 7)
+		{
+			uint8 b;
+			s.serial (b);
+			value |= (uint32)(b & 0x7f) << shift;
+			if ((b & 0x80) == 0)
+				return;
+		}
+		throw EInvalidDataStream (s);
+	}
+	else
+	{
+		uint32 v = value;
+		while (v >= 0x80)
+		{
+			uint8 b = (uint8)(v | 0x80);
+			s.serial (b);
+			v >>= 7;
+		}
+		uint8 b = (uint8)v;
+		s.serial (b);
+	}
+}
+
+static void writeString (IStream &s, const char *str, uint32 len)
+{
+	serialVarUInt (s, len);
+	if (len != 0)
+		s.serialBuffer ((uint8 *)const_cast<char *>(str), len);
+}
+
+static void readString (CIFile &f, std::string &str)
+{
+	uint32 len;
+	serialVarUInt (f, len);
+	if (len > f.getFileSize () - (uint32)f.getPos ())
+		throw EInvalidDataStream (f);
+	str.resize (len);
+	if (len != 0)
+		f.serialBuffer ((uint8 *)&str[0], len);
+}
+
+
+// Type of the argument of a conversion
+enum TArgType { ArgInt, ArgUInt, ArgDouble, ArgString, ArgWideString, ArgPointer, ArgCount, ArgPercent };
+
+// Length modifier of a conversion
+enum TArgSize { SizeInt, SizeChar, SizeShort, SizeInt32, SizeLong, SizeLongLong, SizeIntMax, SizeSizeT, SizePtrDiff, SizeLongDouble };
+
+// A conversion of a format ("%-5.*ld")
+struct CConversion
+{
+	const char	*Begin;
+	const char	*Modifier;
+	const char	*ModifierEnd;
+	const char	*End;
+	char		Conversion;
+	TArgType	Type;
+	TArgSize	Size;
+	bool		StarWidth;
+	bool		StarPrecision;
+
+	// The integer is written on 64 bits
+	bool		is64 () const { return Size >= SizeLong && Size <= SizePtrDiff; }
+};
+
+// Parse the conversion that starts at the '%', returns false if it's unknown (the rest of the format is not converted)
+static bool parseConversion (const char *p, CConversion &conv)
+{
+	conv.Begin = p++;
+	conv.StarWidth = false;
+	conv.StarPrecision = false;
+	conv.Size = SizeInt;
+
+	while (*p != '\0' && strchr ("-+ #0'", *p) != NULL)
+		p++;
+	if (*p == '*')
+	{
+		conv.StarWidth = true;
+		p++;
+	}
+	else
+	{
+		while (*p >= '0' && *p <= '9')
+			p++;
+	}
+	if (*p == '.')
+	{
+		p++;
+		if (*p == '*')
+		{
+			conv.StarPrecision = true;
+			p++;
+		}
+		else
+		{
+			while (*p >= '0' && *p <= '9')
+				p++;
+		}
+	}
+
+	conv.Modifier = p;
+	switch (*p)
+	{
+	case 'h':
+		p++;
+		if (*p == 'h') { p++; conv.Size = SizeChar; }
+		else conv.Size = SizeShort;
+		break;
+	case 'l':
+		p++;
+		if (*p == 'l') { p++; conv.Size = SizeLongLong; }
+		else conv.Size = SizeLong;
+		break;
+	case 'q': p++; conv.Size = SizeLongLong; break;
+	case 'j': p++; conv.Size = SizeIntMax; break;
+	case 'z': p++; conv.Size = SizeSizeT; break;
+	case 't': p++; conv.Size = SizePtrDiff; break;
+	case 'L': p++; conv.Size = SizeLongDouble; break;
+	case 'I':
+		// Windows: I64, I32, I
+		if (p[1] == '6' && p[2] == '4') { p += 3; conv.Size = SizeLongLong; }
+		else if (p[1] == '3' && p[2] == '2') { p += 3; conv.Size = SizeInt32; }
+		else { p++; conv.Size = SizeSizeT; }
+		break;
+	}
+	conv.ModifierEnd = p;
+
+	conv.Conversion = *p;
+	switch (*p)
+	{
+	case 'd': case 'i':
+		conv.Type = ArgInt;
+		break;
+	case 'u': case 'o': case 'x': case 'X':
+		conv.Type = ArgUInt;
+		break;
+	case 'c': case 'C':
+		conv.Type = ArgInt;
+		conv.Size = SizeInt;
+		break;
+	case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+		conv.Type = ArgDouble;
+		break;
+	case 's':
+		conv.Type = (conv.Size == SizeLong) ? ArgWideString : ArgString;
+		break;
+	case 'S':
+		conv.Type = ArgWideString;
+		break;
+	case 'p':
+		conv.Type = ArgPointer;
+		break;
+	case 'n':
+		conv.Type = ArgCount;
+		break;
+	case '%':
+		conv.Type = ArgPercent;
+		break;
+	default:
+		return false;
+	}
+	conv.End = p + 1;
+	return true;
+}
+
+// Write the arguments of a format
+static void serialArgs (IStream &s, const char *format, va_list vargs)
+{
+	for (const char *p = strchr (format, '%'); p != NULL; p = strchr (p, '%'))
+	{
+		CConversion conv;
+		if (!parseConversion (p, conv))
+			break;
+		p = conv.End;
+
+		if (conv.StarWidth)
+		{
+			sint32 width = va_arg (vargs, int);
+			s.serial (width);
+		}
+		if (conv.StarPrecision)
+		{
+			sint32 precision = va_arg (vargs, int);
+			s.serial (precision);
+		}
+
+		switch (conv.Type)
+		{
+		case ArgInt:
+			if (conv.is64 ())
+			{
+				sint64 value;
+				switch (conv.Size)
+				{
+				case SizeLong: value = va_arg (vargs, long); break;
+				case SizeSizeT: value = (sint64)va_arg (vargs, size_t); break;
+				case SizePtrDiff: value = (sint64)va_arg (vargs, ptrdiff_t); break;
+				default: value = va_arg (vargs, sint64); break;
+				}
+				s.serial (value);
+			}
+			else
+			{
+				sint32 value = va_arg (vargs, int);
+				s.serial (value);
+			}
+			break;
+
+		case ArgUInt:
+			if (conv.is64 ())
+			{
+				uint64 value;
+				switch (conv.Size)
+				{
+				case SizeLong: value = va_arg (vargs, unsigned long); break;
+				case SizeSizeT: value = (uint64)va_arg (vargs, size_t); break;
+				case SizePtrDiff: value = (uint64)va_arg (vargs, ptrdiff_t); break;
+				default: value = va_arg (vargs, uint64); break;
+				}
+				s.serial (value);
+			}
+			else
+			{
+				uint32 value = va_arg (vargs, unsigned int);
+				s.serial (value);
+			}
+			break;
+
+		case ArgDouble:
+			{
+				double value;
+				if (conv.Size == SizeLongDouble)
+					value = (double)va_arg (vargs, long double);
+				else
+					value = va_arg (vargs, double);
+				s.serial (value);
+			}
+			break;
+
+		case ArgString:
+			{
+				const char *str = va_arg (vargs, const char *);
+				if (str == NULL)
+					str = "(null)";
+				uint32 len = 0;
+				while (len < MaxStringArg && str[len] != '\0')
+					len++;
+				writeString (s, str, len);
+			}
+			break;
+
+		case ArgWideString:
+			{
+				// only the latin 1 characters are kept
+				const wchar_t *wstr = va_arg (vargs, const wchar_t *);
+				char str [MaxStringArg];
+				uint32 len = 0;
+				if (wstr == NULL)
+					wstr = L"(null)";
+				for (; len < MaxStringArg && wstr[len] != 0; len++)
+					str[len] = ((uint32)wstr[len] < 256) ? (char)wstr[len] : '?';
+				writeString (s, str, len);
+			}
+			break;
+
+		case ArgPointer:
+			{
+				uint64 value = (uint64)(size_t)va_arg (vargs, void *);
+				s.serial (value);
+			}
+			break;
+
+		case ArgCount:
+			va_arg (vargs, void *);
+			break;
+
+		case ArgPercent:
+			break;
+		}
+	}
+}
+
+// Append a formatted value
+static void appendFormatted (std::string &str, const char *format, ...)
+{
+	char buffer [1024];
+	va_list args;
+	va_start (args, format);
+	vsnprintf (buffer, sizeof (buffer) - 1, format, args);
+	va_end (args);
+	buffer[sizeof (buffer) - 1] = '\0';
+	str += buffer;
+}
+
+// Render a format with the arguments written by serialArgs()
+static void renderArgs (IStream &s, const char *format, std::string &str)
+{
+	const char *p = format;
+	while (*p != '\0')
+	{
+		const char *percent = strchr (p, '%');
+		if (percent == NULL)
+		{
+			str += p;
+			break;
+		}
+		str.append (p, percent - p);
+
+		CConversion conv;
+		if (!parseConversion (percent, conv))
+		{
+			str += percent;
+			break;
+		}
+		p = conv.End;
+
+		// the flags, width and precision, with the '*' replaced by their value
+		string spec (conv.Begin, conv.Modifier);
+		if (conv.StarWidth)
+		{
+			sint32 width;
+			s.serial (width);
+			spec.replace (spec.find ('*'), 1, toString (width));
+		}
+		if (conv.StarPrecision)
+		{
+			sint32 precision;
+			s.serial (precision);
+			spec.replace (spec.find ('*'), 1, toString (precision));
+		}
+
+		// then the length modifier of the written value
+		switch (conv.Type)
+		{
+		case ArgInt:
+		case ArgUInt:
+			if (conv.is64 ())
+			{
+				spec += NL_I64;
+				spec += conv.Conversion;
+				if (conv.Type == ArgInt)
+				{
+					sint64 value;
+					s.serial (value);
+					appendFormatted (str, spec.c_str (), value);
+				}
+				else
+				{
+					uint64 value;
+					s.serial (value);
+					appendFormatted (str, spec.c_str (), value);
+				}
+			}
+			else
+			{
+				if (conv.Size == SizeChar || conv.Size == SizeShort)
+					spec.append (conv.Modifier, conv.ModifierEnd);
+				spec += (conv.Conversion == 'C') ? 'c' : conv.Conversion;
+				sint32 value;
+				s.serial (value);
+				appendFormatted (str, spec.c_str (), value);
+			}
+			break;
+
+		case ArgDouble:
+			{
+				spec += conv.Conversion;
+				double value;
+				s.serial (value);
+				appendFormatted (str, spec.c_str (), value);
+			}
+			break;
+
+		case ArgString:
+		case ArgWideString:
+			{
+				spec += 's';
+				string value;
+				readString (static_cast<CIFile &>(s), value);
+				appendFormatted (str, spec.c_str (), value.c_str ());
+			}
+			break;
+
+		case ArgPointer:
+			{
+				spec += 'p';
+				uint64 value;
+				s.serial (value);
+				appendFormatted (str, spec.c_str (), (void *)(size_t)value);
+			}
+			break;
+
+		case ArgCount:
+			break;
+
+		case ArgPercent:
+			str += '%';
+			break;
+		}
+	}
+}
+
+
+// ***************************************************************************
+
+CBinaryLogDisplayer::CBinaryLogDisplayer (const std::string &filename, bool eraseLastLog, const char *displayerName) :
+	IDisplayer (displayerName), _FilePointer((FILE*)1), _LastLogSizeChecked(0), _NbStrings(0),
+	_HasLastLine(false), _LastDate(0), _LastThreadId(0), _LastProcessId(0)
+{
+	setParam (filename, eraseLastLog);
+}
+
+CBinaryLogDisplayer::CBinaryLogDisplayer () :
+	IDisplayer (""), _FilePointer((FILE*)1), _LastLogSizeChecked(0), _NbStrings(0),
+	_HasLastLine(false), _LastDate(0), _LastThreadId(0), _LastProcessId(0)
+{
+}
+
+CBinaryLogDisplayer::~CBinaryLogDisplayer ()
+{
+	if (_FilePointer > (FILE*)1)
+	{
+		fclose (_FilePointer);
+		_FilePointer = NULL;
+	}
+}
+
+void CBinaryLogDisplayer::setParam (const std::string &filename, bool eraseLastLog)
+{
+	_FileName = filename;
+
+	if (filename.empty())
+	{
+		// can't do nlwarning or infinite recurs
+		printf ("CBinaryLogDisplayer::setParam(): Can't create file with empty filename\n");
+		return;
+	}
+
+	if (eraseLastLog)
+	{
+		// Erase the file and all the derived log files
+		if (CFile::isExists (filename))
+			CFile::deleteFile (filename);
+		for (uint i = 0; ; i++)
+		{
+			string fileToDelete = CFile::getPath (filename) + CFile::getFilenameWithoutExtension (filename) +
+				toString ("%03d.", i) + CFile::getExtension (filename);
+			if (!CFile::isExists (fileToDelete))
+				break;
+			CFile::deleteFile (fileToDelete);
+		}
+	}
+
+	if (_FilePointer > (FILE*)1)
+	{
+		fclose (_FilePointer);
+		_FilePointer = (FILE*)1;
+	}
+}
+
+bool CBinaryLogDisplayer::openFile ()
+{
+	// if the filename is not set, don't log
+	if (_FileName.empty())
+		return false;
+
+	if (_FilePointer > (FILE*)1)
+	{
+		// if the file is too big (>5mb), rename it and create another one (check only after 20 lines to speed up)
+		if (_LastLogSizeChecked++ > 20)
+		{
+			_LastLogSizeChecked = 0;
+			if (ftell (_FilePointer) > 5*1024*1024)
+			{
+				fclose (_FilePointer);
+				rename (_FileName.c_str(), CFile::findNewFile (_FileName).c_str());
+				_FilePointer = (FILE*)1;
+			}
+		}
+	}
+
+	if (_FilePointer == (FILE*)1)
+	{
+		_FilePointer = fopen (_FileName.c_str(), "ab");
+		if (_FilePointer == NULL)
+		{
+			printf ("Can't open log file '%s': %s\n", _FileName.c_str(), strerror (errno));
+			return false;
+		}
+
+		// the strings and the fields of the lines are written again in the new file (or after the previous session)
+		_StringIds.clear ();
+		_NbStrings = 0;
+		_HasLastLine = false;
+
+		fseek (_FilePointer, 0, SEEK_END);
+		if (ftell (_FilePointer) == 0)
+		{
+			_Record.resetBufPos ();
+			_Record.serialCheck ((uint32)'NLBL');
+			_Record.serialVersion (0);
+			writeRecord ();
+		}
+	}
+
+	return _FilePointer != NULL;
+}
+
+uint32 CBinaryLogDisplayer::addString (const char *str)
+{
+	uint32 id = ++_NbStrings;
+	uint8 recordType = RecordString;
+	_Record.serial (recordType);
+	serialVarUInt (_Record, id);
+	writeString (_Record, str, (uint32)strlen (str));
+	return id;
+}
+
+uint32 CBinaryLogDisplayer::getStringId (const char *str)
+{
+	if (str == NULL)
+		return 0;
+
+	TStringIds::iterator it = _StringIds.find (str);
+	if (it != _StringIds.end () && it->second.Value == str)
+		return it->second.Id;
+
+	CStringId &stringId = _StringIds[str];
+	stringId.Id = addString (str);
+	stringId.Value = str;
+	return stringId.Id;
+}
+
+void CBinaryLogDisplayer::serialLineHeader (uint8 recordType, const CLog::TDisplayInfo& args)
+{
+	// the new strings first
+	uint32 fileId = getStringId (args.FileName);
+	uint32 funcId = getStringId (args.FuncName);
+
+	uint8 flags = 0;
+	if (!_HasLastLine || args.ProcessName != _LastProcessName)
+	{
+		_LastProcessName = args.ProcessName;
+		_LastProcessId = addString (args.ProcessName.c_str ());
+		flags |= NewProcess;
+	}
+	uint32 date = (uint32)args.Date;
+	if (!_HasLastLine || date != _LastDate)
+	{
+		_LastDate = date;
+		flags |= NewDate;
+	}
+	uint32 threadId = (uint32)args.ThreadId;
+	if (!_HasLastLine || threadId != _LastThreadId)
+	{
+		_LastThreadId = threadId;
+		flags |= NewThread;
+	}
+	_HasLastLine = true;
+
+	uint8 logType = (uint8)args.LogType;
+	uint32 line = (uint32)(args.Line + 1);
+	_Record.serial (recordType);
+	_Record.serial (flags);
+	_Record.serial (logType);
+	if (flags & NewDate)
+		_Record.serial (date);
+	if (flags & NewThread)
+		_Record.serial (threadId);
+	if (flags & NewProcess)
+		serialVarUInt (_Record, _LastProcessId);
+	serialVarUInt (_Record, fileId);
+	serialVarUInt (_Record, line);
+	serialVarUInt (_Record, funcId);
+}
+
+void CBinaryLogDisplayer::writeRecord ()
+{
+	fwrite (_Record.buffer (), _Record.length (), 1, _FilePointer);
+	fflush (_FilePointer);
+}
+
+void CBinaryLogDisplayer::doDisplayFormat (const CLog::TDisplayInfo& args, const char *format, va_list vargs)
+{
+	if (!openFile ())
+		return;
+
+	_Record.resetBufPos ();
+	uint32 formatId = getStringId (format);
+	serialLineHeader (RecordLine, args);
+	serialVarUInt (_Record, formatId);
+	serialArgs (_Record, format, vargs);
+	writeRecord ();
+}
+
+void CBinaryLogDisplayer::doDisplay (const CLog::TDisplayInfo& args, const char *message)
+{
+	if (!openFile ())
+		return;
+
+	_Record.resetBufPos ();
+	serialLineHeader (RecordText, args);
+	writeString (_Record, message, (uint32)strlen (message));
+	writeString (_Record, args.CallstackAndLog.c_str (), (uint32)args.CallstackAndLog.size ());
+	writeRecord ();
+}
+
+
+// ***************************************************************************
+
+CBinaryLogReader::CBinaryLogReader () : _Date(0), _ThreadId(0), _ProcessId(0)
+{
+}
+
+bool CBinaryLogReader::open (const std::string &filename)
+{
+	close ();
+
+	_File.setCacheFileOnOpen (true);
+	if (!_File.open (filename))
+		return false;
+
+	try
+	{
+		_File.serialCheck ((uint32)'NLBL');
+		_File.serialVersion (0);
+	}
+	catch (const EStream &)
+	{
+		_File.close ();
+		return false;
+	}
+	return true;
+}
+
+void CBinaryLogReader::close ()
+{
+	_File.close ();
+	_Strings.clear ();
+	_Date = 0;
+	_ThreadId = 0;
+	_ProcessId = 0;
+}
+
+const char *CBinaryLogReader::getString (uint32 id) const
+{
+	if (id == 0 || id >= _Strings.size ())
+		return NULL;
+	return _Strings[id].c_str ();
+}
+
+bool CBinaryLogReader::readLine (CLog::TDisplayInfo &args, std::string &message)
+{
+	try
+	{
+		while ((uint32)_File.getPos () < _File.getFileSize ())
+		{
+			uint8 recordType;
+			_File.serial (recordType);
+
+			if (recordType == RecordString)
+			{
+				uint32 id;
+				serialVarUInt (_File, id);
+				if (id == 0 || id > _File.getFileSize ())
+					throw EInvalidDataStream (_File);
+				if (id >= _Strings.size ())
+					_Strings.resize (id + 1);
+				readString (_File, _Strings[id]);
+				continue;
+			}
+
+			if (recordType != RecordLine && recordType != RecordText)
+				throw EInvalidDataStream (_File);
+
+			uint8 flags, logType;
+			_File.serial (flags);
+			_File.serial (logType);
+			if (flags & NewDate)
+			{
+				uint32 date;
+				_File.serial (date);
+				_Date = date;
+			}
+			if (flags & NewThread)
+			{
+				uint32 threadId;
+				_File.serial (threadId);
+				_ThreadId = threadId;
+			}
+			if (flags & NewProcess)
+				serialVarUInt (_File, _ProcessId);
+			uint32 fileId, line, funcId;
+			serialVarUInt (_File, fileId);
+			serialVarUInt (_File, line);
+			serialVarUInt (_File, funcId);
+
+			args = CLog::TDisplayInfo ();
+			args.Date = _Date;
+			args.LogType = (logType <= CLog::LOG_UNKNOWN) ? (CLog::TLogType)logType : CLog::LOG_UNKNOWN;
+			const char *processName = getString (_ProcessId);
+			args.ProcessName = (processName != NULL) ? processName : "";
+			args.ThreadId = _ThreadId;
+			args.FileName = getString (fileId);
+			args.Line = (sint)line - 1;
+			args.FuncName = getString (funcId);
+
+			message.clear ();
+			if (recordType == RecordLine)
+			{
+				uint32 formatId;
+				serialVarUInt (_File, formatId);
+				const char *format = getString (formatId);
+				if (format == NULL)
+					throw EInvalidDataStream (_File);
+				renderArgs (_File, format, message);
+
+				// as CLog::displayNL()
+				if (message.size () > 256-2)
+					message.resize (256-2);
+				message += '\n';
+			}
+			else
+			{
+				readString (_File, message);
+				readString (_File, args.CallstackAndLog);
+			}
+			return true;
+		}
+	}
+	catch (const EStream &e)
+	{
+		nlwarning ("LOG: The binary log '%s' is truncated or invalid: %s", _File.getStreamName ().c_str (), e.what ());
+	}
+	return false;
+}
+
+
+} // NLMISC
+
+/* End of binary_log_displayer.cpp */
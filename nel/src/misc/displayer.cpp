@@ -144,6 +144,23 @@ void IDisplayer::display ( const CLog::TDisplayInfo& args, const char *message )
 	_Mutex->leave();
 }
 
+/*
+ * Display a line before its formatting
+ */
+void IDisplayer::displayFormat ( const CLog::TDisplayInfo& args, const char *format, va_list vargs )
+{
+	_Mutex->enter();
+	try
+	{
+		doDisplayFormat( args, format, vargs );
+	}
+	catch (Exception &)
+	{
+		// silence
+	}
+	_Mutex->leave();
+}
+
 
 // Log format : "<LogType> <ThreadNo> <FileName> <Line> <ProcessName> : <Msg>"
 void CStdDisplayer::doDisplay ( const CLog::TDisplayInfo& args, const char *message )
@@ -405,23 +422,19 @@ void CFileDisplayer::setParam (const std::string &filename, bool eraseLastLog)
 	}
 }
 
-// Log format: "2000/01/15 12:05:30 <ProcessName> <LogType> <ThreadId> <FileName> <Line> : <Msg>"
-void CFileDisplayer::doDisplay ( const CLog::TDisplayInfo& args, const char *message )
+// Log format: "2000/01/15 12:05:30 <LogType> <ThreadId> <ProcessName> <FileName> <Line> <FuncName> : <Msg>"
+std::string CFileDisplayer::lineHeader ( const CLog::TDisplayInfo& args )
 {
 	bool needSpace = false;
-	//stringstream ss;
 	string str;
 
-	// if the filename is not set, don't log
-	if (_FileName.empty()) return;
-
-	if (args.Date != 0 && !_Raw)
+	if (args.Date != 0)
 	{
 		str += dateToHumanString(args.Date);
 		needSpace = true;
 	}
 
-	if (args.LogType != CLog::LOG_NO && !_Raw)
+	if (args.LogType != CLog::LOG_NO)
 	{
 		if (needSpace) { str += " "; needSpace = false; }
 		str += logTypeToString(args.LogType);
@@ -429,7 +442,7 @@ void CFileDisplayer::doDisplay ( const CLog::TDisplayInfo& args, const char *mes
 	}
 
 	// Write thread identifier
-	if ( args.ThreadId != 0 && !_Raw)
+	if ( args.ThreadId != 0 )
 	{
 		if (needSpace) { str += " "; needSpace = false; }
 #ifdef NL_OS_WINDOWS
@@ -440,28 +453,28 @@ void CFileDisplayer::doDisplay ( const CLog::TDisplayInfo& args, const char *mes
 		needSpace = true;
 	}
 
-	if (!args.ProcessName.empty() && !_Raw)
+	if (!args.ProcessName.empty())
 	{
 		if (needSpace) { str += " "; needSpace = false; }
 		str += args.ProcessName;
 		needSpace = true;
 	}
 
-	if (args.FileName != NULL && !_Raw)
+	if (args.FileName != NULL)
 	{
 		if (needSpace) { str += " "; needSpace = false; }
 		str += CFile::getFilename(args.FileName);
 		needSpace = true;
 	}
 
-	if (args.Line != -1 && !_Raw)
+	if (args.Line != -1)
 	{
 		if (needSpace) { str += " "; needSpace = false; }
 		str += NLMISC::toString(args.Line);
 		needSpace = true;
 	}
 	
-	if (args.FuncName != NULL && !_Raw)
+	if (args.FuncName != NULL)
 	{
 		if (needSpace) { str += " "; needSpace = false; }
 		str += args.FuncName;
@@ -470,6 +483,18 @@ void CFileDisplayer::doDisplay ( const CLog::TDisplayInfo& args, const char *mes
 
 	if (needSpace) { str += " : "; needSpace = false; }
 
+	return str;
+}
+
+void CFileDisplayer::doDisplay ( const CLog::TDisplayInfo& args, const char *message )
+{
+	// if the filename is not set, don't log
+	if (_FileName.empty()) return;
+
+	string str;
+	if (!_Raw)
+		str = lineHeader(args);
+
 	str += message;
 
 	if (_FilePointer > (FILE*)1)
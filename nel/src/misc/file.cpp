@@ -68,6 +68,7 @@ CIFile::CIFile() : IStream(true)
 	_BigFileOffset = 0;
 	_IsInBigFile = false;
 	_IsInXMLPackFile = false;
+	_IsMapped = false;
 	_CacheFileOnOpen = false;
 	_IsAsyncLoading = false;
 	_AllowBNPCacheFileOnOpen= true;
@@ -83,6 +84,7 @@ CIFile::CIFile(const std::string &path, bool text) : IStream(true)
 	_BigFileOffset = 0;
 	_IsInBigFile = false;
 	_IsInXMLPackFile = false;
+	_IsMapped = false;
 	_CacheFileOnOpen = false;
 	_IsAsyncLoading = false;
 	_AllowBNPCacheFileOnOpen= true;
@@ -210,14 +212,23 @@ bool		CIFile::open(const std::string &path, bool text)
 		{
 			// bnp file
 			_IsInBigFile = true;
+			const uint8 *mappedData;
 			if(_AllowBNPCacheFileOnOpen)
 			{
-				_F = CBigFile::getInstance().getFile (path, _FileSize, _BigFileOffset, _CacheFileOnOpen, _AlwaysOpened);
+				_F = CBigFile::getInstance().getFile (path, _FileSize, _BigFileOffset, _CacheFileOnOpen, _AlwaysOpened, &mappedData);
 			}
 			else
 			{
 				bool	dummy;
-				_F = CBigFile::getInstance().getFile (path, _FileSize, _BigFileOffset, dummy, _AlwaysOpened);
+				_F = CBigFile::getInstance().getFile (path, _FileSize, _BigFileOffset, dummy, _AlwaysOpened, &mappedData);
+			}
+
+			// memory mapped bnp: read in place, no handle and no copy
+			if (mappedData != NULL)
+			{
+				_IsMapped = true;
+				_Cache = const_cast<uint8*>(mappedData);
+				return true;
 			}
 		}
 		if(_F != NULL)
@@ -305,7 +316,13 @@ void		CIFile::setAsyncLoading (bool newState)
 // ======================================================================================================
 void		CIFile::close()
 {
-	if (_CacheFileOnOpen)
+	if (_IsMapped)
+	{
+		// the data belongs to CBigFile
+		_Cache = NULL;
+		_IsMapped = false;
+	}
+	else if (_CacheFileOnOpen)
 	{
 		if (_Cache)
 		{
@@ -411,9 +428,10 @@ void		CIFile::serialBuffer(uint8 *buf, uint len) throw(EReadError)
 	// Check the read pos
 	if ((_ReadPos < 0) || ((_ReadPos+len) > _FileSize))
 		throw EReadError (_FileName);
-	if ((_CacheFileOnOpen) && (_Cache == NULL))
+	bool inMemory = _CacheFileOnOpen || _IsMapped;
+	if ((inMemory) && (_Cache == NULL))
 		throw EFileNotOpened (_FileName);
-	if ((!_CacheFileOnOpen) && (_F == NULL))
+	if ((!inMemory) && (_F == NULL))
 		throw EFileNotOpened (_FileName);
 
 	if (_IsAsyncLoading)
@@ -427,7 +445,7 @@ void		CIFile::serialBuffer(uint8 *buf, uint len) throw(EReadError)
 		}
 	}
 
-	if (_CacheFileOnOpen)
+	if (inMemory)
 	{
 		memcpy (buf, _Cache + _ReadPos, len);
 		_ReadPos += len;
@@ -458,9 +476,10 @@ void		CIFile::serialBit(bool &bit) throw(EReadError)
 // ======================================================================================================
 bool		CIFile::seek (sint32 offset, IStream::TSeekOrigin origin) const throw(EStream)
 {
-	if ((_CacheFileOnOpen) && (_Cache == NULL))
+	bool inMemory = _CacheFileOnOpen || _IsMapped;
+	if ((inMemory) && (_Cache == NULL))
 		return false;
-	if ((!_CacheFileOnOpen) && (_F == NULL))
+	if ((!inMemory) && (_F == NULL))
 		return false;
 
 	switch (origin)
@@ -478,7 +497,7 @@ bool		CIFile::seek (sint32 offset, IStream::TSeekOrigin origin) const throw(EStr
 			nlstop;
 	}
 
-	if (_CacheFileOnOpen)
+	if (inMemory)
 		return true;
 
 	// seek in the file. NB: if not in bigfile, _BigFileOffset==0.
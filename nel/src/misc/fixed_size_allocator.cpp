@@ -25,6 +25,8 @@
 #include "stdmisc.h"
 #include "nel/misc/fixed_size_allocator.h"
 
+#include <cstddef>
+
 
 namespace NLMISC
 {
@@ -84,10 +86,16 @@ void CFixedSizeAllocator::free(void *block)
 	node->link();
 }
 
+//*****************************************************************************************************************
+uint CFixedSizeAllocator::getBlockSizeWithOverhead() const
+{
+	return std::max((uint)(sizeof(CNode) - offsetof(CNode, Next)),(uint)(getNumBytesPerBlock())) + offsetof(CNode, Next);	
+}
+
 //*****************************************************************************************************************
 uint CFixedSizeAllocator::CChunk::getBlockSizeWithOverhead() const
 {
-	return std::max((uint)(sizeof(CNode) - offsetof(CNode, Next)),(uint)(Allocator->getNumBytesPerBlock())) + offsetof(CNode, Next);	
+	return Allocator->getBlockSizeWithOverhead();
 }
 
 //*****************************************************************************************************************
@@ -108,7 +116,7 @@ CFixedSizeAllocator::CChunk::~CChunk()
 	nlassert(NumFreeObjs == 0);
 	nlassert(Allocator->_NumChunks > 0);
 	-- (Allocator->_NumChunks);
-	delete Mem;
+	delete [] Mem;
 }
 
 //*****************************************************************************************************************
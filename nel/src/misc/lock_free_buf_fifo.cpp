@@ -0,0 +1,390 @@
+/** \file lock_free_buf_fifo.cpp
+ * Implementation for CLockFreeBufFIFO
+ *
+ * $Id$
+ */
+
+/* Copyright, 2001 Nevrax Ltd.
+ *
+ * This file is part of NEVRAX NEL.
+ * NEVRAX NEL is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+
+ * NEVRAX NEL is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with NEVRAX NEL; see the file COPYING. If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#include "stdmisc.h"
+#include "nel/misc/atomic.h"
+#include "nel/misc/fast_mem.h"
+#include "nel/misc/lock_free_buf_fifo.h"
+
+using namespace std;
+
+namespace NLMISC {
+
+
+/*
+ * Constructor
+ */
+CLockFreeBufFIFO::CLockFreeBufFIFO( uint32 capacity, const char *name ) :
+	_PushPos( 0 ),
+	_PopPos( 0 ),
+	_NbBytes( 0 ),
+	_Name( name ),
+	_Stalled( 0 ),
+	_NbFullWaits( 0 ),
+	_Popped( 0 ),
+	_BiggestBlock( 0 ),
+	_BiggestBatch( 0 )
+{
+	// Round the capacity up to a power of 2
+	uint32 nbSlots = 2;
+	while ( nbSlots < capacity )
+		nbSlots <<= 1;
+	_Mask = nbSlots - 1;
+
+	_Slots = new CSlot [nbSlots];
+	for ( uint32 i=0; i!=nbSlots; ++i )
+	{
+		_Slots[i].Sequence = i;
+	}
+}
+
+
+/*
+ * Destructor
+ */
+CLockFreeBufFIFO::~CLockFreeBufFIFO()
+{
+	clear();
+	delete [] _Slots;
+}
+
+
+/*
+ * Reserves a slot for a producer
+ */
+CLockFreeBufFIFO::CSlot *CLockFreeBufFIFO::reserveSlot( uint32 &pos, bool wait )
+{
+	for (;;)
+	{
+		pos = _PushPos;
+		CSlot *slot = &_Slots[pos & _Mask];
+		sint32 diff = (sint32)(slot->Sequence - pos);
+		if ( diff == 0 )
+		{
+			// The slot is free: try to take it before another producer
+			if ( atomicCompareAndSwap( &_PushPos, pos, pos+1 ) )
+				return slot;
+		}
+		else if ( diff < 0 )
+		{
+			// The ring is full: wait for the consumer
+			if ( ! wait )
+				return NULL;
+			atomicFetchAdd( &_NbFullWaits, 1 );
+			if ( _Name && atomicCompareAndSwap( &_Stalled, 0, 1 ) )
+			{
+				nlwarning( "LFBF: %s is full (%u blocks), the producers wait for the consumer", _Name, capacity() );
+			}
+			yieldThread();
+		}
+		// else another producer has just taken the slot, retry with the next position
+	}
+}
+
+
+/*
+ * Publishes a reserved slot filled by a producer
+ */
+void CLockFreeBufFIFO::publishSlot( CSlot *slot, uint32 pos )
+{
+	atomicFetchAdd( &_NbBytes, slot->Block.size() );
+	memoryBarrier();
+	slot->Sequence = pos + 1;
+}
+
+
+/*
+ * Push a copy of 'buffer' in the head of the FIFO (any thread)
+ */
+void CLockFreeBufFIFO::push( const uint8 *buffer, uint32 size )
+{
+	// Copy the block outside of the ring, so that the slot is reserved for the shortest time
+	TBlock block;
+	block.resize( size );
+	if ( size != 0 )
+		CFastMem::memcpy( block.getPtr(), buffer, size );
+	pushNoCopy( block );
+}
+
+
+/*
+ * Push a copy of 'buffer' if the FIFO is not full (any thread)
+ */
+bool CLockFreeBufFIFO::tryPush( const uint8 *buffer, uint32 size )
+{
+	TBlock block;
+	block.resize( size );
+	if ( size != 0 )
+		CFastMem::memcpy( block.getPtr(), buffer, size );
+
+	uint32 pos;
+	CSlot *slot = reserveSlot( pos, false );
+	if ( slot == NULL )
+		return false;
+	slot->Block.swap( block );
+	publishSlot( slot, pos );
+	return true;
+}
+
+
+/*
+ * Push 'block' in the head of the FIFO without copying it (any thread)
+ */
+void CLockFreeBufFIFO::pushNoCopy( TBlock &block )
+{
+	uint32 pos;
+	CSlot *slot = reserveSlot( pos );
+
+	// The block of a free slot is always empty
+	slot->Block.swap( block );
+	publishSlot( slot, pos );
+}
+
+
+/*
+ * Push 'block' without copying it if the FIFO is not full (any thread)
+ */
+bool CLockFreeBufFIFO::tryPushNoCopy( TBlock &block )
+{
+	uint32 pos;
+	CSlot *slot = reserveSlot( pos, false );
+	if ( slot == NULL )
+		return false;
+	slot->Block.swap( block );
+	publishSlot( slot, pos );
+	return true;
+}
+
+
+/*
+ * Returns the slot at offset from the tail if it is filled, otherwise NULL
+ */
+CLockFreeBufFIFO::CSlot *CLockFreeBufFIFO::tailSlot( uint32 offset ) const
+{
+	uint32 pos = _PopPos + offset;
+	CSlot *slot = &_Slots[pos & _Mask];
+	if ( slot->Sequence != pos + 1 )
+		return NULL;
+	memoryBarrier(); // read the contents of the slot after its sequence
+	return slot;
+}
+
+
+/*
+ * Frees the tail slot for the producers
+ */
+void CLockFreeBufFIFO::releaseTailSlot( CSlot *slot )
+{
+	// Give the slot back to the producers, one round later
+	memoryBarrier();
+	slot->Sequence = _PopPos + _Mask + 1;
+	++_PopPos;
+	++_Popped;
+
+	// The stall is over when half of the ring is free, so that a queue near full warns only once
+	if ( _Stalled && nbBlocks() <= (_Mask + 1) / 2 )
+		_Stalled = 0;
+}
+
+
+/*
+ * Return true if the FIFO is empty
+ */
+bool CLockFreeBufFIFO::empty() const
+{
+	return tailSlot() == NULL;
+}
+
+
+/*
+ * Get the buffer in the tail of the FIFO
+ */
+void CLockFreeBufFIFO::front( uint8 *&buffer, uint32 &size )
+{
+	CSlot *slot = tailSlot();
+	if ( slot == NULL )
+	{
+		nlwarning( "LFBF: Try to get the front of an empty fifo!" );
+		buffer = NULL;
+		size = 0;
+		return;
+	}
+	buffer = slot->Block.getPtr();
+	size = slot->Block.size();
+}
+
+
+void CLockFreeBufFIFO::front( std::vector<uint8> &buffer )
+{
+	uint8 *block;
+	uint32 s;
+	front( block, s );
+	buffer.resize( s );
+	if ( s != 0 )
+		CFastMem::memcpy( &buffer[0], block, s );
+}
+
+
+void CLockFreeBufFIFO::front( NLMISC::CMemStream &buffer )
+{
+	uint8 *block;
+	uint32 s;
+	buffer.clear();
+	front( block, s );
+	buffer.fill( block, s );
+}
+
+
+/*
+ * Returns the last byte of the front message
+ */
+uint8 CLockFreeBufFIFO::frontLast()
+{
+	CSlot *slot = tailSlot();
+	if ( (slot == NULL) || slot->Block.empty() )
+	{
+		nlwarning( "LFBF: Try to get the front of an empty fifo!" );
+		return 0;
+	}
+	return slot->Block[slot->Block.size()-1];
+}
+
+
+/*
+ * Pop the buffer in the tail of the FIFO
+ */
+void CLockFreeBufFIFO::pop()
+{
+	CSlot *slot = tailSlot();
+	if ( slot == NULL )
+	{
+		nlwarning( "LFBF: Try to pop an empty fifo!" );
+		return;
+	}
+
+	if ( slot->Block.size() > _BiggestBlock )
+		_BiggestBlock = slot->Block.size();
+	atomicFetchSub( &_NbBytes, slot->Block.size() );
+	slot->Block.clear();
+	releaseTailSlot( slot );
+}
+
+
+/*
+ * Pop the buffer in the tail of the FIFO into 'block', without copying it
+ */
+void CLockFreeBufFIFO::pop( TBlock &block )
+{
+	CSlot *slot = tailSlot();
+	if ( slot == NULL )
+	{
+		nlwarning( "LFBF: Try to pop an empty fifo!" );
+		block.clear();
+		return;
+	}
+
+	if ( slot->Block.size() > _BiggestBlock )
+		_BiggestBlock = slot->Block.size();
+	atomicFetchSub( &_NbBytes, slot->Block.size() );
+	block.clear();
+	block.swap( slot->Block );
+	releaseTailSlot( slot );
+}
+
+
+/*
+ * Get up to maxNb buffers from the tail of the FIFO in one call
+ */
+uint CLockFreeBufFIFO::frontBatch( uint8 **buffers, uint32 *sizes, uint maxNb )
+{
+	uint nb;
+	for ( nb=0; nb!=maxNb; ++nb )
+	{
+		CSlot *slot = tailSlot( nb );
+		if ( slot == NULL )
+			break;
+		buffers[nb] = slot->Block.getPtr();
+		sizes[nb] = slot->Block.size();
+	}
+	if ( nb > _BiggestBatch )
+		_BiggestBatch = nb;
+	return nb;
+}
+
+
+/*
+ * Pop nb buffers from the tail of the FIFO
+ */
+void CLockFreeBufFIFO::popBatch( uint nb )
+{
+	for ( uint i=0; i!=nb; ++i )
+	{
+		pop();
+	}
+}
+
+
+/*
+ * Erase the FIFO
+ */
+void CLockFreeBufFIFO::clear()
+{
+	while ( ! empty() )
+	{
+		pop();
+	}
+}
+
+
+/*
+ * display the FIFO to stdout
+ */
+void CLockFreeBufFIFO::display()
+{
+	printf( "%p (%u slots, %u blocks, %u B) push %u pop %u\n", this, capacity(), nbBlocks(), size(), _PushPos, _PopPos );
+	for ( uint32 i=0; ; ++i )
+	{
+		CSlot *slot = tailSlot( i );
+		if ( slot == NULL )
+			break;
+		printf( "  [%u] %u B, last byte %hu\n", i, slot->Block.size(), (uint16)(slot->Block.empty() ? 0 : slot->Block[slot->Block.size()-1]) );
+	}
+}
+
+
+/*
+ * display the FIFO statistics
+ */
+void CLockFreeBufFIFO::displayStats( CLog *log )
+{
+	log->displayNL( "%p CurrentQueueSize: %u, InQueue: %u, Capacity: %u blocks", this, size(), nbBlocks(), capacity() );
+	log->displayNL( "%p Popped: %u, BiggestBlock: %u, BiggestBatch: %u", this, _Popped, _BiggestBlock, _BiggestBatch );
+	log->displayNL( "%p FullWaits: %u", this, _NbFullWaits );
+}
+
+
+} // NLMISC
+
+/* End of lock_free_buf_fifo.cpp */
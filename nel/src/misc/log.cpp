@@ -40,6 +40,11 @@
 #include "nel/misc/log.h"
 #include "nel/misc/debug.h"
 #include "nel/misc/path.h"
+#include "nel/misc/atomic.h"
+#include "nel/misc/tds.h"
+#include "nel/misc/thread.h"
+#include "nel/misc/time_nl.h"
+#include "nel/misc/lock_free_buf_fifo.h"
 
 using namespace std;
 
@@ -49,8 +54,295 @@ namespace NLMISC
 
 string *CLog::_ProcessName = NULL;
 
-CLog::CLog( TLogType logType) : _LogType (logType), _FileName(NULL), _Line(-1), _FuncName(NULL), _Mutex("LOG"+toString((uint)logType)), _PosSet(false)
+
+/*
+ * Header of a line in the queue of the async logs (followed by the string and its '\0')
+ */
+struct CAsyncLogLine
+{
+	CLog		*Log;
+	time_t		Date;
+	const char	*FileName;
+	const char	*FuncName;
+	sint32		Line;
+	uint32		ThreadId;
+	bool		Raw;
+};
+
+/*
+ * What a thread gives to an async log between setPosition() and display...()
+ */
+struct CAsyncLogPosition
+{
+	CAsyncLogPosition () : FileName(NULL), Line(-1), FuncName(NULL) {}
+
+	const char		*FileName;
+	sint			Line;
+	const char		*FuncName;
+
+	// Beginning of a line without new line yet, and its header
+	std::string		Partial;
+	CAsyncLogLine	PartialHeader;
+};
+
+
+/*
+ * The thread that sends the lines queued by the async logs to their displayers.
+ * It is created by the first CLog::setAsync(true) and stopped at exit. The producers
+ * share one CLockFreeBufFIFO, the thread locks the mutex of a log once by batch of its lines.
+ */
+class CAsyncLog : public IRunnable
+{
+public:
+
+	static CAsyncLog * volatile	Instance;
+	static uint32				QueueCapacity;
+	static bool					DropWhenFull;
+
+	/// Get the instance, created and started if needed
+	static CAsyncLog *getInstance ()
+	{
+		if (Instance == NULL)
+		{
+			CAsyncLog *asyncLog = new CAsyncLog;
+			if (atomicCompareAndSwapPtr ((void * volatile *)&Instance, NULL, asyncLog))
+			{
+				asyncLog->_Thread = IThread::create (asyncLog);
+				asyncLog->_Thread->start ();
+				atexit (stopAtExit);
+			}
+			else
+			{
+				delete asyncLog;
+			}
+		}
+		return Instance;
+	}
+
+	CAsyncLog () : _Queue(QueueCapacity), _Thread(NULL), _ThreadId(0), _Stop(false), _NbPushed(0), _NbDisplayed(0), NbDropped(0) {}
+
+	/// Position of the calling thread for a log type (the block is allocated at its first log, it's never freed)
+	CAsyncLogPosition &getPosition (CLog::TLogType logType)
+	{
+		CAsyncLogPosition *positions = (CAsyncLogPosition*)_Positions.getPointer ();
+		if (positions == NULL)
+		{
+			positions = new CAsyncLogPosition [CLog::LOG_UNKNOWN + 1];
+			_Positions.setPointer (positions);
+		}
+		return positions[logType];
+	}
+
+	/// Returns true if the calling thread must display its lines itself
+	bool mustDisplayNow () const
+	{
+		return _Stop || getThreadId () == _ThreadId;
+	}
+
+	/// Queue a line (any thread)
+	void push (const CAsyncLogLine &header, const char *str)
+	{
+		uint32 len = (uint32)strlen (str) + 1;
+		uint32 size = sizeof (CAsyncLogLine) + len;
+
+		// the lines of display...() fit in the stack
+		uint8 stackBuffer [sizeof (CAsyncLogLine) + 256];
+		std::vector<uint8> heapBuffer;
+		uint8 *buffer = stackBuffer;
+		if (size > sizeof (stackBuffer))
+		{
+			heapBuffer.resize (size);
+			buffer = &heapBuffer[0];
+		}
+		memcpy (buffer, &header, sizeof (CAsyncLogLine));
+		memcpy (buffer + sizeof (CAsyncLogLine), str, len);
+
+		if (DropWhenFull)
+		{
+			if (!_Queue.tryPush (buffer, size))
+			{
+				atomicFetchAdd (&NbDropped, 1);
+				return;
+			}
+		}
+		else
+		{
+			_Queue.push (buffer, size);
+		}
+		atomicFetchAdd (&_NbPushed, 1);
+	}
+
+	/// Wait until the lines queued before the call are displayed
+	void flush ()
+	{
+		if (mustDisplayNow ())
+			return;
+
+		uint32 target = _NbPushed;
+		while ((sint32)(_NbDisplayed - target) < 0 && !_Stop)
+			nlSleep (1);
+	}
+
+	/// Stop the thread, then display the remaining lines
+	void stop ()
+	{
+		if (_Stop)
+			return;
+
+		_Stop = true;
+		_Thread->wait ();
+		while (displayBatch () != 0)
+			;
+	}
+
+	virtual void run ()
+	{
+		_ThreadId = getThreadId ();
+
+		uint32 nbReportedDropped = 0;
+		TTime lastReport = 0;
+		while (!_Stop)
+		{
+			if (displayBatch () == 0)
+				nlSleep (5);
+
+			uint32 nbDropped = NbDropped;
+			if (nbDropped != nbReportedDropped && CTime::getLocalTime () - lastReport >= 1000)
+			{
+				nlwarning ("LOG: %u lines dropped, the async log queue is full", nbDropped - nbReportedDropped);
+				nbReportedDropped = nbDropped;
+				lastReport = CTime::getLocalTime ();
+			}
+		}
+	}
+
+	virtual void getName (std::string &result) const
+	{
+		result = "CAsyncLog";
+	}
+
+	volatile uint32		NbDropped;
+
+private:
+
+	enum { BatchSize = 64 };
+
+	static void stopAtExit ()
+	{
+		Instance->stop ();
+	}
+
+	/// Display a batch of lines, returns the number of lines
+	uint displayBatch ()
+	{
+		uint8 *blocks [BatchSize];
+		uint32 sizes [BatchSize];
+		uint nb = _Queue.frontBatch (blocks, sizes, BatchSize);
+		if (nb == 0)
+			return 0;
+
+		CLog::setDefaultProcessName ();
+
+		CLog *log = NULL;
+		for (uint i = 0; i < nb; ++i)
+		{
+			CAsyncLogLine header;
+			memcpy (&header, blocks[i], sizeof (CAsyncLogLine));
+
+			// the consecutive lines of a log are displayed under one lock
+			if (header.Log != log)
+			{
+				if (log != NULL)
+					log->_Mutex.leave ();
+				log = header.Log;
+				log->_Mutex.enter ();
+			}
+
+			CLog::TDisplayInfo args;
+			if (!header.Raw)
+			{
+				args.Date = header.Date;
+				args.LogType = log->_LogType;
+				args.ProcessName = *CLog::_ProcessName;
+				args.ThreadId = header.ThreadId;
+				args.FileName = header.FileName;
+				args.Line = header.Line;
+				args.FuncName = header.FuncName;
+			}
+			log->displayAsyncLine (args, (const char *)blocks[i] + sizeof (CAsyncLogLine));
+		}
+		if (log != NULL)
+			log->_Mutex.leave ();
+
+		_Queue.popBatch (nb);
+		atomicFetchAdd (&_NbDisplayed, nb);
+		return nb;
+	}
+
+	CLockFreeBufFIFO	_Queue;
+	CTDS				_Positions;
+	IThread				*_Thread;
+	volatile uint		_ThreadId;
+	volatile bool		_Stop;
+	volatile uint32		_NbPushed;
+	volatile uint32		_NbDisplayed;
+};
+
+CAsyncLog * volatile	CAsyncLog::Instance = NULL;
+uint32					CAsyncLog::QueueCapacity = 16384;
+bool					CAsyncLog::DropWhenFull = false;
+
+
+CLog::CLog( TLogType logType) : _LogType (logType), _FileName(NULL), _Line(-1), _FuncName(NULL), _NbFormatDisplayers(0), _Mutex("LOG"+toString((uint)logType)), _PosSet(false), _Async(false)
+{
+}
+
+CLog::~CLog()
+{
+	if (_Async)
+		setAsync (false);
+}
+
+void CLog::setAsync (bool async)
+{
+	if (async == _Async)
+		return;
+
+	if (async)
+	{
+		CAsyncLog::getInstance ();
+		_Mutex.enter ();
+		_Async = true;
+		_Mutex.leave ();
+	}
+	else
+	{
+		// the new lines are displayed at once, the queued ones before returning
+		_Mutex.enter ();
+		_Async = false;
+		_Mutex.leave ();
+		flushAsync ();
+	}
+}
+
+void CLog::setAsyncQueue (uint32 capacity, bool dropWhenFull)
 {
+	if (CAsyncLog::Instance != NULL && capacity != CAsyncLog::QueueCapacity)
+		nlwarning ("LOG: The async log queue is already created with %u lines", CAsyncLog::QueueCapacity);
+	else
+		CAsyncLog::QueueCapacity = capacity;
+	CAsyncLog::DropWhenFull = dropWhenFull;
+}
+
+void CLog::flushAsync ()
+{
+	if (CAsyncLog::Instance != NULL)
+		CAsyncLog::Instance->flush ();
+}
+
+uint32 CLog::getNbAsyncDropped ()
+{
+	return (CAsyncLog::Instance != NULL) ? CAsyncLog::Instance->NbDropped : 0;
 }
 
 void CLog::setDefaultProcessName ()
@@ -89,6 +381,16 @@ void CLog::setPosition (sint line, const char *fileName, const char *funcName)
 {
 	if ( !noDisplayer() )
 	{
+		if (_Async)
+		{
+			// no lock, the position is kept by thread until display...()
+			CAsyncLogPosition &pos = CAsyncLog::Instance->getPosition (_LogType);
+			pos.FileName = fileName;
+			pos.Line = line;
+			pos.FuncName = funcName;
+			return;
+		}
+
 		_Mutex.enter();
 		_PosSet++;
 		_FileName = fileName;
@@ -122,12 +424,19 @@ void CLog::addDisplayer (IDisplayer *displayer, bool bypassFilter)
 		return;
 	}
 
+	// the async log thread uses the displayers with the mutex
+	bool locked = _Async;
+	if (locked)
+		_Mutex.enter ();
+
 	if (bypassFilter)
 	{
 		CDisplayers::iterator idi = std::find (_BypassFilterDisplayers.begin (), _BypassFilterDisplayers.end (), displayer);
 		if (idi == _BypassFilterDisplayers.end ())
 		{
 			_BypassFilterDisplayers.push_back (displayer);
+			if (displayer->canDisplayFormat ())
+				_NbFormatDisplayers++;
 		}
 		else
 		{
@@ -140,12 +449,17 @@ void CLog::addDisplayer (IDisplayer *displayer, bool bypassFilter)
 		if (idi == _Displayers.end ())
 		{
 			_Displayers.push_back (displayer);
+			if (displayer->canDisplayFormat ())
+				_NbFormatDisplayers++;
 		}
 		else
 		{
 			nlwarning ("LOG: Couldn't add the displayer, it was already added");
 		}
 	}
+
+	if (locked)
+		_Mutex.leave ();
 }
 
 void CLog::removeDisplayer (IDisplayer *displayer)
@@ -156,18 +470,32 @@ void CLog::removeDisplayer (IDisplayer *displayer)
 		return;
 	}
 
+	// the queued lines are displayed before, and the displayer is not used after
+	bool locked = _Async;
+	if (locked)
+	{
+		flushAsync ();
+		_Mutex.enter ();
+	}
+
 	CDisplayers::iterator idi = std::find (_Displayers.begin (), _Displayers.end (), displayer);
 	if (idi != _Displayers.end ())
 	{
 		_Displayers.erase (idi);
+		if (displayer->canDisplayFormat ())
+			_NbFormatDisplayers--;
 	}
 
 	idi = std::find (_BypassFilterDisplayers.begin (), _BypassFilterDisplayers.end (), displayer);
 	if (idi != _BypassFilterDisplayers.end ())
 	{
 		_BypassFilterDisplayers.erase (idi);
+		if (displayer->canDisplayFormat ())
+			_NbFormatDisplayers--;
 	}
 
+	if (locked)
+		_Mutex.leave ();
 }
 
 void CLog::removeDisplayer (const char *displayerName)
@@ -178,11 +506,20 @@ void CLog::removeDisplayer (const char *displayerName)
 		return;
 	}
 
+	bool locked = _Async;
+	if (locked)
+	{
+		flushAsync ();
+		_Mutex.enter ();
+	}
+
 	CDisplayers::iterator idi;
 	for (idi = _Displayers.begin (); idi != _Displayers.end ();)
 	{
 		if ((*idi)->DisplayerName == displayerName)
 		{
+			if ((*idi)->canDisplayFormat ())
+				_NbFormatDisplayers--;
 			idi = _Displayers.erase (idi);
 		}
 		else
@@ -195,6 +532,8 @@ void CLog::removeDisplayer (const char *displayerName)
 	{
 		if ((*idi)->DisplayerName == displayerName)
 		{
+			if ((*idi)->canDisplayFormat ())
+				_NbFormatDisplayers--;
 			idi = _BypassFilterDisplayers.erase (idi);
 		}
 		else
@@ -202,6 +541,9 @@ void CLog::removeDisplayer (const char *displayerName)
 			idi++;
 		}
 	}
+
+	if (locked)
+		_Mutex.leave ();
 }
 
 IDisplayer *CLog::getDisplayer (const char *displayerName)
@@ -317,6 +659,167 @@ void CLog::displayString (const char *str)
 }
 
 
+bool CLog::displayAsync (const char *str, bool raw)
+{
+	if (!_Async)
+		return false;
+
+	CAsyncLog *asyncLog = CAsyncLog::Instance;
+	CAsyncLogPosition &pos = asyncLog->getPosition (_LogType);
+
+	CAsyncLogLine header;
+	header.Log = this;
+	time (&header.Date);
+	header.FileName = pos.FileName;
+	header.FuncName = pos.FuncName;
+	header.Line = pos.Line;
+	header.ThreadId = getThreadId ();
+	header.Raw = raw;
+	pos.FileName = NULL;
+	pos.Line = -1;
+	pos.FuncName = NULL;
+
+	string line;
+	if (!pos.Partial.empty ())
+	{
+		if (pos.PartialHeader.Log == this && pos.PartialHeader.Raw == raw)
+		{
+			// the line keeps the date and position of its beginning
+			header = pos.PartialHeader;
+			line.swap (pos.Partial);
+			line += str;
+			str = line.c_str ();
+		}
+		else
+		{
+			asyncLog->push (pos.PartialHeader, pos.Partial.c_str ());
+			pos.Partial.clear ();
+		}
+	}
+
+	// errors and asserts (they need the callstack and can stop the program) and the logs of the async
+	// thread itself are displayed now, after the queued lines
+	if (_LogType == LOG_ERROR || _LogType == LOG_ASSERT || asyncLog->mustDisplayNow ())
+	{
+		flushAsync ();
+		_Mutex.enter ();
+		_PosSet++;
+		_FileName = header.FileName;
+		_Line = header.Line;
+		_FuncName = header.FuncName;
+		if (raw)
+			displayRawString (str);
+		else
+			displayString (str);
+		return true;
+	}
+
+	if (strchr (str, '\n') == NULL)
+	{
+		pos.PartialHeader = header;
+		pos.Partial = str;
+		return true;
+	}
+
+	asyncLog->push (header, str);
+	return true;
+}
+
+
+void CLog::displayAsyncLine (TDisplayInfo &args, const char *str)
+{
+	// send to all bypass filter displayers
+	for (CDisplayers::iterator idi=_BypassFilterDisplayers.begin(); idi!=_BypassFilterDisplayers.end(); idi++ )
+	{
+		(*idi)->display( args, str );
+	}
+
+	if (passFilter (str))
+	{
+		// Send to the attached displayers
+		for (CDisplayers::iterator idi=_Displayers.begin(); idi!=_Displayers.end(); idi++ )
+		{
+			(*idi)->display( args, str );
+		}
+	}
+}
+
+
+#ifndef va_copy
+#	ifdef __va_copy
+#		define va_copy(dest, src) __va_copy(dest, src)
+#	else
+#		define va_copy(dest, src) ((dest) = (src))
+#	endif
+#endif
+
+// Send a line to a displayer, before its formatting if it can
+static void displayFormatOrString (IDisplayer *displayer, const CLog::TDisplayInfo &args, const char *format, va_list vargs, const char *str)
+{
+	if (displayer->canDisplayFormat ())
+	{
+		va_list copy;
+		va_copy (copy, vargs);
+		displayer->displayFormat (args, format, copy);
+		va_end (copy);
+	}
+	else
+	{
+		displayer->display (args, str);
+	}
+}
+
+void CLog::displayFormatNL (const char *format, va_list vargs)
+{
+	setDefaultProcessName ();
+
+	TDisplayInfo args;
+	time (&args.Date);
+	args.LogType = _LogType;
+	args.ProcessName = *_ProcessName;
+	args.ThreadId = getThreadId();
+	args.FileName = _FileName;
+	args.Line = _Line;
+	args.FuncName = _FuncName;
+
+	// format the line only if a displayer or a filter needs it
+	char str [256/*NLMISC::MaxCStringSize*/];
+	str[0] = '\0';
+	bool needString = !_PositiveFilter.empty () || !_NegativeFilter.empty () ||
+		_NbFormatDisplayers != _Displayers.size () + _BypassFilterDisplayers.size ();
+	if (needString)
+	{
+		va_list copy;
+		va_copy (copy, vargs);
+		int res = vsnprintf (str, 256-1, format, copy);
+		va_end (copy);
+		if (res == -1 || res >= 256-1)
+			str[256-1] = '\0';
+
+		if (strlen(str)<256/*NLMISC::MaxCStringSize*/-1)
+			strcat (str, "\n");
+		else
+			str[256/*NLMISC::MaxCStringSize*/-2] = '\n';
+	}
+
+	// send to all bypass filter displayers
+	for (CDisplayers::iterator idi=_BypassFilterDisplayers.begin(); idi!=_BypassFilterDisplayers.end(); idi++ )
+	{
+		displayFormatOrString (*idi, args, format, vargs, str);
+	}
+
+	if (!needString || passFilter (str))
+	{
+		// Send to the attached displayers
+		for (CDisplayers::iterator idi=_Displayers.begin(); idi!=_Displayers.end(); idi++ )
+		{
+			displayFormatOrString (*idi, args, format, vargs, str);
+		}
+	}
+	unsetPosition();
+}
+
+
 /*
  * Display the string with decoration and final new line to all attached displayers
  */
@@ -334,6 +837,16 @@ void CLog::displayNL (const char *format, ...)
 		return;
 	}
 
+	// the displayers that take the format get the arguments (the errors need their callstack, the async logs a string)
+	if ( _NbFormatDisplayers != 0 && !_Async && _LogType != LOG_ERROR && _LogType != LOG_ASSERT && TempString.empty() )
+	{
+		va_list args;
+		va_start (args, format);
+		displayFormatNL (format, args);
+		va_end (args);
+		return;
+	}
+
 	char *str;
 	NLMISC_CONVERT_VARGS (str, format, 256/*NLMISC::MaxCStringSize*/);
 
@@ -342,7 +855,8 @@ void CLog::displayNL (const char *format, ...)
 	else
 		str[256/*NLMISC::MaxCStringSize*/-2] = '\n';
 
-	displayString (str);
+	if (!displayAsync (str, false))
+		displayString (str);
 }
 #ifdef NL_OS_WINDOWS
 #pragma managed(pop)
@@ -368,7 +882,8 @@ void CLog::display (const char *format, ...)
 	char *str;
 	NLMISC_CONVERT_VARGS (str, format, 256/*NLMISC::MaxCStringSize*/);
 
-	displayString (str);
+	if (!displayAsync (str, false))
+		displayString (str);
 }
 #ifdef NL_OS_WINDOWS
 #pragma managed(pop)
@@ -473,7 +988,8 @@ void CLog::displayRawNL( const char *format, ... )
 	else
 		str[256/*NLMISC::MaxCStringSize*/-2] = '\n';
 
-	displayRawString(str);
+	if (!displayAsync (str, true))
+		displayRawString(str);
 }
 #ifdef NL_OS_WINDOWS
 #pragma managed(pop)
@@ -499,7 +1015,8 @@ void CLog::displayRaw( const char *format, ... )
 	char *str;
 	NLMISC_CONVERT_VARGS (str, format, 256/*NLMISC::MaxCStringSize*/);
 
-	displayRawString(str);
+	if (!displayAsync (str, true))
+		displayRawString(str);
 }
 #ifdef NL_OS_WINDOWS
 #pragma managed(pop)
@@ -587,6 +1104,8 @@ bool CLog::passFilter( const char *filter )
  */
 void CLog::removeFilter( const char *filterstr )
 {
+	// the filters are used by the async log thread with the mutex
+	_Mutex.enter();
 	if (filterstr == NULL)
 	{
 		_PositiveFilter.clear();
@@ -599,6 +1118,7 @@ void CLog::removeFilter( const char *filterstr )
 		_NegativeFilter.remove( filterstr );
 		//displayNL ("CLog::removeFilter('%s')", filterstr);
 	}
+	_Mutex.leave();
 }
 
 void CLog::displayFilter( CLog &log )
@@ -619,20 +1139,26 @@ void CLog::displayFilter( CLog &log )
 void CLog::addPositiveFilter( const char *filterstr )
 {
 	//displayNL ("CLog::addPositiveFilter('%s')", filterstr);
+	_Mutex.enter();
 	_PositiveFilter.push_back( filterstr );
+	_Mutex.leave();
 }
 
 void CLog::addNegativeFilter( const char *filterstr )
 {
 	//displayNL ("CLog::addNegativeFilter('%s')", filterstr);
+	_Mutex.enter();
 	_NegativeFilter.push_back( filterstr );
+	_Mutex.leave();
 }
 
 void CLog::resetFilters()
 {
 	//displayNL ("CLog::resetFilter()");
+	_Mutex.enter();
 	_PositiveFilter.clear();
 	_NegativeFilter.clear();
+	_Mutex.leave();
 }
 
 } // NLMISC
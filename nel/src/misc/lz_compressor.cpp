@@ -0,0 +1,279 @@
+/** \file lz_compressor.cpp
+ * Implementation for CLZCompressor and CLZDecompressor
+ *
+ * $Id$
+ */
+
+/* Copyright, 2001 Nevrax Ltd.
+ *
+ * This file is part of NEVRAX NEL.
+ * NEVRAX NEL is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+
+ * NEVRAX NEL is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with NEVRAX NEL; see the file COPYING. If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#include "stdmisc.h"
+#include "nel/misc/fast_mem.h"
+#include "nel/misc/lz_compressor.h"
+
+using namespace std;
+
+namespace NLMISC {
+
+
+// Shortest match
+static const uint32 MinMatch = 4;
+
+// Longest distance of a match
+static const uint32 MaxOffset = CLZCompressor::WindowSize - 1;
+
+// Size of the hash table of the 4-byte sequences is 1 << HashBits
+static const uint32 HashBits = 14;
+
+// The history is shrunk to WindowSize bytes only when it would exceed this size, to move it rarely
+static const uint32 MaxHistorySize = 4 * CLZCompressor::WindowSize;
+
+// When no match is found, the step increases every (1 << SkipStrength) bytes (fast on incompressible data)
+static const uint32 SkipStrength = 6;
+
+
+/*
+ * Drop the oldest bytes of the history if appending size bytes would make it too big.
+ * Returns the number of bytes dropped.
+ */
+static uint32 shrinkHistory( std::vector<uint8> &history, uint32 size )
+{
+	if ( (history.size() <= CLZCompressor::WindowSize) || (history.size() + size <= MaxHistorySize) )
+		return 0;
+
+	uint32 dropped = (uint32)history.size() - CLZCompressor::WindowSize;
+	history.erase( history.begin(), history.begin() + dropped );
+	return dropped;
+}
+
+
+static inline uint32 read32( const uint8 *p )
+{
+	uint32 v;
+	memcpy( &v, p, sizeof(v) );
+	return v;
+}
+
+
+static inline uint32 hash32( uint32 sequence )
+{
+	return (sequence * 2654435761U) >> (32 - HashBits);
+}
+
+
+// Write a literal or match length beyond 15 (see the token)
+static inline void writeLength( uint8 *&op, uint32 length )
+{
+	while ( length >= 255 )
+	{
+		*op++ = 255;
+		length -= 255;
+	}
+	*op++ = (uint8)length;
+}
+
+
+// Read a literal or match length beyond 15. Returns false if the source is too short.
+static inline bool readLength( const uint8 *&ip, const uint8 *iend, uint32 &length )
+{
+	uint8 b;
+	do
+	{
+		if ( ip == iend )
+			return false;
+		b = *ip++;
+		length += b;
+	}
+	while ( b == 255 );
+	return true;
+}
+
+
+// Write the literals from anchor to ip, then the match if matchLength != 0
+static inline void writeSequence( uint8 *&op, const uint8 *anchor, uint32 nbLiterals, uint32 offset, uint32 matchLength )
+{
+	uint8 *token = op++;
+	*token = (uint8)(std::min( nbLiterals, (uint32)15 ) << 4);
+	if ( nbLiterals >= 15 )
+		writeLength( op, nbLiterals - 15 );
+	CFastMem::memcpy( op, anchor, nbLiterals );
+	op += nbLiterals;
+
+	if ( matchLength != 0 )
+	{
+		*op++ = (uint8)(offset & 0xff);
+		*op++ = (uint8)(offset >> 8);
+		matchLength -= MinMatch;
+		*token |= (uint8)std::min( matchLength, (uint32)15 );
+		if ( matchLength >= 15 )
+			writeLength( op, matchLength - 15 );
+	}
+}
+
+
+/*
+ * Constructor
+ */
+CLZCompressor::CLZCompressor() : _Base( 0 )
+{
+	reset();
+}
+
+
+/*
+ * Forget the previous messages
+ */
+void CLZCompressor::reset()
+{
+	_History.clear();
+	_Base = 0;
+	_HashTable.assign( 1 << HashBits, 0 );
+}
+
+
+/*
+ * Compress a message
+ */
+uint32 CLZCompressor::compress( const uint8 *src, uint32 size, uint8 *dest )
+{
+	// Append the message to the history, so that the matches can be found in the previous messages
+	_Base += shrinkHistory( _History, size );
+	uint32 start = (uint32)_History.size();
+	_History.insert( _History.end(), src, src + size );
+
+	const uint8 *base = _History.empty() ? NULL : &_History[0];
+	const uint8 *ip = base + start;
+	const uint8 *anchor = ip;
+	const uint8 *iend = ip + size;
+	const uint8 *matchLimit = (size >= MinMatch) ? iend - MinMatch : ip;
+	uint8 *op = dest;
+	uint32 misses = 0;
+
+	while ( ip < matchLimit )
+	{
+		uint32 sequence = read32( ip );
+		uint32 &entry = _HashTable[hash32( sequence )];
+		uint32 pos = _Base + (uint32)(ip - base);
+		uint32 candidate = entry;
+		entry = pos;
+
+		// The candidate must still be in the history, before ip, and within the offset range
+		uint32 candidateIndex = candidate - _Base;
+		if ( (candidateIndex < (uint32)(ip - base)) && (pos - candidate <= MaxOffset) && (read32( base + candidateIndex ) == sequence) )
+		{
+			const uint8 *match = base + candidateIndex + MinMatch;
+			const uint8 *mp = ip + MinMatch;
+			while ( (mp < iend) && (*mp == *match) )
+			{
+				++mp;
+				++match;
+			}
+
+			writeSequence( op, anchor, (uint32)(ip - anchor), pos - candidate, (uint32)(mp - ip) );
+			ip = mp;
+			anchor = ip;
+			misses = 0;
+		}
+		else
+		{
+			++misses;
+			ip += 1 + (misses >> SkipStrength);
+		}
+	}
+
+	// The last literals
+	writeSequence( op, anchor, (uint32)(iend - anchor), 0, 0 );
+	return (uint32)(op - dest);
+}
+
+
+/*
+ * Decompress a message
+ */
+bool CLZDecompressor::decompress( const uint8 *src, uint32 srcSize, uint8 *dest, uint32 size )
+{
+	// The message is decompressed at the end of the history, so that the matches can refer to the previous messages
+	shrinkHistory( _History, size );
+	uint32 start = (uint32)_History.size();
+	_History.resize( start + size );
+
+	uint8 *base = _History.empty() ? NULL : &_History[0];
+	uint8 *op = base + start;
+	uint8 *oend = op + size;
+	const uint8 *ip = src;
+	const uint8 *iend = src + srcSize;
+
+	for (;;)
+	{
+		if ( ip == iend )
+			return false;
+		uint8 token = *ip++;
+
+		// Literals
+		uint32 length = token >> 4;
+		if ( (length == 15) && ! readLength( ip, iend, length ) )
+			return false;
+		if ( (length > (uint32)(oend - op)) || (length > (uint32)(iend - ip)) )
+			return false;
+		CFastMem::memcpy( op, ip, length );
+		op += length;
+		ip += length;
+
+		// The last sequence has no match
+		if ( op == oend )
+			break;
+
+		// Match
+		if ( iend - ip < 2 )
+			return false;
+		uint32 offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		length = token & 15;
+		if ( (length == 15) && ! readLength( ip, iend, length ) )
+			return false;
+		length += MinMatch;
+		if ( (offset == 0) || (offset > (uint32)(op - base)) || (length > (uint32)(oend - op)) )
+			return false;
+
+		const uint8 *match = op - offset;
+		if ( offset >= length )
+		{
+			CFastMem::memcpy( op, match, length );
+			op += length;
+		}
+		else
+		{
+			// Overlapping match (repeated pattern)
+			for ( uint32 i=0; i!=length; ++i )
+				*op++ = *match++;
+		}
+	}
+
+	if ( ip != iend )
+		return false;
+
+	if ( size != 0 )
+		CFastMem::memcpy( dest, base + start, size );
+	return true;
+}
+
+
+} // NLMISC
+
+/* End of lz_compressor.cpp */
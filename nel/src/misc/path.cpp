@@ -119,6 +119,8 @@ void CPath::getFileList(const std::string &extension, std::vector<std::string> &
 
 void CFileContainer::getFileList(const std::string &extension, std::vector<std::string> &filenames)
 {
+	uint firstNew = (uint)filenames.size();
+
 	if (!_MemoryCompressed)
 	{
 		TFiles::iterator first(_Files.begin()), last(_Files.end());
@@ -168,6 +170,9 @@ void CFileContainer::getFileList(const std::string &extension, std::vector<std::
 			}
 		}
 	}
+
+	// _Files is a hash map (and _MCFiles is built from it): sort the names, as the callers expect
+	std::sort(filenames.begin() + firstNew, filenames.end());
 }
 
 #ifndef NL_DONT_USE_EXTERNAL_CODE
@@ -178,6 +183,8 @@ void CPath::getFileListByName(const std::string &extension, const std::string &n
 
 void CFileContainer::getFileListByName(const std::string &extension, const std::string &name, std::vector<std::string> &filenames)
 {
+	uint firstNew = (uint)filenames.size();
+
 	if (!_MemoryCompressed)
 	{
 		TFiles::iterator first(_Files.begin()), last(_Files.end());
@@ -227,6 +234,9 @@ void CFileContainer::getFileListByName(const std::string &extension, const std::
 			}
 		}
 	}
+
+	// sorted as in getFileList()
+	std::sort(filenames.begin() + firstNew, filenames.end());
 }
 #endif // NL_DONT_USE_EXTERNAL_CODE
 
@@ -254,18 +264,32 @@ void CFileContainer::clearMap ()
 }
 
 
+// Case insensitive FNV-1a hash of a file name, for the index of _MCFiles
+static uint32 hashFileName (const char *name)
+{
+	uint32 h = 2166136261u;
+	for (; *name != '\0'; ++name)
+	{
+		h ^= (uint8)::tolower(*name);
+		h *= 16777619u;
+	}
+	return h;
+}
+
 CFileContainer::CMCFileEntry *CFileContainer::MCfind (const std::string &filename)
 {
 	nlassert(_MemoryCompressed);
-	vector<CMCFileEntry>::iterator it;
-	CMCFileEntry temp_cmc_file;
-	temp_cmc_file.Name = (char*)filename.c_str();
-	it = lower_bound(_MCFiles.begin(), _MCFiles.end(), temp_cmc_file, CMCFileComp());
-	if (it != _MCFiles.end())
+	if (_MCIndex.empty())
+		return NULL;
+
+	// linear probing until the file or an empty slot
+	uint32 mask = (uint32)_MCIndex.size() - 1;
+	CMCFileComp FileComp;
+	for (uint32 slot = hashFileName(filename.c_str()) & mask; _MCIndex[slot] != 0; slot = (slot + 1) & mask)
 	{
-		CMCFileComp FileComp;
-		if (FileComp.specialCompare(*it, filename.c_str()) == 0)
-			return &(*it);
+		CMCFileEntry &fe = _MCFiles[_MCIndex[slot] - 1];
+		if (FileComp.specialCompare(fe, filename.c_str()) == 0)
+			return &fe;
 	}
 	return NULL;
 }
@@ -344,7 +368,7 @@ void CFileContainer::remapExtension (const string &ext1, const string &ext2, boo
 		_Extensions.push_back (make_pair (ext1lwr, ext2lwr));
 
 		// adding mapping into the map
-		vector<string> newFiles;
+		vector<pair<string, string> > newFiles;
 		TFiles::iterator it = _Files.begin();
 		while (it != _Files.end ())
 		{
@@ -358,13 +382,16 @@ void CFileContainer::remapExtension (const string &ext1, const string &ext2, boo
 					string file = (*it).first.substr (0, pos + 1);
 					file += ext2lwr;
 
-// TODO perhaps a problem because I insert in the current map that i parcours
 					string path = SSMpath.get((*it).second.idPath);
-					insertFileInMap (file, path+file, true, ext1lwr);
+					newFiles.push_back (make_pair (file, path+file));
 				}
 			}
 			it++;
 		}
+
+		// inserted after the loop, the hash map may rehash
+		for (uint i = 0; i < newFiles.size(); i++)
+			insertFileInMap (newFiles[i].first, newFiles[i].second, true, ext1lwr);
 		NL_DISPLAY_PATH("PATH: CPath::remapExtension(%s, %s, %d): extension added", ext1lwr.c_str(), ext2lwr.c_str(), substitute);
 	}
 }
@@ -807,8 +834,13 @@ bool isdirectory (dirent *de)
 	return ((de->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0) && ((de->dwFileAttributes & FILE_ATTRIBUTE_SYSTEM) == 0);
 #else
 	//nlinfo ("isdirectory filename %s -> 0x%08x", de->d_name, de->d_type);
-	// we can't use "de->d_type & DT_DIR" because it s always NULL on libc2.1
-	//return (de->d_type & DT_DIR) != 0;
+	// d_type is DT_UNKNOWN on libc2.1 and on some file systems, stat() the symbolic links too
+#ifdef _DIRENT_HAVE_D_TYPE
+	if (de->d_type == DT_DIR)
+		return true;
+	if (de->d_type == DT_REG)
+		return false;
+#endif
 
 	return CFile::isDirectory (BasePathgetPathContent + de->d_name);
 
@@ -821,8 +853,13 @@ bool isfile (dirent *de)
 #ifdef NL_OS_WINDOWS
 	return ((de->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0) && ((de->dwFileAttributes & FILE_ATTRIBUTE_SYSTEM) == 0);
 #else
-	// we can't use "de->d_type & DT_DIR" because it s always NULL on libc2.1
-	//return (de->d_type & DT_DIR) == 0;
+	// d_type is DT_UNKNOWN on libc2.1 and on some file systems, stat() the symbolic links too
+#ifdef _DIRENT_HAVE_D_TYPE
+	if (de->d_type == DT_REG)
+		return true;
+	if (de->d_type == DT_DIR)
+		return false;
+#endif
 
 	return !CFile::isDirectory (BasePathgetPathContent + de->d_name);
 
@@ -1073,7 +1110,7 @@ void CFileContainer::addSearchPath (const string &path, bool recurse, bool alter
 		}
 
 		// find all files in the path and subpaths
-		getPathContent (newPath, recurse, false, true, filesToProcess, progressCallBack);
+		getSearchPathFiles (newPath, recurse, filesToProcess, progressCallBack);
 
 		// Progree bar
 		if (progressCallBack)
@@ -1093,10 +1130,7 @@ void CFileContainer::addSearchPath (const string &path, bool recurse, bool alter
 				progressCallBack->pushCropedValues ((float)f/(float)filesToProcess.size(), (float)(f+1)/(float)filesToProcess.size());
 			}
 
-			string filename = CFile::getFilename (filesToProcess[f]);
-			string filepath = CFile::getPath (filesToProcess[f]);
-//			insertFileInMap (filename, filepath, false, CFile::getExtension(filename));
-			addSearchFile (filesToProcess[f], false, "", progressCallBack);
+			insertSearchFile (filesToProcess[f], false, "", progressCallBack);
 
 			// Progree bar
 			if (progressCallBack)
@@ -1113,6 +1147,140 @@ void CFileContainer::addSearchPath (const string &path, bool recurse, bool alter
 	}
 }
 
+// Modification date of a directory, 0 if not found (CFile::getFileModificationDate() can't open the directories on windows)
+static uint32 getDirectoryDate (const string &path)
+{
+	string dir = path;
+	if (dir.size() > 1 && dir[dir.size()-1] == '/' && dir[dir.size()-2] != ':')
+		dir.resize(dir.size()-1);
+
+#ifdef NL_OS_WINDOWS
+	struct _stat buf;
+	if (_stat (dir.c_str(), &buf) != 0)
+		return 0;
+#else
+	struct stat buf;
+	if (stat (dir.c_str(), &buf) != 0)
+		return 0;
+#endif
+	return (uint32)buf.st_mtime;
+}
+
+void CFileContainer::getSearchPathFiles (const string &path, bool recurse, vector<string> &files, IProgressCallback *progressCallBack)
+{
+	string key = recurse ? path + "*" : path;
+
+	TPathCache::iterator it = _LoadedPathCache.find (key);
+	if (it != _LoadedPathCache.end())
+	{
+		// the directory entries only change with the modification date of their directory
+		CPathCacheEntry &entry = it->second;
+		uint i;
+		for (i = 0; i < entry.Dirs.size(); i++)
+		{
+			if (entry.DirDates[i] >= entry.ScanDate || getDirectoryDate (entry.Dirs[i]) != entry.DirDates[i])
+				break;
+		}
+
+		if (i == entry.Dirs.size())
+		{
+			NL_DISPLAY_PATH("PATH: CPath::addSearchPath(%s, %d, 0): %d files from the path cache", path.c_str(), recurse, entry.Files.size());
+			files.reserve (files.size() + entry.Files.size());
+			for (i = 0; i < entry.Files.size(); i++)
+				files.push_back (path + entry.Files[i]);
+			_PathCache[key] = entry;
+			return;
+		}
+
+		nlinfo ("PATH: CPath::addSearchPath(%s, %d, 0): '%s' is modified since the path cache, scan it", path.c_str(), recurse, (i < entry.Dirs.size()) ? entry.Dirs[i].c_str() : path.c_str());
+	}
+
+	// the directories modified during the scan have a date after it
+	CPathCacheEntry &entry = _PathCache[key];
+	entry.ScanDate = CTime::getSecondsSince1970 ();
+	entry.Dirs.clear ();
+	entry.Files.clear ();
+
+	vector<string> content;
+	getPathContent (path, recurse, recurse, true, content, progressCallBack);
+
+	entry.Dirs.push_back (path);
+	for (uint i = 0; i < content.size(); i++)
+	{
+		// getPathContent() ends the directories with a '/'
+		if (!content[i].empty() && content[i][content[i].size()-1] == '/')
+		{
+			entry.Dirs.push_back (content[i]);
+		}
+		else
+		{
+			files.push_back (content[i]);
+			entry.Files.push_back (content[i].substr (path.size()));
+		}
+	}
+
+	entry.DirDates.resize (entry.Dirs.size());
+	for (uint i = 0; i < entry.Dirs.size(); i++)
+		entry.DirDates[i] = getDirectoryDate (entry.Dirs[i]);
+}
+
+void CFileContainer::CPathCacheEntry::serial (IStream &f)
+{
+	f.serialCont (Dirs);
+	f.serialCont (DirDates);
+	f.serialCont (Files);
+	f.serial (ScanDate);
+}
+
+bool CFileContainer::loadPathCache (const string &filename)
+{
+	CIFile f;
+	if (!f.open (filename))
+	{
+		nlinfo ("PATH: CPath::loadPathCache(%s): can't open the file, the search paths will be scanned", filename.c_str());
+		return false;
+	}
+
+	try
+	{
+		f.serialCheck ((uint32)'HTAP');
+		f.serialVersion (0);
+		f.serialCont (_LoadedPathCache);
+	}
+	catch (const EStream &e)
+	{
+		nlwarning ("PATH: CPath::loadPathCache(%s): can't read the path cache (%s), the search paths will be scanned", filename.c_str(), e.what());
+		_LoadedPathCache.clear ();
+		return false;
+	}
+
+	nlinfo ("PATH: CPath::loadPathCache(%s): %d search paths in the cache", filename.c_str(), _LoadedPathCache.size());
+	return true;
+}
+
+bool CFileContainer::savePathCache (const string &filename)
+{
+	COFile f;
+	if (!f.open (filename))
+	{
+		nlwarning ("PATH: CPath::savePathCache(%s): can't open the file", filename.c_str());
+		return false;
+	}
+
+	try
+	{
+		f.serialCheck ((uint32)'HTAP');
+		f.serialVersion (0);
+		f.serialCont (_PathCache);
+	}
+	catch (const EStream &e)
+	{
+		nlwarning ("PATH: CPath::savePathCache(%s): can't write the path cache (%s)", filename.c_str(), e.what());
+		return false;
+	}
+	return true;
+}
+
 void CPath::addSearchFile (const string &file, bool remap, const string &virtual_ext, NLMISC::IProgressCallback *progressCallBack)
 {
 	getInstance()->_FileContainer.addSearchFile(file, remap, virtual_ext, progressCallBack);
@@ -1154,19 +1322,24 @@ void CFileContainer::addSearchFile (const string &file, bool remap, const string
 		return;
 	}
 
+	insertSearchFile (newFile, remap, virtual_ext, progressCallBack);
+}
+
+void CFileContainer::insertSearchFile (const string &newFile, bool remap, const string &virtual_ext, NLMISC::IProgressCallback *progressCallBack)
+{
 	// check if it s a big file
 	if (CFile::getExtension(newFile) == "bnp")
 	{
-		NL_DISPLAY_PATH ("PATH: CPath::addSearchFile(%s, %d, '%s'): '%s' is a big file, add it", file.c_str(), remap, virtual_ext.c_str(), newFile.c_str());
-		addSearchBigFile(file, false, false, progressCallBack);
+		NL_DISPLAY_PATH ("PATH: CPath::addSearchFile(%s, %d, '%s'): is a big file, add it", newFile.c_str(), remap, virtual_ext.c_str());
+		addSearchBigFile(newFile, false, false, progressCallBack);
 		return;
 	}
 
 	// check if it s an xml pack file
 	if (CFile::getExtension(newFile) == "xml_pack")
 	{
-		NL_DISPLAY_PATH ("PATH: CPath::addSearchFile(%s, %d, '%s'): '%s' is an xml pack file, add it", file.c_str(), remap, virtual_ext.c_str(), newFile.c_str());
-		addSearchXmlpackFile(file, false, false, progressCallBack);
+		NL_DISPLAY_PATH ("PATH: CPath::addSearchFile(%s, %d, '%s'): is an xml pack file, add it", newFile.c_str(), remap, virtual_ext.c_str());
+		addSearchXmlpackFile(newFile, false, false, progressCallBack);
 		return;
 	}
 
@@ -1194,7 +1367,7 @@ void CFileContainer::addSearchFile (const string &file, bool remap, const string
 			if (_Extensions[i].first == toLower(ext))
 			{
 				// need to remap
-				addSearchFile (newFile, true, _Extensions[i].second, progressCallBack);
+				insertSearchFile (newFile, true, _Extensions[i].second, progressCallBack);
 			}
 		}
 	}
@@ -1262,32 +1435,22 @@ void CFileContainer::addSearchBigFile (const string &sBigFilename, bool recurse,
 		nlwarning ("PATH: CPath::addSearchBigFile(%s, %d, %d): '%s' is not a file, skip it", sBigFilename.c_str(), recurse, alternative, sBigFilename.c_str());
 		return;
 	}
-	// Open and read the big file header
 	nlassert(!_MemoryCompressed);
 
-	FILE *Handle = fopen (sBigFilename.c_str(), "rb");
-	if (Handle == NULL)
-	{
-		nlwarning ("PATH: CPath::addSearchBigFile(%s, %d, %d): can't open file, skip it", sBigFilename.c_str(), recurse, alternative);
-		return;
-	}
-
-	// add the link with the CBigFile singleton
-	if (CBigFile::getInstance().add (sBigFilename, BF_ALWAYS_OPENED | BF_CACHE_FILE_ON_OPEN))
+	// add the link with the CBigFile singleton, it reads the big file header
+	uint32 options = BF_ALWAYS_OPENED | BF_CACHE_FILE_ON_OPEN;
+	if (_MemoryMappedBigFiles)
+		options |= BF_MEMORY_MAPPED;
+	if (CBigFile::getInstance().add (sBigFilename, options))
 	{
 		// also add the bigfile name in the map to retreive the full path of a .bnp when we want modification date of the bnp for example
 		insertFileInMap (CFile::getFilename (sBigFilename), sBigFilename, false, CFile::getExtension(sBigFilename));
 
-		// parse the big file to add file in the map
-		uint32 nFileSize=CFile::getFileSize (Handle);
-		//nlfseek64 (Handle, 0, SEEK_END);
-		//uint32 nFileSize = ftell (Handle);
-		nlfseek64 (Handle, nFileSize-4, SEEK_SET);
-		uint32 nOffsetFromBegining;
-		fread (&nOffsetFromBegining, sizeof(uint32), 1, Handle);
-		nlfseek64 (Handle, nOffsetFromBegining, SEEK_SET);
-		uint32 nNbFile;
-		fread (&nNbFile, sizeof(uint32), 1, Handle);
+		// add the files of the big file in the map
+		string bigfilenamealone = CFile::getFilename (sBigFilename);
+		vector<string> files;
+		CBigFile::getInstance().list (bigfilenamealone, files);
+		uint32 nNbFile = (uint32)files.size();
 		for (uint32 i = 0; i < nNbFile; ++i)
 		{
 			// Progress bar
@@ -1297,22 +1460,12 @@ void CFileContainer::addSearchBigFile (const string &sBigFilename, bool recurse,
 				progressCallBack->pushCropedValues ((float)i/(float)nNbFile, (float)(i+1)/(float)nNbFile);
 			}
 
-			char FileName[256];
-			uint8 nStringSize;
-			fread (&nStringSize, 1, 1, Handle);
-			fread (FileName, 1, nStringSize, Handle);
-			FileName[nStringSize] = 0;
-			uint32 nFileSize2;
-			fread (&nFileSize2, sizeof(uint32), 1, Handle);
-			uint32 nFilePos;
-			fread (&nFilePos, sizeof(uint32), 1, Handle);
-			string sTmp = toLower(string(FileName));
+			const string &sTmp = files[i];
 			if (sTmp.empty())
 			{
 				nlwarning ("PATH: CPath::addSearchBigFile(%s, %d, %d): can't add empty file, skip it", sBigFilename.c_str(), recurse, alternative);
 				continue;
 			}
-			string bigfilenamealone = CFile::getFilename (sBigFilename);
 			string filenamewoext = CFile::getFilenameWithoutExtension (sTmp);
 			string ext = toLower(CFile::getExtension(sTmp));
 
@@ -1341,8 +1494,6 @@ void CFileContainer::addSearchBigFile (const string &sBigFilename, bool recurse,
 	{
 		nlwarning ("PATH: CPath::addSearchBigFile(%s, %d, %d): can't add the big file", sBigFilename.c_str(), recurse, alternative);
 	}
-
-	fclose (Handle);
 }
 
 // WARNING : recurse is not used
@@ -1687,6 +1838,19 @@ void CFileContainer::memoryCompress()
 		it++;
 	}
 
+	// Index them by name, at most half of the slots are used
+	uint32 nbSlots = 16;
+	while (nbSlots < 2 * _MCFiles.size())
+		nbSlots *= 2;
+	_MCIndex.resize(nbSlots, 0);
+	for (uint32 i = 0; i < _MCFiles.size(); ++i)
+	{
+		uint32 slot = hashFileName(_MCFiles[i].Name) & (nbSlots - 1);
+		while (_MCIndex[slot] != 0)
+			slot = (slot + 1) & (nbSlots - 1);
+		_MCIndex[slot] = i + 1;
+	}
+
 	contReset(_Files);
 	_MemoryCompressed = true;
 }
@@ -1711,6 +1875,7 @@ void CFileContainer::memoryUncompress()
 		_Files[toLower(CFile::getFilename(fe.Name))] = fe;
 	}
 	contReset(_MCFiles);
+	contReset(_MCIndex);
 	_MemoryCompressed = false;
 }
 
@@ -1884,9 +2049,9 @@ uint32	CFile::getFileSize (const std::string &filename)
 	}
 	else if (filename.find('@') != string::npos)
 	{
+		// no need to open the big file
 		uint32 fs = 0, bfo;
-		bool c, d;
-		CBigFile::getInstance().getFile (filename, fs, bfo, c, d);
+		CBigFile::getInstance().getFileInfo (filename, fs, bfo);
 		return fs;
 	}
 	else
@@ -813,6 +813,18 @@ bool CSystemInfo::hasHyperThreading()
 #pragma managed(pop)
 #endif
 
+uint CSystemInfo::getNumberOfProcessors()
+{
+#ifdef NL_OS_WINDOWS
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	return si.dwNumberOfProcessors > 0 ? (uint)si.dwNumberOfProcessors : 1;
+#else
+	long nb = sysconf(_SC_NPROCESSORS_ONLN);
+	return nb > 0 ? (uint)nb : 1;
+#endif
+}
+
 bool CSystemInfo::isNT()
 {
 #ifdef NL_OS_WINDOWS
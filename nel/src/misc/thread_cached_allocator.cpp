@@ -0,0 +1,473 @@
+/** \file thread_cached_allocator.cpp
+ * Thread-safe object arena allocator with a cache of blocks by thread
+ *
+ * $Id$
+ */
+
+/* Copyright, 2000, 2001, 2002, 2003 Nevrax Ltd.
+ *
+ * This file is part of NEVRAX NEL.
+ * NEVRAX NEL is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+
+ * NEVRAX NEL is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with NEVRAX NEL; see the file COPYING. If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#include "stdmisc.h"
+
+#include "nel/misc/thread_cached_allocator.h"
+#include "nel/misc/fixed_size_allocator.h"
+#include "nel/misc/atomic.h"
+#include "nel/misc/log.h"
+
+using namespace std;
+
+
+namespace NLMISC
+{
+
+
+// The header of a block contains its size class (0 for the blocks allocated with new). It keeps the 8 bytes alignment.
+static const uint	HeaderSize = 8;
+
+// The magazines of a size class contain about MagazineBytes bytes of blocks
+static const uint	MagazineBytes = 8192;
+
+// The chunks of the CFixedSizeAllocator contain about ChunkBytes bytes of blocks
+static const uint	ChunkBytes = 16384;
+
+// Max number of full magazines kept in the depot of a size class, the other blocks go back to the CFixedSizeAllocator
+static const uint	MaxDepotMagazines = 4;
+
+
+// A stack of free blocks of a size class
+class CThreadCachedAllocator::CMagazine
+{
+public:
+	enum { MaxSize = 64 };
+
+	CMagazine() : NumBlocks(0), Next(NULL) {}
+
+	uint		NumBlocks;
+	CMagazine	*Next;		// in the lists of the depot
+	void		*Blocks[MaxSize];
+};
+
+// The depot of a size class
+class CThreadCachedAllocator::CSizeClass
+{
+public:
+	CSizeClass() : Allocator(NULL), FullMagazines(NULL), EmptyMagazines(NULL), NumFullMagazines(0), BlockSize(0), MagazineSize(0) {}
+
+	// Get an empty magazine (with the mutex)
+	CMagazine	*getEmptyMagazine ()
+	{
+		CMagazine *magazine = EmptyMagazines;
+		if (magazine == NULL)
+			return new CMagazine;
+		EmptyMagazines = magazine->Next;
+		magazine->Next = NULL;
+		return magazine;
+	}
+
+	// Keep an empty magazine (with the mutex)
+	void		putEmptyMagazine (CMagazine *magazine)
+	{
+		nlassert (magazine->NumBlocks == 0);
+		magazine->Next = EmptyMagazines;
+		EmptyMagazines = magazine;
+	}
+
+	// Give back the blocks of a magazine to the CFixedSizeAllocator and keep it as empty (with the mutex)
+	void		releaseMagazine (CMagazine *magazine)
+	{
+		for (uint i = 0; i < magazine->NumBlocks; ++i)
+			Allocator->free (magazine->Blocks[i]);
+		magazine->NumBlocks = 0;
+		putEmptyMagazine (magazine);
+	}
+
+	CFastMutex			Mutex;
+	CFixedSizeAllocator	*Allocator;			// created at the first allocation
+	CMagazine			*FullMagazines;
+	CMagazine			*EmptyMagazines;
+	uint				NumFullMagazines;
+	uint				BlockSize;			// header included
+	uint				MagazineSize;		// max number of blocks in a magazine
+};
+
+// The magazines of a thread, used without lock
+class CThreadCachedAllocator::CThreadCache
+{
+public:
+	struct CEntry
+	{
+		CEntry() : Loaded(NULL), Previous(NULL) {}
+
+		CMagazine	*Loaded;	// the blocks are allocated from and freed to this one
+		CMagazine	*Previous;	// exchanged with Loaded when it is empty or full
+	};
+
+	// by size class
+	std::vector<CEntry>	Entries;
+};
+
+
+CThreadCachedAllocator *CThreadCachedAllocator::_DefaultAllocator = NULL;
+
+
+//*****************************************************************************************************************
+CThreadCachedAllocator::CThreadCachedAllocator(uint maxAllocSize, uint granularity /* = 8*/)
+{
+	nlassert(granularity > 0 && (granularity % 8) == 0);
+	nlassert(maxAllocSize > 0);
+	_Granularity = granularity;
+	_NumSizeClasses = (maxAllocSize + (granularity - 1)) / granularity;
+	_MaxAllocSize = _NumSizeClasses * granularity;
+	_NumLargeBlocks = 0;
+
+	_SizeClasses = new CSizeClass[_NumSizeClasses + 1];
+	for (uint k = 1; k <= _NumSizeClasses; ++k)
+	{
+		CSizeClass &sizeClass = _SizeClasses[k];
+		sizeClass.BlockSize = k * granularity + HeaderSize;
+		sizeClass.MagazineSize = std::min(std::max(MagazineBytes / sizeClass.BlockSize, (uint) 2), (uint) CMagazine::MaxSize);
+	}
+}
+
+//*****************************************************************************************************************
+CThreadCachedAllocator::~CThreadCachedAllocator()
+{
+	for (uint k = 0; k < _ThreadCaches.size(); ++k)
+	{
+		flushThreadCache(*_ThreadCaches[k]);
+		delete _ThreadCaches[k];
+	}
+	_ThreadCaches.clear();
+	_ThreadCache.setPointer(NULL);
+
+	for (uint k = 1; k <= _NumSizeClasses; ++k)
+	{
+		CSizeClass &sizeClass = _SizeClasses[k];
+		while (sizeClass.FullMagazines)
+		{
+			CMagazine *magazine = sizeClass.FullMagazines;
+			sizeClass.FullMagazines = magazine->Next;
+			sizeClass.releaseMagazine(magazine);
+		}
+		while (sizeClass.EmptyMagazines)
+		{
+			CMagazine *magazine = sizeClass.EmptyMagazines;
+			sizeClass.EmptyMagazines = magazine->Next;
+			delete magazine;
+		}
+		delete sizeClass.Allocator;
+	}
+	delete [] _SizeClasses;
+}
+
+//*****************************************************************************************************************
+void *CThreadCachedAllocator::alloc(uint size)
+{
+	if (size > _MaxAllocSize)
+	{
+		// use standard allocator
+		uint8 *block = new uint8[size + HeaderSize];
+		*(uint32 *) block = 0;
+		atomicFetchAdd(&_NumLargeBlocks, 1);
+		return block + HeaderSize;
+	}
+
+	uint sizeClass = size == 0 ? 1 : (size + (_Granularity - 1)) / _Granularity;
+	CThreadCache &cache = *getThreadCache();
+	CThreadCache::CEntry &entry = cache.Entries[sizeClass];
+	void *block;
+	if (entry.Loaded != NULL && entry.Loaded->NumBlocks != 0)
+	{
+		// fast path, in the magazine of the thread
+		block = entry.Loaded->Blocks[--entry.Loaded->NumBlocks];
+	}
+	else
+	{
+		block = allocFromDepot(cache, sizeClass);
+	}
+	*(uint32 *) block = sizeClass;
+	return (uint8 *) block + HeaderSize;
+}
+
+//*****************************************************************************************************************
+void CThreadCachedAllocator::free(void *block)
+{
+	if (!block) return;
+	uint8 *realBlock = (uint8 *) block - HeaderSize;
+	uint32 sizeClass = *(uint32 *) realBlock;
+	if (sizeClass == 0)
+	{
+		atomicFetchSub(&_NumLargeBlocks, 1);
+		delete [] realBlock;
+		return;
+	}
+	nlassert(sizeClass <= _NumSizeClasses);
+
+	CThreadCache &cache = *getThreadCache();
+	CThreadCache::CEntry &entry = cache.Entries[sizeClass];
+	if (entry.Loaded != NULL && entry.Loaded->NumBlocks < _SizeClasses[sizeClass].MagazineSize)
+	{
+		// fast path, in the magazine of the thread
+		entry.Loaded->Blocks[entry.Loaded->NumBlocks++] = realBlock;
+	}
+	else
+	{
+		freeToDepot(cache, sizeClass, realBlock);
+	}
+}
+
+//*****************************************************************************************************************
+void *CThreadCachedAllocator::allocFromDepot(CThreadCache &cache, uint sizeClass)
+{
+	CThreadCache::CEntry &entry = cache.Entries[sizeClass];
+
+	// the other magazine of the thread has blocks
+	if (entry.Previous != NULL && entry.Previous->NumBlocks != 0)
+	{
+		std::swap(entry.Loaded, entry.Previous);
+		return entry.Loaded->Blocks[--entry.Loaded->NumBlocks];
+	}
+
+	CSizeClass &depot = _SizeClasses[sizeClass];
+	depot.Mutex.enter();
+
+	if (entry.Loaded == NULL)
+		entry.Loaded = depot.getEmptyMagazine();
+	if (entry.Previous == NULL)
+		entry.Previous = depot.getEmptyMagazine();
+
+	if (depot.FullMagazines != NULL)
+	{
+		// exchange the empty magazine with a full one
+		CMagazine *full = depot.FullMagazines;
+		depot.FullMagazines = full->Next;
+		--depot.NumFullMagazines;
+		full->Next = NULL;
+		depot.putEmptyMagazine(entry.Loaded);
+		entry.Loaded = full;
+	}
+	else
+	{
+		// fill half of the magazine, so that the next frees don't come back at once
+		if (depot.Allocator == NULL)
+			depot.Allocator = new CFixedSizeAllocator(depot.BlockSize, std::max(ChunkBytes / depot.BlockSize, depot.MagazineSize));
+		uint numBlocks = std::max(depot.MagazineSize / 2, (uint) 1);
+		for (uint k = 0; k < numBlocks; ++k)
+			entry.Loaded->Blocks[entry.Loaded->NumBlocks++] = depot.Allocator->alloc();
+	}
+
+	depot.Mutex.leave();
+
+	return entry.Loaded->Blocks[--entry.Loaded->NumBlocks];
+}
+
+//*****************************************************************************************************************
+void CThreadCachedAllocator::freeToDepot(CThreadCache &cache, uint sizeClass, void *block)
+{
+	CThreadCache::CEntry &entry = cache.Entries[sizeClass];
+
+	// the other magazine of the thread is empty
+	if (entry.Previous != NULL && entry.Previous->NumBlocks == 0)
+	{
+		std::swap(entry.Loaded, entry.Previous);
+		entry.Loaded->Blocks[entry.Loaded->NumBlocks++] = block;
+		return;
+	}
+
+	CSizeClass &depot = _SizeClasses[sizeClass];
+	depot.Mutex.enter();
+
+	if (entry.Loaded == NULL)
+		entry.Loaded = depot.getEmptyMagazine();
+	if (entry.Previous == NULL)
+		entry.Previous = depot.getEmptyMagazine();
+
+	if (entry.Loaded->NumBlocks == depot.MagazineSize)
+	{
+		// give the full magazine to the depot, or its blocks to the CFixedSizeAllocator if the depot has enough
+		if (depot.NumFullMagazines < MaxDepotMagazines)
+		{
+			entry.Loaded->Next = depot.FullMagazines;
+			depot.FullMagazines = entry.Loaded;
+			++depot.NumFullMagazines;
+		}
+		else
+		{
+			depot.releaseMagazine(entry.Loaded);
+		}
+		entry.Loaded = depot.getEmptyMagazine();
+	}
+
+	depot.Mutex.leave();
+
+	entry.Loaded->Blocks[entry.Loaded->NumBlocks++] = block;
+}
+
+//*****************************************************************************************************************
+CThreadCachedAllocator::CThreadCache *CThreadCachedAllocator::getThreadCache()
+{
+	CThreadCache *cache = (CThreadCache *) _ThreadCache.getPointer();
+	if (cache == NULL)
+	{
+		cache = new CThreadCache;
+		cache->Entries.resize(_NumSizeClasses + 1);
+		_ThreadCache.setPointer(cache);
+
+		_CachesMutex.enter();
+		_ThreadCaches.push_back(cache);
+		_CachesMutex.leave();
+	}
+	return cache;
+}
+
+//*****************************************************************************************************************
+void CThreadCachedAllocator::flushThreadCache(CThreadCache &cache)
+{
+	for (uint k = 1; k <= _NumSizeClasses; ++k)
+	{
+		CThreadCache::CEntry &entry = cache.Entries[k];
+		if (entry.Loaded == NULL && entry.Previous == NULL)
+			continue;
+
+		CSizeClass &depot = _SizeClasses[k];
+		depot.Mutex.enter();
+		if (entry.Loaded != NULL)
+			depot.releaseMagazine(entry.Loaded);
+		if (entry.Previous != NULL)
+			depot.releaseMagazine(entry.Previous);
+		depot.Mutex.leave();
+
+		entry.Loaded = NULL;
+		entry.Previous = NULL;
+	}
+}
+
+//*****************************************************************************************************************
+void CThreadCachedAllocator::releaseThreadCache()
+{
+	CThreadCache *cache = (CThreadCache *) _ThreadCache.getPointer();
+	if (cache == NULL) return;
+
+	flushThreadCache(*cache);
+
+	_CachesMutex.enter();
+	std::vector<CThreadCache*>::iterator it = std::find(_ThreadCaches.begin(), _ThreadCaches.end(), cache);
+	nlassert(it != _ThreadCaches.end());
+	_ThreadCaches.erase(it);
+	_CachesMutex.leave();
+
+	_ThreadCache.setPointer(NULL);
+	delete cache;
+}
+
+//*****************************************************************************************************************
+void CThreadCachedAllocator::getStats(CStats &stats) const
+{
+	stats.SizeClasses.clear();
+	stats.UsedBytes = 0;
+	stats.ReservedBytes = 0;
+	stats.NumLargeBlocks = _NumLargeBlocks;
+
+	// blocks of the CFixedSizeAllocator and of the depots
+	std::vector<uint> statsIndex(_NumSizeClasses + 1, 0xffffffff);
+	std::vector<uint> numAllocated;
+	std::vector<uint> blockSizes;
+	for (uint k = 1; k <= _NumSizeClasses; ++k)
+	{
+		CSizeClass &depot = _SizeClasses[k];
+		depot.Mutex.enter();
+		if (depot.Allocator != NULL)
+		{
+			CSizeClassStats sizeClassStats;
+			sizeClassStats.BlockSize = k * _Granularity;
+			sizeClassStats.NumUsedBlocks = 0;
+			sizeClassStats.NumCachedBlocks = 0;
+			for (CMagazine *magazine = depot.FullMagazines; magazine != NULL; magazine = magazine->Next)
+				sizeClassStats.NumCachedBlocks += magazine->NumBlocks;
+			sizeClassStats.NumFreeBlocks = depot.Allocator->getNumFreeBlocks();
+			sizeClassStats.NumChunks = depot.Allocator->getNumChunks();
+
+			statsIndex[k] = (uint) stats.SizeClasses.size();
+			stats.SizeClasses.push_back(sizeClassStats);
+			numAllocated.push_back(depot.Allocator->getNumAllocatedBlocks());
+			stats.ReservedBytes += (uint64) sizeClassStats.NumChunks * depot.Allocator->getNumBlockPerChunk() * depot.Allocator->getBlockSizeWithOverhead();
+		}
+		depot.Mutex.leave();
+	}
+
+	// blocks of the magazines of the threads (read without lock)
+	_CachesMutex.enter();
+	stats.NumThreadCaches = (uint) _ThreadCaches.size();
+	for (uint c = 0; c < _ThreadCaches.size(); ++c)
+	{
+		const CThreadCache &cache = *_ThreadCaches[c];
+		for (uint k = 1; k <= _NumSizeClasses; ++k)
+		{
+			if (statsIndex[k] == 0xffffffff) continue;
+			const CThreadCache::CEntry &entry = cache.Entries[k];
+			const CMagazine *loaded = entry.Loaded;
+			const CMagazine *previous = entry.Previous;
+			if (loaded != NULL) stats.SizeClasses[statsIndex[k]].NumCachedBlocks += loaded->NumBlocks;
+			if (previous != NULL) stats.SizeClasses[statsIndex[k]].NumCachedBlocks += previous->NumBlocks;
+		}
+	}
+	_CachesMutex.leave();
+
+	for (uint k = 0; k < stats.SizeClasses.size(); ++k)
+	{
+		CSizeClassStats &sizeClassStats = stats.SizeClasses[k];
+		if (numAllocated[k] > sizeClassStats.NumCachedBlocks)
+			sizeClassStats.NumUsedBlocks = numAllocated[k] - sizeClassStats.NumCachedBlocks;
+		stats.UsedBytes += (uint64) sizeClassStats.NumUsedBlocks * sizeClassStats.BlockSize;
+	}
+}
+
+//*****************************************************************************************************************
+void CThreadCachedAllocator::displayStats(CLog *log) const
+{
+	CStats stats;
+	getStats(stats);
+
+	log->displayNL("THREADALLOC: %u thread caches, %u large blocks, %"NL_I64"u bytes used in %"NL_I64"u reserved, fragmentation %.1f%%",
+		stats.NumThreadCaches, stats.NumLargeBlocks, stats.UsedBytes, stats.ReservedBytes, stats.getFragmentation() * 100.f);
+	for (uint k = 0; k < stats.SizeClasses.size(); ++k)
+	{
+		const CSizeClassStats &sizeClassStats = stats.SizeClasses[k];
+		log->displayNL("THREADALLOC: %6u bytes: %8u used %8u cached %8u free %6u chunks",
+			sizeClassStats.BlockSize, sizeClassStats.NumUsedBlocks, sizeClassStats.NumCachedBlocks, sizeClassStats.NumFreeBlocks, sizeClassStats.NumChunks);
+	}
+}
+
+//*****************************************************************************************************************
+CThreadCachedAllocator &CThreadCachedAllocator::getDefaultAllocator()
+{
+	if (_DefaultAllocator == NULL)
+	{
+		// several threads can get there, only the first allocator is kept
+		CThreadCachedAllocator *allocator = new CThreadCachedAllocator(32768);
+		if (!atomicCompareAndSwapPtr((void * volatile *) &_DefaultAllocator, NULL, allocator))
+			delete allocator;
+	}
+	return *_DefaultAllocator;
+}
+
+
+} // NLMISC
+
+/* End of thread_cached_allocator.cpp */
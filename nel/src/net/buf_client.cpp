@@ -29,6 +29,7 @@
 
 #include "nel/net/buf_client.h"
 #include "nel/misc/thread.h"
+#include "nel/misc/atomic.h"
 #include "nel/net/dummy_tcp_sock.h"
 #include "nel/net/net_log.h"
 
@@ -37,6 +38,12 @@
 #	include <windows.h>
 #elif defined NL_OS_UNIX
 #	include <netinet/in.h>
+#	include <unistd.h>
+#endif
+
+#ifdef NL_NET_HAS_EPOLL
+#	include <sys/epoll.h>
+#	include <errno.h>
 #endif
 
 using namespace NLMISC;
@@ -47,7 +54,128 @@ namespace NLNET {
 
 
 uint32 	NbClientReceiveTask = 0;
-	
+
+#ifdef NL_NET_HAS_EPOLL
+CBufClient::TReceiveEngine CBufClient::_DefaultReceiveEngine = CBufClient::SharedEngine;
+#else
+CBufClient::TReceiveEngine CBufClient::_DefaultReceiveEngine = CBufClient::ThreadEngine;
+#endif
+
+/// Number of shared receive threads started with the first client of SharedEngine
+static uint NbSharedReceiveThreads = 1;
+
+#ifdef NL_NET_HAS_EPOLL
+
+/// Max number of events returned by one epoll_wait() call
+static const int NbClientEpollEventsPerWait = 256;
+
+/// Delay before retrying the connections whose receive queue is full (ms)
+static const int StalledClientRetryDelay = 10;
+
+/*
+ * Shared receive threads, started with the first client of SharedEngine and stopped with the last one
+ */
+struct CSharedReceiveThreads
+{
+	CSharedReceiveThreads() : NbClients(0) {}
+
+	CMutex						Mutex;
+	vector<CClientReceiveLoop*>	Loops;
+	vector<IThread*>			Threads;
+	uint						NbClients;
+};
+
+static CSharedReceiveThreads& sharedReceiveThreads()
+{
+	// Never deleted, because clients can be destroyed after the static objects
+	static CSharedReceiveThreads *threads = new CSharedReceiveThreads;
+	return *threads;
+}
+
+
+/*
+ * Register a client of SharedEngine, starting the threads if it is the first one.
+ * Returns false if the threads can't be started.
+ */
+static bool acquireSharedReceiveThreads()
+{
+	CSharedReceiveThreads& shared = sharedReceiveThreads();
+	CAutoMutex<CMutex> automutex( shared.Mutex );
+	if ( shared.NbClients == 0 )
+	{
+		for ( uint i=0; i!=NbSharedReceiveThreads; ++i )
+		{
+			CClientReceiveLoop *loop = new CClientReceiveLoop();
+			if ( ! loop->init() )
+			{
+				delete loop;
+				break;
+			}
+			IThread *thread = IThread::create( loop, 1024*4*4 );
+			thread->start();
+			shared.Loops.push_back( loop );
+			shared.Threads.push_back( thread );
+		}
+		if ( shared.Loops.empty() )
+		{
+			nlwarning( "LNETL1: Unable to start the shared client receive threads, using a receive thread by connection" );
+			return false;
+		}
+		LNETL1_DEBUG( "LNETL1: %u shared client receive threads started", (uint)shared.Loops.size() );
+	}
+	++shared.NbClients;
+	return true;
+}
+
+
+/*
+ * Unregister a client of SharedEngine, stopping the threads if it is the last one
+ */
+static void releaseSharedReceiveThreads()
+{
+	CSharedReceiveThreads& shared = sharedReceiveThreads();
+	CAutoMutex<CMutex> automutex( shared.Mutex );
+	nlassert( shared.NbClients != 0 );
+	if ( --shared.NbClients == 0 )
+	{
+		for ( uint i=0; i!=shared.Loops.size(); ++i )
+		{
+			shared.Loops[i]->requireExit();
+			shared.Threads[i]->wait();
+			delete shared.Threads[i];
+			delete shared.Loops[i];
+		}
+		shared.Loops.clear();
+		shared.Threads.clear();
+		LNETL1_DEBUG( "LNETL1: Shared client receive threads stopped" );
+	}
+}
+
+
+/*
+ * Returns the shared receive thread that has the fewest connections
+ */
+static CClientReceiveLoop *chooseSharedReceiveLoop()
+{
+	CSharedReceiveThreads& shared = sharedReceiveThreads();
+	CAutoMutex<CMutex> automutex( shared.Mutex );
+	nlassert( ! shared.Loops.empty() );
+	CClientReceiveLoop *best = shared.Loops[0];
+	uint bestNb = best->numberOfConnections();
+	for ( uint i=1; i<shared.Loops.size(); ++i )
+	{
+		uint nb = shared.Loops[i]->numberOfConnections();
+		if ( nb < bestNb )
+		{
+			best = shared.Loops[i];
+			bestNb = nb;
+		}
+	}
+	return best;
+}
+
+#endif // NL_NET_HAS_EPOLL
+
 
 /***************************************************************************************************
  * User main thread (initialization)
@@ -58,15 +186,20 @@ uint32 	NbClientReceiveTask = 0;
  */
 CBufClient::CBufClient( bool nodelay, bool replaymode, bool initPipeForDataAvailable ) :
 #ifdef NL_OS_UNIX
-	CBufNetBase( initPipeForDataAvailable ),
+	CBufNetBase( initPipeForDataAvailable, ClientReceiveQueueCapacity ),
 #else
-	CBufNetBase(),
+	CBufNetBase( ClientReceiveQueueCapacity ),
 #endif
 	_NoDelay( nodelay ),
 	_PrevBytesDownloaded( 0 ),
 	_PrevBytesUploaded( 0 ),
 	_RecvTask( NULL ),
-	_RecvThread( NULL )
+	_RecvThread( NULL ),
+	_ReceiveEngine( _DefaultReceiveEngine )
+#ifdef NL_NET_HAS_EPOLL
+	, _SharedLoop( NULL ),
+	_SharedKey( 0 )
+#endif
 	/*_PrevBytesReceived( 0 ),
 	_PrevBytesSent( 0 )*/
 {
@@ -75,16 +208,51 @@ CBufClient::CBufClient( bool nodelay, bool replaymode, bool initPipeForDataAvail
 	if ( replaymode )
 	{
 		_BufSock = new CNonBlockingBufSock( new CDummyTcpSock(), CBufNetBase::DefaultMaxExpectedBlockSize );
+		_ReceiveEngine = ThreadEngine;
 	}
 	else
 	{
 
 		_BufSock = new CNonBlockingBufSock( NULL, CBufNetBase::DefaultMaxExpectedBlockSize );
-		_RecvTask = new CClientReceiveTask( this, _BufSock );
+#ifdef NL_NET_HAS_EPOLL
+		if ( (_ReceiveEngine == SharedEngine) && (! acquireSharedReceiveThreads()) )
+		{
+			_ReceiveEngine = ThreadEngine;
+		}
+#endif
+		if ( _ReceiveEngine == ThreadEngine )
+		{
+			_RecvTask = new CClientReceiveTask( this, _BufSock );
+		}
 	}
 }
 
 
+/*
+ * Sets the engine used by the clients created afterwards
+ */
+void CBufClient::setDefaultReceiveEngine( TReceiveEngine engine )
+{
+#ifndef NL_NET_HAS_EPOLL
+	if ( engine == SharedEngine )
+	{
+		nlwarning( "LNETL1: epoll is not available on this system, using a receive thread by client connection" );
+		engine = ThreadEngine;
+	}
+#endif
+	_DefaultReceiveEngine = engine;
+}
+
+
+/*
+ * Sets the number of shared receive threads
+ */
+void CBufClient::setNbSharedReceiveThreads( uint nb )
+{
+	NbSharedReceiveThreads = std::max( nb, (uint)1 );
+}
+
+
 /*
  * Connects to the specified host
  * Precond: not connected
@@ -93,6 +261,10 @@ void CBufClient::connect( const CInetAddress& addr )
 {
 	nlnettrace( "CBufClient::connect" );
 	nlassert( ! _BufSock->Sock->connected() );
+#ifdef NL_NET_HAS_EPOLL
+	// The previous connection may have been closed by the remote host
+	unwatchConnection();
+#endif
 	_BufSock->setMaxExpectedBlockSize( maxExpectedBlockSize() );
 	_BufSock->connect( addr, _NoDelay, true );
 	_BufSock->setNonBlocking(); // ADDED: non-blocking client connection
@@ -101,6 +273,14 @@ void CBufClient::connect( const CInetAddress& addr )
 	/*_PrevBytesReceived = 0;
 	_PrevBytesSent = 0;*/
 
+#ifdef NL_NET_HAS_EPOLL
+	if ( _ReceiveEngine == SharedEngine )
+	{
+		chooseSharedReceiveLoop()->watch( this );
+		return;
+	}
+#endif
+
 	// Allow reconnection
 	if ( _RecvThread != NULL )
 	{
@@ -118,7 +298,16 @@ void CBufClient::connect( const CInetAddress& addr )
 
 void CBufClient::displayThreadStat (NLMISC::CLog *log)
 {
-	log->displayNL ("client thread %p nbloop %d", _RecvTask, _RecvTask->NbLoop);
+#ifdef NL_NET_HAS_EPOLL
+	if ( _ReceiveEngine == SharedEngine )
+	{
+		if ( _SharedLoop != NULL )
+			log->displayNL ("client shared thread %p nbloop %d nbconnections %u", _SharedLoop, _SharedLoop->NbLoop, _SharedLoop->numberOfConnections());
+		return;
+	}
+#endif
+	if ( _RecvTask != NULL )
+		log->displayNL ("client thread %p nbloop %d", _RecvTask, _RecvTask->NbLoop);
 }
 
 
@@ -148,23 +337,20 @@ bool CBufClient::dataAvailable()
 {
 	// slow down the layer H_AUTO (CBufClient_dataAvailable);
 	{
+		// The system events pushed by the user thread may be waiting for room in the receive queue
+		flushPendingEvents();
+
 		/* If no data available, enter the 'while' loop and return false (1 volatile test)
 		 * If there are user data available, enter the 'while' and return true immediately (1 volatile test + 1 short locking)
 		 * If there is a disconnection event (rare), call the callback and loop
 		 */
 		while ( dataAvailableFlag() )
 		{
-			// Because _DataAvailable is true, the receive queue is not empty at this point
-			uint8 val;
-			{
-				CFifoAccessor recvfifo( &receiveQueue() );
-				val = recvfifo.value().frontLast ();
-			}
+			// Because dataAvailableFlag() is true, the receive queue is not empty at this point
+			uint8 val = receiveQueue().frontLast ();
 
 #ifdef NL_OS_UNIX
-			uint8 b;
-			if ( read( _DataAvailablePipeHandle[PipeRead], &b, 1 ) == -1 )
-				nlwarning( "LNETL1: Read pipe failed in dataAvailable" );
+			readDataAvailablePipe( 1 );
 			//nldebug( "Pipe: 1 byte read (client %p)", this );
 #endif
 
@@ -195,25 +381,21 @@ bool CBufClient::dataAvailable()
 
 			default: // should not occur
 				{
-					CFifoAccessor recvfifo( &receiveQueue() );
 					vector<uint8> buffer;
-					recvfifo.value().front (buffer);
+					receiveQueue().front (buffer);
 					LNETL1_INFO( "LNETL1: Invalid block type: %hu (should be = %hu)", (uint16)(buffer[buffer.size()-1]), (uint16)val );
 					LNETL1_INFO( "LNETL1: Buffer (%d B): [%s]", buffer.size(), stringFromVector(buffer).c_str() );
 					LNETL1_INFO( "LNETL1: Receive queue:" );
-					recvfifo.value().display();
+					receiveQueue().display();
 					nlerror( "LNETL1: Invalid system event type in client receive queue" );
 				}
 			}
 			// Extract system event
-			{
-				CFifoAccessor recvfifo( &receiveQueue() );
-				recvfifo.value().pop();
-				setDataAvailableFlag( ! recvfifo.value().empty() );
-			}
+			receiveQueue().pop();
+			flushPendingEvents();
 
 		}
-		// _DataAvailable is false here
+		// The receive queue is empty here
 		return false;
 	}
 }
@@ -237,7 +419,7 @@ void	CBufClient::sleepUntilDataAvailable( uint usecMax )
 		FD_ZERO( &readers );
 		FD_SET( _DataAvailablePipeHandle[PipeRead], &readers );
 		tv.tv_sec = 0;
-		tv.tv_usec = usecMax;
+		tv.tv_usec = dataAvailableFlag() ? 0 : usecMax; // a system event pushed by this thread has no byte in the pipe
 		int res = ::select( _DataAvailablePipeHandle[PipeRead]+1, &readers, NULL, NULL, &tv );
 		if ( res == -1 )
 			nlerror( "LNETL1: Select failed in sleepUntilDataAvailable (code %u)", CSock::getLastError() );
@@ -257,13 +439,11 @@ void CBufClient::receive( NLMISC::CMemStream& buffer )
 	//nlassert( dataAvailable() );
 
 	// Extract buffer from the receive queue
-	{
-		CFifoAccessor recvfifo( &receiveQueue() );
-		nlassert( ! recvfifo.value().empty() );
-		recvfifo.value().front( buffer );
-		recvfifo.value().pop();
-		setDataAvailableFlag( ! recvfifo.value().empty() );
-	}
+	nlassert( ! receiveQueue().empty() );
+	CReceiveFIFO::TBlock block;
+	receiveQueue().pop( block );
+	buffer.clear();
+	buffer.swapBuffer( block );
 
 	// Extract event type
 	nlassert( buffer.buffer()[buffer.size()-1] == CBufNetBase::User );
@@ -272,6 +452,42 @@ void CBufClient::receive( NLMISC::CMemStream& buffer )
 }
 
 
+/*
+ * Receives up to maxNb blocks of data in one call
+ */
+uint CBufClient::receiveBatch( std::vector<NLMISC::CMemStream>& buffers, uint maxNb )
+{
+	uint nb = 0;
+	uint8 *blocks [MaxReceiveBatch];
+	uint32 sizes [MaxReceiveBatch];
+
+	// dataAvailable() processes the system events and consumes the pipe byte of the first user block
+	while ( (nb < maxNb) && dataAvailable() )
+	{
+		uint nbInQueue = receiveQueue().frontBatch( blocks, sizes, std::min( maxNb-nb, (uint)MaxReceiveBatch ) );
+		uint i;
+		for ( i=0; i!=nbInQueue; ++i )
+		{
+			// Stop at the next system event, it will be processed by dataAvailable()
+			if ( blocks[i][sizes[i]-1] != CBufNetBase::User )
+				break;
+		}
+#ifdef NL_OS_UNIX
+		if ( i > 1 )
+			readDataAvailablePipe( i-1 );
+#endif
+		// Move the blocks to the streams, without copy
+		buffers.resize( buffers.size() + i, CMemStream( true ) );
+		for ( uint j=0; j!=i; ++j )
+		{
+			receive( buffers[buffers.size()-i+j] );
+		}
+		nb += i;
+	}
+	return nb;
+}
+
+
 /*
  * Update the network (call this method evenly)
  */
@@ -304,6 +520,11 @@ void CBufClient::disconnect( bool quick )
 	// Do not allow to disconnect a socket that is not connected
 	nlassert( _BufSock->connectedState() );
 
+#ifdef NL_NET_HAS_EPOLL
+	// The shared thread must not receive anymore when the receive queue is emptied
+	unwatchConnection();
+#endif
+
 	// When the NS tells us to remove this connection AND the connection has physically
 	// disconnected but not yet logically (i.e. disconnection event not processed yet),
 	// skip flushing and physical active disconnection
@@ -319,12 +540,13 @@ void CBufClient::disconnect( bool quick )
 		_BufSock->disconnect( false );
 	}
 
-	// Empty the receive queue
-	{
-		CFifoAccessor recvfifo( &receiveQueue() );
-		recvfifo.value().clear();
-		setDataAvailableFlag( false );
-	}
+	// Empty the receive queue, with the bytes of its blocks in the pipe (that may be shared
+	// by several clients, see setExternalPipeForDataAvailable())
+#ifdef NL_OS_UNIX
+	readDataAvailablePipe( receiveQueue().nbBlocks() );
+#endif
+	receiveQueue().clear();
+	clearPendingEvents();
 }
 
 
@@ -388,6 +610,14 @@ CBufClient::~CBufClient()
 		disconnect( true );
 	}
 
+#ifdef NL_NET_HAS_EPOLL
+	if ( _ReceiveEngine == SharedEngine )
+	{
+		unwatchConnection();
+		releaseSharedReceiveThreads();
+	}
+#endif
+
 	// Clean thread termination
 	if ( _RecvThread != NULL )
 	{
@@ -472,6 +702,313 @@ void CClientReceiveTask::run()
 	NbNetworkTask--;
 }
 
+#ifdef NL_NET_HAS_EPOLL
+
+/*
+ * Remove the connection from its shared receive thread, if any
+ */
+void CBufClient::unwatchConnection()
+{
+	if ( _SharedLoop != NULL )
+	{
+		_SharedLoop->unwatch( this );
+		_SharedLoop = NULL;
+	}
+}
+
+
+/***************************************************************************************************
+ * Shared receive thread
+ **************************************************************************************************/
+
+
+/*
+ * Constructor
+ */
+CClientReceiveLoop::CClientReceiveLoop() :
+	NbLoop( 0 ),
+	_ClientInUse( NULL ),
+	_NextKey( 1 ), // 0 is the wake-up pipe
+	_EpollHandle( -1 ),
+	_ExitRequired( false )
+{
+	_WakeUpPipeHandle[PipeRead] = -1;
+	_WakeUpPipeHandle[PipeWrite] = -1;
+}
+
+
+/*
+ * Create the epoll set and register the read end of the wake-up pipe into it
+ */
+bool CClientReceiveLoop::init()
+{
+	if ( pipe( _WakeUpPipeHandle ) == -1 )
+	{
+		nlwarning( "LNETL1: Unable to create the wake-up pipe of a shared client receive thread (code %u)", CSock::getLastError() );
+		return false;
+	}
+	_EpollHandle = epoll_create( NbClientEpollEventsPerWait );
+	if ( _EpollHandle == -1 )
+	{
+		nlwarning( "LNETL1: epoll_create failed (code %u)", CSock::getLastError() );
+		return false;
+	}
+
+	// The pipe is level-triggered: one byte is read per wake-up
+	epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.u64 = 0;
+	if ( epoll_ctl( _EpollHandle, EPOLL_CTL_ADD, _WakeUpPipeHandle[PipeRead], &ev ) == -1 )
+	{
+		nlwarning( "LNETL1: Unable to add the wake-up pipe to the epoll set (code %u)", CSock::getLastError() );
+		return false;
+	}
+	return true;
+}
+
+
+/*
+ * Destructor
+ */
+CClientReceiveLoop::~CClientReceiveLoop()
+{
+	if ( _EpollHandle != -1 )
+		close( _EpollHandle );
+	if ( _WakeUpPipeHandle[PipeRead] != -1 )
+		close( _WakeUpPipeHandle[PipeRead] );
+	if ( _WakeUpPipeHandle[PipeWrite] != -1 )
+		close( _WakeUpPipeHandle[PipeWrite] );
+}
+
+
+/*
+ * Tells the thread to exit and wakes it up
+ */
+void CClientReceiveLoop::requireExit()
+{
+	_ExitRequired = true;
+	uint8 b = 0;
+	if ( write( _WakeUpPipeHandle[PipeWrite], &b, 1 ) == -1 )
+	{
+		LNETL1_DEBUG( "LNETL1: In CClientReceiveLoop::requireExit(): write() failed" );
+	}
+}
+
+
+/*
+ * Add the connection of the client into the epoll set (edge-triggered)
+ */
+void CClientReceiveLoop::watch( CBufClient *client )
+{
+	CAutoMutex<CMutex> automutex( _Mutex );
+	uint64 key = _NextKey++;
+	epoll_event ev;
+	ev.events = EPOLLIN | EPOLLET;
+	ev.data.u64 = key;
+	// If data is already there, the event is reported as well
+	if ( epoll_ctl( _EpollHandle, EPOLL_CTL_ADD, client->_BufSock->Sock->descriptor(), &ev ) == -1 )
+	{
+		nlwarning( "LNETL1: Unable to add %s to the epoll set (code %u), disconnecting it", client->_BufSock->asString().c_str(), CSock::getLastError() );
+		client->_BufSock->Sock->disconnect();
+		return;
+	}
+	_Clients.insert( make_pair( key, client ) );
+	client->_SharedLoop = this;
+	client->_SharedKey = key;
+}
+
+
+/*
+ * Remove the connection of the client from the epoll set
+ */
+void CClientReceiveLoop::unwatch( CBufClient *client )
+{
+	_Mutex.enter();
+
+	// Wait until the thread has finished reading the socket (it never waits for the user thread)
+	while ( _ClientInUse == client )
+	{
+		_Mutex.leave();
+		yieldThread();
+		_Mutex.enter();
+	}
+
+	TClients::iterator it = _Clients.find( client->_SharedKey );
+	if ( it != _Clients.end() )
+	{
+		epoll_event ev; // not used but must not be NULL on old kernels
+		epoll_ctl( _EpollHandle, EPOLL_CTL_DEL, client->_BufSock->Sock->descriptor(), &ev );
+		_Clients.erase( it );
+	}
+	_Mutex.leave();
+}
+
+
+/*
+ * Returns the number of connections handled by the thread
+ */
+uint CClientReceiveLoop::numberOfConnections()
+{
+	CAutoMutex<CMutex> automutex( _Mutex );
+	return (uint)_Clients.size();
+}
+
+
+/*
+ * Code of the shared receive thread. Unlike CClientReceiveTask, it does not poll the connections
+ * with a timeout: a socket is removed from the set by the thread when it gets disconnected, or by
+ * the user thread before closing it.
+ */
+void CClientReceiveLoop::run()
+{
+	NbClientReceiveTask++;
+	NbNetworkTask++;
+	nlnettrace( "CClientReceiveLoop::run" );
+
+	// Not on the stack, the receive threads have a small one
+	vector<epoll_event> events( NbClientEpollEventsPerWait );
+
+	vector<uint64> stalledKeys;
+
+	while ( ! _ExitRequired )
+	{
+		// Wake up periodically while a receive queue is full
+		int timeout = _StalledKeys.empty() ? -1 : StalledClientRetryDelay;
+		int res = epoll_wait( _EpollHandle, &events[0], NbClientEpollEventsPerWait, timeout );
+		if ( res == -1 )
+		{
+			// we'll ignore message (Interrupted system call) caused by a CTRL-C
+			if ( errno == EINTR )
+			{
+				continue;
+			}
+			nlwarning( "LNETL1: epoll_wait failed (in shared client receive thread): %s (code %u)", CSock::errorString( CSock::getLastError() ).c_str(), CSock::getLastError() );
+			break;
+		}
+
+		for ( int i=0; i!=res; ++i )
+		{
+			if ( events[i].data.u64 == 0 )
+			{
+				uint8 b;
+				if ( read( _WakeUpPipeHandle[PipeRead], &b, 1 ) == -1 ) // we were woken-up by the wake-up pipe
+				{
+					LNETL1_DEBUG( "LNETL1: In CClientReceiveLoop::run(): read() failed" );
+				}
+				continue;
+			}
+
+			// A stalled connection is read below
+			if ( _StalledKeys.find( events[i].data.u64 ) == _StalledKeys.end() )
+			{
+				receive( events[i].data.u64 );
+			}
+		}
+
+		// Retry the connections whose receive queue was full
+		stalledKeys.assign( _StalledKeys.begin(), _StalledKeys.end() );
+		for ( uint i=0; i!=stalledKeys.size(); ++i )
+		{
+			receive( stalledKeys[i] );
+		}
+
+		NbLoop++;
+	}
+
+	nlnettrace( "Exiting CClientReceiveLoop::run()" );
+	NbClientReceiveTask--;
+	NbNetworkTask--;
+}
+
+
+/*
+ * Read the socket of a client. The mutex is not held while reading, so that the user thread
+ * is not blocked meanwhile: the client is pinned by _ClientInUse instead (see unwatch()).
+ */
+void CClientReceiveLoop::receive( uint64 key )
+{
+	CBufClient *client;
+	{
+		// The connection may have been removed after epoll_wait()
+		CAutoMutex<CMutex> automutex( _Mutex );
+		TClients::iterator it = _Clients.find( key );
+		if ( it == _Clients.end() )
+		{
+			_StalledKeys.erase( key );
+			return;
+		}
+		client = (*it).second;
+		_ClientInUse = client;
+	}
+
+	bool stalled = (_StalledKeys.find( key ) != _StalledKeys.end());
+	bool connected = drain( client, stalled );
+	if ( stalled )
+		_StalledKeys.insert( key );
+	else
+		_StalledKeys.erase( key );
+
+	CAutoMutex<CMutex> automutex( _Mutex );
+	_ClientInUse = NULL;
+	if ( ! connected )
+	{
+		// The disconnection is advertised by CBufClient::update()
+		epoll_event ev;
+		epoll_ctl( _EpollHandle, EPOLL_CTL_DEL, client->_BufSock->Sock->descriptor(), &ev );
+		_Clients.erase( key );
+	}
+}
+
+
+/*
+ * Read everything the socket holds. With edge-triggering, no other event will be reported for
+ * the socket until the input buffer has been emptied. If the receive queue is full, the socket
+ * is left as is and the received block is kept in the bufsock, until the next call.
+ */
+bool CClientReceiveLoop::drain( CBufClient *client, bool& stalled )
+{
+	CNonBlockingBufSock *bufsock = client->_BufSock;
+	if ( stalled )
+	{
+		if ( ! client->tryPushMessageIntoReceiveQueue( bufsock->receivedBuffer() ) )
+			return true;
+		stalled = false;
+	}
+	if ( ! bufsock->Sock->connected() )
+		return false;
+
+	try
+	{
+		for (;;)
+		{
+			if ( bufsock->receivePart( 1 ) ) // 1 for the event type
+			{
+				bufsock->fillEventTypeOnly();
+
+				// Push message into receive queue, unless it is full
+				if ( ! client->tryPushMessageIntoReceiveQueue( bufsock->receivedBuffer() ) )
+				{
+					stalled = true;
+					return true;
+				}
+			}
+			else if ( bufsock->receiveDrained() || (! bufsock->Sock->connected()) )
+			{
+				break;
+			}
+		}
+	}
+	catch ( ESocket& )
+	{
+		LNETL1_DEBUG( "LNETL1: Client connection %s broken", bufsock->asString().c_str() );
+		bufsock->Sock->disconnect();
+	}
+	return bufsock->Sock->connected();
+}
+
+#endif // NL_NET_HAS_EPOLL
+
+
 NLMISC_CATEGORISED_VARIABLE(nel, uint32, NbClientReceiveTask, "Number of client receive thread");
 
 
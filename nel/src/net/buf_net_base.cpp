@@ -27,6 +27,10 @@
 
 #include "nel/net/buf_net_base.h"
 
+#ifdef NL_OS_UNIX
+#	include <errno.h>
+#endif
+
 using namespace NLMISC;
 using namespace std;
 
@@ -51,16 +55,18 @@ uint32 CBufNetBase::DefaultMaxSentBlockSize = 1048576; // 10 M unless changed by
  * Constructor
  */
 #ifdef NL_OS_UNIX
-CBufNetBase::CBufNetBase( bool isDataAvailablePipeSelfManaged ) :
+CBufNetBase::CBufNetBase( bool isDataAvailablePipeSelfManaged, uint32 receiveQueueCapacity ) :
 #else
-CBufNetBase::CBufNetBase() :
+CBufNetBase::CBufNetBase( uint32 receiveQueueCapacity ) :
 #endif
-	_RecvFifo("CBufNetBase::_RecvFifo"),
+	_RecvFifo( receiveQueueCapacity, "LNETL1 receive queue" ),
 	_DisconnectionCallback( NULL ),
 	_DisconnectionCbArg( NULL ),
 	_MaxExpectedBlockSize( DefaultMaxExpectedBlockSize ),
-	_MaxSentBlockSize( DefaultMaxSentBlockSize ),
-	_DataAvailable( false )
+	_MaxSentBlockSize( DefaultMaxSentBlockSize )
+#ifdef NL_OS_UNIX
+	, _NbPipeBytesMissing( 0 )
+#endif
 {
 	// Debug info for mutexes
 #ifdef MUTEX_DEBUG
@@ -92,26 +98,45 @@ CBufNetBase::~CBufNetBase()
 }
 
 
+#ifdef NL_OS_UNIX
 /*
- * Push message into receive queue (mutexed)
- * TODO OPTIM never use this function
+ * Consumes nb bytes of the data available pipe
  */
-void	CBufNetBase::pushMessageIntoReceiveQueue( const std::vector<uint8>& buffer )
+void	CBufNetBase::readDataAvailablePipe( uint nb )
 {
-	//sint32 mbsize;
+	// The blocks may be visible in the queue slightly before their byte is written by the
+	// receive thread, so read() may return less than requested: loop (read() blocks if needed)
+	uint missing = std::min( nb, _NbPipeBytesMissing );
+	nb -= missing;
+	_NbPipeBytesMissing -= missing;
+
+	uint8 bytes [MaxReceiveBatch];
+	while ( nb != 0 )
 	{
-		//nldebug( "BNB: Acquiring the receive queue... ");
-		CFifoAccessor recvfifo( &_RecvFifo );
-		//nldebug( "BNB: Acquired, pushing the received buffer... ");
-		recvfifo.value().push( buffer );
-		//nldebug( "BNB: Pushed, releasing the receive queue..." );
-		//mbsize = recvfifo.value().size() / 1048576;
-		setDataAvailableFlag( true );
+		ssize_t r = read( _DataAvailablePipeHandle[PipeRead], bytes, std::min( nb, (uint)MaxReceiveBatch ) );
+		if ( r <= 0 )
+		{
+			if ( (r == -1) && (errno == EINTR) )
+				continue;
+			nlwarning( "LNETL1: Read pipe failed in readDataAvailablePipe" );
+			return;
+		}
+		nb -= (uint)r;
 	}
+}
+#endif
+
+
+/*
+ * Push message into receive queue (lock-free)
+ * TODO OPTIM never use this function
+ */
+void	CBufNetBase::pushMessageIntoReceiveQueue( const std::vector<uint8>& buffer )
+{
+	_RecvFifo.push( buffer );
 #ifdef NL_OS_UNIX
-	// Wake-up main thread (outside the critical section of CFifoAccessor, to allow main thread to be
-	// read the fifo; if the main thread sees the Data Available flag is true but the pipe not written
-	// yet, it will block on read()).
+	// Wake-up main thread (after the push, to allow main thread to read the fifo; if the main
+	// thread sees the fifo not empty but the pipe not written yet, it will block on read()).
 	uint8 b=0;
 	if ( write( _DataAvailablePipeHandle[PipeWrite], &b, 1 ) == -1 )
 	{
@@ -127,29 +152,53 @@ void	CBufNetBase::pushMessageIntoReceiveQueue( const std::vector<uint8>& buffer
 }
 
 /*
- * Push message into receive queue (mutexed)
+ * Push message into receive queue without copying it (lock-free)
  */
-void	CBufNetBase::pushMessageIntoReceiveQueue( const uint8 *buffer, uint32 size )
+void	CBufNetBase::pushMessageIntoReceiveQueue( CReceiveFIFO::TBlock& buffer )
 {
-	//sint32 mbsize;
+	_RecvFifo.pushNoCopy( buffer );
+#ifdef NL_OS_UNIX
+	// Wake-up main thread
+	uint8 b=0;
+	if ( write( _DataAvailablePipeHandle[PipeWrite], &b, 1 ) == -1 )
 	{
-		//nldebug( "BNB: Acquiring the receive queue... ");
-		CFifoAccessor recvfifo( &_RecvFifo );
-		//nldebug( "BNB: Acquired, pushing the received buffer... ");
-		recvfifo.value().push( buffer, size );
-		//nldebug( "BNB: Pushed, releasing the receive queue..." );
-		//mbsize = recvfifo.value().size() / 1048576;
-		setDataAvailableFlag( true );
+		nlwarning( "LNETL1: Write pipe failed in pushMessageIntoReceiveQueue" );
+	}
+#endif
+}
+
+/*
+ * Push message into receive queue without copying it, if the queue is not full (lock-free)
+ */
+bool	CBufNetBase::tryPushMessageIntoReceiveQueue( CReceiveFIFO::TBlock& buffer )
+{
+	if ( ! _RecvFifo.tryPushNoCopy( buffer ) )
+		return false;
 #ifdef NL_OS_UNIX
-		// Wake-up main thread
-		uint8 b=0;
-		if ( write( _DataAvailablePipeHandle[PipeWrite], &b, 1 ) == -1 )
-		{
-			nlwarning( "LNETL1: Write pipe failed in pushMessageIntoReceiveQueue" );
-		}
-		nldebug( "Pipe: 1 byte written" );
+	// Wake-up main thread
+	uint8 b=0;
+	if ( write( _DataAvailablePipeHandle[PipeWrite], &b, 1 ) == -1 )
+	{
+		nlwarning( "LNETL1: Write pipe failed in tryPushMessageIntoReceiveQueue" );
+	}
 #endif
+	return true;
+}
+
+/*
+ * Push message into receive queue (lock-free)
+ */
+void	CBufNetBase::pushMessageIntoReceiveQueue( const uint8 *buffer, uint32 size )
+{
+	_RecvFifo.push( buffer, size );
+#ifdef NL_OS_UNIX
+	// Wake-up main thread
+	uint8 b=0;
+	if ( write( _DataAvailablePipeHandle[PipeWrite], &b, 1 ) == -1 )
+	{
+		nlwarning( "LNETL1: Write pipe failed in pushMessageIntoReceiveQueue" );
 	}
+#endif
 	//nldebug( "BNB: Released." );
 	/*if ( mbsize > 1 )
 	{
@@ -159,6 +208,36 @@ void	CBufNetBase::pushMessageIntoReceiveQueue( const uint8 *buffer, uint32 size
 
 
 
+/*
+ * Push a system event into receive queue from the user thread
+ */
+void	CBufNetBase::pushEventIntoReceiveQueue( const std::vector<uint8>& buffer )
+{
+	// Keep the order of the events: if some are already pending, this one waits behind them
+	_PendingEvents.push_back( buffer );
+	flushPendingEvents();
+}
+
+/*
+ * Move the pending system events into the receive queue, as long as it is not full
+ */
+void	CBufNetBase::flushPendingEvents()
+{
+	while ( ! _PendingEvents.empty() )
+	{
+		const std::vector<uint8>& buffer = _PendingEvents.front();
+		if ( ! _RecvFifo.tryPush( &buffer[0], (uint32)buffer.size() ) )
+			return; // retried by the next dataAvailable(), after some blocks are popped
+		_PendingEvents.pop_front();
+#ifdef NL_OS_UNIX
+		// No byte is written into the pipe: when it is full, write() would block the only thread
+		// that reads it. The next pipe read skips the missing byte instead.
+		++_NbPipeBytesMissing;
+#endif
+	}
+}
+
+
 NLMISC_CATEGORISED_VARIABLE(nel, uint32, NbNetworkTask, "Number of server and client thread");
 	
 } // NLNET
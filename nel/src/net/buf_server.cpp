@@ -39,6 +39,11 @@
 #	include <sys/time.h>
 #endif
 
+#ifdef NL_NET_HAS_EPOLL
+#	include <sys/epoll.h>
+#	include <errno.h>
+#endif
+
 /*
  * On Linux, the default limit of descriptors is usually 1024, you can increase it with ulimit
  */
@@ -51,6 +56,15 @@ namespace NLNET {
 uint32 	NbServerListenTask = 0;
 uint32 	NbServerReceiveTask = 0;
 
+#ifdef NL_NET_HAS_EPOLL
+CBufServer::TReceiveEngine CBufServer::_DefaultReceiveEngine = CBufServer::EpollEngine;
+#else
+CBufServer::TReceiveEngine CBufServer::_DefaultReceiveEngine = CBufServer::SelectEngine;
+#endif
+
+/// Max number of events returned by one epoll_wait() call
+static const int NbEpollEventsPerWait = 256;
+
 /***************************************************************************************************
  * User main thread (initialization)
  **************************************************************************************************/
@@ -61,9 +75,9 @@ uint32 	NbServerReceiveTask = 0;
 CBufServer::CBufServer( TThreadStategy strategy,
 	uint16 max_threads, uint16 max_sockets_per_thread, bool nodelay, bool replaymode, bool initPipeForDataAvailable ) :
 #ifdef NL_OS_UNIX
-	CBufNetBase( initPipeForDataAvailable ),
+	CBufNetBase( initPipeForDataAvailable, ServerReceiveQueueCapacity ),
 #else
-	CBufNetBase(),
+	CBufNetBase( ServerReceiveQueueCapacity ),
 #endif
 	_ThreadStrategy( strategy ),
 	_MaxThreads( max_threads ),
@@ -79,7 +93,8 @@ CBufServer::CBufServer( TThreadStategy strategy,
 	_PrevBytesPushedOut( 0 ),
 	_NbConnections (0),
 	_NoDelay( nodelay ),
-	_ReplayMode( replaymode )
+	_ReplayMode( replaymode ),
+	_ReceiveEngine( _DefaultReceiveEngine )
 {
 	nlnettrace( "CBufServer::CBufServer" );
 	if ( ! _ReplayMode )
@@ -97,12 +112,18 @@ CBufServer::CBufServer( TThreadStategy strategy,
 /*
  * Listens on the specified port
  */
-void CBufServer::init( uint16 port )
+void CBufServer::init( uint16 port, bool reusePort )
 {
 	nlnettrace( "CBufServer::init" );
 	if ( ! _ReplayMode )
 	{
-		_ListenTask->init( port, maxExpectedBlockSize() );
+		_ListenTask->init( port, maxExpectedBlockSize(), reusePort );
+#ifdef NL_NET_HAS_EPOLL
+		if ( _ReceiveEngine == EpollEngine )
+		{
+			_ListenTask->useEpoll();
+		}
+#endif
 		_ListenThread->start();
 	}
 	else
@@ -115,14 +136,44 @@ void CBufServer::init( uint16 port )
 /*
  * Begins to listen on the specified port (call before running thread)
  */
-void CListenTask::init( uint16 port, sint32 maxExpectedBlockSize )
+void CListenTask::init( uint16 port, sint32 maxExpectedBlockSize, bool reusePort )
 {
 	nlnettrace( "CListenTask::init" );
+	if ( reusePort )
+	{
+		_ListenSock.setReusePort( true );
+	}
 	_ListenSock.init( port );
 	_MaxExpectedBlockSize = maxExpectedBlockSize;
 }
 
 
+/*
+ * Returns the server that accepted the specified connection
+ */
+CBufServer *CBufServer::ownerOf( TSockId hostid )
+{
+	nlassert( hostid != InvalidSockId );
+	return static_cast<CServerBufSock*>(static_cast<CBufSock*>(hostid))->ownerServer();
+}
+
+
+/*
+ * Sets the engine used by the servers created afterwards
+ */
+void CBufServer::setDefaultReceiveEngine( TReceiveEngine engine )
+{
+#ifndef NL_NET_HAS_EPOLL
+	if ( engine == EpollEngine )
+	{
+		nlwarning( "LNETL1: epoll is not available on this system, using select" );
+		engine = SelectEngine;
+	}
+#endif
+	_DefaultReceiveEngine = engine;
+}
+
+
 /***************************************************************************************************
  * User main thread (running)
  **************************************************************************************************/
@@ -131,7 +182,11 @@ void CListenTask::init( uint16 port, sint32 maxExpectedBlockSize )
 /*
  * Constructor
  */
-CServerTask::CServerTask() : NbLoop (0), _ExitRequired(false)
+CServerTask::CServerTask() : NbLoop (0),
+#ifdef NL_NET_HAS_EPOLL
+	_EpollHandle(-1),
+#endif
+	_ExitRequired(false)
 {
 #ifdef NL_OS_UNIX
 	pipe( _WakeUpPipeHandle );
@@ -139,6 +194,36 @@ CServerTask::CServerTask() : NbLoop (0), _ExitRequired(false)
 }
 
 
+#ifdef NL_NET_HAS_EPOLL
+/*
+ * Create the epoll set and register the read end of the wake-up pipe into it
+ */
+bool CServerTask::initEpoll()
+{
+	nlassert( _EpollHandle == -1 );
+	_EpollHandle = epoll_create( NbEpollEventsPerWait );
+	if ( _EpollHandle == -1 )
+	{
+		nlwarning( "LNETL1: epoll_create failed (code %u), falling back to select", CSock::getLastError() );
+		return false;
+	}
+
+	// The pipe is level-triggered: one byte is read per wake-up, as in the select loop
+	epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	if ( epoll_ctl( _EpollHandle, EPOLL_CTL_ADD, _WakeUpPipeHandle[PipeRead], &ev ) == -1 )
+	{
+		nlwarning( "LNETL1: Unable to add the wake-up pipe to the epoll set (code %u), falling back to select", CSock::getLastError() );
+		::close( _EpollHandle );
+		_EpollHandle = -1;
+		return false;
+	}
+	return true;
+}
+#endif
+
+
 
 #ifdef NL_OS_UNIX
 /*
@@ -160,6 +245,12 @@ void CServerTask::wakeUp()
  */
 CServerTask::~CServerTask()
 {
+#ifdef NL_NET_HAS_EPOLL
+	if ( _EpollHandle != -1 )
+	{
+		close( _EpollHandle );
+	}
+#endif
 #ifdef NL_OS_UNIX
 	close( _WakeUpPipeHandle[PipeRead] );
 	close( _WakeUpPipeHandle[PipeWrite] );
@@ -361,22 +452,21 @@ bool CBufServer::dataAvailable()
 {
 	// slow down the layer H_AUTO (CBufServer_dataAvailable);
 	{
+		// The system events pushed by the user thread may be waiting for room in the receive queue
+		flushPendingEvents();
+
 		/* If no data available, enter the 'while' loop and return false (1 volatile test)
 		 * If there are user data available, enter the 'while' and return true immediately (1 volatile test + 1 short locking)
 		 * If there is a connection/disconnection event (rare), call the callback and loop
 		 */
 		while ( dataAvailableFlag() )
 		{
-			// Because _DataAvailable is true, the receive queue is not empty at this point
+			// Because dataAvailableFlag() is true, the receive queue is not empty at this point
 			vector<uint8> buffer;
-			uint8 val;
+			uint8 val = receiveQueue().frontLast();
+			if ( val != CBufNetBase::User )
 			{
-				CFifoAccessor recvfifo( &receiveQueue() );
-				val = recvfifo.value().frontLast();
-				if ( val != CBufNetBase::User )
-				{
-					recvfifo.value().front( buffer );
-				}
+				receiveQueue().front( buffer );
 			}
 
 			/*sint32 mbsize = recvfifo.value().size() / 1048576;
@@ -389,9 +479,7 @@ bool CBufServer::dataAvailable()
 			recvfifo.value().front( buffer );*/
 
 #ifdef NL_OS_UNIX
-			uint8 b;
-			if ( read( _DataAvailablePipeHandle[PipeRead], &b, 1 ) == -1 )
-				nlwarning( "LNETL1: Read pipe failed in dataAvailable" );
+			readDataAvailablePipe( 1 );
 			//nldebug( "Pipe: 1 byte read (server %p)", this );
 #endif
 
@@ -451,22 +539,16 @@ bool CBufServer::dataAvailable()
 				LNETL1_INFO( "LNETL1: Invalid block type: %hu (should be = to %hu", (uint16)(buffer[buffer.size()-1]), (uint16)(val) );
 				LNETL1_INFO( "LNETL1: Buffer (%d B): [%s]", buffer.size(), stringFromVector(buffer).c_str() );
 				LNETL1_INFO( "LNETL1: Receive queue:" );
-				{
-					CFifoAccessor recvfifo( &receiveQueue() );
-					recvfifo.value().display();
-				}
+				receiveQueue().display();
 				nlerror( "LNETL1: Invalid system event type in server receive queue" );
 
 			}
 
 			// Extract system event
-			{
-				CFifoAccessor recvfifo( &receiveQueue() );
-				recvfifo.value().pop();
-				setDataAvailableFlag( ! recvfifo.value().empty() );
-			}
+			receiveQueue().pop();
+			flushPendingEvents();
 		}
-		// _DataAvailable is false here
+		// The receive queue is empty here
 		return false;
 	}
 }
@@ -490,7 +572,7 @@ void	CBufServer::sleepUntilDataAvailable( uint usecMax )
 		FD_ZERO( &readers );
 		FD_SET( _DataAvailablePipeHandle[PipeRead], &readers );
 		tv.tv_sec = 0;
-		tv.tv_usec = usecMax;
+		tv.tv_usec = dataAvailableFlag() ? 0 : usecMax; // a system event pushed by this thread has no byte in the pipe
 		int res = ::select( _DataAvailablePipeHandle[PipeRead]+1, &readers, NULL, NULL, &tv );
 		if ( res == -1 )
 			nlerror( "LNETL1: Select failed in sleepUntilDataAvailable (code %u)", CSock::getLastError() );
@@ -510,13 +592,12 @@ void CBufServer::receive( CMemStream& buffer, TSockId* phostid )
 	//nlassert( dataAvailable() );
 	nlassert( phostid != NULL );
 
-	{
-		CFifoAccessor recvfifo( &receiveQueue() );
-		nlassert( ! recvfifo.value().empty() );
-		recvfifo.value().front( buffer );
-		recvfifo.value().pop();
-		setDataAvailableFlag( ! recvfifo.value().empty() );
-	}
+	// Move the block from the receive queue to the stream, without copy
+	nlassert( ! receiveQueue().empty() );
+	CReceiveFIFO::TBlock block;
+	receiveQueue().pop( block );
+	buffer.clear();
+	buffer.swapBuffer( block );
 
 	// Extract hostid (and event type)
 	*phostid = *((TSockId*)&(buffer.buffer()[buffer.size()-sizeof(TSockId)-1]));
@@ -532,6 +613,43 @@ void CBufServer::receive( CMemStream& buffer, TSockId* phostid )
 }
 
 
+/*
+ * Receives up to maxNb blocks of data in one call
+ */
+uint CBufServer::receiveBatch( std::vector<NLMISC::CMemStream>& buffers, std::vector<TSockId>& hostids, uint maxNb )
+{
+	uint nb = 0;
+	uint8 *blocks [MaxReceiveBatch];
+	uint32 sizes [MaxReceiveBatch];
+
+	// dataAvailable() processes the system events and consumes the pipe byte of the first user block
+	while ( (nb < maxNb) && dataAvailable() )
+	{
+		uint nbInQueue = receiveQueue().frontBatch( blocks, sizes, std::min( maxNb-nb, (uint)MaxReceiveBatch ) );
+		uint i;
+		for ( i=0; i!=nbInQueue; ++i )
+		{
+			// Stop at the next system event, it will be processed by dataAvailable()
+			if ( blocks[i][sizes[i]-1] != CBufNetBase::User )
+				break;
+		}
+#ifdef NL_OS_UNIX
+		if ( i > 1 )
+			readDataAvailablePipe( i-1 );
+#endif
+		// Move the blocks to the streams, without copy
+		buffers.resize( buffers.size() + i, CMemStream( true ) );
+		hostids.resize( hostids.size() + i );
+		for ( uint j=0; j!=i; ++j )
+		{
+			receive( buffers[buffers.size()-i+j], &hostids[hostids.size()-i+j] );
+		}
+		nb += i;
+	}
+	return nb;
+}
+
+
 /*
  * Update the network (call this method evenly)
  */
@@ -742,6 +860,29 @@ uint64 CBufServer::newBytesSent()
  **************************************************************************************************/
 
 
+#ifdef NL_NET_HAS_EPOLL
+/*
+ * Switch the accept loop to epoll()
+ */
+void CListenTask::useEpoll()
+{
+	if ( ! initEpoll() )
+		return;
+
+	// Level-triggered: accept() is called once per wake-up, as in the select loop
+	epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.ptr = &_ListenSock;
+	if ( epoll_ctl( _EpollHandle, EPOLL_CTL_ADD, _ListenSock.descriptor(), &ev ) == -1 )
+	{
+		nlwarning( "LNETL1: Unable to add the listen socket to the epoll set (code %u), falling back to select", CSock::getLastError() );
+		::close( _EpollHandle );
+		_EpollHandle = -1;
+	}
+}
+#endif
+
+
 /*
  * Code of listening thread
  */
@@ -765,6 +906,43 @@ void CListenTask::run()
 		{
 			LNETL1_DEBUG( "LNETL1: Waiting incoming connection..." );
 			// Get and setup the new socket
+#ifdef NL_NET_HAS_EPOLL
+			if ( usingEpoll() )
+			{
+				epoll_event events [2];
+				int res = epoll_wait( _EpollHandle, events, 2, -1 ); /// Wait indefinitely
+				if ( res == -1 )
+				{
+					// we'll ignore message (Interrupted system call) caused by a CTRL-C
+					if ( errno == EINTR )
+					{
+						continue;
+					}
+					nlerror( "LNETL1: epoll_wait failed (in listen thread): %s (code %u)", CSock::errorString( CSock::getLastError() ).c_str(), CSock::getLastError() );
+				}
+
+				bool wokenUp = false;
+				for ( int i=0; i!=res; ++i )
+				{
+					if ( events[i].data.ptr == NULL )
+					{
+						wokenUp = true;
+					}
+				}
+				if ( wokenUp )
+				{
+					uint8 b;
+					if ( read( _WakeUpPipeHandle[PipeRead], &b, 1 ) == -1 ) // we were woken-up by the wake-up pipe
+					{
+						LNETL1_DEBUG( "LNETL1: In CListenTask::run(): read() failed" );
+					}
+					LNETL1_DEBUG( "LNETL1: listen thread epoll woken-up" );
+					continue;
+				}
+			}
+			else
+#endif
+			{
 #ifdef NL_OS_UNIX
 			FD_ZERO( &readers );
 			FD_SET( _ListenSock.descriptor(), &readers );
@@ -805,12 +983,14 @@ void CListenTask::run()
 				continue;
 			}
 #endif
+			}
 			LNETL1_DEBUG( "LNETL1: Accepting an incoming connection..." );
 			CTcpSock *newSock = _ListenSock.accept();
 			if (newSock != NULL)
 			{
 				CServerBufSock *bufsock = new CServerBufSock( newSock );
 				LNETL1_DEBUG( "LNETL1: New connection : %s", bufsock->asString().c_str() );
+				bufsock->setOwnerServer( _Server );
 				bufsock->setNonBlocking();
 				bufsock->setMaxExpectedBlockSize( _MaxExpectedBlockSize );
 				if ( _Server->noDelay() )
@@ -949,7 +1129,7 @@ void CBufServer::addNewThread( CThreadPool& threadpool, CServerBufSock *bufsock
 	nlassert( bufsock != NULL );
 
 	// Create new task and dispatch the socket to it
-	CServerReceiveTask *task = new CServerReceiveTask( this );
+	CServerReceiveTask *task = new CServerReceiveTask( this, _ReceiveEngine );
 	bufsock->setOwnerTask( task );
 	task->addNewSocket( bufsock );
 
@@ -969,6 +1149,25 @@ void CBufServer::addNewThread( CThreadPool& threadpool, CServerBufSock *bufsock
  **************************************************************************************************/
 
 
+/*
+ * Constructor
+ */
+CServerReceiveTask::CServerReceiveTask( CBufServer *server, CBufServer::TReceiveEngine engine ) :
+	CServerTask(),
+	_Server(server),
+	_Connections("CServerReceiveTask::_Connections"),
+	_RemoveSet("CServerReceiveTask::_RemoveSet")
+{
+#ifdef NL_NET_HAS_EPOLL
+	// Created now because the sockets are added before the thread runs
+	if ( engine == CBufServer::EpollEngine )
+	{
+		initEpoll();
+	}
+#endif
+}
+
+
 /*
  * Code of receiving threads for servers
  */
@@ -978,13 +1177,35 @@ void CServerReceiveTask::run()
 	NbServerReceiveTask++;
 	nlnettrace( "CServerReceiveTask::run" );
 
-	SOCKET descmax;
-	fd_set readers;
-
 #if defined NL_OS_UNIX
 	// POLL7
 	nice( 2 ); // is this really useful as long as select() sleeps?
 #endif // NL_OS_UNIX
+
+#ifdef NL_NET_HAS_EPOLL
+	if ( usingEpoll() )
+	{
+		runEpoll();
+	}
+	else
+#endif
+	{
+		runSelect();
+	}
+
+	nlnettrace( "Exiting CServerReceiveTask::run" );
+	NbServerReceiveTask--;
+	NbNetworkTask--;
+}
+
+
+/*
+ * Receive loop waiting with select() on a copy of _Connections
+ */
+void CServerReceiveTask::runSelect()
+{
+	SOCKET descmax;
+	fd_set readers;
 	
 	// Copy of _Connections
 	vector<TSockId>	connections_copy;	
@@ -1085,7 +1306,7 @@ void CServerReceiveTask::run()
 				}*/
 				//nlerror( "LNETL1: Select failed (in receive thread): %s (code %u)", CSock::errorString( CSock::getLastError() ).c_str(), CSock::getLastError() );
 				LNETL1_DEBUG( "LNETL1: Select failed (in receive thread): %s (code %u)", CSock::errorString( CSock::getLastError() ).c_str(), CSock::getLastError() );
-				goto end;
+				return;
 		}
 
 		// 4. Get results
@@ -1160,13 +1381,125 @@ void CServerReceiveTask::run()
 
 		NbLoop++;
 	}
-end:
-	nlnettrace( "Exiting CServerReceiveTask::run" );
-	NbServerReceiveTask--;
-	NbNetworkTask--;
 }
 
 
+#ifdef NL_NET_HAS_EPOLL
+/*
+ * Receive loop waiting with epoll() on the persistent interest set.
+ * Unlike the select loop, _Connections is neither locked nor copied: the sockets are registered
+ * once by addNewSocket() and unregistered by clearClosedConnections(), that is called in this
+ * thread before waiting, so an event can never refer to a deleted socket.
+ */
+void CServerReceiveTask::runEpoll()
+{
+	// Not on the stack, the receive threads have a small one
+	vector<epoll_event> events( NbEpollEventsPerWait );
+
+	while ( ! exitRequired() )
+	{
+		// 1. Remove closed connections
+		clearClosedConnections();
+
+		// 2. Wait until a socket of this thread becomes readable, or until woken up
+		int res = epoll_wait( _EpollHandle, &events[0], NbEpollEventsPerWait, -1 );
+		if ( res == -1 )
+		{
+			// we'll ignore message (Interrupted system call) caused by a CTRL-C
+			if ( errno == EINTR )
+			{
+				continue;
+			}
+			LNETL1_DEBUG( "LNETL1: epoll_wait failed (in receive thread): %s (code %u)", CSock::errorString( CSock::getLastError() ).c_str(), CSock::getLastError() );
+			break;
+		}
+
+		// 3. Receive data from the active sockets only
+		for ( int i=0; i!=res; ++i )
+		{
+			if ( events[i].data.ptr == NULL )
+			{
+				uint8 b;
+				if ( read( _WakeUpPipeHandle[PipeRead], &b, 1 ) == -1 ) // we were woken-up by the wake-up pipe
+				{
+					LNETL1_DEBUG( "LNETL1: In CServerReceiveTask::run(): read() failed" );
+				}
+				LNETL1_DEBUG( "LNETL1: Receive thread epoll woken-up" );
+			}
+			else
+			{
+				drainSocket( (TSockId)events[i].data.ptr );
+			}
+		}
+
+		NbLoop++;
+	}
+}
+
+
+/*
+ * Add the socket into the epoll set (edge-triggered)
+ */
+void CServerReceiveTask::watchSocket( TSockId sockid )
+{
+	epoll_event ev;
+	ev.events = EPOLLIN | EPOLLET;
+	ev.data.ptr = sockid;
+	if ( epoll_ctl( _EpollHandle, EPOLL_CTL_ADD, sockid->Sock->descriptor(), &ev ) == -1 )
+	{
+		nlwarning( "LNETL1: Unable to add %s to the epoll set (code %u), disconnecting it", sockid->asString().c_str(), CSock::getLastError() );
+		sockid->Sock->disconnect();
+	}
+}
+
+
+/*
+ * Remove the socket from the epoll set (before deleting it)
+ */
+void CServerReceiveTask::unwatchSocket( TSockId sockid )
+{
+	// Closing the descriptor would remove it as well, but only if it has not been duplicated
+	epoll_event ev; // not used but must not be NULL on old kernels
+	epoll_ctl( _EpollHandle, EPOLL_CTL_DEL, sockid->Sock->descriptor(), &ev );
+}
+
+
+/*
+ * Read everything the socket holds. With edge-triggering, no other event will be reported for
+ * the socket until the input buffer has been emptied.
+ */
+void CServerReceiveTask::drainSocket( TSockId sockid )
+{
+	if ( ! sockid->Sock->connected() ) // exclude disconnected sockets that are not deleted
+		return;
+
+	CServerBufSock *serverbufsock = static_cast<CServerBufSock*>(static_cast<CBufSock*>(sockid));
+	try
+	{
+		for (;;)
+		{
+			if ( serverbufsock->receivePart( sizeof(TSockId) + 1 ) ) // +1 for the event type
+			{
+				serverbufsock->fillSockIdAndEventType( sockid );
+
+				// Push message into receive queue
+				_Server->pushMessageIntoReceiveQueue( serverbufsock->receivedBuffer() );
+			}
+			else if ( serverbufsock->receiveDrained() || (! sockid->Sock->connected()) )
+			{
+				break;
+			}
+		}
+	}
+	catch ( ESocket& )
+	{
+		LNETL1_DEBUG( "LNETL1: Connection %s broken", serverbufsock->asString().c_str() );
+		sockid->Sock->disconnect();
+	}
+}
+#endif
+
+
 /*
  * Delete all connections referenced in the remove list (double-mutexed)
  */
@@ -1190,6 +1523,13 @@ void CServerReceiveTask::clearClosedConnections()
 					// Remove from the connection list
 					connectionssync.value().erase( *ic );
 
+#ifdef NL_NET_HAS_EPOLL
+					if ( usingEpoll() )
+					{
+						unwatchSocket( sid );
+					}
+#endif
+
 					// Delete the socket object
 					delete sid;
 				}
@@ -42,7 +42,7 @@
 using namespace NLMISC;
 using namespace std;
 
-NLMISC::CVariable<uint32> MaxTCPPacketSize("nel", "MaxTCPPacketSize", "Maximum size of TCP packets created by cumulating small packets", 10240, 0, true);
+NLMISC::CVariable<uint32> MaxTCPPacketSize("nel", "MaxTCPPacketSize", "Maximum number of bytes of queued messages gathered in one send", 262144, 0, true);
 
 
 namespace NLNET {
@@ -96,7 +96,7 @@ CBufSock::~CBufSock()
 	_LastFlushTime = 0;
 	_TriggerTime = 0;
 	_TriggerSize = 0;
-	_ReadyToSendBuffer.clear ();
+	SendFifo.clear ();
 	_RTSBIndex = 0;
 	_AppId = 0;
 	_ConnectedState = false;
@@ -148,122 +148,129 @@ bool CBufSock::flush( uint *nbBytesRemaining )
 	nlassert (this != InvalidSockId);	// invalid bufsock
 	//nlnettrace( "CBufSock::flush" );
 
-	// Copy data from the send queue to _ReadyToSendBuffer
-	TBlockSize netlen;
-//	vector<uint8> tmpbuffer;
+	const uint8 *buffers [CSock::MaxSendBuffers];
+	uint32 lengths [CSock::MaxSendBuffers];
 
-	do
+	while ( ! SendFifo.empty() )
 	{
-		// Process each element in the send queue
-		uint8 *tmpbuffer;
-		uint32 size;
-		if (! SendFifo.empty())
+		// Gather the length prefix and the payload of the queued blocks, without copying them,
+		// starting from the first byte not sent yet
+		uint nbBuffers = 0;
+		uint32 nbBlocks = 0;
+		uint32 total = 0;
+		while ( (nbBlocks < SendFifo.nbBlocks()) && (nbBuffers+2 <= CSock::MaxSendBuffers) )
 		{
-			SendFifo.front( tmpbuffer, size );
-		}
-		while ( ! SendFifo.empty() && ( (_ReadyToSendBuffer.size()==0) || (_ReadyToSendBuffer.size() +size < MaxTCPPacketSize) ) )
-		{
-			// Compute the size and add it into the beginning of the buffer
-			netlen = htonl( (TBlockSize)size );
-			uint32 oldBufferSize = _ReadyToSendBuffer.size();
-			_ReadyToSendBuffer.resize (oldBufferSize+sizeof(TBlockSize)+size);
-			*(TBlockSize*)&(_ReadyToSendBuffer[oldBufferSize])=netlen;
-			//nldebug( "O-%u %u+L%u (0x%x)", Sock->descriptor(), oldBufferSize, size, size );
+			const CSendQueue::CBlock& block = SendFifo.block( nbBlocks );
+			if ( (total != 0) && (total + sizeof(TBlockSize) + block.Length > MaxTCPPacketSize) )
+				break;
 
-
-			// Append the temporary buffer to the global buffer
-			CFastMem::memcpy (&_ReadyToSendBuffer[oldBufferSize+sizeof(TBlockSize)], tmpbuffer, size);
-			SendFifo.pop();
-			if (! SendFifo.empty())
+			uint32 skip = (nbBlocks == 0) ? _RTSBIndex : 0;
+			if ( skip < sizeof(TBlockSize) )
 			{
-				SendFifo.front( tmpbuffer, size );
-			}
-		}
-
-		// Actual sending of _ReadyToSendBuffer
-		//if ( ! _ReadyToSendBuffer.empty() )
-		if ( _ReadyToSendBuffer.size() != 0 )
-		{		
-			// Send
-			CSock::TSockResult res;
-			TBlockSize len = _ReadyToSendBuffer.size() - _RTSBIndex;
-
-			res = Sock->send( _ReadyToSendBuffer.getPtr()+_RTSBIndex, len, false );
-
-			if ( res == CSock::Ok )
-			{
-/*				// Debug display
-				switch ( _FlushTrigger )
-				{
-				case FTTime : LNETL1_DEBUG( "LNETL1: Time triggered flush for %s:", asString().c_str() ); break;
-				case FTSize : LNETL1_DEBUG( "LNETL1: Size triggered flush for %s:", asString().c_str() ); break;
-				default:	  LNETL1_DEBUG( "LNETL1: Manual flush for %s:", asString().c_str() );
-				}
-				_FlushTrigger = FTManual;
-				LNETL1_DEBUG( "LNETL1: %s sent effectively a buffer (%d on %d B)", asString().c_str(), len, _ReadyToSendBuffer.size() );
-*/			
-				
-				// TODO OPTIM remove the nldebug for speed
-				//commented for optimisation LNETL1_DEBUG( "LNETL1: %s sent effectively %u/%u bytes (pos %u wantedsend %u)", asString().c_str(), len, _ReadyToSendBuffer.size(), _RTSBIndex, realLen/*, stringFromVectorPart(_ReadyToSendBuffer,_RTSBIndex,len).c_str()*/ );
-
-				if ( _RTSBIndex+len == _ReadyToSendBuffer.size() ) // for non-blocking mode
-				{
-					// If sending is ok, clear the global buffer
-					//nldebug( "O-%u all %u bytes (%u to %u) sent", Sock->descriptor(), len, _RTSBIndex, _ReadyToSendBuffer.size() );
-					_ReadyToSendBuffer.clear();
-					_RTSBIndex = 0;
-					if ( nbBytesRemaining )
-						*nbBytesRemaining = 0;
-				}
-				else
-				{
-					// Or clear only the data that was actually sent
-					nlassertex( _RTSBIndex+len < _ReadyToSendBuffer.size(), ("index=%u len=%u size=%u", _RTSBIndex, len, _ReadyToSendBuffer.size()) );
-					//nldebug( "O-%u only %u B on %u (%u to %u) sent", Sock->descriptor(), len, _ReadyToSendBuffer.size()-_RTSBIndex, _RTSBIndex, _ReadyToSendBuffer.size() );
-					_RTSBIndex += len;
-					if ( nbBytesRemaining )
-						*nbBytesRemaining = _ReadyToSendBuffer.size() - _RTSBIndex;
-					if ( _ReadyToSendBuffer.size() > 20480 ) // if big, clear data already sent
-					{
-						uint nbcpy = _ReadyToSendBuffer.size() - _RTSBIndex;
-						for (uint i = 0; i < nbcpy; i++)
-						{
-							_ReadyToSendBuffer[i] = _ReadyToSendBuffer[i+_RTSBIndex];
-						}
-						_ReadyToSendBuffer.resize(nbcpy);
-						//_ReadyToSendBuffer.erase( _ReadyToSendBuffer.begin(), _ReadyToSendBuffer.begin()+_RTSBIndex );
-						_RTSBIndex = 0;
-						//nldebug( "O-%u Cleared data already sent, %u B remain", Sock->descriptor(), nbcpy );
-					}
-				}
+				buffers[nbBuffers] = (const uint8*)&block.NetLength + skip;
+				lengths[nbBuffers] = sizeof(TBlockSize) - skip;
+				total += lengths[nbBuffers];
+				++nbBuffers;
+				skip = 0;
 			}
 			else
 			{
-#ifdef NL_DEBUG
-				// Can happen in a normal behavior if, for example, the other side is not connected anymore
-				LNETL1_DEBUG( "LNETL1: %s failed to send effectively a buffer of %d bytes", asString().c_str(), _ReadyToSendBuffer.size() );
-#endif
-				// NEW: Clearing (loosing) the buffer if the sending can't be performed at all
-				_ReadyToSendBuffer.clear();
-				_RTSBIndex = 0;
-				if ( nbBytesRemaining )
-					*nbBytesRemaining = 0;
-				return false;
+				skip -= sizeof(TBlockSize);
 			}
+			buffers[nbBuffers] = block.Data + skip;
+			lengths[nbBuffers] = block.Length - skip;
+			total += lengths[nbBuffers];
+			++nbBuffers;
+			++nbBlocks;
 		}
-		else
+
+		// Send them in one system call
+		uint32 len = total;
+		CSock::TSockResult res = Sock->sendv( buffers, lengths, nbBuffers, len, false );
+		if ( res != CSock::Ok )
 		{
+#ifdef NL_DEBUG
+			// Can happen in a normal behavior if, for example, the other side is not connected anymore
+			LNETL1_DEBUG( "LNETL1: %s failed to send effectively %u blocks (%u bytes)", asString().c_str(), nbBlocks, total );
+#endif
+			// Clearing (loosing) the blocks if the sending can't be performed at all
+			for ( uint32 i=0; i!=nbBlocks; ++i )
+			{
+				SendFifo.pop();
+			}
+			_RTSBIndex = 0;
 			if ( nbBytesRemaining )
 				*nbBytesRemaining = 0;
+			return false;
+		}
+
+		// Release the blocks completely sent
+		uint32 sent = _RTSBIndex + len;
+		while ( (! SendFifo.empty()) && (sent >= sizeof(TBlockSize) + SendFifo.block( 0 ).Length) )
+		{
+			sent -= sizeof(TBlockSize) + SendFifo.block( 0 ).Length;
+			SendFifo.pop();
 		}
+		_RTSBIndex = sent;
 
+		if ( len < total ) // for non-blocking mode
+		{
+			//commented for optimisation LNETL1_DEBUG( "LNETL1: %s sent only %u bytes on %u", asString().c_str(), len, total );
+			if ( nbBytesRemaining )
+				*nbBytesRemaining = SendFifo.size() - _RTSBIndex;
+			return true;
+		}
 	}
-	while ( !SendFifo.empty() && _ReadyToSendBuffer.size()==0 );
 
+	if ( nbBytesRemaining )
+		*nbBytesRemaining = 0;
 	return true;
 }
 
 
+/*
+ * Push a message (its buffer is shared, not copied)
+ */
+void CSendQueue::push( const NLMISC::CMemStream& buffer )
+{
+	_Blocks.push_back( CBlock() );
+	CBlock& block = _Blocks.back();
+
+	// The copy of the stream keeps the buffer alive (and unchanged: if the caller writes into
+	// its stream afterwards, the copy-on-write gives it a new buffer)
+	block.Stream = buffer;
+	block.Data = buffer.buffer();
+	block.Length = buffer.length();
+	block.NetLength = htonl( (TBlockSize)block.Length );
+
+	_Size += sizeof(TBlockSize) + block.Length;
+	if ( block.Length > _BiggestBlock )
+		_BiggestBlock = block.Length;
+	++_Pushed;
+}
+
+
+/*
+ * Pop the first block
+ */
+void CSendQueue::pop()
+{
+	nlassert( ! _Blocks.empty() );
+	_Size -= sizeof(TBlockSize) + _Blocks.front().Length;
+	_Blocks.pop_front();
+}
+
+
+/*
+ * display the queue statistics
+ */
+void CSendQueue::displayStats( NLMISC::CLog *log )
+{
+	log->displayNL( "%p CurrentQueueSize: %u, InQueue: %u", this, _Size, nbBlocks() );
+	log->displayNL( "%p Pushed: %u, BiggestBlock: %u", this, _Pushed, _BiggestBlock );
+}
+
+
 /* Sets the time flush trigger (in millisecond). When this time is elapsed,
  * all data in the send queue is automatically sent (-1 to disable this trigger)
  */
@@ -338,8 +345,12 @@ void CBufSock::connect( const CInetAddress& addr, bool nodelay, bool connectedst
 	{
 		Sock->setNoDelay( true );
 	}
-	_ReadyToSendBuffer.clear();
-	_RTSBIndex = 0;
+	// Drop the block partially sent on the previous connection
+	if ( _RTSBIndex != 0 )
+	{
+		SendFifo.pop();
+		_RTSBIndex = 0;
+	}
 }
 
 
@@ -390,7 +401,8 @@ CNonBlockingBufSock::CNonBlockingBufSock( CTcpSock *sock, uint32 maxExpectedBloc
 	_MaxExpectedBlockSize( maxExpectedBlockSize ),
 	_NowReadingBuffer( false ),
 	_BytesRead( 0 ),
-	_Length( 0 )
+	_Length( 0 ),
+	_ReceiveDrained( false )
 {
 	nlnettrace( "CNonBlockingBufSock::CNonBlockingBufSock" );
 }
@@ -402,7 +414,8 @@ CNonBlockingBufSock::CNonBlockingBufSock( CTcpSock *sock, uint32 maxExpectedBloc
 CServerBufSock::CServerBufSock( CTcpSock *sock ) :
 	CNonBlockingBufSock( sock ),
 	_Advertised( false ),
-	_OwnerTask( NULL )
+	_OwnerTask( NULL ),
+	_OwnerServer( NULL )
 {
 	nlassert (this != InvalidSockId);	// invalid bufsock
 	nlnettrace( "CServerBufSock::CServerBufSock" );
@@ -420,24 +433,32 @@ bool CNonBlockingBufSock::receivePart( uint32 nbExtraBytes )
 	nlassert (this != InvalidSockId);	// invalid bufsock
 	nlnettrace( "CNonBlockingBufSock::receivePart" );
 
-	TBlockSize actuallen;
+	TBlockSize actuallen, requestedlen;
+	_ReceiveDrained = false;
 	if ( ! _NowReadingBuffer )
 	{
 		// Receiving length prefix
-		actuallen = sizeof(_Length)-_BytesRead;
+		requestedlen = actuallen = sizeof(_Length)-_BytesRead;
 		CSock :: TSockResult ret = Sock->receive( (uint8*)(&_Length)+_BytesRead, actuallen, false );
 		if (ret == CSock::ConnectionClosed)
 		{
 			LNETL1_DEBUG( "LNETL1: Connection %s closed", asString().c_str() );
+			_ReceiveDrained = true;
 			return false;
 		}
 		else if (ret == CSock::Error)
 		{
 			LNETL1_DEBUG( "LNETL1: Socket error for %s", asString().c_str() );
 			Sock->disconnect();
+			_ReceiveDrained = true;
 			return false;
 		}
 
+		if ( actuallen < requestedlen )
+		{
+			_ReceiveDrained = true;
+		}
+
 		_BytesRead += actuallen;
 		if ( _BytesRead == sizeof(_Length ) )
 		{
@@ -467,14 +488,18 @@ bool CNonBlockingBufSock::receivePart( uint32 nbExtraBytes )
 	if ( _NowReadingBuffer )
 	{
 		// Receiving payload buffer
-		actuallen = _Length-_BytesRead;
-		Sock->receive( &*_ReceiveBuffer.begin()+_BytesRead, actuallen );
+		requestedlen = actuallen = _Length-_BytesRead;
+		Sock->receive( _ReceiveBuffer.getPtr()+_BytesRead, actuallen );
+		if ( actuallen < requestedlen )
+		{
+			_ReceiveDrained = true;
+		}
 		_BytesRead += actuallen;
 
 		if ( _BytesRead == _Length )
 		{
 #ifdef NL_DEBUG
-			LNETL1_DEBUG( "LNETL1: %s received buffer (%u bytes): [%s]", asString().c_str(), _ReceiveBuffer.size(), stringFromVector(_ReceiveBuffer).c_str() );
+			LNETL1_DEBUG( "LNETL1: %s received buffer (%u bytes): [%s]", asString().c_str(), _ReceiveBuffer.size(), stringFromVector( std::vector<uint8>( _ReceiveBuffer.getPtr(), _ReceiveBuffer.getPtr()+_ReceiveBuffer.size() ) ).c_str() );
 #endif
 			_NowReadingBuffer = false;
 			//nldebug( "I-%u all %u B on %u", Sock->descriptor(), actuallen );
@@ -143,6 +143,10 @@ void CCallbackNetBase::addCallbackArray (const TCallbackItem *callbackarray, sin
 		
 		_CallbackArray[ni] = callbackarray[i];
 
+		// index it by message type id (if the type is already in the array, the first callback is kept)
+		uint32 id = CMessage::registerTypeName (callbackarray[i].Key);
+		if (_CallbackIndex.find (id) == _CallbackIndex.end ())
+			_CallbackIndex.insert (make_pair (id, (uint)ni));
 	}
 
 //	LNETL3_DEBUG ("LNETL3NB_CB: Added %d callback Now, there're %d callback associated with message type", arraysize, _CallbackArray.size ());
@@ -170,21 +174,14 @@ void CCallbackNetBase::processOneMessage ()
 
 	_BytesReceived += msgin.length ();
 	
-	// now, we have to call the good callback
-	sint pos = -1;
-	std::string name = msgin.getName ();
-	sint i;
-	for (i = 0; i < (sint)_CallbackArray.size (); i++)
-	{
-		if (name == _CallbackArray[i].Key)
-		{
-			pos = i;
-			break;
-		}
-	}
+	// now, we have to call the good callback (a name received with the message must be the
+	// name of the callback, not only have the same id)
+	TCallbackIndex::const_iterator itcb = _CallbackIndex.find (msgin.getTypeId ());
+	if (itcb != _CallbackIndex.end () && !msgin.typeNameMatches (_CallbackArray[(*itcb).second].Key))
+		itcb = _CallbackIndex.end ();
 
 	TMsgCallback	cb = NULL;
-	if (pos < 0 || pos >= (sint16) _CallbackArray.size ())
+	if (itcb == _CallbackIndex.end ())
 	{
 		if (_DefaultCallback == NULL)
 		{
@@ -197,7 +194,7 @@ void CCallbackNetBase::processOneMessage ()
 	}
 	else
 	{
-		cb = _CallbackArray[pos].Callback;
+		cb = _CallbackArray[(*itcb).second].Callback;
 	}
 
 	TSockId realid = getSockId (tsid);
@@ -157,6 +157,40 @@ CTcpSock *CListenSock::accept()
 }
 
 
+/*
+ * Allows several sockets to listen on the same port (call before init())
+ */
+void CListenSock::setReusePort( bool enabled )
+{
+	nlassert( ! _Bound );
+#ifdef SO_REUSEPORT
+	int value = enabled;
+	if ( setsockopt( _Sock, SOL_SOCKET, SO_REUSEPORT, (const char*)&value, sizeof(value) ) == SOCKET_ERROR )
+	{
+		throw ESocket( "ReusePort failed" );
+	}
+#else
+	if ( enabled )
+	{
+		throw ESocket( "ReusePort not supported on this system" );
+	}
+#endif
+}
+
+
+/*
+ * Returns true if setReusePort() is supported by the system
+ */
+bool CListenSock::reusePortSupported()
+{
+#ifdef SO_REUSEPORT
+	return true;
+#else
+	return false;
+#endif
+}
+
+
 /*
  * Sets the number of the pending connections queue. -1 for the maximum possible value.
  */
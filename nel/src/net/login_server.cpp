@@ -503,6 +503,16 @@ void CLoginServer::clientDisconnected (uint32 userId)
 		UserIdSockAssociations.erase (userId);
 }
 
+void CLoginServer::reportLoad (float cpuLoad, uint32 bandwidth, uint32 tickLag)
+{
+	CMessage msgout ("FS_LOAD");
+	msgout.serial (cpuLoad);
+	msgout.serial (bandwidth);
+	msgout.serial (tickLag);
+
+	CUnifiedNetwork::getInstance()->send("WS", msgout);
+}
+
 /// Call this method to retrieve the listen address
 const std::string &CLoginServer::getListenAddress()
 {
@@ -25,6 +25,8 @@
 
 #include "stdnet.h"
 
+#include "nel/misc/mutex.h"
+
 #include "nel/net/message.h"
 
 /*#ifdef MESSAGES_PLAIN_TEXT
@@ -38,18 +40,36 @@ namespace NLNET
 
 bool CMessage::_DefaultStringMode = false;
 
+bool CMessage::_DefaultIdMode = false;
+
 const char *LockedSubMessageError = "a sub message is forbidden";
 
 #define FormatLong 1
 #define FormatShort 0
 
+typedef CHashMap<uint32, std::string> TTypeNames;
+
+// The registered names of the message types, by id (the services register names while
+// other threads read them, e.g. the module tasks)
+struct CTypeNames
+{
+	NLMISC::CMutex	Mutex;
+	TTypeNames		Names;
+};
+
+static CTypeNames &typeNames()
+{
+	static CTypeNames names;
+	return names;
+}
+
 
 /*
  * Constructor by name
  */
 CMessage::CMessage (const std::string &name, bool inputStream, TStreamFormat streamformat, uint32 defaultCapacity) :
 	NLMISC::CMemStream (inputStream, false, defaultCapacity),
-	_Type(OneWay), _SubMessagePosR(0), _LengthR(0), _HeaderSize(0xFFFFFFFF), _TypeSet (false)
+	_TypeId(0), _TypeIdSet(false), _Type(OneWay), _SubMessagePosR(0), _LengthR(0), _HeaderSize(0xFFFFFFFF), _TypeSet (false)
 {
 	init( name, streamformat );
 }
@@ -79,7 +99,7 @@ void CMessage::init( const std::string &name, TStreamFormat streamformat )
  */
 CMessage::CMessage (NLMISC::CMemStream &memstr) :
 	NLMISC::CMemStream( memstr ),
-	_Type(OneWay), _SubMessagePosR(0), _LengthR(0), _HeaderSize(0xFFFFFFFF), _TypeSet (false)
+	_TypeId(0), _TypeIdSet(false), _Type(OneWay), _SubMessagePosR(0), _LengthR(0), _HeaderSize(0xFFFFFFFF), _TypeSet (false)
 {
 	sint32 pos = getPos();
 	bool reading = isReading();
@@ -121,6 +141,8 @@ CMessage &CMessage::operator= (const CMessage &other)
 		_Type = other._Type;
 		_TypeSet = other._TypeSet;
 		_Name = other._Name;
+		_TypeId = other._TypeId;
+		_TypeIdSet = other._TypeIdSet;
 		_HeaderSize = other._HeaderSize;
 		_SubMessagePosR = other._SubMessagePosR;
 		_LengthR = other._LengthR;
@@ -134,6 +156,8 @@ void CMessage::swap(CMessage &other)
 	nlassert( !hasLockedSubMessage() );
 	CMemStream::swap(other);
 	_Name.swap(other._Name);
+	std::swap(_TypeId, other._TypeId);
+	std::swap(_TypeIdSet, other._TypeIdSet);
 	std::swap(_SubMessagePosR, other._SubMessagePosR);
 	std::swap(_LengthR, other._LengthR);
 	std::swap(_HeaderSize, other._HeaderSize);
@@ -186,6 +210,8 @@ void CMessage::setType (const std::string &name, TMessageType type)
 	nlassert (!name.empty ());
 
 	_Name = name;
+	_TypeId = hashTypeName (name);
+	_TypeIdSet = true;
 	_Type = type;
 
 	if (!isReading ())
@@ -193,15 +219,12 @@ void CMessage::setType (const std::string &name, TMessageType type)
 		// check if they don't already serial some stuffs
 		nlassert (length () == 0);
 
-		// if we can send the id instead of the string, "just do it" (c)nike!
-		//NLMISC::CStringIdArray::TStringId id = _SIDA->getId (name);
-
 		// Force binary mode for header
 		bool msgmode = _StringMode;
 		_StringMode = false;
 
 		TFormat format;
-		format.LongFormat = FormatLong;
+		format.LongFormat = _DefaultIdMode ? FormatShort : FormatLong;
 		format.StringMode = msgmode;
 		format.MessageType = _Type;
 		//nldebug( "OUT format = %hu", (uint16)format );
@@ -210,7 +233,11 @@ void CMessage::setType (const std::string &name, TMessageType type)
 		// End of binary header
 		_StringMode = msgmode;
 
-		serial ((std::string&)name);
+		// if we can send the id instead of the string, "just do it" (c)nike!
+		if (format.LongFormat)
+			serial ((std::string&)name);
+		else
+			serial (_TypeId);
 
 		_HeaderSize = getPos ();
 	}
@@ -226,8 +253,19 @@ void CMessage::setType (const std::string &name, TMessageType type)
 void CMessage::changeType (const std::string &name)
 {
 	sint32 prevPos = getPos();
-	seek( sizeof(uint32)+sizeof(uint8), begin );
-	serial ((std::string&)name);
+	_Name = name;
+	_TypeId = hashTypeName (name);
+	_TypeIdSet = true;
+	if ( (buffer()[0] & 1) == FormatLong )
+	{
+		seek( sizeof(uint32)+sizeof(uint8), begin );
+		serial ((std::string&)name);
+	}
+	else
+	{
+		seek( sizeof(uint8), begin );
+		serial (_TypeId);
+	}
 	seek( prevPos, begin );
 }
 
@@ -264,9 +302,22 @@ void CMessage::readType ()
 	// Set mode for the following of the buffer
 	_StringMode = format.StringMode;
 
-	std::string name;
-	serial (name);
-	setType (name, TMessageType(format.MessageType));
+	// No string is built nor hashed for each message: the id of a long format message
+	// is computed by getTypeId(), the name of an id is found by getName(), when needed
+	nlassert (!_TypeSet);
+	if (LongFormat)
+	{
+		serial (_Name);
+		_TypeIdSet = false;
+	}
+	else
+	{
+		serial (_TypeId);
+		_TypeIdSet = true;
+		_Name.clear();
+	}
+	_Type = TMessageType(format.MessageType);
+	_TypeSet = true;
 	_HeaderSize = getPos();
 }
 
@@ -292,14 +343,111 @@ std::string CMessage::readTypeAtCurrentPos() const
 		std::string name;
 		nlRead(*this, serial, name );
 		_StringMode = sm;
+		_TypeId = hashTypeName( name );
+		_TypeIdSet = true;
 		return name;
 	}
 	else
-		nlerror( "Id not supported" );
+	{
+		uint32 id;
+		nlRead(*this, serial, id );
+		_StringMode = sm;
+		_TypeId = id;
+		_TypeIdSet = true;
+		return getTypeNameFromId( id );
+	}
+}
+
+
+/*
+ * Returns the 32-bit id of the message type
+ */
+uint32 CMessage::getTypeId () const
+{
+	if ( hasLockedSubMessage() )
+	{
+		// read the header of the sub message, that sets _TypeId
+		getType();
+		return _TypeId;
+	}
+	else
+	{
+		nlassert (_TypeSet);
+		if (!_TypeIdSet)
+		{
+			_TypeId = hashTypeName (_Name);
+			_TypeIdSet = true;
+		}
+		return _TypeId;
+	}
+}
+
+
+/*
+ * Returns false if the name of the type is known and is not name
+ */
+bool CMessage::typeNameMatches (const char *name) const
+{
+	if ( hasLockedSubMessage() )
+	{
+		return getName() == name;
+	}
+	else
+	{
+		nlassert (_TypeSet);
+		// The name of a message received with an id is only the registered name of its id
+		return _Name.empty() || (_Name == name);
+	}
+}
 
 
-	_StringMode = sm;
-	return "";
+/*
+ * Returns the 32-bit id of a message name (FNV-1a hash)
+ */
+uint32 CMessage::hashTypeName (const std::string &name)
+{
+	uint32 id = 2166136261U;
+	for (std::string::size_type i = 0; i < name.size(); ++i)
+	{
+		id ^= (uint8)name[i];
+		id *= 16777619U;
+	}
+	return id;
+}
+
+
+/*
+ * Register a message name, so that the name of the messages received with an id can be found
+ */
+uint32 CMessage::registerTypeName (const std::string &name)
+{
+	uint32 id = hashTypeName (name);
+	CTypeNames &typeNamesRef = typeNames();
+	NLMISC::CAutoMutex<NLMISC::CMutex> automutex (typeNamesRef.Mutex);
+	TTypeNames::iterator it = typeNamesRef.Names.find (id);
+	if (it == typeNamesRef.Names.end())
+	{
+		typeNamesRef.Names.insert (std::make_pair (id, name));
+	}
+	else if ((*it).second != name)
+	{
+		nlwarning ("MSG: The message types '%s' and '%s' have the same id %08X, the id mode can't be used", (*it).second.c_str(), name.c_str(), id);
+	}
+	return id;
+}
+
+
+/*
+ * Returns the registered name of a type id
+ */
+std::string CMessage::getTypeNameFromId (uint32 id)
+{
+	CTypeNames &typeNamesRef = typeNames();
+	NLMISC::CAutoMutex<NLMISC::CMutex> automutex (typeNamesRef.Mutex);
+	TTypeNames::const_iterator it = typeNamesRef.Names.find (id);
+	if (it == typeNamesRef.Names.end())
+		return NLMISC::toString ("#%08X", id);
+	return (*it).second;
 }
 
 
@@ -344,6 +492,9 @@ std::string CMessage::getName () const
 	else
 	{
 		nlassert (_TypeSet);
+		// A message received with an id gets its name only when asked (for the logs)
+		if (_Name.empty())
+			_Name = getTypeNameFromId (_TypeId);
 		return _Name;
 	}
 }
@@ -382,7 +533,7 @@ CMessage::TMessageType CMessage::getType() const
 std::string CMessage::toString( bool hexFormat, bool textFormat ) const
 {
 	//nlassert (_TypeSet);
-	std::string s = "('" + _Name + "')";
+	std::string s = "('" + (_TypeSet ? getName() : _Name) + "')";
 	if ( hexFormat )
 		s += " " + CMemStream::toString( true );
 	if ( textFormat )
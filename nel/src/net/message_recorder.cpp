@@ -25,6 +25,10 @@
 
 #include "stdnet.h"
 
+#include "nel/misc/thread.h"
+#include "nel/misc/mutex.h"
+#include "nel/misc/common.h"
+#include "nel/misc/lz_compressor.h"
 #include "nel/net/message_recorder.h"
 #include "nel/net/inet_address.h"
 
@@ -73,14 +77,700 @@ TNetworkEvent StringToEvent( string& s )
 }
 
 
+// Magic numbers of the record file
+static const uint32 FileMagic = 0x524d4c4e;		// "NLMR"
+static const uint32 BlockMagic = 0x424d4c4e;	// "NLMB"
+static const uint32 IndexMagic = 0x494d4c4e;	// "NLMI"
+static const uint32 TrailerMagic = 0x544d4c4e;	// "NLMT"
+static const uint32 FileVersion = 1;
+
+// Sizes of the fixed parts of the file
+static const uint32 FileHeaderSize = 8;			// magic, version
+static const uint32 BlockHeaderSize = 44;		// magic, flags, stored size, raw size, nb records, first and last counters, first time
+static const uint32 TrailerSize = 12;			// index offset, magic
+
+// Flags of a block
+static const uint32 BlockCompressed = 1;
+
+// Above this number of blocks waiting to be written, the disk does not follow
+static const uint32 MaxPendingBlocks = 256;
+
+
+/*
+ * Write an unsigned number in 7-bit groups (small numbers take one byte)
+ */
+static inline void writeVarUInt( std::vector<uint8>& dest, uint64 value )
+{
+	while ( value >= 0x80 )
+	{
+		dest.push_back( (uint8)(value | 0x80) );
+		value >>= 7;
+	}
+	dest.push_back( (uint8)value );
+}
+
+/*
+ * Write a signed number (zig-zag coded so that small negative numbers are short too)
+ */
+static inline void writeVarSInt( std::vector<uint8>& dest, sint64 value )
+{
+	writeVarUInt( dest, ((uint64)value << 1) ^ (uint64)(value >> 63) );
+}
+
+/*
+ * Read a number written by writeVarUInt(). Returns false if the source is too short.
+ */
+static inline bool readVarUInt( const std::vector<uint8>& src, uint32& pos, uint64& value )
+{
+	value = 0;
+	for ( uint shift=0; shift<64; shift+=7 )
+	{
+		if ( pos >= src.size() )
+			return false;
+		uint8 b = src[pos++];
+		value |= (uint64)(b & 0x7f) << shift;
+		if ( (b & 0x80) == 0 )
+			return true;
+	}
+	return false;
+}
+
+static inline bool readVarSInt( const std::vector<uint8>& src, uint32& pos, sint64& value )
+{
+	uint64 v;
+	if ( ! readVarUInt( src, pos, v ) )
+		return false;
+	value = (sint64)(v >> 1) ^ -(sint64)(v & 1);
+	return true;
+}
+
+
+/*
+ * Write the content of an output stream to a file. Returns false on error.
+ */
+static bool writeStream( FILE *f, const CMemStream& stream )
+{
+	return fwrite( stream.buffer(), 1, stream.length(), f ) == stream.length();
+}
+
+/*
+ * Read size bytes of a file into an input stream. Returns false on error.
+ */
+static bool readStream( FILE *f, CMemStream& stream, uint32 size )
+{
+	return fread( stream.bufferToFill( size ), 1, size, f ) == size;
+}
+
+
+/*
+ * A block of records, filled by the recording thread and written by the writing thread
+ */
+struct CRecordBlock
+{
+	std::vector<uint8>	Data;
+	uint32				NbRecords;
+	sint64				FirstCounter;
+	sint64				LastCounter;
+	TTime				FirstTime;
+};
+
+
+/*
+ * Code of the writing thread of CMessageRecordWriter
+ */
+class CRecordWriterTask : public IRunnable
+{
+public:
+
+	/// Constructor
+	CRecordWriterTask( FILE *file, const std::string& filename, bool compress ) :
+		_File( file ), _Filename( filename ), _Compress( compress ), _Offset( FileHeaderSize ),
+		_ExitRequired( false ), _Failed( false ), _Blocks( "CRecordWriterTask::_Blocks" ) {}
+
+	/// Destructor (closes the file)
+	~CRecordWriterTask() { fclose( _File ); }
+
+	/// Queue a block to write (the task deletes it)
+	void			push( CRecordBlock *block )
+	{
+		uint32 nbPending;
+		{
+			CSynchronized< std::deque<CRecordBlock*> >::CAccessor blocks( &_Blocks );
+			blocks.value().push_back( block );
+			nbPending = (uint32)blocks.value().size();
+		}
+		if ( nbPending == MaxPendingBlocks )
+			nlwarning( "MR:%s: %u blocks waiting to be written, the disk is too slow", _Filename.c_str(), nbPending );
+	}
+
+	/// Tells the task to exit when all the blocks are written
+	void			requireExit() { _ExitRequired = true; }
+
+	/// Run
+	virtual void	run()
+	{
+		for (;;)
+		{
+			CRecordBlock *block = NULL;
+			{
+				CSynchronized< std::deque<CRecordBlock*> >::CAccessor blocks( &_Blocks );
+				if ( ! blocks.value().empty() )
+				{
+					block = blocks.value().front();
+					blocks.value().pop_front();
+				}
+			}
+			if ( block != NULL )
+			{
+				writeBlock( *block );
+				delete block;
+			}
+			else if ( _ExitRequired )
+			{
+				break;
+			}
+			else
+			{
+				nlSleep( 10 );
+			}
+		}
+	}
+
+	/// Returns the runnable name
+	virtual void	getName( std::string &result ) const { result = "CRecordWriterTask"; }
+
+	/// Write the index at the end of the file (call it when the thread is over)
+	void			writeIndex()
+	{
+		CMemStream stream( false );
+		uint32 magic = IndexMagic;
+		uint32 nbBlocks = (uint32)_Index.size();
+		stream.serial( magic );
+		stream.serial( nbBlocks );
+		for ( uint32 i=0; i!=nbBlocks; ++i )
+		{
+			stream.serial( _Index[i].Offset );
+			stream.serial( _Index[i].FirstCounter );
+			stream.serial( _Index[i].LastCounter );
+		}
+		magic = TrailerMagic;
+		stream.serial( _Offset );
+		stream.serial( magic );
+		if ( ! writeStream( _File, stream ) )
+			nlwarning( "MR:%s: Cannot write the index", _Filename.c_str() );
+	}
+
+private:
+
+	/// Compress (if enabled) and write a block
+	void			writeBlock( CRecordBlock& block )
+	{
+		uint32 flags = 0;
+		uint32 rawSize = (uint32)block.Data.size();
+		const uint8 *data = &block.Data[0];
+		uint32 storedSize = rawSize;
+		if ( _Compress )
+		{
+			// each block has its own dictionary, to be readable alone
+			_Compressed.resize( CLZCompressor::maxCompressedSize( rawSize ) );
+			_Compressor.reset();
+			uint32 compressedSize = _Compressor.compress( data, rawSize, &_Compressed[0] );
+			if ( compressedSize < rawSize )
+			{
+				flags |= BlockCompressed;
+				data = &_Compressed[0];
+				storedSize = compressedSize;
+			}
+		}
+
+		CMemStream header( false );
+		uint32 magic = BlockMagic;
+		header.serial( magic );
+		header.serial( flags );
+		header.serial( storedSize );
+		header.serial( rawSize );
+		header.serial( block.NbRecords );
+		header.serial( block.FirstCounter );
+		header.serial( block.LastCounter );
+		header.serial( block.FirstTime );
+		nlassert( header.length() == BlockHeaderSize );
+
+		if ( ! writeStream( _File, header ) || (fwrite( data, 1, storedSize, _File ) != storedSize) )
+		{
+			if ( ! _Failed )
+				nlwarning( "MR:%s: Cannot write a block of records", _Filename.c_str() );
+			_Failed = true;
+			return;
+		}
+
+		CMessageRecordReader::TBlockEntry entry;
+		entry.Offset = _Offset;
+		entry.FirstCounter = block.FirstCounter;
+		entry.LastCounter = block.LastCounter;
+		_Index.push_back( entry );
+		_Offset += BlockHeaderSize + storedSize;
+	}
+
+	FILE										*_File;
+	std::string									_Filename;
+	bool										_Compress;
+	CLZCompressor								_Compressor;
+	std::vector<uint8>							_Compressed;
+	std::vector<CMessageRecordReader::TBlockEntry>	_Index;
+	sint64										_Offset;
+	volatile bool								_ExitRequired;
+	bool										_Failed;
+	CSynchronized< std::deque<CRecordBlock*> >	_Blocks;
+};
+
+
+/*
+ * Constructor
+ */
+CMessageRecordWriter::CMessageRecordWriter() :
+	_Task( NULL ), _Thread( NULL ), _BlockSize( DefaultBlockSize ), _BlockNbRecords( 0 ),
+	_BlockFirstCounter( 0 ), _PrevCounter( 0 ), _BlockFirstTime( 0 ), _PrevTime( 0 ), _NbRecords( 0 )
+{
+}
+
+
+/*
+ * Destructor
+ */
+CMessageRecordWriter::~CMessageRecordWriter()
+{
+	close();
+}
+
+
+/*
+ * Create the file and start the writing thread
+ */
+bool CMessageRecordWriter::open( const std::string& filename, bool compress, uint32 blockSize )
+{
+	close();
+
+	FILE *file = fopen( filename.c_str(), "wb" );
+	if ( file == NULL )
+		return false;
+
+	CMemStream header( false );
+	uint32 magic = FileMagic;
+	uint32 version = FileVersion;
+	header.serial( magic );
+	header.serial( version );
+	if ( ! writeStream( file, header ) )
+	{
+		fclose( file );
+		return false;
+	}
+
+	_BlockSize = blockSize;
+	_Block.clear();
+	_Block.reserve( _BlockSize + 1024 );
+	_BlockNbRecords = 0;
+	_SockNumbers.clear();
+	_NbRecords = 0;
+
+	_Task = new CRecordWriterTask( file, filename, compress );
+	_Thread = IThread::create( _Task );
+	_Thread->start();
+	return true;
+}
+
+
+/*
+ * Add a record
+ */
+void CMessageRecordWriter::write( sint64 updatecounter, TTime time, TNetworkEvent event, TSockId sockid, const CMessage& message )
+{
+	nlassert( isOpen() );
+
+	if ( _BlockNbRecords == 0 )
+	{
+		_BlockFirstCounter = updatecounter;
+		_BlockFirstTime = time;
+		_PrevCounter = updatecounter;
+		_PrevTime = time;
+	}
+
+	// The socket numbers are given in order of appearance, 0 is InvalidSockId
+	uint32 sockNumber = 0;
+	if ( sockid != InvalidSockId )
+	{
+		std::map<TSockId,uint32>::iterator it = _SockNumbers.find( sockid );
+		if ( it == _SockNumbers.end() )
+			it = _SockNumbers.insert( std::make_pair( sockid, (uint32)_SockNumbers.size() + 1 ) ).first;
+		sockNumber = it->second;
+	}
+
+	uint32 len = message.length();
+	writeVarSInt( _Block, updatecounter - _PrevCounter );
+	writeVarSInt( _Block, time - _PrevTime );
+	_Block.push_back( (uint8)event );
+	writeVarUInt( _Block, sockNumber );
+	writeVarUInt( _Block, len );
+	_Block.insert( _Block.end(), message.buffer(), message.buffer() + len );
+	_PrevCounter = updatecounter;
+	_PrevTime = time;
+	++_BlockNbRecords;
+	++_NbRecords;
+
+	if ( _Block.size() >= _BlockSize )
+		flushBlock();
+}
+
+
+/*
+ * Give the current block to the writing thread
+ */
+void CMessageRecordWriter::flushBlock()
+{
+	if ( _BlockNbRecords == 0 )
+		return;
+
+	CRecordBlock *block = new CRecordBlock;
+	block->Data.swap( _Block );
+	block->NbRecords = _BlockNbRecords;
+	block->FirstCounter = _BlockFirstCounter;
+	block->LastCounter = _PrevCounter;
+	block->FirstTime = _BlockFirstTime;
+	_Task->push( block );
+
+	_Block.reserve( _BlockSize + 1024 );
+	_BlockNbRecords = 0;
+}
+
+
+/*
+ * Write the pending records and the index, and close the file
+ */
+void CMessageRecordWriter::close()
+{
+	if ( ! isOpen() )
+		return;
+
+	flushBlock();
+	_Task->requireExit();
+	_Thread->wait();
+	_Task->writeIndex();
+
+	// the file is owned by the task
+	delete _Thread;
+	_Thread = NULL;
+	delete _Task;
+	_Task = NULL;
+}
+
+
+/*
+ * Constructor
+ */
+CMessageRecordReader::CMessageRecordReader() :
+	_File( NULL ), _NextBlock( 0 ), _BlockPos( 0 ), _BlockNbRecords( 0 ), _PrevCounter( 0 ), _PrevTime( 0 )
+{
+}
+
+
+/*
+ * Open the file and load the index
+ */
+bool CMessageRecordReader::open( const std::string& filename )
+{
+	close();
+
+	_File = fopen( filename.c_str(), "rb" );
+	if ( _File == NULL )
+		return false;
+	_Filename = filename;
+
+	CMemStream header( true );
+	uint32 magic = 0, version = 0;
+	if ( readStream( _File, header, FileHeaderSize ) )
+	{
+		header.serial( magic );
+		header.serial( version );
+	}
+	if ( (magic != FileMagic) || (version != FileVersion) )
+	{
+		nlwarning( "MR:%s: Not a record file, or not of version %u", _Filename.c_str(), FileVersion );
+		close();
+		return false;
+	}
+
+	nlfseek64( _File, 0, SEEK_END );
+	sint64 fileSize = (sint64)ftell( _File );
+	if ( ! loadIndex( fileSize ) )
+	{
+		nlinfo( "MR:%s: No index, the recording was not stopped properly, reading the blocks", _Filename.c_str() );
+		scanBlocks( fileSize );
+	}
+
+	// position before the first record
+	_NextBlock = 0;
+	_Block.clear();
+	_BlockPos = 0;
+	_BlockNbRecords = 0;
+	return true;
+}
+
+
+/*
+ * Load the index written at the end of the file
+ */
+bool CMessageRecordReader::loadIndex( sint64 fileSize )
+{
+	_Index.clear();
+	if ( fileSize < FileHeaderSize + TrailerSize )
+		return false;
+
+	CMemStream trailer( true );
+	sint64 indexOffset;
+	uint32 magic;
+	if ( (nlfseek64( _File, fileSize - TrailerSize, SEEK_SET ) != 0) || ! readStream( _File, trailer, TrailerSize ) )
+		return false;
+	trailer.serial( indexOffset );
+	trailer.serial( magic );
+	if ( (magic != TrailerMagic) || (indexOffset < FileHeaderSize) || (indexOffset > fileSize - TrailerSize - 8) )
+		return false;
+
+	CMemStream index( true );
+	uint32 indexSize = (uint32)(fileSize - TrailerSize - indexOffset);
+	uint32 nbBlocks;
+	if ( (nlfseek64( _File, indexOffset, SEEK_SET ) != 0) || ! readStream( _File, index, indexSize ) )
+		return false;
+	index.serial( magic );
+	index.serial( nbBlocks );
+	if ( (magic != IndexMagic) || (indexSize != 8 + nbBlocks * 24) )
+		return false;
+	_Index.resize( nbBlocks );
+	for ( uint32 i=0; i!=nbBlocks; ++i )
+	{
+		index.serial( _Index[i].Offset );
+		index.serial( _Index[i].FirstCounter );
+		index.serial( _Index[i].LastCounter );
+	}
+	return true;
+}
+
+
+/*
+ * Rebuild the index by reading the block headers (the last block may be incomplete)
+ */
+void CMessageRecordReader::scanBlocks( sint64 fileSize )
+{
+	_Index.clear();
+	sint64 offset = FileHeaderSize;
+	while ( offset + BlockHeaderSize <= fileSize )
+	{
+		CMemStream header( true );
+		if ( (nlfseek64( _File, offset, SEEK_SET ) != 0) || ! readStream( _File, header, BlockHeaderSize ) )
+			break;
+		uint32 magic, flags, storedSize;
+		TBlockEntry entry;
+		header.serial( magic );
+		header.serial( flags );
+		header.serial( storedSize );
+		if ( (magic != BlockMagic) || (offset + BlockHeaderSize + storedSize > fileSize) )
+			break;
+		uint32 rawSize, nbRecords;
+		header.serial( rawSize );
+		header.serial( nbRecords );
+		header.serial( entry.FirstCounter );
+		header.serial( entry.LastCounter );
+		entry.Offset = offset;
+		_Index.push_back( entry );
+		offset += BlockHeaderSize + storedSize;
+	}
+}
+
+
+/*
+ * Read and decompress a block
+ */
+bool CMessageRecordReader::loadBlock( uint32 block )
+{
+	_Block.clear();
+	_BlockPos = 0;
+	_BlockNbRecords = 0;
+	_NextBlock = block + 1;
+	if ( block >= _Index.size() )
+		return false;
+
+	CMemStream header( true );
+	if ( (nlfseek64( _File, _Index[block].Offset, SEEK_SET ) != 0) || ! readStream( _File, header, BlockHeaderSize ) )
+		return false;
+	uint32 magic, flags, storedSize, rawSize, nbRecords;
+	sint64 firstCounter, lastCounter;
+	TTime firstTime;
+	header.serial( magic );
+	header.serial( flags );
+	header.serial( storedSize );
+	header.serial( rawSize );
+	header.serial( nbRecords );
+	header.serial( firstCounter );
+	header.serial( lastCounter );
+	header.serial( firstTime );
+	if ( magic != BlockMagic )
+	{
+		nlwarning( "MR:%s: Bad block %u", _Filename.c_str(), block );
+		return false;
+	}
+
+	std::vector<uint8> stored( storedSize );
+	if ( (storedSize != 0) && (fread( &stored[0], 1, storedSize, _File ) != storedSize) )
+	{
+		nlwarning( "MR:%s: Block %u is truncated", _Filename.c_str(), block );
+		return false;
+	}
+	if ( flags & BlockCompressed )
+	{
+		CLZDecompressor decompressor;
+		_Block.resize( rawSize );
+		if ( ! decompressor.decompress( &stored[0], storedSize, &_Block[0], rawSize ) )
+		{
+			nlwarning( "MR:%s: Block %u is corrupted", _Filename.c_str(), block );
+			_Block.clear();
+			return false;
+		}
+	}
+	else
+	{
+		_Block.swap( stored );
+	}
+
+	_BlockNbRecords = nbRecords;
+	_PrevCounter = firstCounter;
+	_PrevTime = firstTime;
+	return true;
+}
+
+
+/*
+ * Read the next record
+ */
+bool CMessageRecordReader::readNext( TMessageRecord& record )
+{
+	if ( ! isOpen() )
+		return false;
+
+	// go to the next non-empty block (skipping the bad ones)
+	while ( _BlockNbRecords == 0 )
+	{
+		if ( _NextBlock >= _Index.size() )
+			return false;
+		loadBlock( _NextBlock );
+	}
+
+	sint64 counterDelta, timeDelta;
+	uint64 sockNumber, len;
+	uint8 event = 0;
+	bool ok = readVarSInt( _Block, _BlockPos, counterDelta ) && readVarSInt( _Block, _BlockPos, timeDelta );
+	if ( ok && (_BlockPos < _Block.size()) )
+		event = _Block[_BlockPos++];
+	else
+		ok = false;
+	ok = ok && readVarUInt( _Block, _BlockPos, sockNumber ) && readVarUInt( _Block, _BlockPos, len ) &&
+		(len <= _Block.size() - _BlockPos);
+	if ( ! ok )
+	{
+		nlwarning( "MR:%s: Block %u is corrupted", _Filename.c_str(), _NextBlock - 1 );
+		_BlockNbRecords = 0;
+		return readNext( record );
+	}
+
+	record.Event = (TNetworkEvent)event;
+	_PrevCounter += counterDelta;
+	_PrevTime += timeDelta;
+	record.UpdateCounter = _PrevCounter;
+	record.Time = _PrevTime;
+	record.SockId = (TSockId)(size_t)sockNumber;
+	if ( len != 0 )
+	{
+		// as a received message
+		CMemStream stream( true );
+		memcpy( stream.bufferToFill( (uint32)len ), &_Block[_BlockPos], (size_t)len );
+		record.Message = CMessage( stream );
+	}
+	else
+	{
+		record.Message = CMessage( "", true );
+	}
+	_BlockPos += (uint32)len;
+	--_BlockNbRecords;
+	return true;
+}
+
+
+/*
+ * Go to the first record of which the update counter is updatecounter or more
+ */
+bool CMessageRecordReader::seek( sint64 updatecounter )
+{
+	if ( ! isOpen() )
+		return false;
+
+	// first block that may contain the counter
+	uint32 block = 0;
+	while ( (block < _Index.size()) && (_Index[block].LastCounter < updatecounter) )
+		++block;
+	_NextBlock = block;
+	_BlockNbRecords = 0;
+
+	// skip the records before the counter, and stop before the first one after it
+	TMessageRecord record( true );
+	for (;;)
+	{
+		uint32 nextBlock = _NextBlock;
+		uint32 pos = _BlockPos;
+		uint32 nbRecords = _BlockNbRecords;
+		sint64 prevCounter = _PrevCounter;
+		TTime prevTime = _PrevTime;
+		if ( ! readNext( record ) )
+			return false;
+		if ( record.UpdateCounter >= updatecounter )
+		{
+			if ( (nbRecords != 0) && (_NextBlock == nextBlock) )
+			{
+				_BlockPos = pos;
+				_BlockNbRecords = nbRecords;
+				_PrevCounter = prevCounter;
+				_PrevTime = prevTime;
+			}
+			else
+			{
+				// the record is the first one of a block
+				loadBlock( _NextBlock - 1 );
+			}
+			return true;
+		}
+	}
+}
+
+
+/*
+ * Close the file
+ */
+void CMessageRecordReader::close()
+{
+	if ( _File != NULL )
+	{
+		fclose( _File );
+		_File = NULL;
+	}
+	_Index.clear();
+	_Block.clear();
+	_BlockPos = 0;
+	_BlockNbRecords = 0;
+	_NextBlock = 0;
+}
+
+
 /*
  * Constructor
  */
 CMessageRecorder::CMessageRecorder() : _RecordAll(true)
 {
-#ifndef MESSAGES_PLAIN_TEXT
-	nlerror( "The message recorder works only with plain text messages. Please #define MESSAGES_PLAIN_TEXT" );
-#endif
 }
 
 
@@ -101,13 +791,11 @@ CMessageRecorder::~CMessageRecorder()
 /*
  * Start recording
  */
-bool CMessageRecorder::startRecord( const std::string& filename, bool recordall )
+bool CMessageRecorder::startRecord( const std::string& filename, bool recordall, bool compress )
 {
 	_Filename = filename;
-	_File.open( _Filename.c_str(), ios_base::out );
-	_File << endl;
 	_RecordAll = recordall;
-	if ( _File.fail() )
+	if ( ! _Writer.open( _Filename, compress ) )
 	{
 		nlwarning( "MR: Record: Cannot open file %s", _Filename.c_str() );
 		return false;
@@ -120,44 +808,16 @@ bool CMessageRecorder::startRecord( const std::string& filename, bool recordall
 }
 
 
-/*
- * Same as stringFromVector() but assumes the vector contains only printable characters
- */
-/*string stringFromTextVector( const vector<uint8>& v )
-{
-	string s;
-
-	// Copy contents
-	s.resize( v.size() );
-	memcpy( &*s.begin(), &*v.begin(), v.size() );
-
-	return s;
-}*/
-
-
 /*
  * Add a record
  */
 void CMessageRecorder::recordNext( sint64 updatecounter, TNetworkEvent event, TSockId sockid, CMessage& message )
 {
-	nlassert( _File.is_open() );
+	nlassert( _Writer.isOpen() );
 
 	if ( (_RecordAll) || (event != Sending) )
 	{
-		// Serial to stream
-		TMessageRecord rec ( event, sockid, message, updatecounter /*CTime::getLocalTime()*/ );
-		CMemStream stream ( false, true );
-		rec.serial( stream );
-		char c = '\0';      // end of cstring
-		stream.serial( c ); // added to the stream for _File << (char*)stream.buffer()
-
-		// Dump to file
-		nldebug( "MR:%s: Recording [%s]", _Filename.c_str(), stream.buffer() );
-		int len = (int)(stream.length()-2); // not the null character (and its separator) at the end of the buffer
-		_File << "* ";
-		_File <<  len; // if we put the expression directly, it makes an access violation ! Weird.
-		_File << " ";
-		_File << (char*)stream.buffer() << endl;
+		_Writer.write( updatecounter, CTime::getLocalTime(), event, sockid, message );
 	}
 }
 
@@ -167,7 +827,7 @@ void CMessageRecorder::recordNext( sint64 updatecounter, TNetworkEvent event, TS
  */
 void CMessageRecorder::stopRecord()
 {
-	_File.close();
+	_Writer.close();
 	_Filename = "";
 }
 
@@ -178,8 +838,7 @@ void CMessageRecorder::stopRecord()
 bool CMessageRecorder::startReplay( const std::string& filename )
 {
 	_Filename = filename;
-	_File.open( _Filename.c_str(), ios_base::in );
-	if ( _File.fail() )
+	if ( ! _Reader.open( _Filename ) )
 	{
 		nlerror( "MR: Replay: Cannot open file %s", _Filename.c_str() );
 		return false;
@@ -193,34 +852,24 @@ bool CMessageRecorder::startReplay( const std::string& filename )
 
 
 /*
- * Get next record (throw EStreamOverflow)
+ * Skip the records before updatecounter
  */
-bool CMessageRecorder::loadNext( TMessageRecord& record )
+bool CMessageRecorder::seekReplay( sint64 updatecounter )
 {
-	// WARNING!!! This features doesn't work anymore becaues bufferAsVector() is not available with new CMemStream
-	nlstop;
-	return false;
-
-	nlassert( _File.is_open() );
-
-	// Dump from file
-	CMemStream stream ( true, true );
-	uint32 len;
-	char c;
-	_File >> c; // skip "* ";
-	_File >> (int&)len;
-	_File.ignore(); // skip delimiter
-	if ( ! _File.fail() )
-	{
-		_File.get( (char*)stream.bufferToFill( len+1 ), len+1, '\0' );
-		//stream.bufferAsVector().resize( len ); // cut end of cstring
-		nldebug( "MR:%s: Reading [%s]", _Filename.c_str(), stream.buffer() );
+	_PreloadedRecords.clear();
+	_ConnectionAttempts.clear();
+	while ( ! ReceivedMessages.empty() )
+		ReceivedMessages.pop();
+	return _Reader.seek( updatecounter );
+}
 
-		// Serial from stream
-		record.serial( stream ); // may throw EStreamOverflow if _File.fail()
-	}
 
-	return ! _File.fail(); // retest
+/*
+ * Load the next record from the file
+ */
+bool CMessageRecorder::loadNext( TMessageRecord& record )
+{
+	return _Reader.readNext( record );
 }
 
 
@@ -403,8 +1052,75 @@ TNetworkEvent CMessageRecorder::replayConnectionAttempt( const CInetAddress& add
  */
 void CMessageRecorder::stopReplay()
 {
-	_File.close();
+	_Reader.close();
 	_Filename = "";
+	_PreloadedRecords.clear();
+	_ConnectionAttempts.clear();
+}
+
+
+/*
+ * Open a record file
+ */
+bool CMessageReplayer::open( const std::string& filename )
+{
+	if ( ! _Reader.open( filename ) )
+		return false;
+	_HasNext = _Reader.readNext( _Next );
+	_Started = false;
+	return true;
+}
+
+
+/*
+ * Restart the replay at updatecounter
+ */
+bool CMessageReplayer::seek( sint64 updatecounter )
+{
+	_HasNext = _Reader.seek( updatecounter ) && _Reader.readNext( _Next );
+	_Started = false;
+	return _HasNext;
+}
+
+
+/*
+ * Call the callback for the records that are due
+ */
+uint32 CMessageReplayer::update( TRecordCallback cb, void *arg )
+{
+	if ( ! _HasNext )
+		return 0;
+
+	uint32 nbRecords = 0;
+	if ( _Speed <= 0.0f )
+	{
+		// no wait: the records of the next update counter
+		sint64 counter = _Next.UpdateCounter;
+		while ( _HasNext && (_Next.UpdateCounter == counter) )
+		{
+			cb( _Next, arg );
+			++nbRecords;
+			_HasNext = _Reader.readNext( _Next );
+		}
+	}
+	else
+	{
+		TTime now = CTime::getLocalTime();
+		if ( ! _Started )
+		{
+			_StartTime = now;
+			_RecordStartTime = _Next.Time;
+			_Started = true;
+		}
+		TTime due = _RecordStartTime + (TTime)((double)(now - _StartTime) * _Speed);
+		while ( _HasNext && (_Next.Time <= due) )
+		{
+			cb( _Next, arg );
+			++nbRecords;
+			_HasNext = _Reader.readNext( _Next );
+		}
+	}
+	return nbRecords;
 }
 
 
@@ -39,6 +39,10 @@ using namespace NLNET;
 
 namespace NLNET
 {
+	// The envelopes of the asynchronous requests and responses (registered for the id mode of CMessage)
+	static const uint32 ModuleRequestTypeId = CMessage::registerTypeName("MOD_REQ");
+	static const uint32 ModuleResponseTypeId = CMessage::registerTypeName("MOD_RESP");
+
 
 	//////////////////////////////////////
 	// Module interceptor implementation
@@ -183,6 +187,9 @@ namespace NLNET
 		  _CurrentMessage(NULL),
 		  _CurrentMessageFailed(false),
 		  _MessageDispatchTask(NULL),
+		  _LastRequestId(InvalidRequestId),
+		  _CurrentRequestSender(NULL),
+		  _CurrentRequestId(InvalidRequestId),
 		  _ModuleFactory(NULL),
 		  _ModuleId(INVALID_MODULE_ID)
 	{
@@ -297,6 +304,13 @@ namespace NLNET
 	{
 		H_AUTO(CModuleBase_onReceiveModuleMessage);
 
+		if (message.getTypeId() == ModuleResponseTypeId)
+		{
+			// a response is never queued, it completes its request at once
+			_onReceiveModuleResponse(senderModuleProxy, message);
+			return;
+		}
+
 		if (!_ModuleTasks.empty())
 		{
 			// there is a task running, queue in the message
@@ -536,6 +550,204 @@ namespace NLNET
 		}
 	}
 
+	/** Send a request without waiting for the response.
+	 *	The request is sent in a MOD_REQ envelope with its id, the addressee
+	 *	sends back the response in a MOD_RESP envelope with the same id.
+	 */
+	IModule::TRequestId CModuleBase::sendModuleRequest(IModuleProxy *destModule, const NLNET::CMessage &requestMsg, uint32 timeout)
+	{
+		H_AUTO(CModuleBase_sendModuleRequest);
+
+		nlassert(requestMsg.getType() == CMessage::Request);
+
+		TRequestId requestId = ++_LastRequestId;
+		if (requestId == InvalidRequestId)
+			requestId = ++_LastRequestId;
+
+		// register the request before sending, a local addressee can answer immediately
+		TPendingRequest &request = _PendingRequests[requestId];
+		request.Addressee = destModule;
+		request.Deadline = (timeout != 0) ? CTime::getLocalTime() + timeout : 0;
+		request.State = rs_pending;
+
+		CMessage envelope("MOD_REQ");
+		envelope.serial(requestId);
+		envelope.serialMessage(const_cast<CMessage&>(requestMsg));
+
+		try
+		{
+			destModule->sendModuleMessage(this, envelope);
+		}
+		catch(...)
+		{
+			_PendingRequests.erase(requestId);
+			throw;
+		}
+
+		return requestId;
+	}
+
+	IModule::TRequestState CModuleBase::getModuleRequestState(TRequestId requestId)
+	{
+		TPendingRequests::iterator it(_PendingRequests.find(requestId));
+		if (it == _PendingRequests.end())
+			return rs_unknown;
+
+		TPendingRequest &request = it->second;
+		if (request.State == rs_pending
+			&& request.Deadline != 0
+			&& CTime::getLocalTime() > request.Deadline)
+		{
+			request.State = rs_timeout;
+		}
+
+		return request.State;
+	}
+
+	IModule::TRequestState CModuleBase::pollModuleResponse(TRequestId requestId, NLNET::CMessage &responseMsg)
+	{
+		TRequestState state = getModuleRequestState(requestId);
+		if (state == rs_unknown || state == rs_pending)
+			return state;
+
+		TPendingRequests::iterator it(_PendingRequests.find(requestId));
+		if (state == rs_response || state == rs_except)
+			responseMsg.swap(it->second.Response);
+		_PendingRequests.erase(it);
+
+		return state;
+	}
+
+	/** Wait for the response of a request.
+	 *	Caller MUST be in a module task to call this method.
+	 */
+	void CModuleBase::awaitModuleResponse(TRequestId requestId, NLNET::CMessage &responseMsg) throw (EInvokeFailed)
+	{
+		H_AUTO(CModuleBase_awaitModuleResponse);
+
+		// check that we are running in a coroutine task
+		CModuleTask *task = dynamic_cast<CModuleTask *>(CCoTask::getCurrentTask());
+		nlassert(task != NULL);
+
+		for (;;)
+		{
+			TRequestState state = pollModuleResponse(requestId, responseMsg);
+			if (state == rs_response)
+				return;
+			if (state != rs_pending)
+				throw EInvokeFailed();
+
+			// yield and dispatch the messages received in the mean time
+			task->yield();
+			task->processPendingMessage(this);
+		}
+	}
+
+	void CModuleBase::cancelModuleRequest(TRequestId requestId)
+	{
+		_PendingRequests.erase(requestId);
+	}
+
+	/** Send the response to a request in a MOD_RESP envelope with the request id.
+	 *	The responses sent while processing the request are tagged the same way by CModuleProxy::sendModuleMessage.
+	 */
+	void CModuleBase::sendModuleResponse(IModuleProxy *requester, TRequestId requestId, const NLNET::CMessage &responseMsg)
+	{
+		H_AUTO(CModuleBase_sendModuleResponse);
+
+		nlassert(responseMsg.getType() == CMessage::Response || responseMsg.getType() == CMessage::Except);
+		nlassert(requestId != InvalidRequestId);
+
+		CMessage envelope("MOD_RESP");
+		envelope.serial(requestId);
+		envelope.serialMessage(const_cast<CMessage&>(responseMsg));
+		requester->sendModuleMessage(this, envelope);
+	}
+
+	/** Process a request sent with sendModuleRequest().
+	 *	The enclosed request is dispatched normally, the responses sent
+	 *	to the requester meanwhile are tagged by CModuleProxy::sendModuleMessage.
+	 */
+	bool CModuleBase::_onProcessModuleRequest(IModuleProxy *senderModuleProxy, const CMessage &envelope)
+	{
+		H_AUTO(CModuleBase__onProcessModuleRequest);
+
+		TRequestId requestId;
+		CMessage requestMsg;
+		try
+		{
+			nlRead(envelope, serial, requestId);
+			const_cast<CMessage&>(envelope).serialMessage(requestMsg);
+		}
+		catch (NLMISC::EStream &)
+		{
+			nlwarning("Module '%s' received an invalid request envelope from '%s'",
+				getModuleName().c_str(),
+				senderModuleProxy->getModuleName().c_str());
+			return true;
+		}
+		requestMsg.invert();
+
+		// requests can be nested (e.g. dispatched while waiting for a response)
+		IModuleProxy *previousSender = _CurrentRequestSender;
+		TRequestId previousId = _CurrentRequestId;
+		_CurrentRequestSender = senderModuleProxy;
+		_CurrentRequestId = requestId;
+
+		bool processed = _onProcessModuleMessage(senderModuleProxy, requestMsg);
+		if (!processed)
+		{
+			// nobody knows this request, fail it now rather than on timeout
+			LNETL6_DEBUG("NLNETL6: module '%s' has no handler for the request '%s'", getModuleName().c_str(), requestMsg.getName().c_str());
+			CMessage except;
+			except.setType("EXCEPT", CMessage::Except);
+			try
+			{
+				senderModuleProxy->sendModuleMessage(this, except);
+			}
+			catch(...)
+			{
+			}
+		}
+
+		_CurrentRequestSender = previousSender;
+		_CurrentRequestId = previousId;
+
+		return true;
+	}
+
+	void CModuleBase::_onReceiveModuleResponse(IModuleProxy *senderModuleProxy, const CMessage &envelope)
+	{
+		H_AUTO(CModuleBase__onReceiveModuleResponse);
+
+		TRequestId requestId;
+		CMessage responseMsg;
+		try
+		{
+			nlRead(envelope, serial, requestId);
+			const_cast<CMessage&>(envelope).serialMessage(responseMsg);
+		}
+		catch (NLMISC::EStream &)
+		{
+			nlwarning("Module '%s' received an invalid response envelope from '%s'",
+				getModuleName().c_str(),
+				senderModuleProxy->getModuleName().c_str());
+			return;
+		}
+		responseMsg.invert();
+
+		if (getModuleRequestState(requestId) != rs_pending)
+		{
+			LNETL6_DEBUG("NLNETL6: module '%s' discards the response '%s' to the request %u (cancelled, timed out or already answered)",
+				getModuleName().c_str(), responseMsg.getName().c_str(), requestId);
+			return;
+		}
+
+		TPendingRequest &request = _PendingRequests[requestId];
+		request.State = (responseMsg.getType() == CMessage::Except) ? rs_except : rs_response;
+		request.Response.swap(responseMsg);
+	}
+
 	void CModuleBase::_onModuleUp(IModuleProxy *removedProxy)
 	{
 		H_AUTO(CModuleBase__onModuleUp);
@@ -565,6 +777,15 @@ namespace NLNET
 				}
 			}
 		}
+		// fail the requests that this proxy will never answer
+		{
+			TPendingRequests::iterator first(_PendingRequests.begin()), last(_PendingRequests.end());
+			for (; first != last; ++first)
+			{
+				if (first->second.Addressee == removedProxy && first->second.State == rs_pending)
+					first->second.State = rs_module_down;
+			}
+		}
 		// check the invocation stack also
 		{
 			TInvokeStack::iterator first(_InvokeStack.begin()), last(_InvokeStack.end());
@@ -603,6 +824,9 @@ namespace NLNET
 	{
 		H_AUTO(CModuleBase__OnProcessModuleMessage);
 
+		if (message.getTypeId() == ModuleRequestTypeId)
+			return _onProcessModuleRequest(senderModuleProxy, message);
+
 		// try the call on each interceptor
 		bool result;
 		result = false;
@@ -764,6 +988,7 @@ namespace NLNET
 		log.displayNL("  Module full name : '%s'", getModuleFullyQualifiedName().c_str());
 		log.displayNL("  Module class     : '%s'", _ModuleFactory->getModuleClassName().c_str());
 		log.displayNL("  Module ID        : %u", _ModuleId);
+		log.displayNL("  Pending requests : %u", _PendingRequests.size());
 		log.displayNL("  The module is plugged into %u sockets :", _ModuleSockets.size());
 		{
 			TModuleSockets::iterator first(_ModuleSockets.begin()), last(_ModuleSockets.end());
@@ -872,6 +1097,18 @@ namespace NLNET
 			throw EModuleNotReachable();
 		}
 
+		CMessage::TMessageType msgType = message.getType();
+		if (msgType == CMessage::Response || msgType == CMessage::Except)
+		{
+			// a response to a request sent with sendModuleRequest() must carry the request id
+			CModuleBase *senderBase = dynamic_cast<CModuleBase*>(senderModule);
+			if (senderBase != NULL && senderBase->_CurrentRequestSender == this)
+			{
+				senderBase->sendModuleResponse(this, senderBase->_CurrentRequestId, message);
+				return;
+			}
+		}
+
 		_Gateway->sendModuleMessage(senderProx, this, message);
 	}
 
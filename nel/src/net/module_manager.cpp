@@ -859,6 +859,7 @@ namespace NLNET
 	extern void forceLocalGatewayLink();
 	extern void forceGatewayTransportLink();
 	extern void forceGatewayL5TransportLink();
+	extern void forceGatewayShmTransportLink();
 
 
 	void forceLink()
@@ -867,6 +868,7 @@ namespace NLNET
 		forceLocalGatewayLink();
 		forceGatewayTransportLink();
 		forceGatewayL5TransportLink();
+		forceGatewayShmTransportLink();
 	}
 
 } // namespace NLNET
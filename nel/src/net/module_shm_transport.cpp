@@ -0,0 +1,954 @@
+/** \file module_shm_transport.cpp
+ * transport over shared memory for gateways in processes of the same host
+ *
+ * $Id$
+ */
+
+/* Copyright, 2001 Nevrax Ltd.
+ *
+ * This file is part of NEVRAX NEL.
+ * NEVRAX NEL is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+
+ * NEVRAX NEL is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with NEVRAX NEL; see the file COPYING. If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#include "stdnet.h"
+#include "nel/misc/time_nl.h"
+#include "nel/misc/atomic.h"
+#include "nel/misc/shared_memory.h"
+#include "nel/net/module_gateway.h"
+#include "nel/net/module.h"
+#include "nel/net/module_manager.h"
+#include "nel/net/module_socket.h"
+#include "nel/net/module_message.h"
+#include "nel/net/net_log.h"
+
+using namespace std;
+using namespace NLMISC;
+
+
+/* The ShmServer transport creates a shared memory segment identified by a key.
+ * The segment contains a fixed number of slots, each slot being a connection
+ * with a ShmClient transport of another process (or of the same process).
+ * A slot has a single producer/single consumer ring in each direction.
+ * The messages are written in the rings as frames, a message bigger than
+ * a frame is split in several frames. When a ring is full, the messages
+ * are kept in the process and written at the next send or update.
+ *
+ * The rings are polled at each gateway update, like the sockets of the
+ * layer 3 transports, so no system call is needed to send or receive
+ * a message. Each side updates a heart beat in the segment to detect
+ * a dead process.
+ *
+ * Commands:
+ *	ShmServer : open key=<int> [slots=<int>] [ringSize=<bytes>]
+ *				close
+ *	ShmClient : connect key=<int>
+ *				close key=<int>
+ *				retryInterval=<seconds>
+ */
+
+namespace NLNET
+{
+
+	// delay in seconds without heart beat after which the other side is considered dead
+	const uint32	SHM_KEEP_ALIVE_DELAY = 10;
+
+	enum
+	{
+		ShmMagic = 0x4d534c4e, // 'NLSM'
+		ShmVersion = 1,
+		DefaultShmSlots = 8,
+		DefaultShmRingSize = 256*1024,
+		MinShmRingSize = 4096,
+		// size of a cache line, to keep the positions of the producer and of the consumer apart
+		ShmLineSize = 64,
+	};
+
+	/// flag in the frame size, set on the last frame of a message
+	const uint32	ShmLastFrame = 0x80000000;
+
+	/// State of a connection slot
+	enum TShmSlotState
+	{
+		/// The slot is free for a new client
+		sss_free,
+		/// A client is initializing the slot
+		sss_claimed,
+		/// The client and the server are connected
+		sss_connected,
+		/// The client has closed the connection, the server will free the slot
+		sss_client_closed,
+		/// The server has closed the connection
+		sss_server_closed,
+	};
+
+	/// A single producer/single consumer ring (the positions are free running)
+	struct TShmRing
+	{
+		/// Position after the last frame written by the producer
+		volatile uint32	Head;
+		uint8			HeadPad[ShmLineSize-sizeof(uint32)];
+		/// Position after the last frame read by the consumer
+		volatile uint32	Tail;
+		uint8			TailPad[ShmLineSize-sizeof(uint32)];
+	};
+
+	/// A connection slot in the segment
+	struct TShmSlot
+	{
+		/// Current state (from TShmSlotState)
+		volatile uint32	State;
+		/// Last time (seconds since 1970) the client updated the slot
+		volatile uint32	ClientBeat;
+		uint8			Pad[ShmLineSize-2*sizeof(uint32)];
+		/// The ring from the client to the server, then the ring from the server to the client
+		TShmRing		Rings[2];
+	};
+
+	/// Header of the segment, followed by the slots then by the data of the rings
+	struct TShmHeader
+	{
+		uint32			Magic;
+		uint32			Version;
+		uint32			NbSlots;
+		uint32			RingSize;
+		/// Last time (seconds since 1970) the server updated the segment
+		volatile uint32	ServerBeat;
+		uint8			Pad[ShmLineSize-5*sizeof(uint32)];
+
+		TShmSlot *getSlot(uint32 slot)
+		{
+			return reinterpret_cast<TShmSlot*>(this+1) + slot;
+		}
+
+		uint8 *getRingData(uint32 slot, uint32 ring)
+		{
+			return reinterpret_cast<uint8*>(getSlot(NbSlots)) + (slot*2+ring)*RingSize;
+		}
+
+		static uint32 getSegmentSize(uint32 nbSlots, uint32 ringSize)
+		{
+			return sizeof(TShmHeader) + nbSlots*(sizeof(TShmSlot) + 2*ringSize);
+		}
+	};
+
+
+	/** The local side of a connection slot: sends in one ring and receives from the other.
+	 */
+	class CShmChannel
+	{
+		TShmRing		*_Out;
+		uint8			*_OutData;
+		TShmRing		*_In;
+		uint8			*_InData;
+		uint32			_RingSize;
+		uint32			_MaxFrameSize;
+
+		/// Messages waiting for room in the output ring, the first one may be partly written
+		std::deque<std::vector<uint8> >	_Pending;
+		/// Number of bytes of the first pending message already written
+		uint32			_PendingPos;
+		/// The frames received of an incomplete message
+		std::vector<uint8>	_Partial;
+
+	public:
+		/// true if a corrupted frame was received
+		bool			Broken;
+
+		//@{
+		//@name Statistics
+		uint32			NbSent;
+		uint32			NbReceived;
+		uint64			BytesSent;
+		uint64			BytesReceived;
+		/// Number of messages that did not fit in the output ring at once
+		uint32			NbDelayed;
+		//@}
+
+		CShmChannel(TShmHeader *header, uint32 slot, bool server)
+			: _PendingPos(0),
+			Broken(false),
+			NbSent(0),
+			NbReceived(0),
+			BytesSent(0),
+			BytesReceived(0),
+			NbDelayed(0)
+		{
+			uint32 outRing = server ? 1 : 0;
+			TShmSlot *shmSlot = header->getSlot(slot);
+			_Out = &shmSlot->Rings[outRing];
+			_OutData = header->getRingData(slot, outRing);
+			_In = &shmSlot->Rings[1-outRing];
+			_InData = header->getRingData(slot, 1-outRing);
+			_RingSize = header->RingSize;
+			// small frames, so that a big message can be written while the consumer reads its beginning
+			_MaxFrameSize = _RingSize / 4;
+		}
+
+		uint32 getPendingCount() const
+		{
+			return (uint32)_Pending.size();
+		}
+
+		/// Send a message, or keep it for the next flush() if the ring is full
+		void send(const CMessage &message)
+		{
+			H_AUTO(CShmChannel_send);
+
+			const uint8 *data = message.buffer();
+			uint32 size = message.length();
+
+			++NbSent;
+			BytesSent += size;
+
+			uint32 pos = 0;
+			if (_Pending.empty() && writeFrames(data, size, pos))
+				return;
+
+			// keep the remaining of the message for later
+			++NbDelayed;
+			_Pending.push_back(std::vector<uint8>(data, data+size));
+			if (_Pending.size() == 1)
+				_PendingPos = pos;
+		}
+
+		/// Write the pending messages that fit in the output ring. Return true if all are written.
+		bool flush()
+		{
+			while (!_Pending.empty())
+			{
+				std::vector<uint8> &data = _Pending.front();
+				if (!writeFrames(&data[0], (uint32)data.size(), _PendingPos))
+					return false;
+				_Pending.pop_front();
+				_PendingPos = 0;
+			}
+			return true;
+		}
+
+		/// Read the next complete message from the input ring. Return false if there is none.
+		bool receive(CMessage &msgin)
+		{
+			H_AUTO(CShmChannel_receive);
+
+			uint32 head = _In->Head;
+			memoryBarrier();
+			uint32 tail = _In->Tail;
+
+			while (tail != head)
+			{
+				uint32 frameHeader;
+				if (head - tail < sizeof(frameHeader))
+				{
+					Broken = true;
+					return false;
+				}
+				readRing(tail, (uint8*)&frameHeader, sizeof(frameHeader));
+				tail += sizeof(frameHeader);
+				uint32 frameSize = frameHeader & ~ShmLastFrame;
+				if (frameSize > head - tail)
+				{
+					Broken = true;
+					return false;
+				}
+
+				if ((frameHeader & ShmLastFrame) && _Partial.empty())
+				{
+					// a message in one frame, read it directly in the message
+					if (frameSize == 0)
+					{
+						Broken = true;
+						return false;
+					}
+					readRing(tail, msgin.bufferToFill(frameSize), frameSize);
+					tail += frameSize;
+					releaseInput(tail);
+					msgin.readType();
+					++NbReceived;
+					BytesReceived += frameSize;
+					return true;
+				}
+
+				uint32 offset = (uint32)_Partial.size();
+				_Partial.resize(offset + frameSize);
+				readRing(tail, &_Partial[offset], frameSize);
+				tail += frameSize;
+
+				if (frameHeader & ShmLastFrame)
+				{
+					releaseInput(tail);
+					memcpy(msgin.bufferToFill((uint32)_Partial.size()), &_Partial[0], _Partial.size());
+					msgin.readType();
+					++NbReceived;
+					BytesReceived += _Partial.size();
+					_Partial.clear();
+					return true;
+				}
+			}
+
+			releaseInput(tail);
+			return false;
+		}
+
+	private:
+		/// Write frames from data+pos as long as they fit, return true if the whole message is written
+		bool writeFrames(const uint8 *data, uint32 size, uint32 &pos)
+		{
+			uint32 head = _Out->Head;
+			uint32 tail = _Out->Tail;
+			memoryBarrier();
+			uint32 freeSize = _RingSize - (head - tail);
+
+			bool complete = false;
+			for (;;)
+			{
+				uint32 frameSize = std::min(size - pos, _MaxFrameSize);
+				if (freeSize < frameSize + sizeof(uint32))
+					break;
+
+				uint32 frameHeader = frameSize;
+				if (pos + frameSize == size)
+					frameHeader |= ShmLastFrame;
+				writeRing(head, (const uint8*)&frameHeader, sizeof(frameHeader));
+				writeRing(head + sizeof(frameHeader), data + pos, frameSize);
+				head += frameSize + sizeof(frameHeader);
+				freeSize -= frameSize + sizeof(frameHeader);
+				pos += frameSize;
+
+				if (frameHeader & ShmLastFrame)
+				{
+					complete = true;
+					break;
+				}
+			}
+
+			// publish the frames after their content
+			memoryBarrier();
+			_Out->Head = head;
+			return complete;
+		}
+
+		void writeRing(uint32 pos, const uint8 *src, uint32 size)
+		{
+			uint32 offset = pos & (_RingSize-1);
+			uint32 first = std::min(size, _RingSize - offset);
+			memcpy(_OutData + offset, src, first);
+			memcpy(_OutData, src + first, size - first);
+		}
+
+		void readRing(uint32 pos, uint8 *dest, uint32 size)
+		{
+			uint32 offset = pos & (_RingSize-1);
+			uint32 first = std::min(size, _RingSize - offset);
+			memcpy(dest, _InData + offset, first);
+			memcpy(dest + first, _InData, size - first);
+		}
+
+		/// Give the read bytes back to the producer
+		void releaseInput(uint32 tail)
+		{
+			memoryBarrier();
+			_In->Tail = tail;
+		}
+	};
+
+	/** Common part of the shared memory routes */
+	class CShmRoute : public CGatewayRoute
+	{
+	public:
+		/// The connection slot used by the route
+		uint32						Slot;
+		/// The local side of the slot
+		mutable CShmChannel			Channel;
+
+		CShmRoute(IGatewayTransport *transport, TShmHeader *header, uint32 slot, bool server)
+			: CGatewayRoute(transport),
+			Slot(slot),
+			Channel(header, slot, server)
+		{
+		}
+
+		void sendMessage(const CMessage &message) const
+		{
+			NLNET_AUTO_DELTE_ASSERT;
+			H_AUTO(ShmRoute_sendMessage);
+
+			Channel.send(message);
+		}
+
+		/// Dispatch the received messages to the gateway and write the pending messages
+		void update(IModuleGateway *gateway)
+		{
+			H_AUTO(ShmRoute_update);
+
+			for (;;)
+			{
+				CMessage msgin("", true);
+				if (!Channel.receive(msgin))
+					break;
+				gateway->onReceiveMessage(this, msgin);
+			}
+
+			Channel.flush();
+		}
+
+		void dump(NLMISC::CLog &log) const
+		{
+			IModuleManager &mm = IModuleManager::getInstance();
+			log.displayNL("    + route on slot %u, %u entries in the proxy translation table :",
+				Slot,
+				ForeignToLocalIdx.getAToBMap().size());
+
+			CGatewayRoute::TForeignToLocalIdx::TAToBMap::const_iterator first(ForeignToLocalIdx.getAToBMap().begin()), last(ForeignToLocalIdx.getAToBMap().end());
+			for (; first != last; ++first)
+			{
+				IModuleProxy *modProx = mm.getModuleProxy(first->second);
+
+				log.displayNL("      - Proxy '%s' : local proxy id %u => foreign module id %u",
+					modProx != NULL ? modProx->getModuleName().c_str() : "ERROR, invalid module",
+					first->second,
+					first->first);
+			}
+			log.displayNL("      sent %u messages (%"NL_I64"u bytes, %u delayed by a full ring, %u pending), received %u messages (%"NL_I64"u bytes)",
+				Channel.NbSent, Channel.BytesSent, Channel.NbDelayed, Channel.getPendingCount(),
+				Channel.NbReceived, Channel.BytesReceived);
+		}
+	};
+
+	/// Return true if the heart beat is too old
+	static bool isBeatDead(uint32 beat, uint32 now)
+	{
+		return now > beat && now - beat > SHM_KEEP_ALIVE_DELAY;
+	}
+
+
+#define SHM_SERVER_CLASS_NAME "ShmServer"
+
+	/** Gateway transport using shared memory, server side (owner of the segment) */
+	class CGatewayShmServerTransport : public IGatewayTransport
+	{
+	public:
+		/// The key of the segment
+		sint32			_Key;
+		/// The segment, NULL when the transport is closed
+		TShmHeader		*_Header;
+
+		/// The routes, by slot
+		typedef std::map<uint32, CShmRoute*>	TRouteMap;
+		TRouteMap		_Routes;
+
+		/// Constructor
+		CGatewayShmServerTransport(const IGatewayTransport::TCtorParam &param)
+			: IGatewayTransport(param),
+			_Key(0),
+			_Header(NULL)
+		{
+		}
+
+		~CGatewayShmServerTransport()
+		{
+			if (_Header != NULL)
+			{
+				// the transport is still open, close it before destruction
+				closeServer();
+			}
+		}
+
+		const std::string &getClassName() const
+		{
+			static string className(SHM_SERVER_CLASS_NAME);
+			return className;
+		}
+
+		virtual void update()
+		{
+			H_AUTO(ShmS_update);
+
+			if (_Header == NULL)
+				return;
+
+			uint32 now = CTime::getSecondsSince1970();
+			_Header->ServerBeat = now;
+
+			for (uint32 i=0; i<_Header->NbSlots; ++i)
+			{
+				TShmSlot *slot = _Header->getSlot(i);
+				TRouteMap::iterator it(_Routes.find(i));
+				CShmRoute *route = (it != _Routes.end()) ? it->second : NULL;
+
+				switch (slot->State)
+				{
+				case sss_connected:
+					if (route == NULL)
+					{
+						// a new client
+						LNETL6_DEBUG("LNETL6: ShmServer: new client on slot %u", i);
+						route = new CShmRoute(this, _Header, i, true);
+						_Routes.insert(make_pair(i, route));
+						_Gateway->onRouteAdded(route);
+					}
+					else if (isBeatDead(slot->ClientBeat, now) || route->Channel.Broken)
+					{
+						nlinfo("NETL6:ShmServer: the client of slot %u is dead or corrupted, closing the route", i);
+						removeRoute(i);
+						route = NULL;
+						slot->State = sss_free;
+					}
+					break;
+				case sss_client_closed:
+					if (route != NULL)
+					{
+						// dispatch the last messages before removing the route
+						route->update(_Gateway);
+						removeRoute(i);
+						route = NULL;
+					}
+					slot->State = sss_free;
+					break;
+				case sss_claimed:
+					// the client may have died while connecting
+					if (isBeatDead(slot->ClientBeat, now))
+						atomicCompareAndSwap(&slot->State, sss_claimed, sss_free);
+					break;
+				default:
+					break;
+				}
+
+				if (route != NULL)
+					route->update(_Gateway);
+			}
+		}
+
+		virtual uint32 getRouteCount() const
+		{
+			return _Routes.size();
+		}
+
+		void dump(NLMISC::CLog &log) const
+		{
+			log.displayNL("  NeL Net shared memory transport, SERVER mode");
+			if (_Header == NULL)
+			{
+				log.displayNL("  The server is currently closed.");
+			}
+			else
+			{
+				log.displayNL("  The server is open on key %d (%u slots, rings of %u bytes) and support %u routes :",
+					_Key,
+					_Header->NbSlots,
+					_Header->RingSize,
+					_Routes.size());
+				TRouteMap::const_iterator first(_Routes.begin()), last(_Routes.end());
+				for (; first != last; ++first)
+				{
+					first->second->dump(log);
+				}
+			}
+		}
+
+		void onCommand(const CMessage &command) throw (EInvalidCommand)
+		{
+			// nothing done for now
+			throw EInvalidCommand();
+		}
+		/// The gateway send a textual command to the transport
+		bool onCommand(const TParsedCommandLine &command) throw (EInvalidCommand)
+		{
+			if (command.SubParams.size() < 1)
+				throw  EInvalidCommand();
+
+			const std::string &commandName = command.SubParams[0]->ParamName;
+			if (commandName == "open")
+			{
+				const TParsedCommandLine *keyParam = command.getParam("key");
+				if (keyParam == NULL)
+					throw EInvalidCommand();
+
+				uint32 nbSlots = DefaultShmSlots;
+				const TParsedCommandLine *slotsParam = command.getParam("slots");
+				if (slotsParam != NULL)
+					nbSlots = atoi(slotsParam->ParamValue.c_str());
+
+				uint32 ringSize = DefaultShmRingSize;
+				const TParsedCommandLine *ringSizeParam = command.getParam("ringSize");
+				if (ringSizeParam != NULL)
+					ringSize = atoi(ringSizeParam->ParamValue.c_str());
+
+				openServer(atoi(keyParam->ParamValue.c_str()), nbSlots, ringSize);
+			}
+			else if (commandName == "close")
+			{
+				closeServer();
+			}
+			else
+				return false;
+
+			return true;
+		}
+
+		/// Create the segment
+		void openServer(sint32 key, uint32 nbSlots, uint32 ringSize) throw (ETransportError)
+		{
+			if (_Header != NULL)
+				throw ETransportError("openServer : The server is already open");
+			if (nbSlots == 0)
+				throw ETransportError("openServer : At least one slot is needed");
+
+			// the ring size must be a power of 2
+			uint32 size = MinShmRingSize;
+			while (size < ringSize)
+				size <<= 1;
+			ringSize = size;
+
+			uint32 segmentSize = TShmHeader::getSegmentSize(nbSlots, ringSize);
+			void *segment = CSharedMemory::createSharedMemory(toSharedMemId(key), segmentSize);
+			if (segment == NULL)
+			{
+				// a segment with this key exists, reuse the key only if its server is dead
+				TShmHeader *header = (TShmHeader*)CSharedMemory::accessSharedMemory(toSharedMemId(key));
+				if (header != NULL)
+				{
+					bool alive = header->Magic == ShmMagic && !isBeatDead(header->ServerBeat, CTime::getSecondsSince1970());
+					CSharedMemory::closeSharedMemory(header);
+					if (alive)
+						throw ETransportError("openServer : The key is used by another server");
+				}
+
+				nlinfo("NETL6:ShmServer: destroying the segment %d left by a dead server", key);
+				CSharedMemory::destroySharedMemory(toSharedMemId(key), true);
+				segment = CSharedMemory::createSharedMemory(toSharedMemId(key), segmentSize);
+				if (segment == NULL)
+					throw ETransportError("openServer : Can't create the shared memory segment");
+			}
+
+			memset(segment, 0, segmentSize);
+			_Header = (TShmHeader*)segment;
+			_Header->Version = ShmVersion;
+			_Header->NbSlots = nbSlots;
+			_Header->RingSize = ringSize;
+			_Header->ServerBeat = CTime::getSecondsSince1970();
+			// the clients check the magic number last
+			memoryBarrier();
+			_Header->Magic = ShmMagic;
+			_Key = key;
+		}
+
+		/// Close the server, this will close all the routes
+		void closeServer()
+		{
+			if (_Header == NULL)
+				throw ETransportError("closeServer : The server is not open");
+
+			while (!_Routes.empty())
+			{
+				uint32 slot = _Routes.begin()->first;
+				removeRoute(slot);
+				_Header->getSlot(slot)->State = sss_server_closed;
+			}
+
+			// the clients still attached will see that the server is closed
+			_Header->Magic = 0;
+			memoryBarrier();
+
+			// the segment is destroyed when the last process detaches it
+			CSharedMemory::destroySharedMemory(toSharedMemId(_Key));
+			CSharedMemory::closeSharedMemory(_Header);
+			_Header = NULL;
+		}
+
+	private:
+		void removeRoute(uint32 slot)
+		{
+			TRouteMap::iterator it(_Routes.find(slot));
+			nlassert(it != _Routes.end());
+
+			CShmRoute *route = it->second;
+			_Gateway->onRouteRemoved(route);
+
+			_Routes.erase(it);
+			delete route;
+		}
+	};
+
+	// register this class in the transport factory
+	NLMISC_REGISTER_OBJECT(IGatewayTransport, CGatewayShmServerTransport, std::string, string(SHM_SERVER_CLASS_NAME));
+
+
+	/////////////////////////////////////////////////////////////////////////////////////////
+	/////////////////////////////////////////////////////////////////////////////////////////
+	/// Shared memory client transport
+	/////////////////////////////////////////////////////////////////////////////////////////
+	/////////////////////////////////////////////////////////////////////////////////////////
+
+	/** A connection of the client transport to a server segment */
+	struct TShmConnection
+	{
+		/// The attached segment, NULL when not connected
+		TShmHeader		*Header;
+		/// The route, NULL when not connected
+		CShmRoute		*Route;
+		/// The last time we try to connect
+		uint32			LastConnectionRetry;
+
+		TShmConnection()
+			: Header(NULL),
+			Route(NULL),
+			LastConnectionRetry(0)
+		{
+		}
+	};
+
+#define SHM_CLIENT_CLASS_NAME "ShmClient"
+
+	/** Gateway transport using shared memory, client side */
+	class CGatewayShmClientTransport : public IGatewayTransport
+	{
+	public:
+		/// The connections, by segment key
+		typedef std::map<sint32, TShmConnection>	TConnections;
+		TConnections	_Connections;
+
+		/// Retry interval for reconnection
+		uint32			_RetryInterval;
+
+		enum
+		{
+			/// Default time interval (in seconds) between to connection attempts
+			RETRY_INTERVAL =  5,
+			/// A minimum value in case or configuration error
+			MIN_RETRY_INTERVAL = 1,
+		};
+
+		/// Constructor
+		CGatewayShmClientTransport(const IGatewayTransport::TCtorParam &param)
+			: IGatewayTransport(param),
+			_RetryInterval(RETRY_INTERVAL)
+		{
+		}
+
+		~CGatewayShmClientTransport()
+		{
+			while (!_Connections.empty())
+			{
+				close(_Connections.begin()->first);
+			}
+		}
+
+		const std::string &getClassName() const
+		{
+			static string className(SHM_CLIENT_CLASS_NAME);
+			return className;
+		}
+
+		virtual void update()
+		{
+			H_AUTO(ShmC_update);
+
+			uint32 now = CTime::getSecondsSince1970();
+			TConnections::iterator first(_Connections.begin()), last(_Connections.end());
+			for (; first != last; ++first)
+			{
+				TShmConnection &conn = first->second;
+
+				if (conn.Route == NULL)
+				{
+					// not connected, try a connection ?
+					if (conn.LastConnectionRetry + _RetryInterval < now)
+					{
+						conn.LastConnectionRetry = now;
+						connectSegment(first->first, conn);
+					}
+					continue;
+				}
+
+				TShmSlot *slot = conn.Header->getSlot(conn.Route->Slot);
+				slot->ClientBeat = now;
+
+				conn.Route->update(_Gateway);
+
+				if (slot->State != sss_connected
+					|| conn.Header->Magic != ShmMagic
+					|| isBeatDead(conn.Header->ServerBeat, now)
+					|| conn.Route->Channel.Broken)
+				{
+					nlinfo("NETL6:ShmClient: lost the connection to the segment %d", first->first);
+					disconnectSegment(conn, false);
+				}
+			}
+		}
+
+		virtual uint32 getRouteCount() const
+		{
+			uint32 count = 0;
+			TConnections::const_iterator first(_Connections.begin()), last(_Connections.end());
+			for (; first != last; ++first)
+			{
+				if (first->second.Route != NULL)
+					++count;
+			}
+			return count;
+		}
+
+		void dump(NLMISC::CLog &log) const
+		{
+			log.displayNL("  NeL Net shared memory transport, CLIENT mode");
+			log.displayNL("  There are actually %u connections :", _Connections.size());
+
+			TConnections::const_iterator first(_Connections.begin()), last(_Connections.end());
+			for (; first != last; ++first)
+			{
+				log.displayNL("    + connection to the segment %d, %s",
+					first->first,
+					first->second.Route != NULL ? "connected" : "NOT CONNECTED");
+				if (first->second.Route != NULL)
+					first->second.Route->dump(log);
+			}
+		}
+
+		void onCommand(const CMessage &command) throw (EInvalidCommand)
+		{
+			// nothing done for now
+			throw EInvalidCommand();
+		}
+		/// The gateway send a textual command to the transport
+		bool onCommand(const TParsedCommandLine &command) throw (EInvalidCommand)
+		{
+			if (command.SubParams.size() < 1)
+				throw  EInvalidCommand();
+
+			const std::string &commandName = command.SubParams[0]->ParamName;
+			if (commandName == "connect")
+			{
+				const TParsedCommandLine *keyParam = command.getParam("key");
+				if (keyParam == NULL)
+					throw EInvalidCommand();
+
+				connect(atoi(keyParam->ParamValue.c_str()));
+			}
+			else if (commandName == "close")
+			{
+				const TParsedCommandLine *keyParam = command.getParam("key");
+				if (keyParam == NULL)
+					throw EInvalidCommand();
+
+				close(atoi(keyParam->ParamValue.c_str()));
+			}
+			else if (commandName == "retryInterval")
+			{
+				uint32 interval = atoi(command.SubParams[0]->ParamValue.c_str());
+				_RetryInterval = std::max(uint32(MIN_RETRY_INTERVAL), interval);
+			}
+			else
+				return false;
+
+			return true;
+		}
+
+		/// Connect to a server segment, the connection is retried until the server is available
+		void connect(sint32 key)
+		{
+			if (_Connections.find(key) != _Connections.end())
+				throw ETransportError("connect : Already connected to this segment");
+
+			TShmConnection &conn = _Connections[key];
+			conn.LastConnectionRetry = CTime::getSecondsSince1970();
+			if (!connectSegment(key, conn))
+				nlinfo("NETL6:ShmClient: segment %d still not available for connection", key);
+		}
+
+		/// Close the connection to a server segment
+		void close(sint32 key)
+		{
+			TConnections::iterator it(_Connections.find(key));
+			if (it == _Connections.end())
+				throw ETransportError("close : Not connected to this segment");
+
+			if (it->second.Route != NULL)
+				disconnectSegment(it->second, true);
+			_Connections.erase(it);
+		}
+
+	private:
+		/// Attach the segment and claim a free slot
+		bool connectSegment(sint32 key, TShmConnection &conn)
+		{
+			nlassert(conn.Header == NULL);
+
+			TShmHeader *header = (TShmHeader*)CSharedMemory::accessSharedMemory(toSharedMemId(key));
+			if (header == NULL)
+				return false;
+
+			uint32 now = CTime::getSecondsSince1970();
+			if (header->Magic != ShmMagic
+				|| header->Version != ShmVersion
+				|| isBeatDead(header->ServerBeat, now))
+			{
+				CSharedMemory::closeSharedMemory(header);
+				return false;
+			}
+			memoryBarrier();
+
+			for (uint32 i=0; i<header->NbSlots; ++i)
+			{
+				TShmSlot *slot = header->getSlot(i);
+				if (atomicCompareAndSwap(&slot->State, sss_free, sss_claimed))
+				{
+					// initialize the slot before the server sees it
+					slot->ClientBeat = now;
+					slot->Rings[0].Head = slot->Rings[0].Tail = 0;
+					slot->Rings[1].Head = slot->Rings[1].Tail = 0;
+					memoryBarrier();
+					slot->State = sss_connected;
+
+					conn.Header = header;
+					conn.Route = new CShmRoute(this, header, i, false);
+					LNETL6_DEBUG("LNETL6: ShmClient: connected to the segment %d on slot %u", key, i);
+					_Gateway->onRouteAdded(conn.Route);
+					return true;
+				}
+			}
+
+			nlwarning("NETL6:ShmClient: no free slot in the segment %d", key);
+			CSharedMemory::closeSharedMemory(header);
+			return false;
+		}
+
+		void disconnectSegment(TShmConnection &conn, bool closedByClient)
+		{
+			_Gateway->onRouteRemoved(conn.Route);
+
+			TShmSlot *slot = conn.Header->getSlot(conn.Route->Slot);
+			if (closedByClient)
+			{
+				// the server will free the slot
+				slot->State = sss_client_closed;
+			}
+
+			delete conn.Route;
+			conn.Route = NULL;
+			CSharedMemory::closeSharedMemory(conn.Header);
+			conn.Header = NULL;
+		}
+	};
+
+	// register this class in the transport factory
+	NLMISC_REGISTER_OBJECT(IGatewayTransport, CGatewayShmClientTransport, std::string, string(SHM_CLIENT_CLASS_NAME));
+
+
+	void forceGatewayShmTransportLink()
+	{
+	}
+
+} // namespace NLNET
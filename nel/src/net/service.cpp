@@ -48,6 +48,7 @@
 
 #include "nel/misc/config_file.h"
 #include "nel/misc/displayer.h"
+#include "nel/misc/binary_log_displayer.h"
 #include "nel/misc/mutex.h"
 #include "nel/misc/window_displayer.h"
 #include "nel/misc/gtk_displayer.h"
@@ -137,6 +138,7 @@ uint32 LastTimeInCallback = 0;
 static uint SignalisedThread;
 
 static CFileDisplayer fd;
+static CBinaryLogDisplayer bfd;
 static CNetDisplayer commandDisplayer(false);
 //static CLog commandLog;
 
@@ -731,15 +733,27 @@ sint IService::main (const char *serviceShortName, const char *serviceLongName,
 			string logname = LogDirectory.toString() + _LongName;
 			if (haveArg('N'))
 				logname += "_" + toLower(getArg('N'));
-			logname += ".log";
-			fd.setParam (logname, false);
-
-			DebugLog->addDisplayer (&fd);
-			InfoLog->addDisplayer (&fd);
-			WarningLog->addDisplayer (&fd);
-			AssertLog->addDisplayer (&fd);
-			ErrorLog->addDisplayer (&fd);
-			CommandLog.addDisplayer (&fd, true);
+
+			// the binary log ("test_service_ALIAS.blog") is read with the log_decoder tool
+			IDisplayer *logDisplayer = &fd;
+			if (ConfigFile.exists ("BinaryLog") && ConfigFile.getVar("BinaryLog").asInt() == 1)
+			{
+				logname += ".blog";
+				bfd.setParam (logname, false);
+				logDisplayer = &bfd;
+			}
+			else
+			{
+				logname += ".log";
+				fd.setParam (logname, false);
+			}
+
+			DebugLog->addDisplayer (logDisplayer);
+			InfoLog->addDisplayer (logDisplayer);
+			WarningLog->addDisplayer (logDisplayer);
+			AssertLog->addDisplayer (logDisplayer);
+			ErrorLog->addDisplayer (logDisplayer);
+			CommandLog.addDisplayer (logDisplayer, true);
 		}
 
 		bool dontUseStdIn= (ConfigFile.exists ("DontUseStdIn")) && (ConfigFile.getVar("DontUseStdIn").asInt() == 1);
@@ -869,6 +883,20 @@ sint IService::main (const char *serviceShortName, const char *serviceLongName,
 			}
 		}
 
+		// The debug, info and warning logs can be displayed by a background thread (errors and asserts are always displayed at once)
+		if ((var = ConfigFile.getVarPtr ("AsyncLog")) != NULL && var->asInt() == 1)
+		{
+			uint32 queueSize = 16384;
+			bool dropWhenFull = false;
+			if ((var = ConfigFile.getVarPtr ("AsyncLogQueueSize")) != NULL) queueSize = var->asInt();
+			if ((var = ConfigFile.getVarPtr ("AsyncLogDropWhenFull")) != NULL) dropWhenFull = var->asInt() == 1;
+			CLog::setAsyncQueue (queueSize, dropWhenFull);
+
+			DebugLog->setAsync (true);
+			InfoLog->setAsync (true);
+			WarningLog->setAsync (true);
+		}
+
 		nlinfo ("SERVICE: Starting Service '%s' using NeL ("__DATE__" "__TIME__") compiled %s", _ShortName.c_str(), CompilationDate.c_str());
 		nlinfo ("SERVICE: On OS: %s", CSystemInfo::getOS().c_str());
 		
@@ -1011,6 +1039,59 @@ sint IService::main (const char *serviceShortName, const char *serviceLongName,
 			CMessage::setDefaultStringMode( false );
 		}
 
+		// Load the default type format (1 means that the message types are sent as ids instead of names)
+		if ((var = ConfigFile.getVarPtr ("IdMsgFormat")) != NULL)
+		{
+			CMessage::setDefaultIdMode( var->asInt() == 1 );
+		}
+		else
+		{
+			// Not found => names
+			CMessage::setDefaultIdMode( false );
+		}
+
+		// Load the layer 1 receive engine (if not found, the best one available is used)
+		if ((var = ConfigFile.getVarPtr ("NetReceiveEngine")) != NULL)
+		{
+			string sengine = toLower(var->asString());
+			if ( sengine == "select" )
+			{
+				CBufServer::setDefaultReceiveEngine( CBufServer::SelectEngine );
+			}
+			else if ( sengine == "epoll" )
+			{
+				CBufServer::setDefaultReceiveEngine( CBufServer::EpollEngine );
+			}
+			else
+			{
+				nlwarning( "SERVICE: Unknown NetReceiveEngine '%s' (expected 'epoll' or 'select')", sengine.c_str() );
+			}
+		}
+		nlinfo( "SERVICE: Layer 1 receive engine is %s", (CBufServer::defaultReceiveEngine() == CBufServer::EpollEngine) ? "epoll" : "select" );
+
+		// Load the layer 1 client receive engine (if not found, the best one available is used)
+		if ((var = ConfigFile.getVarPtr ("NetClientReceiveEngine")) != NULL)
+		{
+			string sengine = toLower(var->asString());
+			if ( sengine == "thread" )
+			{
+				CBufClient::setDefaultReceiveEngine( CBufClient::ThreadEngine );
+			}
+			else if ( sengine == "shared" )
+			{
+				CBufClient::setDefaultReceiveEngine( CBufClient::SharedEngine );
+			}
+			else
+			{
+				nlwarning( "SERVICE: Unknown NetClientReceiveEngine '%s' (expected 'shared' or 'thread')", sengine.c_str() );
+			}
+		}
+		if ((var = ConfigFile.getVarPtr ("NetClientReceiveThreads")) != NULL)
+		{
+			CBufClient::setNbSharedReceiveThreads( var->asInt() );
+		}
+		nlinfo( "SERVICE: Layer 1 client receive engine is %s", (CBufClient::defaultReceiveEngine() == CBufClient::SharedEngine) ? "shared" : "thread" );
+
 
 		///
 		/// Layer5 Startup
@@ -1622,6 +1703,11 @@ sint IService::main (const char *serviceShortName, const char *serviceLongName,
 
 	nlinfo ("SERVICE: Service ends");
 
+	// display the last queued lines
+	DebugLog->setAsync (false);
+	InfoLog->setAsync (false);
+	WarningLog->setAsync (false);
+
 	return ExitSignalAsked?100+ExitSignalAsked:getExitStatus ();
 }
 
@@ -0,0 +1,298 @@
+/** \file sharded_buf_server.cpp
+ * Network engine, layer 1, server split into independent shards
+ *
+ * $Id$
+ */
+
+/* Copyright, 2001 Nevrax Ltd.
+ *
+ * This file is part of NEVRAX NEL.
+ * NEVRAX NEL is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+
+ * NEVRAX NEL is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with NEVRAX NEL; see the file COPYING. If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#include "stdnet.h"
+
+#include "nel/misc/system_info.h"
+#include "nel/misc/time_nl.h"
+
+#include "nel/net/sharded_buf_server.h"
+#include "nel/net/listen_sock.h"
+#include "nel/net/net_log.h"
+
+#ifdef NL_OS_UNIX
+#	include <poll.h>
+#endif
+
+using namespace NLMISC;
+using namespace std;
+
+namespace NLNET {
+
+
+/*
+ * Code of a shard thread
+ */
+class CShardTask : public IRunnable
+{
+public:
+
+	/// Constructor
+	CShardTask( CBufServer *shard, TShardMessageCallback cb, void *arg, uint32 updatePeriod ) :
+		_Shard( shard ), _Callback( cb ), _Arg( arg ), _UpdatePeriod( updatePeriod ), _ExitRequired( false ) {}
+
+	/// Tells the task to exit (it will exit within updatePeriod)
+	void			requireExit() { _ExitRequired = true; }
+
+	/// Run
+	virtual void	run()
+	{
+		TSockId from;
+		TTime lastUpdate = CTime::getLocalTime();
+		while ( ! _ExitRequired )
+		{
+			// Process the messages of this shard only
+			while ( _Shard->dataAvailable() )
+			{
+				CMemStream buffer( true );
+				_Shard->receive( buffer, &from );
+				_Callback( _Shard, buffer, from, _Arg );
+
+				// Do not starve the send queues under a continuous flow
+				if ( CTime::getLocalTime() - lastUpdate >= (TTime)_UpdatePeriod )
+					break;
+			}
+
+			// Flush the send queues of this shard
+			_Shard->update();
+			lastUpdate = CTime::getLocalTime();
+
+			waitForData();
+		}
+	}
+
+	/// Returns the runnable name
+	virtual void	getName( std::string &result ) const { result = "CShardTask"; }
+
+private:
+
+	/// Wait until the receive queue is written or until the update period is elapsed
+	void			waitForData()
+	{
+		if ( _Shard->dataAvailable() )
+			return;
+#ifdef NL_OS_UNIX
+		// poll() does not have the FD_SETSIZE limit of select()
+		pollfd pfd;
+		pfd.fd = _Shard->dataAvailablePipeReadHandle();
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		::poll( &pfd, 1, (int)_UpdatePeriod );
+#else
+		nlSleep( 1 );
+#endif
+	}
+
+	CBufServer				*_Shard;
+	TShardMessageCallback	_Callback;
+	void					*_Arg;
+	uint32					_UpdatePeriod;
+	volatile bool			_ExitRequired;
+};
+
+
+/*
+ * Constructor
+ */
+CShardedBufServer::CShardedBufServer( uint nbShards, bool nodelay )
+{
+	if ( nbShards == 0 )
+	{
+		nbShards = CSystemInfo::getNumberOfProcessors();
+	}
+	if ( (nbShards > 1) && (! CListenSock::reusePortSupported()) )
+	{
+		nlwarning( "LNETL1: SO_REUSEPORT not supported, using one shard instead of %u", nbShards );
+		nbShards = 1;
+	}
+
+	// Each shard spreads its sockets among its receive threads
+	_Shards.resize( nbShards );
+	for ( uint i=0; i!=nbShards; ++i )
+	{
+		_Shards[i] = new CBufServer( CBufServer::SpreadSockets, DEFAULT_MAX_THREADS, DEFAULT_MAX_SOCKETS_PER_THREADS, nodelay );
+	}
+}
+
+
+/*
+ * Destructor
+ */
+CShardedBufServer::~CShardedBufServer()
+{
+	stopThreads();
+	for ( uint i=0; i!=_Shards.size(); ++i )
+	{
+		delete _Shards[i];
+	}
+}
+
+
+/*
+ * Listens on the specified port with all the shards
+ */
+void CShardedBufServer::init( uint16 port )
+{
+	bool reusePort = (_Shards.size() > 1);
+	for ( uint i=0; i!=_Shards.size(); ++i )
+	{
+		_Shards[i]->init( port, reusePort );
+	}
+	LNETL1_DEBUG( "LNETL1: %u shards listening on port %hu", _Shards.size(), port );
+}
+
+
+/*
+ * Sets the connection callback of every shard
+ */
+void CShardedBufServer::setConnectionCallback( TNetCallback cb, void* arg )
+{
+	for ( uint i=0; i!=_Shards.size(); ++i )
+	{
+		_Shards[i]->setConnectionCallback( cb, arg );
+	}
+}
+
+
+/*
+ * Sets the disconnection callback of every shard
+ */
+void CShardedBufServer::setDisconnectionCallback( TNetCallback cb, void* arg )
+{
+	for ( uint i=0; i!=_Shards.size(); ++i )
+	{
+		_Shards[i]->setDisconnectionCallback( cb, arg );
+	}
+}
+
+
+/*
+ * Sends a message to the specified host, or to all hosts of all shards
+ */
+void CShardedBufServer::send( const NLMISC::CMemStream& buffer, TSockId hostid )
+{
+	nlassert( ! threadsRunning() );
+	if ( hostid != InvalidSockId )
+	{
+		shardOf( hostid )->send( buffer, hostid );
+	}
+	else
+	{
+		for ( uint i=0; i!=_Shards.size(); ++i )
+		{
+			_Shards[i]->send( buffer, InvalidSockId );
+		}
+	}
+}
+
+
+/*
+ * Disconnects a connection, or all connections of all shards
+ */
+void CShardedBufServer::disconnect( TSockId hostid, bool quick )
+{
+	nlassert( ! threadsRunning() );
+	if ( hostid != InvalidSockId )
+	{
+		shardOf( hostid )->disconnect( hostid, quick );
+	}
+	else
+	{
+		for ( uint i=0; i!=_Shards.size(); ++i )
+		{
+			_Shards[i]->disconnect( InvalidSockId, quick );
+		}
+	}
+}
+
+
+/*
+ * Updates every shard
+ */
+void CShardedBufServer::update()
+{
+	nlassert( ! threadsRunning() );
+	for ( uint i=0; i!=_Shards.size(); ++i )
+	{
+		_Shards[i]->update();
+	}
+}
+
+
+/*
+ * Returns the number of connections of all shards
+ */
+uint32 CShardedBufServer::nbConnections() const
+{
+	uint32 nb = 0;
+	for ( uint i=0; i!=_Shards.size(); ++i )
+	{
+		nb += _Shards[i]->nbConnections();
+	}
+	return nb;
+}
+
+
+/*
+ * Starts one thread per shard
+ */
+void CShardedBufServer::startThreads( TShardMessageCallback cb, void *arg, uint32 updatePeriod )
+{
+	nlassert( cb != NULL );
+	nlassert( ! threadsRunning() );
+	for ( uint i=0; i!=_Shards.size(); ++i )
+	{
+		CShardTask *task = new CShardTask( _Shards[i], cb, arg, updatePeriod );
+		IThread *thread = IThread::create( task );
+		_Tasks.push_back( task );
+		_Threads.push_back( thread );
+		thread->start();
+	}
+}
+
+
+/*
+ * Stops the shard threads and waits for them
+ */
+void CShardedBufServer::stopThreads()
+{
+	for ( uint i=0; i!=_Threads.size(); ++i )
+	{
+		static_cast<CShardTask*>(_Tasks[i])->requireExit();
+	}
+	for ( uint i=0; i!=_Threads.size(); ++i )
+	{
+		_Threads[i]->wait();
+		delete _Threads[i];
+		delete _Tasks[i];
+	}
+	_Threads.clear();
+	_Tasks.clear();
+}
+
+
+} // NLNET
+
+/* End of sharded_buf_server.cpp */
@@ -53,6 +53,7 @@
 #	include <netdb.h>
 #	include <fcntl.h>
 #	include <cerrno>
+#	include <sys/uio.h>
 
 #	define SOCKET_ERROR -1
 #	define INVALID_SOCKET -1
@@ -278,6 +279,9 @@ void CSock::createSocket( int type, int protocol )
 		throw ESocket( "Socket creation failed" );
 	}
 
+	// A new descriptor is blocking, even when the previous one of this object was not
+	_NonBlocking = false;
+
 	if ( _Logging )
 	{
 //		LNETL0_DEBUG( "LNETL0: Socket %d open (TCP)", _Sock );
@@ -492,6 +496,69 @@ CSock::TSockResult CSock::send( const uint8 *buffer, uint32& len, bool throw_exc
 }
 
 
+/*
+ * Sends several buffers in one system call, or returns false if it would block
+ */
+CSock::TSockResult CSock::sendv( const uint8 * const *buffers, const uint32 *lengths, uint nbBuffers, uint32& len, bool throw_exception )
+{
+	nlassert( nbBuffers <= MaxSendBuffers );
+	TTicks before = CTime::getPerformanceTime();
+	sint result;
+#ifdef NL_OS_WINDOWS
+	WSABUF wsabufs [MaxSendBuffers];
+	for ( uint i=0; i!=nbBuffers; ++i )
+	{
+		wsabufs[i].buf = (char*)buffers[i];
+		wsabufs[i].len = lengths[i];
+	}
+	DWORD sent = 0;
+	result = WSASend( _Sock, wsabufs, nbBuffers, &sent, 0, NULL, NULL );
+	if ( result != SOCKET_ERROR )
+		result = (sint)sent;
+#elif defined NL_OS_UNIX
+	iovec iovecs [MaxSendBuffers];
+	for ( uint i=0; i!=nbBuffers; ++i )
+	{
+		iovecs[i].iov_base = (void*)buffers[i];
+		iovecs[i].iov_len = lengths[i];
+	}
+	result = ::writev( _Sock, iovecs, nbBuffers );
+#endif
+	_MaxSendTime = max( (uint32)(CTime::ticksToSecond(CTime::getPerformanceTime()-before)*1000.0f), _MaxSendTime );
+
+	if ( result == SOCKET_ERROR )
+	{
+		if ( ERROR_NUM == ERROR_WOULDBLOCK )
+		{
+			H_AUTO(L0SendWouldBlock);
+			len = 0;
+			if (!_Blocking)
+			{
+				_Blocking= true;
+			}
+			return Ok;
+		}
+		if ( throw_exception )
+		{
+#ifdef NL_OS_WINDOWS
+			throw ESocket( NLMISC::toString( "Unable to send data: error %u", GetLastError() ).c_str() );
+#else
+			throw ESocket( "Unable to send data" );
+#endif
+		}
+		return Error;
+	}
+	len = (uint32)result;
+	_BytesSent += len;
+
+	if (_Blocking)
+	{
+		_Blocking= false;
+	}
+	return Ok;
+}
+
+
 
 /*
  * Receives data
@@ -59,6 +59,8 @@ namespace NLNET {
 
 NLMISC::CVariable<bool> VerboseNETTC("nel","VerboseNETTC","Enable verbose logging in CTransportClass operations",true,0,true);
 
+NLMISC::CVariable<bool> TransportClassCodec("nel","TransportClassCodec","Use the compiled codecs to send and receive the transport classes",true,0,true);
+
 
 //
 // Variables
@@ -68,6 +70,8 @@ uint CTransportClass::Mode = 0;	// 0=nothing 1=read 2=write 3=register
 
 map<string, CTransportClass::CRegisteredClass>	CTransportClass::LocalRegisteredClass;	// registered class that are in my program
 
+vector<CTransportClass *>	CTransportClass::LocalClassByIndex;
+
 CTransportClass::CRegisteredClass	CTransportClass::TempRegisteredClass;
 
 NLNET::CMessage	CTransportClass::TempMessage;
@@ -94,6 +98,12 @@ string typeToString (CTransportClass::TProp type)
 	return conv[type];
 }
 
+// True if a value of this type can be serialized by the codec itself
+static bool isFlatType (CTransportClass::TProp type)
+{
+	return type <= CTransportClass::PropString;
+}
+
 void CTransportClass::displayDifferentClass (TServiceId sid, const string &className, const vector<CRegisteredBaseProp> &otherClass, const vector<CRegisteredBaseProp *> &myClass)
 {
 	NETTC_INFO ("NETTC: Service with sid %hu send me the TransportClass '%s' with differents properties:", sid.get(), className.c_str());
@@ -160,6 +170,8 @@ void CTransportClass::registerOtherSideClass (TServiceId sid, TOtherSideRegister
 			}
 		}
 
+		(*res).second.Instance->compileReadCodec (sid);
+
 		// check if the version are the same
 		if ((*it).second.size () != (*res).second.Instance->Prop.size ())
 		{
@@ -211,8 +223,136 @@ void CTransportClass::registerClass (CTransportClass &instance)
 	// add the new registered class in the array
 	LocalRegisteredClass[TempRegisteredClass.Instance->Name] = TempRegisteredClass;
 
+	// keep the index of a class registered again, the other services may use it
+	uint i;
+	for (i = 0; i < LocalClassByIndex.size(); i++)
+	{
+		if (LocalClassByIndex[i]->Name == instance.Name)
+			break;
+	}
+	if (i == LocalClassByIndex.size())
+		LocalClassByIndex.push_back (&instance);
+	else
+		LocalClassByIndex[i] = &instance;
+
 	// set to mode none
 	Mode = 0;
+
+	instance.compileWriteCodec ();
+}
+
+void CTransportClass::compileWriteCodec ()
+{
+	if (Codec == NULL)
+		Codec = new CClassCodec;
+	Codec->Write.clear ();
+	for (uint i = 0; i < Prop.size(); i++)
+	{
+		sint32 offset = (sint32)((uint8 *)Prop[i]->getValue () - (uint8 *)this);
+		if (isFlatType (Prop[i]->Type) && !Prop[i]->isContainer ())
+			Codec->Write.push_back (CCodecStep (CCodecStep::Flat, Prop[i]->Type, offset, NULL));
+		else
+			Codec->Write.push_back (CCodecStep (CCodecStep::ByProp, Prop[i]->Type, offset, Prop[i]));
+	}
+}
+
+void CTransportClass::compileReadCodec (TServiceId sid)
+{
+	nlassert (Codec != NULL);
+	if (sid.get() >= Codec->Read.size ())
+		Codec->Read.resize (sid.get()+1);
+
+	CReadCodec &codec = Codec->Read[sid.get()];
+	codec.Steps.clear ();
+	codec.Defaults.clear ();
+	codec.Valid = true;
+
+	vector<bool> sent (Prop.size(), false);
+	const vector<pair<sint, TProp> > &states = States[sid.get()];
+	for (uint i = 0; i < states.size(); i++)
+	{
+		if (states[i].first == -1)
+		{
+			// the value is not in the local class, skip it
+			TProp type = states[i].second;
+			if (type >= DummyProp.size() || DummyProp[type] == NULL)
+			{
+				nlwarning ("NETTC: Can't skip the property of type '%s' of the class '%s' sent by service %hu", typeToString(type).c_str(), Name.c_str(), sid.get());
+				codec.Valid = false;
+				return;
+			}
+			codec.Steps.push_back (CCodecStep (CCodecStep::Skip, type, 0, DummyProp[type]));
+		}
+		else
+		{
+			// same step as to write the local prop
+			codec.Steps.push_back (Codec->Write[states[i].first]);
+			sent[states[i].first] = true;
+		}
+	}
+
+	for (uint i = 0; i < Prop.size(); i++)
+	{
+		if (!sent[i])
+			codec.Defaults.push_back (Prop[i]);
+	}
+}
+
+void CTransportClass::serialCodec (CMessage &msg, const TCodec &codec)
+{
+	for (TCodec::const_iterator it = codec.begin(); it != codec.end(); ++it)
+	{
+		void *value = (uint8 *)this + (*it).Offset;
+		switch ((*it).Kind)
+		{
+		case CCodecStep::Flat:
+			switch ((*it).Type)
+			{
+			case PropUInt8: case PropSInt8: msg.serial (*(uint8 *)value); break;
+			case PropUInt16: case PropSInt16: msg.serial (*(uint16 *)value); break;
+			case PropUInt32: case PropSInt32: msg.serial (*(uint32 *)value); break;
+			case PropUInt64: case PropSInt64: msg.serial (*(uint64 *)value); break;
+			case PropBool: msg.serial (*(bool *)value); break;
+			case PropFloat: msg.serial (*(float *)value); break;
+			case PropDouble: msg.serial (*(double *)value); break;
+			case PropString: msg.serial (*(string *)value); break;
+			default: nlstop;
+			}
+			break;
+		case CCodecStep::ByProp:
+			(*it).Prop->serialValueAt (msg, value);
+			break;
+		case CCodecStep::Skip:
+			(*it).Prop->serialDefaultValue (msg);
+			break;
+		}
+	}
+}
+
+bool CTransportClass::readCompiled (CMessage &msgin, const string &name, TServiceId sid)
+{
+	nlassert (Init);
+	nlassert (Mode == 0);
+
+	// there's no info about how to read this message from this sid, give up
+	if (Codec == NULL || sid.get() >= Codec->Read.size() || !Codec->Read[sid.get()].Valid)
+		return false;
+
+	const CReadCodec &codec = Codec->Read[sid.get()];
+	serialCodec (msgin, codec.Steps);
+
+	// set default value for the props that the other side does not know
+	for (uint i = 0; i < codec.Defaults.size(); i++)
+	{
+		codec.Defaults[i]->setDefaultValue ();
+	}
+
+	if (VerboseNETTC.get())
+		display ();
+
+	// call the user callback
+	callback (name, sid);
+	return true;
 }
 
 void CTransportClass::unregisterClass ()
@@ -224,9 +364,12 @@ void CTransportClass::unregisterClass ()
 			delete (*it).second.Instance->Prop[j];
 		}
 		(*it).second.Instance->Prop.clear ();
+		delete (*it).second.Instance->Codec;
+		(*it).second.Instance->Codec = NULL;
 		(*it).second.Instance = NULL;
 	}
 	LocalRegisteredClass.clear ();
+	LocalClassByIndex.clear ();
 }
 
 void CTransportClass::displayLocalRegisteredClass (CRegisteredClass &c)
@@ -263,6 +406,28 @@ void cbTCReceiveMessage (CMessage &msgin, const string &name, TServiceId sid)
 {
 	NETTC_DEBUG ("NETTC: cbReceiveMessage");
 
+	if (TransportClassCodec.get())
+	{
+		// read directly from the message
+		string className;
+		CTransportClass::readHeader(msgin, className);
+
+		CTransportClass::TRegisteredClass::iterator it = CTransportClass::LocalRegisteredClass.find (className);
+		if (it == CTransportClass::LocalRegisteredClass.end ())
+		{
+			nlwarning ("NETTC: Receive unknown transport class '%s' received from %s-%hu", className.c_str(), name.c_str(), sid.get());
+			return;
+		}
+
+		nlassert ((*it).second.Instance != NULL);
+
+		if (!(*it).second.Instance->readCompiled (msgin, name, sid))
+		{
+			nlwarning ("NETTC: Can't read the transportclass '%s' received from %s-%hu (probably not registered on sender service)", className.c_str(), name.c_str(), sid.get());
+		}
+		return;
+	}
+
 	CTransportClass::TempMessage.clear();
 	CTransportClass::TempMessage.assignFromSubMessage( msgin );
 
@@ -284,6 +449,26 @@ void cbTCReceiveMessage (CMessage &msgin, const string &name, TServiceId sid)
 	}
 }
 
+void cbTCReceiveIndexedMessage (CMessage &msgin, const string &name, TServiceId sid)
+{
+	NETTC_DEBUG ("NETTC: cbReceiveIndexedMessage");
+
+	// the index is the one of the class in our CT_LRC
+	uint32 index;
+	msgin.serial (index);
+	if (index >= CTransportClass::LocalClassByIndex.size ())
+	{
+		nlwarning ("NETTC: Receive unknown transport class %u received from %s-%hu", index, name.c_str(), sid.get());
+		return;
+	}
+
+	CTransportClass *instance = CTransportClass::LocalClassByIndex[index];
+	if (!instance->readCompiled (msgin, name, sid))
+	{
+		nlwarning ("NETTC: Can't read the transportclass '%s' received from %s-%hu (probably not registered on sender service)", instance->Name.c_str(), name.c_str(), sid.get());
+	}
+}
+
 void cbTCReceiveOtherSideClass (CMessage &msgin, const string &name, TServiceId sid)
 {
 	NETTC_DEBUG ("NETTC: cbReceiveOtherSideClass");
@@ -317,6 +502,28 @@ void cbTCReceiveOtherSideClass (CMessage &msgin, const string &name, TServiceId
 		}
 	}
 
+	// since version 1, the other side receives the classes by their index in its message
+	uint32 version = 0;
+	if (msgin.getPos() < (sint32)msgin.length())
+		msgin.serial (version);
+
+	for (uint i = 0; i < CTransportClass::LocalClassByIndex.size(); i++)
+	{
+		vector<sint32> &remoteIndex = CTransportClass::LocalClassByIndex[i]->Codec->RemoteIndex;
+		if (sid.get() >= remoteIndex.size())
+			remoteIndex.resize (sid.get()+1, -1);
+		remoteIndex[sid.get()] = -1;
+	}
+	if (version >= 1)
+	{
+		for (uint i = 0; i < osrc.size(); i++)
+		{
+			CTransportClass::TRegisteredClass::iterator it = CTransportClass::LocalRegisteredClass.find (osrc[i].first);
+			if (it != CTransportClass::LocalRegisteredClass.end ())
+				(*it).second.Instance->Codec->RemoteIndex[sid.get()] = (sint32)i;
+		}
+	}
+
 	// we have the good structure
 	CTransportClass::registerOtherSideClass (sid, osrc);
 }
@@ -325,6 +532,7 @@ static TUnifiedCallbackItem CallbackArray[] =
 {
 	{ "CT_LRC", cbTCReceiveOtherSideClass },
 	{ "CT_MSG", cbTCReceiveMessage },
+	{ "CT_MSGI", cbTCReceiveIndexedMessage },
 };
 
 void cbTCUpService (const std::string &serviceName, TServiceId sid, void *arg)
@@ -335,6 +543,17 @@ void cbTCUpService (const std::string &serviceName, TServiceId sid, void *arg)
 	CTransportClass::sendLocalRegisteredClass (sid);
 }
 
+void cbTCDownService (const std::string &serviceName, TServiceId sid, void *arg)
+{
+	// the next service with this sid may not know the indexes
+	for (uint i = 0; i < CTransportClass::LocalClassByIndex.size(); i++)
+	{
+		vector<sint32> &remoteIndex = CTransportClass::LocalClassByIndex[i]->Codec->RemoteIndex;
+		if (sid.get() < remoteIndex.size())
+			remoteIndex[sid.get()] = -1;
+	}
+}
+
 void CTransportClass::init ()
 {
 	// this isn't an error!
@@ -364,6 +583,7 @@ void CTransportClass::init ()
 
 	// we have to know when a service comes, so add callback (put the callback before all other one because we have to send this message first)
 	CUnifiedNetwork::getInstance()->setServiceUpCallback("*", cbTCUpService, NULL, false);
+	CUnifiedNetwork::getInstance()->setServiceDownCallback("*", cbTCDownService, NULL);
 
 	Init = true;
 }
@@ -377,6 +597,14 @@ void CTransportClass::release ()
 		delete DummyProp[i];
 	}
 	DummyProp.clear ();
+
+	// allow to init again (the dummy props are needed)
+	if (Init)
+	{
+		CUnifiedNetwork::getInstance()->removeServiceUpCallback("*", cbTCUpService, NULL);
+		CUnifiedNetwork::getInstance()->removeServiceDownCallback("*", cbTCDownService, NULL);
+		Init = false;
+	}
 }
 
 void CTransportClass::createLocalRegisteredClassMessage ()
@@ -386,25 +614,30 @@ void CTransportClass::createLocalRegisteredClassMessage ()
 		TempMessage.invert();
 	TempMessage.setType ("CT_LRC");
 
-	uint32 nbClass = LocalRegisteredClass.size ();
+	// in the order of LocalClassByIndex, the other side sends the classes by their index in this list
+	uint32 nbClass = LocalClassByIndex.size ();
 	TempMessage.serial (nbClass);
 
-	for (TRegisteredClass::iterator it = LocalRegisteredClass.begin(); it != LocalRegisteredClass.end (); it++)
+	for (uint i = 0; i < LocalClassByIndex.size(); i++)
 	{
-		nlassert ((*it).first == (*it).second.Instance->Name);
+		CTransportClass *instance = LocalClassByIndex[i];
 
-		TempMessage.serial ((*it).second.Instance->Name);
+		TempMessage.serial (instance->Name);
 
-		uint32 nbProp = (*it).second.Instance->Prop.size ();
+		uint32 nbProp = instance->Prop.size ();
 		TempMessage.serial (nbProp);
 
-		for (uint j = 0; j < (*it).second.Instance->Prop.size (); j++)
+		for (uint j = 0; j < instance->Prop.size (); j++)
 		{
 			// send the name and the type of the prop
-			TempMessage.serial ((*it).second.Instance->Prop[j]->Name);
-			TempMessage.serialEnum ((*it).second.Instance->Prop[j]->Type);
+			TempMessage.serial (instance->Prop[j]->Name);
+			TempMessage.serialEnum (instance->Prop[j]->Type);
 		}
 	}
+
+	// version of the message, ignored by the services that don't know CT_MSGI
+	uint32 version = 1;
+	TempMessage.serial (version);
 }
 
 
@@ -229,6 +229,16 @@ void				CUdpSimSock::setSimValues (NLMISC::CConfigFile &cf)
 		cbSimVar( *pv );
 }
 
+void				CUdpSimSock::setSimValues (uint32 inLag, uint8 inPacketLoss, uint32 outLag, uint8 outPacketLoss, uint8 outPacketDuplication, uint8 outPacketDisordering)
+{
+	_InLag = inLag;
+	_InPacketLoss = inPacketLoss;
+	_OutLag = outLag;
+	_OutPacketLoss = outPacketLoss;
+	_OutPacketDuplication = outPacketDuplication;
+	_OutPacketDisordering = outPacketDisordering;
+}
+
 void				CUdpSimSock::connect( const CInetAddress& addr )
 {
 	UdpSock.connect (addr);
@@ -314,6 +324,33 @@ bool				CUdpSimSock::receive (uint8 *buffer, uint32& len, bool throw_exception)
 	}
 }
 
+bool				CUdpSimSock::receivedFrom (uint8 *buffer, uint& len, CInetAddress& addr, bool throw_exception)
+{
+	if (_InLag> 0)
+	{
+		if (_BufferizedInPackets.empty())
+		{
+			if (throw_exception)
+				throw Exception ("no data available");
+			return false;
+		}
+		
+		CBufferizedOutPacket *bp = _BufferizedInPackets.front ();
+		uint32 s = min (len, bp->PacketSize);
+		memcpy (buffer, bp->Packet, s);
+		len = s;
+		addr = *bp->Addr;
+
+		delete bp;
+		_BufferizedInPackets.pop ();
+		return true;
+	}
+	else
+	{
+		return UdpSock.receivedFrom(buffer, len, addr, throw_exception);
+	}
+}
+
 CSock::TSockResult	CUdpSimSock::send (const uint8 *buffer, uint32& len, bool throw_exception)
 {
 	sendUDP (buffer, len);
@@ -0,0 +1,730 @@
+/** \file udp_transport.cpp
+ * Channels with reliability and congestion control over UDP
+ *
+ * $Id$
+ */
+
+/* Copyright, 2001 Nevrax Ltd.
+ *
+ * This file is part of NEVRAX NEL.
+ * NEVRAX NEL is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+
+ * NEVRAX NEL is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with NEVRAX NEL; see the file COPYING. If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#include "stdnet.h"
+
+#include "nel/net/udp_transport.h"
+
+using namespace std;
+using namespace NLMISC;
+
+namespace NLNET {
+
+
+/*
+ * A datagram is:
+ *   uint32 Session (chosen by the peer that connects)
+ *   uint8  Flags (TFlag)
+ *   uint32 Seq (0 for a close datagram sent to an unknown peer)
+ *   uint32 AckSeq, uint32 AckBits (bit i acknowledges AckSeq-1-i), uint16 AckDelay (ms)
+ *   uint8  NbMessages, then for each one:
+ *          uint8 Channel, uint32 MessageSeq, uint16 Length, Length bytes
+ */
+
+// Datagrams sent before receiving from the peer, a new connection starts with one of them
+static const uint8	OpenFlag = 4;
+
+// Silence of a connection before a new session of its peer replaces it (ms): a live peer sends
+// at least every KeepAlivePeriod, so that a spoofed datagram can't reset its connection
+static const TTime	SessionReplaceDelay = 3 * CUdpConnection::KeepAlivePeriod;
+
+// Reordering tolerated before a datagram is lost, in datagrams and in round trips
+static const uint32	LossThreshold = 3;
+static const float	LossTimeThreshold = 9.0f / 8.0f;
+
+static const float	InitialWindow = 4.0f * CUdpConnection::MaxDatagramSize;
+static const float	MinWindow = 2.0f * CUdpConnection::MaxDatagramSize;
+
+
+//
+// CUdpConnection
+//
+
+CUdpConnection::CUdpConnection (CUdpTransport *transport, const CInetAddress &addr, uint32 session, TTime now) :
+	_Transport(transport), _Addr(addr), _Session(session), _Closed(false),
+	_NextDatagramSeq(1), _BytesInFlight(0), _LargestAcked(0), _LastSentTime(0), _DatagramNbMessages(0),
+	_CongestionWindow(InitialWindow), _SlowStartThreshold(1e9f), _RecoverySeq(0),
+	_SmoothedRTT(0.0f), _RTTVariation(0.0f), _RTO(InitialRTO),
+	_HighestReceived(0), _ReceivedBits(0), _HighestReceivedTime(now), _LastReceivedTime(now), _NbAckPending(0),
+	_LastUnreliable(0), _NbDatagramsSent(0), _NbDatagramsLost(0), _NbRetransmissions(0)
+{
+	for (uint c = 0; c < 2; c++)
+	{
+		_NextToSend[c] = 0;
+		_NextExpected[c] = 0;
+	}
+	_NextMessageSeq[ReliableOrdered] = 0;
+	_NextMessageSeq[ReliableUnordered] = 0;
+	_NextMessageSeq[UnreliableSequenced] = 1;
+}
+
+
+bool CUdpConnection::send (const CMemStream &buffer, TChannel channel)
+{
+	return send (buffer.buffer(), buffer.length(), channel);
+}
+
+
+bool CUdpConnection::send (const uint8 *buffer, uint32 len, TChannel channel)
+{
+	nlassert (channel < NbChannels);
+	if (len > MaxMessageSize)
+	{
+		nlwarning ("UDPT: Can't send a message of %u bytes to %s, the maximum is %u", len, _Addr.asString().c_str(), (uint)MaxMessageSize);
+		return false;
+	}
+
+	uint32 seq = _NextMessageSeq[channel]++;
+	vector<uint8> *data;
+	if (channel == UnreliableSequenced)
+	{
+		_Unreliable.push_back (make_pair (seq, vector<uint8>()));
+		data = &_Unreliable.back().second;
+	}
+	else
+	{
+		data = &_Unacked[channel][seq];
+	}
+	data->assign (buffer, buffer + len);
+	return true;
+}
+
+
+bool CUdpConnection::receive (CMemStream &buffer, TChannel *channel)
+{
+	if (_Received.empty())
+		return false;
+
+	CReceived &received = _Received.front();
+	buffer.clear();
+	if (!buffer.isReading())
+		buffer.invert();
+	if (!received.Data.empty())
+		buffer.fill (&received.Data[0], (uint32)received.Data.size());
+	if (channel != NULL)
+		*channel = received.Channel;
+	_Received.pop_front();
+	return true;
+}
+
+
+uint32 CUdpConnection::getSendQueueSize () const
+{
+	uint32 size = (uint32)(_Retransmissions.size() + _Unreliable.size());
+	for (uint c = 0; c < 2; c++)
+		size += _NextMessageSeq[c] - _NextToSend[c];
+	return size;
+}
+
+
+void CUdpConnection::updateRTT (float sample)
+{
+	// RFC 2988
+	if (_SmoothedRTT == 0.0f)
+	{
+		_SmoothedRTT = sample;
+		_RTTVariation = sample / 2.0f;
+	}
+	else
+	{
+		_RTTVariation = 0.75f * _RTTVariation + 0.25f * (float)fabs (_SmoothedRTT - sample);
+		_SmoothedRTT = 0.875f * _SmoothedRTT + 0.125f * sample;
+	}
+	float rto = _SmoothedRTT + max (4.0f * _RTTVariation, 10.0f);
+	_RTO = (uint32)min (max (rto, (float)MinRTO), (float)MaxRTO);
+}
+
+
+void CUdpConnection::acknowledge (uint32 seq)
+{
+	map<uint32, CInFlight>::iterator it = _InFlight.find (seq);
+	if (it == _InFlight.end())
+		return;
+
+	CInFlight &inFlight = (*it).second;
+	for (uint i = 0; i < inFlight.Messages.size(); i++)
+		_Unacked[inFlight.Messages[i].first].erase (inFlight.Messages[i].second);
+
+	// slow start, then congestion avoidance
+	if (_CongestionWindow < _SlowStartThreshold)
+		_CongestionWindow += inFlight.Size;
+	else
+		_CongestionWindow += (float)MaxDatagramSize * inFlight.Size / _CongestionWindow;
+
+	_BytesInFlight -= inFlight.Size;
+	_InFlight.erase (it);
+}
+
+
+void CUdpConnection::lose (map<uint32, CInFlight>::iterator it)
+{
+	CInFlight &inFlight = (*it).second;
+	for (uint i = 0; i < inFlight.Messages.size(); i++)
+	{
+		const TMessageId &id = inFlight.Messages[i];
+		if (_Unacked[id.first].find (id.second) != _Unacked[id.first].end())
+			_Retransmissions.push_back (id);
+	}
+
+	// one window reduction by loss event
+	if ((*it).first >= _RecoverySeq)
+	{
+		_SlowStartThreshold = max (_CongestionWindow / 2.0f, MinWindow);
+		_CongestionWindow = _SlowStartThreshold;
+		_RecoverySeq = _NextDatagramSeq;
+	}
+
+	_NbDatagramsLost++;
+	_BytesInFlight -= inFlight.Size;
+	_InFlight.erase (it);
+}
+
+
+void CUdpConnection::processAck (uint32 ackSeq, uint32 ackBits, uint16 ackDelay, TTime now)
+{
+	if (ackSeq == 0 || ackSeq >= _NextDatagramSeq)
+		return;
+
+	// the largest one gives the round trip, without the time the peer kept the ack
+	map<uint32, CInFlight>::iterator it = _InFlight.find (ackSeq);
+	if (it != _InFlight.end())
+	{
+		float sample = (float)(now - (*it).second.SentTime) - ackDelay;
+		updateRTT (max (sample, 1.0f));
+	}
+
+	acknowledge (ackSeq);
+	for (uint i = 0; i < 32 && i + 1 < ackSeq; i++)
+	{
+		if (ackBits & (1u << i))
+			acknowledge (ackSeq - 1 - i);
+	}
+
+	_LargestAcked = max (_LargestAcked, ackSeq);
+	detectLosses (now);
+}
+
+
+void CUdpConnection::detectLosses (TTime now)
+{
+	// without enough datagrams in flight to reorder, the time of the newer ones tells
+	TTime delay = (TTime)(LossTimeThreshold * _SmoothedRTT) + 1;
+	while (!_InFlight.empty())
+	{
+		map<uint32, CInFlight>::iterator it = _InFlight.begin();
+		if ((*it).first >= _LargestAcked)
+			break;
+		if ((*it).first + LossThreshold > _LargestAcked && (*it).second.SentTime + delay > now)
+			break;
+		lose (it);
+	}
+}
+
+
+void CUdpConnection::deliver (uint8 channel, uint32 msgSeq, const uint8 *data, uint16 len)
+{
+	// the peer never sends a reliable message MaxUnackedMessages after the oldest we miss: the
+	// ones beyond are bogus, and dropping them bounds _OutOfOrder and _ReceivedUnordered
+	if (channel != UnreliableSequenced && msgSeq >= _NextExpected[channel] && msgSeq - _NextExpected[channel] >= MaxUnackedMessages)
+	{
+		nldebug ("UDPT: Message %u of channel %hu from %s is out of the receive window, dropped", msgSeq, (uint16)channel, _Addr.asString().c_str());
+		return;
+	}
+
+	switch (channel)
+	{
+	case ReliableOrdered:
+		if (msgSeq < _NextExpected[ReliableOrdered] || _OutOfOrder.find (msgSeq) != _OutOfOrder.end())
+			return;
+		if (msgSeq != _NextExpected[ReliableOrdered])
+		{
+			// wait for the previous ones
+			_OutOfOrder[msgSeq].assign (data, data + len);
+			return;
+		}
+		break;
+
+	case ReliableUnordered:
+		if (msgSeq < _NextExpected[ReliableUnordered] || _ReceivedUnordered.find (msgSeq) != _ReceivedUnordered.end())
+			return;
+		if (msgSeq == _NextExpected[ReliableUnordered])
+		{
+			++_NextExpected[ReliableUnordered];
+			while (!_ReceivedUnordered.empty() && *_ReceivedUnordered.begin() == _NextExpected[ReliableUnordered])
+			{
+				_ReceivedUnordered.erase (_ReceivedUnordered.begin());
+				++_NextExpected[ReliableUnordered];
+			}
+		}
+		else
+		{
+			_ReceivedUnordered.insert (msgSeq);
+		}
+		break;
+
+	case UnreliableSequenced:
+		if (msgSeq <= _LastUnreliable)
+			return;
+		_LastUnreliable = msgSeq;
+		break;
+	}
+
+	if (_Received.empty())
+		_Transport->_ReadyConnections.push_back (this);
+
+	_Received.push_back (CReceived());
+	_Received.back().Channel = (TChannel)channel;
+	_Received.back().Data.assign (data, data + len);
+
+	if (channel == ReliableOrdered)
+	{
+		// the next ones may be there already
+		++_NextExpected[ReliableOrdered];
+		map<uint32, vector<uint8> >::iterator it;
+		while ((it = _OutOfOrder.begin()) != _OutOfOrder.end() && (*it).first == _NextExpected[ReliableOrdered])
+		{
+			_Received.push_back (CReceived());
+			_Received.back().Channel = ReliableOrdered;
+			_Received.back().Data.swap ((*it).second);
+			_OutOfOrder.erase (it);
+			++_NextExpected[ReliableOrdered];
+		}
+	}
+}
+
+
+void CUdpConnection::receiveDatagram (CMemStream &datagram, uint8 flags, uint32 seq, TTime now)
+{
+	_LastReceivedTime = now;
+
+	uint32 ackSeq, ackBits;
+	uint16 ackDelay;
+	uint8 nbMessages;
+	datagram.serial (ackSeq, ackBits, ackDelay, nbMessages);
+
+	if (flags & Close)
+	{
+		_Closed = true;
+		return;
+	}
+
+	processAck (ackSeq, ackBits, ackDelay, now);
+
+	// the ack of a duplicate may have been lost, ack it again
+	if (flags & AckEliciting)
+		_NbAckPending++;
+
+	if (seq > _HighestReceived)
+	{
+		uint32 shift = seq - _HighestReceived;
+		if (_HighestReceived == 0 || shift > 32)
+			_ReceivedBits = 0;
+		else if (shift == 32)
+			_ReceivedBits = 1u << 31;
+		else
+			_ReceivedBits = (_ReceivedBits << shift) | (1u << (shift - 1));
+		_HighestReceived = seq;
+		_HighestReceivedTime = now;
+	}
+	else if (seq == _HighestReceived)
+	{
+		return;
+	}
+	else
+	{
+		// older than the bits: the messages of a duplicate are dropped by their sequence
+		uint32 bit = _HighestReceived - seq - 1;
+		if (bit < 32)
+		{
+			if (_ReceivedBits & (1u << bit))
+				return;
+			_ReceivedBits |= 1u << bit;
+		}
+	}
+
+	vector<uint8> data;
+	for (uint i = 0; i < nbMessages; i++)
+	{
+		uint8 channel;
+		uint32 msgSeq;
+		uint16 len;
+		datagram.serial (channel, msgSeq, len);
+		if (channel >= NbChannels)
+			throw EStream ("invalid channel");
+		data.resize (len);
+		if (len != 0)
+			datagram.serialBuffer (&data[0], len);
+		deliver (channel, msgSeq, data.empty() ? NULL : &data[0], len);
+	}
+
+	// the acks only cover 33 datagrams, a burst can't wait for the next update
+	if (_NbAckPending >= AckFrequency)
+	{
+		clearDatagram();
+		sendDatagram (0, NULL, now);
+	}
+}
+
+
+bool CUdpConnection::fillDatagram (vector<TMessageId> &messages)
+{
+	clearDatagram();
+	uint32 size = HeaderSize;
+	uint8 &nbMessages = _DatagramNbMessages;
+
+	// the retransmissions first, then the new reliable messages the peer has room for, then the unreliable ones
+	while (!_Retransmissions.empty() && nbMessages < 255)
+	{
+		TMessageId id = _Retransmissions.front();
+		map<uint32, vector<uint8> >::iterator it = _Unacked[id.first].find (id.second);
+		if (it != _Unacked[id.first].end())
+		{
+			vector<uint8> &data = (*it).second;
+			if (size + MessageHeaderSize + data.size() > MaxDatagramSize)
+				break;
+			uint16 len = (uint16)data.size();
+			_Datagram.serial (id.first, id.second, len);
+			if (len != 0)
+				_Datagram.serialBuffer (&data[0], len);
+			size += MessageHeaderSize + len;
+			nbMessages++;
+			messages.push_back (id);
+			_NbRetransmissions++;
+		}
+		_Retransmissions.pop_front();
+	}
+
+	for (uint8 c = 0; c < 2; c++)
+	{
+		uint32 oldest = _Unacked[c].empty() ? _NextToSend[c] : (*_Unacked[c].begin()).first;
+		while (_NextToSend[c] < _NextMessageSeq[c] && _NextToSend[c] < oldest + MaxUnackedMessages && nbMessages < 255)
+		{
+			vector<uint8> &data = _Unacked[c][_NextToSend[c]];
+			if (size + MessageHeaderSize + data.size() > MaxDatagramSize)
+				break;
+			uint16 len = (uint16)data.size();
+			_Datagram.serial (c, _NextToSend[c], len);
+			if (len != 0)
+				_Datagram.serialBuffer (&data[0], len);
+			size += MessageHeaderSize + len;
+			nbMessages++;
+			messages.push_back (make_pair (c, _NextToSend[c]));
+			_NextToSend[c]++;
+		}
+	}
+
+	while (!_Unreliable.empty() && nbMessages < 255)
+	{
+		vector<uint8> &data = _Unreliable.front().second;
+		if (size + MessageHeaderSize + data.size() > MaxDatagramSize)
+			break;
+		uint8 c = UnreliableSequenced;
+		uint16 len = (uint16)data.size();
+		_Datagram.serial (c, _Unreliable.front().first, len);
+		if (len != 0)
+			_Datagram.serialBuffer (&data[0], len);
+		size += MessageHeaderSize + len;
+		nbMessages++;
+		_Unreliable.pop_front();
+	}
+
+	return nbMessages != 0;
+}
+
+
+void CUdpConnection::sendDatagram (uint8 flags, vector<TMessageId> *messages, TTime now)
+{
+	if (_HighestReceived == 0)
+		flags |= OpenFlag;
+
+	uint32 seq = _NextDatagramSeq++;
+	uint16 ackDelay = (uint16)min (now - _HighestReceivedTime, (TTime)0xFFFF);
+
+	// the messages are in _Datagram
+	uint32 body = _Datagram.length();
+	CMemStream out (false, false, HeaderSize + body);
+	out.serial (_Session, flags, seq);
+	out.serial (_HighestReceived, _ReceivedBits, ackDelay, _DatagramNbMessages);
+	if (body != 0)
+		out.serialBuffer (const_cast<uint8*>(_Datagram.buffer()), body);
+
+	_Transport->sendDatagram (_Addr, out.buffer(), out.length());
+
+	if (flags & AckEliciting)
+	{
+		// the unreliable messages are not in the list, they are never sent again
+		CInFlight &inFlight = _InFlight[seq];
+		inFlight.SentTime = now;
+		inFlight.Size = out.length();
+		if (messages != NULL)
+			inFlight.Messages.swap (*messages);
+		_BytesInFlight += inFlight.Size;
+	}
+
+	_NbAckPending = 0;
+	_LastSentTime = now;
+	_NbDatagramsSent++;
+}
+
+
+void CUdpConnection::update (TTime now)
+{
+	detectLosses (now);
+
+	// the datagrams not acknowledged in time are lost, the next ones wait longer
+	bool timeout = false;
+	while (!_InFlight.empty() && (*_InFlight.begin()).second.SentTime + _RTO <= now)
+	{
+		lose (_InFlight.begin());
+		timeout = true;
+	}
+	if (timeout)
+	{
+		_RTO = min (_RTO * 2, (uint32)MaxRTO);
+		_CongestionWindow = MinWindow;
+		_RecoverySeq = _NextDatagramSeq;
+	}
+
+	bool sent = false;
+	vector<TMessageId> messages;
+	while (_BytesInFlight + MaxDatagramSize <= _CongestionWindow)
+	{
+		messages.clear();
+		if (!fillDatagram (messages))
+			break;
+		sendDatagram (AckEliciting, &messages, now);
+		sent = true;
+	}
+
+	if (!sent)
+	{
+		clearDatagram();
+		if (now >= _LastSentTime + KeepAlivePeriod)
+		{
+			// gives the round trip and tells the peer we are still there
+			sendDatagram (AckEliciting, NULL, now);
+		}
+		else if (_NbAckPending != 0)
+		{
+			sendDatagram (0, NULL, now);
+		}
+	}
+}
+
+
+void CUdpConnection::sendClose ()
+{
+	clearDatagram();
+	sendDatagram (Close, NULL, CTime::getLocalTime());
+}
+
+
+//
+// CUdpTransport
+//
+
+CUdpTransport::CUdpTransport () :
+	_Sock(false), _AcceptConnections(false), _ReceiveBuffer(65536),
+	_ConnectionCallback(NULL), _ConnectionCbArg(NULL),
+	_DisconnectionCallback(NULL), _DisconnectionCbArg(NULL)
+{
+}
+
+
+CUdpTransport::~CUdpTransport ()
+{
+	release ();
+}
+
+
+void CUdpTransport::init (uint16 port, bool acceptConnections)
+{
+	// a client is bound by its first datagram
+	if (port != 0)
+		_Sock.UdpSock.bind (port);
+	_AcceptConnections = acceptConnections;
+}
+
+
+void CUdpTransport::release ()
+{
+	for (TConnections::iterator it = _Connections.begin(); it != _Connections.end(); ++it)
+	{
+		(*it).second->sendClose();
+		delete (*it).second;
+	}
+	_Connections.clear();
+	_ReadyConnections.clear();
+}
+
+
+CUdpConnection *CUdpTransport::connect (const CInetAddress &addr)
+{
+	TConnections::iterator it = _Connections.find (addr);
+	if (it != _Connections.end())
+		return (*it).second;
+
+	// the session tells the peer when we restart
+	uint32 session = (uint32)CTime::getPerformanceTime() ^ ((uint32)rand() << 16) ^ (uint32)rand();
+	CUdpConnection *connection = new CUdpConnection (this, addr, session, CTime::getLocalTime());
+	_Connections.insert (make_pair (addr, connection));
+	return connection;
+}
+
+
+void CUdpTransport::disconnect (CUdpConnection *connection)
+{
+	connection->sendClose();
+
+	_ReadyConnections.erase (remove (_ReadyConnections.begin(), _ReadyConnections.end(), connection), _ReadyConnections.end());
+	_Connections.erase (connection->remoteAddress());
+	delete connection;
+}
+
+
+void CUdpTransport::removeConnection (TConnections::iterator it)
+{
+	CUdpConnection *connection = (*it).second;
+	if (_DisconnectionCallback != NULL)
+		_DisconnectionCallback (connection, _DisconnectionCbArg);
+
+	_ReadyConnections.erase (remove (_ReadyConnections.begin(), _ReadyConnections.end(), connection), _ReadyConnections.end());
+	_Connections.erase (it);
+	delete connection;
+}
+
+
+void CUdpTransport::sendDatagram (const CInetAddress &addr, const uint8 *buffer, uint32 len)
+{
+	_Sock.sendTo (buffer, len, addr);
+}
+
+
+void CUdpTransport::receiveDatagram (const CInetAddress &addr, const uint8 *buffer, uint32 len, TTime now)
+{
+	if (len < CUdpConnection::HeaderSize)
+		return;
+
+	try
+	{
+		CMemStream datagram (true);
+		datagram.fill (buffer, len);
+		uint32 session, seq;
+		uint8 flags;
+		datagram.serial (session, flags, seq);
+
+		TConnections::iterator it = _Connections.find (addr);
+		if (it != _Connections.end() && (*it).second->_Session != session)
+		{
+			// the peer restarted, or the datagram does not come from it
+			if (!_AcceptConnections || !(flags & OpenFlag) || now < (*it).second->_LastReceivedTime + SessionReplaceDelay)
+				return;
+			removeConnection (it);
+			it = _Connections.end();
+		}
+
+		if (it == _Connections.end())
+		{
+			if (flags & CUdpConnection::Close)
+				return;
+
+			if (!_AcceptConnections || !(flags & OpenFlag))
+			{
+				// we restarted, or don't accept: tell the peer it's not connected
+				CMemStream out;
+				uint8 closeFlags = CUdpConnection::Close;
+				uint32 zero = 0;
+				uint16 zero16 = 0;
+				uint8 nbMessages = 0;
+				out.serial (session, closeFlags, zero);
+				out.serial (zero, zero, zero16, nbMessages);
+				sendDatagram (addr, out.buffer(), out.length());
+				return;
+			}
+
+			CUdpConnection *connection = new CUdpConnection (this, addr, session, now);
+			it = _Connections.insert (make_pair (addr, connection)).first;
+			if (_ConnectionCallback != NULL)
+				_ConnectionCallback (connection, _ConnectionCbArg);
+		}
+
+		(*it).second->receiveDatagram (datagram, flags, seq, now);
+	}
+	catch (EStream &)
+	{
+		nlwarning ("UDPT: Invalid datagram of %u bytes from %s", len, addr.asString().c_str());
+	}
+}
+
+
+void CUdpTransport::update ()
+{
+	TTime now = CTime::getLocalTime();
+
+	while (_Sock.dataAvailable())
+	{
+		CInetAddress addr;
+		uint len = (uint)_ReceiveBuffer.size();
+		if (!_Sock.receivedFrom (&_ReceiveBuffer[0], len, addr, false))
+			break;
+		receiveDatagram (addr, &_ReceiveBuffer[0], len, now);
+	}
+
+	for (TConnections::iterator it = _Connections.begin(); it != _Connections.end(); )
+	{
+		CUdpConnection *connection = (*it).second;
+		if (connection->_Closed || now > connection->_LastReceivedTime + CUdpConnection::Timeout)
+		{
+			removeConnection (it++);
+		}
+		else
+		{
+			connection->update (now);
+			++it;
+		}
+	}
+}
+
+
+bool CUdpTransport::receive (CMemStream &buffer, CUdpConnection **from, CUdpConnection::TChannel *channel)
+{
+	while (!_ReadyConnections.empty())
+	{
+		CUdpConnection *connection = _ReadyConnections.front();
+		if (connection->receive (buffer, channel))
+		{
+			if (!connection->dataAvailable())
+				_ReadyConnections.pop_front();
+			if (from != NULL)
+				*from = connection;
+			return true;
+		}
+		_ReadyConnections.pop_front();
+	}
+	return false;
+}
+
+
+} // NLNET
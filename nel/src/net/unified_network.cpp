@@ -68,11 +68,30 @@ CVariablePtr<uint32> DefaultMaxExpectedBlockSize("nel", "DefaultMaxExpectedBlock
 /// Sending size limit
 CVariablePtr<uint32> DefaultMaxSentBlockSize("nel", "DefaultMaxSentBlockSize", "If sending more than this value in bytes, the program may be stopped", &CBufNetBase::DefaultMaxSentBlockSize, true );
 
+/// Compression of the messages between services
+CVariable<bool> NetCompression("nel", "NetCompression", "If true, the messages exchanged with the services that accept it are compressed (negotiated at identification)", false, 0, true );
+
+/// Compression threshold
+CVariable<uint32> NetCompressionThreshold("nel", "NetCompressionThreshold", "Messages smaller than this value in bytes are not compressed", 256, 0, true );
+
 #define AUTOCHECK_DISPLAY nlwarning
 //#define AUTOCHECK_DISPLAY CUnifiedNetwork::getInstance()->displayInternalTables (), nlerror
 
 const TServiceId	TServiceId::InvalidId = TServiceId(uint16(~0));
 
+/// Compression accepted by a service, sent at the end of UN_SIDENT (nothing sent by older services means CompressionNone)
+static const uint8 CompressionNone = 0;
+static const uint8 CompressionLZ = 1;
+
+/// Compression statistics of all the connections
+static uint64 TotalBytesBeforeCompression = 0;
+static uint64 TotalBytesAfterCompression = 0;
+static TTicks TotalCompressionTicks = 0;
+static TTicks TotalDecompressionTicks = 0;
+
+/// Output buffer of the compressor (the layer 5 is not multithread)
+static vector<uint8> CompressionBuffer;
+
 //
 // Callbacks from NAMING SERVICE
 //
@@ -269,8 +288,11 @@ void	uncbServiceIdentification(CMessage &msgin, TSockId from, CCallbackNetBase &
 	msgin.serial (pos);
 	bool isExternal;
 	msgin.serial (isExternal);
+	uint8 compression = CompressionNone;
+	if (msgin.getPos() < (sint32)msgin.length())
+		msgin.serial (compression);
 
-	nlinfo ("HNETL5: + connect ident '%s' %s-%hu pos %hu ext %d", from->asString().c_str(), inSName.c_str(), inSid.get(), (uint16)pos, (uint8)isExternal);
+	nlinfo ("HNETL5: + connect ident '%s' %s-%hu pos %hu ext %d comp %hu", from->asString().c_str(), inSName.c_str(), inSid.get(), (uint16)pos, (uint8)isExternal, (uint16)compression);
 	
 	if(isExternal)
 	{
@@ -329,6 +351,19 @@ void	uncbServiceIdentification(CMessage &msgin, TSockId from, CCallbackNetBase &
 	}
 	uni->_IdCnx[inSid.get()].Connections[pos] = CUnifiedNetwork::CUnifiedConnection::TConnection(&netbase, from);
 
+	// If both services accept it, compress the messages on this connection, and tell the other service
+	// to do the same (before any message is sent by the service up callbacks)
+	if (compression == CompressionLZ && NetCompression.get())
+	{
+		CUnifiedNetwork::CUnifiedConnection::TConnection &cnx = uni->_IdCnx[inSid.get()].Connections[pos];
+		cnx.Compression = new CUnifiedNetwork::CUnifiedConnection::CCompression;
+		cnx.Compression->SendCompressed = true;
+		CMessage msgout ("UN_COMPRESS");
+		msgout.serial (compression);
+		netbase.send (msgout, from);
+		nlinfo ("HNETL5: compression enabled with %s-%hu pos %hu", inSName.c_str(), inSid.get(), (uint16)pos);
+	}
+
 	// If the connection is external, we'll never receive the ExtAddress by the naming service, so add it manually
 	if (isExternal)
 	{
@@ -359,7 +394,10 @@ void	uncbMsgProcessing(CMessage &msgin, TSockId from, CCallbackNetBase &netbase)
 	TServiceId										sid(uint16(from->appId()));
 	CUnifiedNetwork::TMsgMappedCallback::iterator	itcb;
 
-	itcb = uni->_Callbacks.find(msgin.getName());
+	// a name received with the message must be the name of the callback, not only have the same id
+	itcb = uni->_Callbacks.find(msgin.getTypeId());
+	if (itcb != uni->_Callbacks.end() && !msgin.typeNameMatches((*itcb).second.Name.c_str()))
+		itcb = uni->_Callbacks.end();
 	if (itcb == uni->_Callbacks.end())
 	{
 		// the callback doesn't exist
@@ -374,24 +412,25 @@ void	uncbMsgProcessing(CMessage &msgin, TSockId from, CCallbackNetBase &netbase)
 			nlwarning ("HNETL5: Received a message from a service %hu that is not ready (bad appid? 0x%"NL_I64"X)", sid.get(), from->appId ());
 			return;
 		}
-		if((*itcb).second == 0)
+		if((*itcb).second.Callback == 0)
 		{
 			nlwarning ("HNETL5: Received message %s from a service %hu but the associated callback is NULL", msgin.getName ().c_str(), sid.get());
 			return;
 		}
 
 		{
-			static map<string, CHTimer> timers;
-			map<string, CHTimer>::iterator it;
+			// the timers by message type id, with their name
+			typedef CHashMap<uint32, pair<string, CHTimer> > TTimers;
+			static TTimers timers;
+			TTimers::iterator it;
 			
 			{
 				H_AUTO(L5UCHTimerOverhead);
-				string callbackName = "USRCB_" + msgin.getName();
-				it = timers.find(callbackName);
+				it = timers.find((*itcb).first);
 				if(it == timers.end())
 				{
-					it = timers.insert(make_pair(callbackName, CHTimer(NULL))).first;
-					(*it).second.setName((*it).first.c_str());
+					it = timers.insert(make_pair((*itcb).first, make_pair("USRCB_" + (*itcb).second.Name, CHTimer(NULL)))).first;
+					(*it).second.second.setName((*it).second.first.c_str());
 				}
 			}
 
@@ -400,10 +439,10 @@ void	uncbMsgProcessing(CMessage &msgin, TSockId from, CCallbackNetBase &netbase)
 
 				TTime before = CTime::getLocalTime();
 				
-				(*it).second.before();
-				const std::string &cbName = itcb->first;
-				(*itcb).second (msgin, uc->ServiceName, sid);
-				(*it).second.after();
+				(*it).second.second.before();
+				const std::string &cbName = (*itcb).second.Name;
+				(*itcb).second.Callback (msgin, uc->ServiceName, sid);
+				(*it).second.second.after();
 
 				TTime after = CTime::getLocalTime();
 
@@ -418,9 +457,98 @@ void	uncbMsgProcessing(CMessage &msgin, TSockId from, CCallbackNetBase &netbase)
 }
 
 
+// the other service accepts the compression that we have proposed in UN_SIDENT
+void	uncbCompressionAccepted(CMessage &msgin, TSockId from, CCallbackNetBase &netbase)
+{
+	CUnifiedNetwork	*uni = CUnifiedNetwork::getInstance();
+	CUnifiedNetwork::CUnifiedConnection::TConnection *cnx = uni->findConnection (from, netbase);
+	if (cnx == 0)
+	{
+		AUTOCHECK_DISPLAY ("HNETL5: received a compression acceptance from an unknown connection '%s'", from->asString().c_str());
+		return;
+	}
+
+	uint8 compression;
+	msgin.serial (compression);
+	if (compression != CompressionLZ)
+	{
+		nlwarning ("HNETL5: '%s' accepts an unknown compression %hu, disconnecting", from->asString().c_str(), (uint16)compression);
+		netbase.disconnect (from);
+		return;
+	}
+
+	cnx->Compression = new CUnifiedNetwork::CUnifiedConnection::CCompression;
+	cnx->Compression->SendCompressed = true;
+	nlinfo ("HNETL5: compression enabled with '%s'", from->asString().c_str());
+}
+
+// a message compressed by TConnection::send()
+void	uncbCompressedMessage(CMessage &msgin, TSockId from, CCallbackNetBase &netbase)
+{
+	if (from->appId() == AppIdDeadConnection)
+	{
+		AUTOCHECK_DISPLAY ("HNETL5: Receive a message from a dead connection");
+		return;
+	}
+
+	CUnifiedNetwork	*uni = CUnifiedNetwork::getInstance();
+	CUnifiedNetwork::CUnifiedConnection::TConnection *cnx = uni->findConnection (from, netbase);
+	if (cnx == 0 || cnx->Compression == NULL)
+	{
+		nlwarning ("HNETL5: Received a compressed message from '%s' but the compression is not enabled with it, disconnecting", from->asString().c_str());
+		netbase.disconnect (from);
+		return;
+	}
+
+	uint32 size;
+	msgin.serial (size);
+	if (size > CBufNetBase::DefaultMaxExpectedBlockSize)
+	{
+		nlwarning ("HNETL5: Received a compressed message of %u bytes from '%s' (max %u), disconnecting", size, from->asString().c_str(), CBufNetBase::DefaultMaxExpectedBlockSize);
+		netbase.disconnect (from);
+		return;
+	}
+
+	// decompress the whole message (header included) directly into the buffer of the message
+	CUnifiedNetwork::CUnifiedConnection::CCompression &compression = *cnx->Compression;
+	uint32 compressedSize = msgin.length() - msgin.getPos();
+	CMemStreamBuffer::TBuffer buffer;
+	buffer.resize (size);
+
+	TTicks before = CTime::getPerformanceTime ();
+	bool ok = compression.Decompressor.decompress (msgin.buffer() + msgin.getPos(), compressedSize, buffer.getPtr(), size);
+	TTicks ticks = CTime::getPerformanceTime () - before;
+	compression.DecompressionTicks += ticks;
+	TotalDecompressionTicks += ticks;
+
+	if (!ok)
+	{
+		nlwarning ("HNETL5: Received a corrupted compressed message from '%s', disconnecting", from->asString().c_str());
+		netbase.disconnect (from);
+		return;
+	}
+
+	++compression.NbDecompressed;
+	compression.BytesBeforeDecompression += compressedSize;
+	compression.BytesAfterDecompression += size;
+
+	CMessage msg ("", true);
+	msg.swapBuffer (buffer);
+	msg.readType ();
+	uncbMsgProcessing (msg, from, netbase);
+}
+
+
 TCallbackItem	unServerCbArray[] =
 {
-	{ "UN_SIDENT", uncbServiceIdentification }
+	{ "UN_SIDENT", uncbServiceIdentification },
+	{ "UN_Z", uncbCompressedMessage }
+};
+
+TCallbackItem	unClientCbArray[] =
+{
+	{ "UN_COMPRESS", uncbCompressionAccepted },
+	{ "UN_Z", uncbCompressedMessage }
 };
 
 
@@ -606,7 +734,7 @@ bool	CUnifiedNetwork::init(const CInetAddress *addr, CCallbackNetBase::TRecordin
 			}
 		} while(retry);
 
-		_CbServer->addCallbackArray(unServerCbArray, 1);				// the service ident callback
+		_CbServer->addCallbackArray(unServerCbArray, sizeof(unServerCbArray)/sizeof(unServerCbArray[0]));	// the service ident and compression callbacks
 		_CbServer->setDefaultCallback(uncbMsgProcessing);				// the default callback wrapper
 		_CbServer->setConnectionCallback(uncbConnection, NULL);
 		_CbServer->setDisconnectionCallback(uncbDisconnection, NULL);
@@ -865,6 +993,7 @@ void	CUnifiedNetwork::addService(const string &name, const vector<CInetAddress>
 #endif
 		cbc->setDisconnectionCallback(uncbDisconnection, NULL);
 		cbc->setDefaultCallback(uncbMsgProcessing);
+		cbc->addCallbackArray(unClientCbArray, sizeof(unClientCbArray)/sizeof(unClientCbArray[0]));
 		cbc->getSockId()->setAppId(sid.get());
 
 		try
@@ -905,6 +1034,8 @@ void	CUnifiedNetwork::addService(const string &name, const vector<CInetAddress>
 			uint8 pos = j;
 			msg.serial(pos);	// send the position in the connection table
 			msg.serial (uc->IsExternal);
+			uint8 compression = NetCompression.get() ? CompressionLZ : CompressionNone;
+			msg.serial (compression);	// the compression we accept (the other service answers UN_COMPRESS if it accepts it too)
 			cbc->send (msg);
 		}
 	}
@@ -1183,6 +1314,7 @@ void CUnifiedNetwork::autoReconnect( CUnifiedConnection &uc, uint connectionInde
 		CCallbackClient *cbc = (CCallbackClient *)uc.Connections[connectionIndex].CbNetBase;
 		cbc->connect(uc.ExtAddress[connectionIndex]);
 		uc.Connections[connectionIndex].CbNetBase->getSockId()->setAppId(uc.ServiceId.get());
+		uc.Connections[connectionIndex].Compression = NULL; // the dictionaries start again with the new connection
 		nlinfo ("HNETL5: reconnection to %s-%hu success", uc.ServiceName.c_str(), uc.ServiceId.get());
 
 		// add the name only if at least one connection is ok
@@ -1208,6 +1340,8 @@ void CUnifiedNetwork::autoReconnect( CUnifiedConnection &uc, uint connectionInde
 			uint8 pos = connectionIndex;
 			msg.serial(pos);	// send the position in the connection table
 			msg.serial (uc.IsExternal);
+			uint8 compression = NetCompression.get() ? CompressionLZ : CompressionNone;
+			msg.serial (compression);	// the compression we accept
 			uc.Connections[connectionIndex].CbNetBase->send (msg, uc.Connections[connectionIndex].HostId);
 		}
 
@@ -1321,6 +1455,60 @@ uint8 CUnifiedNetwork::findConnectionId (TServiceId sid, uint8 nid)
 	return connectionId;
 }
 
+//
+//
+//
+CUnifiedNetwork::CUnifiedConnection::TConnection *CUnifiedNetwork::findConnection (TSockId from, CCallbackNetBase &netbase)
+{
+	if (from->appId () == AppIdDeadConnection)
+		return NULL;
+
+	CUnifiedConnection *uc = getUnifiedConnection (TServiceId(uint16(from->appId ())), false);
+	if (uc == NULL)
+		return NULL;
+
+	for (uint i = 0; i < uc->Connections.size (); ++i)
+	{
+		if (uc->Connections[i].valid() && uc->Connections[i].CbNetBase == &netbase && netbase.getSockId (uc->Connections[i].HostId) == from)
+			return &uc->Connections[i];
+	}
+	return NULL;
+}
+
+
+/*
+ * Send a message on a connection, compressed if it is enabled
+ */
+void CUnifiedNetwork::CUnifiedConnection::TConnection::send (const CMessage &msgout)
+{
+	if (Compression == NULL || !Compression->SendCompressed || msgout.length () < NetCompressionThreshold.get ())
+	{
+		CbNetBase->send (msgout, HostId);
+		return;
+	}
+
+	// compress the whole message (header included), the dictionary being the previous messages of the connection
+	uint32 size = msgout.length ();
+	CompressionBuffer.resize (CLZCompressor::maxCompressedSize (size));
+
+	TTicks before = CTime::getPerformanceTime ();
+	uint32 compressedSize = Compression->Compressor.compress (msgout.buffer (), size, &CompressionBuffer[0]);
+	TTicks ticks = CTime::getPerformanceTime () - before;
+
+	++Compression->NbCompressed;
+	Compression->BytesBeforeCompression += size;
+	Compression->BytesAfterCompression += compressedSize;
+	Compression->CompressionTicks += ticks;
+	TotalBytesBeforeCompression += size;
+	TotalBytesAfterCompression += compressedSize;
+	TotalCompressionTicks += ticks;
+
+	CMessage msgz ("UN_Z", false, CMessage::UseDefault, compressedSize + 32);
+	msgz.serial (size);
+	msgz.serialBuffer (&CompressionBuffer[0], compressedSize);
+	CbNetBase->send (msgz, HostId);
+}
+
 
 //
 //
@@ -1359,7 +1547,7 @@ uint	CUnifiedNetwork::send(const string &serviceName, const CMessage &msgout, bo
 				continue;
 			}
 
-			_IdCnx[sid.get()].Connections[connectionId].CbNetBase->send (msgout, _IdCnx[sid.get()].Connections[connectionId].HostId);
+			_IdCnx[sid.get()].Connections[connectionId].send (msgout);
 		}
 	}
 
@@ -1389,7 +1577,7 @@ bool	CUnifiedNetwork::send(TServiceId sid, const CMessage &msgout, uint8 nid)
 		return false;
 	}
 
-	_IdCnx[sid.get()].Connections[connectionId].CbNetBase->send (msgout, _IdCnx[sid.get()].Connections[connectionId].HostId);
+	_IdCnx[sid.get()].Connections[connectionId].send (msgout);
 	return true;
 }
 
@@ -1410,7 +1598,7 @@ void	CUnifiedNetwork::sendAll(const CMessage &msgout, uint8 nid)
 				continue;
 			}
 
-			_IdCnx[i].Connections[connectionId].CbNetBase->send (msgout, _IdCnx[i].Connections[connectionId].HostId);
+			_IdCnx[i].Connections[connectionId].send (msgout);
 		}
 	}
 }
@@ -1464,7 +1652,14 @@ void	CUnifiedNetwork::addCallbackArray (const TUnifiedCallbackItem *callbackarra
 	uint	i;
 
 	for (i=0; i<(uint)arraysize; ++i)
-		_Callbacks.insert(make_pair(string(callbackarray[i].Key),callbackarray[i].Callback));
+	{
+		// to know the name of the messages received with an id (if two names have the same id,
+		// the first callback is kept)
+		TMsgCallbackItem item;
+		item.Name = callbackarray[i].Key;
+		item.Callback = callbackarray[i].Callback;
+		_Callbacks.insert(make_pair(CMessage::registerTypeName(item.Name), item));
+	}
 }
 
 
@@ -1495,13 +1690,14 @@ void	CUnifiedNetwork::removeServiceUpCallback (const string &serviceName, TUnifi
 		for (i=0; i<_UpUniCallback.size(); ++i)
 		{
 			if (_UpUniCallback[i].first == cb && _UpUniCallback[i].second == arg)
-			{
-				// we found it
-				_UpUniCallback.erase(_UpUniCallback.begin()+i);
 				break;
-			}
 		}
-		if (i == _UpUniCallback.size())
+		if (i < _UpUniCallback.size())
+		{
+			// we found it
+			_UpUniCallback.erase(_UpUniCallback.begin()+i);
+		}
+		else
 		{
 			nlwarning("HNETL5 : can't remove service up callback, not found");
 		}
@@ -1566,13 +1762,14 @@ void	CUnifiedNetwork::removeServiceDownCallback (const string &serviceName, TUni
 		for (i=0; i<_DownUniCallback.size(); ++i)
 		{
 			if (_DownUniCallback[i].first == cb && _DownUniCallback[i].second == arg)
-			{
-				// we found it
-				_DownUniCallback.erase(_DownUniCallback.begin()+i);
 				break;
-			}
 		}
-		if (i == _DownUniCallback.size())
+		if (i < _DownUniCallback.size())
+		{
+			// we found it
+			_DownUniCallback.erase(_DownUniCallback.begin()+i);
+		}
+		else
 		{
 			nlwarning("HNETL5 : can't remove service down callback, not found");
 		}
@@ -1745,11 +1942,11 @@ CCallbackNetBase	*CUnifiedNetwork::getNetBase(TServiceId sid, TSockId &host, uin
 
 TUnifiedMsgCallback CUnifiedNetwork::findCallback (const std::string &callbackName)
 {
-	TMsgMappedCallback::iterator	itcb = _Callbacks.find(callbackName);
-	if (itcb == _Callbacks.end())
+	TMsgMappedCallback::iterator	itcb = _Callbacks.find(CMessage::hashTypeName(callbackName));
+	if (itcb == _Callbacks.end() || (*itcb).second.Name != callbackName)
 		return NULL;
 	else
-		return (*itcb).second;
+		return (*itcb).second.Callback;
 }
 
 bool CUnifiedNetwork::isServiceLocal (const std::string &serviceName)
@@ -2184,9 +2381,20 @@ void CUnifiedNetwork::CUnifiedConnection::display (bool full, CLog *log)
 			log->displayNL ("     * ThreadStat");
 			Connections[j].CbNetBase->displayThreadStat(log);
 		}
+		if(j < Connections.size () && Connections[j].Compression != NULL)
+		{
+			Connections[j].Compression->display(log);
+		}
 	}
 }
 
+void CUnifiedNetwork::CUnifiedConnection::CCompression::display (CLog *log) const
+{
+	log->displayNL ("     * Compression: sent %u msg %"NL_I64"u B -> %"NL_I64"u B (%.1f%%) in %.3f s, received %u msg %"NL_I64"u B -> %"NL_I64"u B in %.3f s",
+		NbCompressed, BytesBeforeCompression, BytesAfterCompression, (BytesBeforeCompression == 0) ? 100.0 : 100.0 * (double)BytesAfterCompression / (double)BytesBeforeCompression,
+		CTime::ticksToSecond (CompressionTicks), NbDecompressed, BytesBeforeDecompression, BytesAfterDecompression, CTime::ticksToSecond (DecompressionTicks));
+}
+
 
 //
 // Commands
@@ -2269,6 +2477,23 @@ NLMISC_CATEGORISED_DYNVARIABLE(nel, uint64, SentBytes, "total of bytes sent by t
 	}
 }
 
+NLMISC_CATEGORISED_DYNVARIABLE(nel, float, L5CompressionRatio, "size after compression divided by size before compression of the compressed messages sent by this service")
+{
+	if (get)
+	{
+		if (TotalBytesBeforeCompression == 0)
+			*pointer = 1.0f;
+		else
+			*pointer = (float)((double)TotalBytesAfterCompression / (double)TotalBytesBeforeCompression);
+	}
+}
+
+NLMISC_CATEGORISED_DYNVARIABLE(nel, uint32, L5CompressionTime, "total time in ms spent compressing and decompressing the messages")
+{
+	if (get)
+		*pointer = (uint32)(CTime::ticksToSecond (TotalCompressionTicks + TotalDecompressionTicks) * 1000.0);
+}
+
 
 /*
  * Simulate a message that comes from the network.
@@ -2416,6 +2641,36 @@ NLMISC_CATEGORISED_COMMAND(nel, l5QueuesStats, "Displays queues stats of network
 }
 
 	
+NLMISC_CATEGORISED_COMMAND(nel, l5CompressionStats, "Displays the compression stats of the connections of network layer5", "")
+{
+	if(args.size() != 0) return false;
+
+	if (!CUnifiedNetwork::isUsed ())
+	{
+		log.displayNL("Can't display compression stats because layer5 is not used");
+		return false;
+	}
+
+	log.displayNL ("Compression %s, threshold %u B, sent %"NL_I64"u B -> %"NL_I64"u B, %.3f s compressing, %.3f s decompressing", NetCompression.get() ? "on" : "off", NetCompressionThreshold.get(),
+		TotalBytesBeforeCompression, TotalBytesAfterCompression, CTime::ticksToSecond (TotalCompressionTicks), CTime::ticksToSecond (TotalDecompressionTicks));
+	for (uint i = 0; i < CUnifiedNetwork::getInstance()->_IdCnx.size (); i++)
+	{
+		CUnifiedNetwork::CUnifiedConnection &uc = CUnifiedNetwork::getInstance()->_IdCnx[i];
+		if (uc.State == CUnifiedNetwork::CUnifiedConnection::NotUsed)
+			continue;
+		for (uint j = 0; j < uc.Connections.size (); j++)
+		{
+			if (uc.Connections[j].Compression != NULL)
+			{
+				log.displayNL ("> %s-%hu connection %u", uc.ServiceName.c_str (), uc.ServiceId.get(), j);
+				uc.Connections[j].Compression->display (&log);
+			}
+		}
+	}
+
+	return true;
+}
+
 NLMISC_CATEGORISED_COMMAND(nel, l5InternalTables, "Displays internal table of network layer5", "")
 {
 	if(args.size() != 0) return false;
@@ -2445,7 +2700,7 @@ NLMISC_CATEGORISED_COMMAND(nel, l5Callback, "Displays all callback registered in
 	uint i = 0;
 	for (CUnifiedNetwork::TMsgMappedCallback::iterator it = CUnifiedNetwork::getInstance()->_Callbacks.begin(); it != CUnifiedNetwork::getInstance()->_Callbacks.end(); it++)
 	{
-		log.displayNL (" %d '%s' %s", i++, (*it).first.c_str(), ((*it).second == NULL?"have a NULL address":""));
+		log.displayNL (" %d '%s' %s", i++, (*it).second.Name.c_str(), ((*it).second.Callback == NULL?"have a NULL address":""));
 	}
 	
 	return true;
@@ -0,0 +1,198 @@
+/** \file buf_fifo_bench/main.cpp
+ * Compares the message throughput of the mutexed CBufFIFO and of CLockFreeBufFIFO,
+ * in the configuration of the layer1 receive queue (N receive threads, 1 user thread)
+ *
+ * $Id$
+ */
+
+/* Copyright, 2001 Nevrax Ltd.
+ *
+ * This file is part of NEVRAX NEL.
+ * NEVRAX NEL is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+
+ * NEVRAX NEL is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with NEVRAX NEL; see the file COPYING. If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#include "nel/misc/types_nl.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vector>
+
+#include "nel/misc/debug.h"
+#include "nel/misc/thread.h"
+#include "nel/misc/mutex.h"
+#include "nel/misc/time_nl.h"
+#include "nel/misc/buf_fifo.h"
+#include "nel/misc/lock_free_buf_fifo.h"
+
+using namespace std;
+using namespace NLMISC;
+
+// ---------------------------------------------------------------------------
+
+typedef CSynchronized<CBufFIFO> CMutexedFIFO;
+
+enum TFifoType { MutexedFifo, LockFreeFifo, LockFreeFifoBatch };
+
+const char *FifoTypeNames [] = { "CSynchronized<CBufFIFO>", "CLockFreeBufFIFO", "CLockFreeBufFIFO (batch)" };
+
+const uint BatchSize = 64;
+
+// ---------------------------------------------------------------------------
+
+/// Pushes NbMessages blocks of MessageSize bytes into one of the FIFOs
+class CProducer : public IRunnable
+{
+public:
+
+	CProducer( TFifoType type, CMutexedFIFO *mutexedFifo, CLockFreeBufFIFO *lockFreeFifo, uint nbMessages, uint messageSize ) :
+		_Type( type ), _MutexedFifo( mutexedFifo ), _LockFreeFifo( lockFreeFifo ), _NbMessages( nbMessages ), _Buffer( messageSize, 0 ) {}
+
+	virtual void run()
+	{
+		for ( uint i=0; i!=_NbMessages; ++i )
+		{
+			if ( _Type == MutexedFifo )
+			{
+				CMutexedFIFO::CAccessor fifo( _MutexedFifo );
+				fifo.value().push( _Buffer );
+			}
+			else
+			{
+				_LockFreeFifo->push( _Buffer );
+			}
+		}
+	}
+
+	virtual void getName( std::string &result ) const { result = "CProducer"; }
+
+private:
+
+	TFifoType			_Type;
+	CMutexedFIFO		*_MutexedFifo;
+	CLockFreeBufFIFO	*_LockFreeFifo;
+	uint				_NbMessages;
+	vector<uint8>		_Buffer;
+};
+
+// ---------------------------------------------------------------------------
+
+/// Runs the producers and pops all the messages in the calling thread. Returns the number of messages per second.
+double bench( TFifoType type, uint nbProducers, uint nbMessages, uint messageSize )
+{
+	CMutexedFIFO mutexedFifo( "bench" );
+	CLockFreeBufFIFO lockFreeFifo;
+
+	vector<CProducer*> producers( nbProducers );
+	vector<IThread*> threads( nbProducers );
+	for ( uint i=0; i!=nbProducers; ++i )
+	{
+		producers[i] = new CProducer( type, &mutexedFifo, &lockFreeFifo, nbMessages, messageSize );
+		threads[i] = IThread::create( producers[i] );
+	}
+
+	TTicks start = CTime::getPerformanceTime();
+	for ( uint i=0; i!=nbProducers; ++i )
+	{
+		threads[i]->start();
+	}
+
+	// Pop and read the messages as CBufServer::receive() does
+	uint total = nbProducers * nbMessages;
+	uint popped = 0;
+	uint32 checksum = 0;
+	vector<uint8> buffer;
+	uint8 *blocks [BatchSize];
+	uint32 sizes [BatchSize];
+	while ( popped != total )
+	{
+		switch ( type )
+		{
+		case MutexedFifo:
+			{
+				CMutexedFIFO::CAccessor fifo( &mutexedFifo );
+				if ( ! fifo.value().empty() )
+				{
+					fifo.value().front( buffer );
+					checksum += buffer[buffer.size()-1];
+					fifo.value().pop();
+					++popped;
+				}
+			}
+			break;
+		case LockFreeFifo:
+			if ( ! lockFreeFifo.empty() )
+			{
+				lockFreeFifo.front( buffer );
+				checksum += buffer[buffer.size()-1];
+				lockFreeFifo.pop();
+				++popped;
+			}
+			break;
+		case LockFreeFifoBatch:
+			{
+				uint nb = lockFreeFifo.frontBatch( blocks, sizes, BatchSize );
+				for ( uint i=0; i!=nb; ++i )
+				{
+					checksum += blocks[i][sizes[i]-1];
+				}
+				lockFreeFifo.popBatch( nb );
+				popped += nb;
+			}
+			break;
+		}
+	}
+	TTicks end = CTime::getPerformanceTime();
+
+	for ( uint i=0; i!=nbProducers; ++i )
+	{
+		threads[i]->wait();
+		delete threads[i];
+		delete producers[i];
+	}
+
+	nlassert( checksum == 0 );
+	return (double)total / CTime::ticksToSecond( end - start );
+}
+
+// ---------------------------------------------------------------------------
+
+int main( int argc, char **argv )
+{
+	if ( (argc > 1) && ((string(argv[1]) == "-h") || (string(argv[1]) == "/?")) )
+	{
+		printf( "Usage: buf_fifo_bench [<nbMessagesPerProducer> [<messageSize> [<maxNbProducers>]]]\n" );
+		return 0;
+	}
+
+	uint nbMessages = (argc > 1) ? atoi( argv[1] ) : 1000000;
+	uint messageSize = (argc > 2) ? atoi( argv[2] ) : 64;
+	uint maxNbProducers = (argc > 3) ? atoi( argv[3] ) : 8;
+	if ( messageSize == 0 )
+		messageSize = 1;
+
+	printf( "%u messages of %u bytes per producer\n\n", nbMessages, messageSize );
+	printf( "%-28s %10s %16s\n", "FIFO", "Producers", "Messages/sec" );
+	for ( uint nbProducers=1; nbProducers<=maxNbProducers; nbProducers*=2 )
+	{
+		for ( uint type=MutexedFifo; type<=LockFreeFifoBatch; ++type )
+		{
+			double rate = bench( (TFifoType)type, nbProducers, nbMessages, messageSize );
+			printf( "%-28s %10u %16.0f\n", FifoTypeNames[type], nbProducers, rate );
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,149 @@
+/** \file log_decoder/main.cpp
+ * Renders the binary logs of CBinaryLogDisplayer as the text logs of CFileDisplayer
+ *
+ * $Id$
+ */
+
+/* Copyright, 2001 Nevrax Ltd.
+ *
+ * This file is part of NEVRAX NEL.
+ * NEVRAX NEL is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+
+ * NEVRAX NEL is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with NEVRAX NEL; see the file COPYING. If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#include "nel/misc/types_nl.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <vector>
+#include <string>
+
+#include "nel/misc/debug.h"
+#include "nel/misc/displayer.h"
+#include "nel/misc/binary_log_displayer.h"
+#include "nel/misc/common.h"
+
+using namespace std;
+using namespace NLMISC;
+
+// ---------------------------------------------------------------------------
+
+static void usage ()
+{
+	printf( "Usage: log_decoder [-l <logTypes>] [-p <processName>] [-f <sourceFile>] <file.blog>...\n" );
+	printf( "  -l <logTypes>     only the lines of these types (ex: WRN,ERR,AST)\n" );
+	printf( "  -p <processName>  only the lines of the processes whose name contains processName\n" );
+	printf( "  -f <sourceFile>   only the lines displayed in the source files whose name contains sourceFile\n" );
+	printf( "The lines are written on the standard output, as in the text logs.\n" );
+}
+
+// ---------------------------------------------------------------------------
+
+int main( int argc, char **argv )
+{
+	createDebug();
+
+	bool logTypes [CLog::LOG_UNKNOWN+1];
+	bool allLogTypes = true;
+	string processName, sourceFile;
+	vector<string> filenames;
+
+	for ( int i=1; i<argc; ++i )
+	{
+		string arg = argv[i];
+		if ( (arg == "-h") || (arg == "/?") )
+		{
+			usage();
+			return 0;
+		}
+		else if ( (arg == "-l") || (arg == "-p") || (arg == "-f") )
+		{
+			if ( i+1 >= argc )
+			{
+				usage();
+				return 1;
+			}
+			string value = argv[++i];
+			if ( arg == "-l" )
+			{
+				vector<string> types;
+				explode( toUpper(value), string(","), types, true );
+				allLogTypes = false;
+				for ( uint t=0; t<=CLog::LOG_UNKNOWN; ++t )
+					logTypes[t] = false;
+				for ( uint j=0; j<types.size(); ++j )
+				{
+					uint t;
+					for ( t=0; t<=CLog::LOG_UNKNOWN; ++t )
+					{
+						if ( types[j] == IDisplayer::logTypeToString( (CLog::TLogType)t ) )
+							break;
+					}
+					if ( t > CLog::LOG_UNKNOWN )
+					{
+						printf( "Unknown log type '%s' (DBG, INF, WRN, ERR, AST, STT or UKN)\n", types[j].c_str() );
+						return 1;
+					}
+					logTypes[t] = true;
+				}
+			}
+			else if ( arg == "-p" )
+				processName = value;
+			else
+				sourceFile = value;
+		}
+		else
+			filenames.push_back( arg );
+	}
+
+	if ( filenames.empty() )
+	{
+		usage();
+		return 1;
+	}
+
+	int result = 0;
+	for ( uint i=0; i<filenames.size(); ++i )
+	{
+		CBinaryLogReader reader;
+		if ( !reader.open( filenames[i] ) )
+		{
+			fprintf( stderr, "Can't open '%s' or it's not a binary log\n", filenames[i].c_str() );
+			result = 1;
+			continue;
+		}
+
+		CLog::TDisplayInfo args;
+		string message;
+		while ( reader.readLine( args, message ) )
+		{
+			// the raw lines (LOG_NO) are always kept
+			if ( !allLogTypes && (args.LogType != CLog::LOG_NO) && !logTypes[args.LogType] )
+				continue;
+			if ( !processName.empty() && (args.ProcessName.find( processName ) == string::npos) )
+				continue;
+			if ( !sourceFile.empty() && ((args.FileName == NULL) || (strstr( args.FileName, sourceFile.c_str() ) == NULL)) )
+				continue;
+
+			string line = CFileDisplayer::lineHeader( args );
+			line += message;
+			line += args.CallstackAndLog;
+			fwrite( line.c_str(), line.size(), 1, stdout );
+		}
+	}
+
+	return result;
+}
@@ -0,0 +1,209 @@
+#include "nel/misc/types_nl.h"
+#include "nel/misc/log.h"
+#include "nel/misc/displayer.h"
+#include "nel/misc/binary_log_displayer.h"
+#include "nel/misc/path.h"
+#include "nel/misc/file.h"
+
+#include "cpptest.h"
+
+using namespace std;
+using namespace NLMISC;
+
+// Keeps the displayed lines and their fields
+class CInfoLinesDisplayer : public IDisplayer
+{
+public:
+	vector<string>				Lines;
+	vector<CLog::TDisplayInfo>	Infos;
+
+protected:
+	virtual void doDisplay( const CLog::TDisplayInfo& args, const char *message)
+	{
+		Lines.push_back(message);
+		Infos.push_back(args);
+	}
+};
+
+// Test suite for CBinaryLogDisplayer and CBinaryLogReader
+class CBinaryLogTS : public Test::Suite
+{
+	string		_WorkingPath;
+	string		_OldPath;
+public:
+	CBinaryLogTS(const std::string &workingPath)
+		: _WorkingPath(workingPath)
+	{
+		TEST_ADD(CBinaryLogTS::formats);
+		TEST_ADD(CBinaryLogTS::textLines);
+		TEST_ADD(CBinaryLogTS::binaryOnly);
+		TEST_ADD(CBinaryLogTS::invalidFile);
+	}
+
+	void setup()
+	{
+		_OldPath = CPath::getCurrentPath();
+		CPath::setCurrentPath(_WorkingPath.c_str());
+	}
+
+	void tear_down()
+	{
+		if (CFile::fileExists("binary_log_test.blog"))
+			CFile::deleteFile("binary_log_test.blog");
+		CPath::setCurrentPath(_OldPath.c_str());
+	}
+
+	void formats()
+	{
+		CLog log(CLog::LOG_INFO);
+		CInfoLinesDisplayer text;
+		{
+			CBinaryLogDisplayer binary("binary_log_test.blog", true);
+			log.addDisplayer(&text);
+			log.addDisplayer(&binary);
+
+			string longString(400, 'x');
+			sint64 big = SINT64_CONSTANT(-1234567890123);
+			log.setPosition(__LINE__, __FILE__, "formats"); log.displayNL("no argument");
+			log.setPosition(__LINE__, __FILE__, "formats"); log.displayNL("%d %u %i %x %X %o", -12, 12u, 7, 255, 255, 8);
+			log.setPosition(__LINE__, __FILE__, "formats"); log.displayNL("'%s' '%10s' '%-4.2s' '%s'", "str", "right", "cut", (const char *)NULL);
+			log.setPosition(__LINE__, __FILE__, "formats"); log.displayNL("%*d|%-*.*f|%.3e|%g", 6, 42, 9, 2, 3.14159, 1234.5, 0.25f);
+			log.setPosition(__LINE__, __FILE__, "formats"); log.displayNL("%"NL_I64"d %"NL_I64"u %ld %lu", big, (uint64)big, -5L, 5UL);
+			log.setPosition(__LINE__, __FILE__, "formats"); log.displayNL("%c%c %% %hd %hu %hhd", 'o', 'k', (short)-3, (unsigned short)65535, 300);
+			log.setPosition(__LINE__, __FILE__, "formats"); log.displayNL("%s", longString.c_str());
+			log.setPosition(__LINE__, __FILE__, "formats"); log.displayNL("%s %d", longString.c_str(), 1);
+			for (uint i=0; i<3; ++i)
+			{
+				// the same format and position are written once
+				log.setPosition(__LINE__, __FILE__, "formats"); log.displayNL("loop %u", i);
+			}
+			log.displayNL("no position");
+
+			log.removeDisplayer(&binary);
+			log.removeDisplayer(&text);
+		}
+
+		checkFile(text);
+	}
+
+	void textLines()
+	{
+		CLog log(CLog::LOG_DEBUG);
+		CInfoLinesDisplayer text;
+		{
+			CBinaryLogDisplayer binary("binary_log_test.blog", true);
+			log.addDisplayer(&text);
+			log.addDisplayer(&binary);
+
+			log.display("partial ");
+			log.setPosition(__LINE__, __FILE__); log.displayNL("%s %d", "line", 1);
+			log.displayRaw("raw ");
+			log.displayRawNL("line %d", 2);
+			log.setPosition(__LINE__, __FILE__); log.displayNL("formatted %d", 3);
+
+			log.removeDisplayer(&binary);
+			log.removeDisplayer(&text);
+		}
+
+		// a second session is appended to the file
+		{
+			CBinaryLogDisplayer binary("binary_log_test.blog");
+			log.addDisplayer(&text);
+			log.addDisplayer(&binary);
+
+			log.setPosition(__LINE__, __FILE__); log.displayNL("formatted %d", 4);
+			log.setPosition(__LINE__, __FILE__); log.displayNL("%s", "second session");
+
+			log.removeDisplayer(&binary);
+			log.removeDisplayer(&text);
+		}
+
+		checkFile(text);
+	}
+
+	void binaryOnly()
+	{
+		// without a text displayer, the line is not formatted by the log
+		CLog log(CLog::LOG_WARNING);
+		{
+			CBinaryLogDisplayer binary("binary_log_test.blog", true);
+			log.addDisplayer(&binary);
+			for (uint i=0; i<100; ++i)
+			{
+				log.setPosition(__LINE__, __FILE__, "binaryOnly");
+				log.displayNL("warning %u of %s", i, "binaryOnly");
+			}
+			log.removeDisplayer(&binary);
+		}
+
+		CBinaryLogReader reader;
+		TEST_ASSERT(reader.open("binary_log_test.blog"));
+		CLog::TDisplayInfo args;
+		string message;
+		uint nb = 0;
+		bool same = true;
+		while (reader.readLine(args, message))
+		{
+			if (message != toString("warning %u of binaryOnly\n", nb) || args.LogType != CLog::LOG_WARNING ||
+				args.FuncName == NULL || string(args.FuncName) != "binaryOnly")
+				same = false;
+			++nb;
+		}
+		TEST_ASSERT(same);
+		TEST_ASSERT(nb == 100);
+
+		// the format and the names are written once, so a line takes a few bytes
+		TEST_ASSERT(CFile::getFileSize("binary_log_test.blog") < 100*32);
+	}
+
+	void invalidFile()
+	{
+		{
+			COFile f("binary_log_test.blog");
+			string content = "not a binary log";
+			f.serialBuffer((uint8*)content.data(), (uint)content.size());
+		}
+		CBinaryLogReader reader;
+		TEST_ASSERT(!reader.open("binary_log_test.blog"));
+	}
+
+private:
+
+	// Compare the lines of the file with the lines of the text displayer
+	void checkFile(CInfoLinesDisplayer &text)
+	{
+		CBinaryLogReader reader;
+		TEST_ASSERT(reader.open("binary_log_test.blog"));
+
+		CLog::TDisplayInfo args;
+		string message;
+		uint nb = 0;
+		bool same = true;
+		while (reader.readLine(args, message))
+		{
+			if (nb >= text.Lines.size())
+			{
+				same = false;
+				break;
+			}
+			const CLog::TDisplayInfo &expected = text.Infos[nb];
+			if (message != text.Lines[nb])
+				same = false;
+			if (args.LogType != expected.LogType || args.Line != expected.Line || args.ProcessName != expected.ProcessName ||
+				args.ThreadId != expected.ThreadId || (uint32)args.Date != (uint32)expected.Date)
+				same = false;
+			if ((args.FileName == NULL) != (expected.FileName == NULL) || (args.FileName != NULL && strcmp(args.FileName, expected.FileName) != 0))
+				same = false;
+			if ((args.FuncName == NULL) != (expected.FuncName == NULL) || (args.FuncName != NULL && strcmp(args.FuncName, expected.FuncName) != 0))
+				same = false;
+			++nb;
+		}
+		TEST_ASSERT(same);
+		TEST_ASSERT(nb == text.Lines.size());
+	}
+};
+
+Test::Suite *createCBinaryLogTS(const std::string &workingPath)
+{
+	return new CBinaryLogTS(workingPath);
+}
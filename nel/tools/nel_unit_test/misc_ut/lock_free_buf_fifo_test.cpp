@@ -0,0 +1,195 @@
+#include "nel/misc/types_nl.h"
+#include "nel/misc/debug.h"
+#include "nel/misc/thread.h"
+#include "nel/misc/lock_free_buf_fifo.h"
+
+#include "cpptest.h"
+
+using namespace std;
+using namespace NLMISC;
+
+// Pushes blocks of 5 bytes: producer id then a 32 bit counter
+class CFifoProducer : public IRunnable
+{
+public:
+	CFifoProducer(CLockFreeBufFIFO &fifo, uint8 id, uint32 nb)
+		: Fifo(fifo), Id(id), Nb(nb)
+	{
+	}
+
+	virtual void run()
+	{
+		uint8 block[5];
+		block[0] = Id;
+		for (uint32 i=0; i<Nb; ++i)
+		{
+			memcpy(block+1, &i, sizeof(i));
+			Fifo.push(block, sizeof(block));
+		}
+	}
+
+	CLockFreeBufFIFO	&Fifo;
+	uint8				Id;
+	uint32				Nb;
+};
+
+// Test suite for CLockFreeBufFIFO
+class CLockFreeBufFIFOTS : public Test::Suite
+{
+public:
+	CLockFreeBufFIFOTS()
+	{
+		TEST_ADD(CLockFreeBufFIFOTS::pushPop);
+		TEST_ADD(CLockFreeBufFIFOTS::batch);
+		TEST_ADD(CLockFreeBufFIFOTS::noCopy);
+		TEST_ADD(CLockFreeBufFIFOTS::concurrentProducers);
+	}
+
+	void pushPop()
+	{
+		CLockFreeBufFIFO fifo(4);
+		TEST_ASSERT(fifo.empty());
+		TEST_ASSERT(fifo.capacity() == 4);
+
+		vector<uint8> in(3), out;
+		in[0] = 1; in[1] = 2; in[2] = 3;
+		fifo.push(in);
+		TEST_ASSERT(!fifo.empty());
+		TEST_ASSERT(fifo.size() == 3);
+		TEST_ASSERT(fifo.frontLast() == 3);
+
+		fifo.front(out);
+		TEST_ASSERT(out == in);
+		fifo.pop();
+		TEST_ASSERT(fifo.empty());
+		TEST_ASSERT(fifo.size() == 0);
+
+		// wrap around the ring several times
+		for (uint i=0; i<10; ++i)
+		{
+			in[2] = (uint8)i;
+			fifo.push(in);
+			fifo.push(in);
+			TEST_ASSERT(fifo.nbBlocks() == 2);
+			TEST_ASSERT(fifo.frontLast() == i);
+			fifo.pop();
+			fifo.pop();
+		}
+		TEST_ASSERT(fifo.empty());
+
+		// tryPush() doesn't wait when the ring is full
+		for (uint i=0; i<4; ++i)
+			TEST_ASSERT(fifo.tryPush(&in[0], (uint32)in.size()));
+		TEST_ASSERT(!fifo.tryPush(&in[0], (uint32)in.size()));
+		TEST_ASSERT(fifo.nbBlocks() == 4);
+		fifo.pop();
+		TEST_ASSERT(fifo.tryPush(&in[0], (uint32)in.size()));
+		fifo.clear();
+	}
+
+	void batch()
+	{
+		CLockFreeBufFIFO fifo(16);
+		for (uint8 i=0; i<10; ++i)
+			fifo.push(&i, 1);
+
+		uint8 *blocks[4];
+		uint32 sizes[4];
+		uint nb = fifo.frontBatch(blocks, sizes, 4);
+		TEST_ASSERT(nb == 4);
+		for (uint i=0; i<nb; ++i)
+		{
+			TEST_ASSERT(sizes[i] == 1);
+			TEST_ASSERT(*blocks[i] == i);
+		}
+		fifo.popBatch(nb);
+		TEST_ASSERT(fifo.nbBlocks() == 6);
+		TEST_ASSERT(fifo.frontLast() == 4);
+
+		fifo.clear();
+		TEST_ASSERT(fifo.empty());
+		TEST_ASSERT(fifo.frontBatch(blocks, sizes, 4) == 0);
+	}
+
+	void noCopy()
+	{
+		CLockFreeBufFIFO fifo(4);
+		CLockFreeBufFIFO::TBlock block;
+		block.resize(8);
+		for (uint8 i=0; i<8; ++i)
+			block[i] = i;
+		const uint8 *ptr = block.getPtr();
+
+		// the memory block goes through the fifo into the stream
+		fifo.pushNoCopy(block);
+		TEST_ASSERT(block.empty());
+		TEST_ASSERT(fifo.size() == 8);
+
+		CLockFreeBufFIFO::TBlock out;
+		fifo.pop(out);
+		TEST_ASSERT(fifo.empty());
+		TEST_ASSERT(out.getPtr() == ptr);
+
+		CMemStream stream(true);
+		stream.swapBuffer(out);
+		TEST_ASSERT(stream.buffer() == ptr);
+		TEST_ASSERT(stream.length() == 8);
+		uint8 b;
+		stream.serial(b);
+		stream.serial(b);
+		TEST_ASSERT(b == 1);
+	}
+
+	void concurrentProducers()
+	{
+		const uint NbProducers = 4;
+		const uint32 NbPerProducer = 20000;
+
+		// small capacity, so that the producers have to wait for the consumer
+		CLockFreeBufFIFO fifo(64);
+		vector<CFifoProducer*> producers;
+		vector<IThread*> threads;
+		for (uint i=0; i<NbProducers; ++i)
+		{
+			producers.push_back(new CFifoProducer(fifo, (uint8)i, NbPerProducer));
+			threads.push_back(IThread::create(producers.back()));
+			threads.back()->start();
+		}
+
+		// each producer's blocks must come out in order, none lost
+		vector<uint32> next(NbProducers, 0);
+		uint32 total = 0;
+		bool ordered = true;
+		while (total != NbProducers*NbPerProducer)
+		{
+			uint8 *blocks[16];
+			uint32 sizes[16];
+			uint nb = fifo.frontBatch(blocks, sizes, 16);
+			for (uint i=0; i<nb; ++i)
+			{
+				uint32 counter;
+				memcpy(&counter, blocks[i]+1, sizeof(counter));
+				if (sizes[i] != 5 || blocks[i][0] >= NbProducers || counter != next[blocks[i][0]])
+					ordered = false;
+				else
+					++next[blocks[i][0]];
+			}
+			fifo.popBatch(nb);
+			total += nb;
+		}
+		TEST_ASSERT(ordered);
+		TEST_ASSERT(fifo.empty());
+
+		for (uint i=0; i<NbProducers; ++i)
+		{
+			threads[i]->wait();
+			delete threads[i];
+			delete producers[i];
+		}
+	}
+};
+
+Test::Suite *createCLockFreeBufFIFOTS()
+{
+	return new CLockFreeBufFIFOTS;
+}
@@ -0,0 +1,168 @@
+#include "nel/misc/types_nl.h"
+#include "nel/misc/log.h"
+#include "nel/misc/displayer.h"
+#include "nel/misc/thread.h"
+
+#include "cpptest.h"
+
+using namespace std;
+using namespace NLMISC;
+
+// Keeps the displayed lines
+class CLinesDisplayer : public IDisplayer
+{
+public:
+	vector<string>			Lines;
+	vector<CLog::TLogType>	LogTypes;
+
+protected:
+	virtual void doDisplay( const CLog::TDisplayInfo& args, const char *message)
+	{
+		Lines.push_back(message);
+		LogTypes.push_back(args.LogType);
+	}
+};
+
+// Displays "<id> <counter>" lines in a log
+class CLogProducer : public IRunnable
+{
+public:
+	CLogProducer(CLog &log, uint id, uint nb)
+		: Log(log), Id(id), Nb(nb)
+	{
+	}
+
+	virtual void run()
+	{
+		for (uint i=0; i<Nb; ++i)
+		{
+			Log.setPosition(__LINE__, __FILE__);
+			Log.displayNL("%u %u", Id, i);
+		}
+	}
+
+	CLog	&Log;
+	uint	Id;
+	uint	Nb;
+};
+
+// Test suite for the async mode of CLog
+class CLogTS : public Test::Suite
+{
+public:
+	CLogTS()
+	{
+		TEST_ADD(CLogTS::asyncOrder);
+		TEST_ADD(CLogTS::asyncPartialLines);
+		TEST_ADD(CLogTS::asyncErrors);
+	}
+
+	void asyncOrder()
+	{
+		const uint NbProducers = 4;
+		const uint NbPerProducer = 5000;
+
+		CLog log(CLog::LOG_INFO);
+		CLinesDisplayer displayer;
+		log.addDisplayer(&displayer);
+		log.addNegativeFilter("filtered");
+		log.setAsync(true);
+		TEST_ASSERT(log.isAsync());
+
+		vector<CLogProducer*> producers;
+		vector<IThread*> threads;
+		for (uint i=0; i<NbProducers; ++i)
+		{
+			producers.push_back(new CLogProducer(log, i, NbPerProducer));
+			threads.push_back(IThread::create(producers.back()));
+			threads.back()->start();
+		}
+		log.displayNL("filtered line");
+		for (uint i=0; i<NbProducers; ++i)
+		{
+			threads[i]->wait();
+			delete threads[i];
+			delete producers[i];
+		}
+		CLog::flushAsync();
+
+		// each thread's lines are displayed in order, none lost, and the filters are applied
+		TEST_ASSERT(displayer.Lines.size() == NbProducers*NbPerProducer);
+		vector<uint> next(NbProducers, 0);
+		bool ordered = true;
+		for (uint i=0; i<displayer.Lines.size(); ++i)
+		{
+			uint id, counter;
+			if (sscanf(displayer.Lines[i].c_str(), "%u %u", &id, &counter) != 2 || id >= NbProducers || counter != next[id])
+				ordered = false;
+			else
+				++next[id];
+			if (displayer.LogTypes[i] != CLog::LOG_INFO)
+				ordered = false;
+		}
+		TEST_ASSERT(ordered);
+
+		// the displayer is not used after being removed
+		log.removeDisplayer(&displayer);
+		log.displayNL("after remove");
+		log.setAsync(false);
+		TEST_ASSERT(displayer.Lines.size() == NbProducers*NbPerProducer);
+	}
+
+	void asyncPartialLines()
+	{
+		CLog log(CLog::LOG_DEBUG);
+		CLinesDisplayer displayer;
+		log.addDisplayer(&displayer);
+		log.setAsync(true);
+
+		log.display("begin ");
+		log.display("middle ");
+		log.displayNL("end");
+		log.displayRaw("raw ");
+		log.displayRawNL("line");
+		log.setAsync(false);
+
+		TEST_ASSERT(displayer.Lines.size() == 2);
+		if (displayer.Lines.size() == 2)
+		{
+			TEST_ASSERT(displayer.Lines[0] == "begin middle end\n");
+			TEST_ASSERT(displayer.Lines[1] == "raw line\n");
+			TEST_ASSERT(displayer.LogTypes[1] == CLog::LOG_NO);
+		}
+		log.removeDisplayer(&displayer);
+	}
+
+	void asyncErrors()
+	{
+		CLog infoLog(CLog::LOG_INFO);
+		CLog errorLog(CLog::LOG_ERROR);
+		CLinesDisplayer displayer;
+		infoLog.addDisplayer(&displayer);
+		errorLog.addDisplayer(&displayer);
+		infoLog.setAsync(true);
+		errorLog.setAsync(true);
+
+		// the error is displayed at once, after the queued lines
+		for (uint i=0; i<100; ++i)
+			infoLog.displayNL("info %u", i);
+		errorLog.displayNL("error");
+		TEST_ASSERT(displayer.Lines.size() == 101);
+		if (displayer.Lines.size() == 101)
+		{
+			TEST_ASSERT(displayer.Lines[99] == "info 99\n");
+			TEST_ASSERT(displayer.Lines[100] == "error\n");
+			TEST_ASSERT(displayer.LogTypes[100] == CLog::LOG_ERROR);
+		}
+
+		infoLog.setAsync(false);
+		errorLog.setAsync(false);
+		infoLog.removeDisplayer(&displayer);
+		errorLog.removeDisplayer(&displayer);
+	}
+};
+
+Test::Suite *createCLogTS()
+{
+	return new CLogTS;
+}
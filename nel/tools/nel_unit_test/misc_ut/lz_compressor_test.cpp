@@ -0,0 +1,129 @@
+#include "nel/misc/types_nl.h"
+#include "nel/misc/debug.h"
+#include "nel/misc/lz_compressor.h"
+
+#include "cpptest.h"
+
+using namespace std;
+using namespace NLMISC;
+
+// Test suite for CLZCompressor and CLZDecompressor
+class CLZCompressorTS : public Test::Suite
+{
+public:
+	CLZCompressorTS()
+	{
+		TEST_ADD(CLZCompressorTS::roundTrip);
+		TEST_ADD(CLZCompressorTS::dictionary);
+		TEST_ADD(CLZCompressorTS::bigMessages);
+		TEST_ADD(CLZCompressorTS::corrupted);
+	}
+
+	// Compress then decompress src, returns the compressed size or 0 if the result differs
+	uint32 transfer(CLZCompressor &compressor, CLZDecompressor &decompressor, const vector<uint8> &src)
+	{
+		vector<uint8> compressed(CLZCompressor::maxCompressedSize((uint32)src.size()));
+		uint32 compressedSize = compressor.compress(src.empty() ? NULL : &src[0], (uint32)src.size(), &compressed[0]);
+		if (compressedSize > compressed.size())
+			return 0;
+
+		vector<uint8> result(src.size() + 1);
+		if (!decompressor.decompress(&compressed[0], compressedSize, &result[0], (uint32)src.size()))
+			return 0;
+		result.resize(src.size());
+		return (result == src) ? compressedSize : 0;
+	}
+
+	void roundTrip()
+	{
+		CLZCompressor compressor;
+		CLZDecompressor decompressor;
+
+		vector<uint8> src;
+		TEST_ASSERT(transfer(compressor, decompressor, src) != 0);
+
+		// short and repetitive
+		for (uint i=0; i<300; ++i)
+			src.push_back((uint8)(i % 7));
+		TEST_ASSERT(transfer(compressor, decompressor, src) != 0);
+		TEST_ASSERT(transfer(compressor, decompressor, src) < src.size() / 4);
+
+		// incompressible
+		src.clear();
+		uint32 seed = 12345;
+		for (uint i=0; i<1000; ++i)
+		{
+			seed = seed * 1103515245 + 12345;
+			src.push_back((uint8)(seed >> 16));
+		}
+		TEST_ASSERT(transfer(compressor, decompressor, src) != 0);
+	}
+
+	void dictionary()
+	{
+		// a message with no internal redundancy compresses well when it was already sent
+		vector<uint8> src;
+		uint32 seed = 1;
+		for (uint i=0; i<200; ++i)
+		{
+			seed = seed * 1103515245 + 12345;
+			src.push_back((uint8)(seed >> 16));
+		}
+
+		CLZCompressor compressor;
+		CLZDecompressor decompressor;
+		uint32 first = transfer(compressor, decompressor, src);
+		uint32 second = transfer(compressor, decompressor, src);
+		TEST_ASSERT(first >= src.size());
+		TEST_ASSERT(second != 0 && second < 16);
+
+		// after a reset of both sides, the message is new again
+		compressor.reset();
+		decompressor.reset();
+		TEST_ASSERT(transfer(compressor, decompressor, src) == first);
+	}
+
+	void bigMessages()
+	{
+		// many messages bigger than the window, so that the history is shrunk several times
+		CLZCompressor compressor;
+		CLZDecompressor decompressor;
+		vector<uint8> src(100000);
+		bool ok = true;
+		for (uint m=0; m<10; ++m)
+		{
+			for (uint i=0; i<src.size(); ++i)
+				src[i] = (uint8)((i * m) >> 5);
+			if (transfer(compressor, decompressor, src) == 0)
+				ok = false;
+		}
+		TEST_ASSERT(ok);
+	}
+
+	void corrupted()
+	{
+		vector<uint8> src(500);
+		for (uint i=0; i<src.size(); ++i)
+			src[i] = (uint8)(i % 13);
+
+		CLZCompressor compressor;
+		vector<uint8> compressed(CLZCompressor::maxCompressedSize((uint32)src.size()));
+		uint32 compressedSize = compressor.compress(&src[0], (uint32)src.size(), &compressed[0]);
+
+		// a bad offset or a truncated stream must be detected
+		vector<uint8> result(src.size());
+		CLZDecompressor decompressor;
+		TEST_ASSERT(!decompressor.decompress(&compressed[0], compressedSize-1, &result[0], (uint32)src.size()));
+		decompressor.reset();
+		TEST_ASSERT(!decompressor.decompress(&compressed[0], compressedSize, &result[0], (uint32)src.size()+1));
+		decompressor.reset();
+		compressed[14] = 0;
+		compressed[15] = 0;
+		TEST_ASSERT(!decompressor.decompress(&compressed[0], compressedSize, &result[0], (uint32)src.size()));
+	}
+};
+
+Test::Suite *createCLZCompressorTS()
+{
+	return new CLZCompressorTS;
+}
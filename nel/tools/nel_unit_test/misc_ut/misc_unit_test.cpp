@@ -439,6 +439,12 @@ Test::Suite *createCStreamTS();
 Test::Suite *createCCoTaskTS();
 Test::Suite *createCConfigFileTS(const std::string &workingPath);
 Test::Suite *createCPackFileTS(const std::string &workingPath);
+Test::Suite *createCLockFreeBufFIFOTS();
+Test::Suite *createCLZCompressorTS();
+Test::Suite *createCPathTS(const std::string &workingPath);
+Test::Suite *createCLogTS();
+Test::Suite *createCBinaryLogTS(const std::string &workingPath);
+Test::Suite *createCThreadCachedAllocatorTS();
 
 
 
@@ -460,6 +466,12 @@ public:
 		add(auto_ptr<Test::Suite>(createCCoTaskTS()));
 		add(auto_ptr<Test::Suite>(createCConfigFileTS(workingPath)));
 		add(auto_ptr<Test::Suite>(createCPackFileTS(workingPath)));
+		add(auto_ptr<Test::Suite>(createCLockFreeBufFIFOTS()));
+		add(auto_ptr<Test::Suite>(createCLZCompressorTS()));
+		add(auto_ptr<Test::Suite>(createCPathTS(workingPath)));
+		add(auto_ptr<Test::Suite>(createCLogTS()));
+		add(auto_ptr<Test::Suite>(createCBinaryLogTS(workingPath)));
+		add(auto_ptr<Test::Suite>(createCThreadCachedAllocatorTS()));
 
 		// initialise the application context
 		NLMISC::CApplicationContext::getInstance();
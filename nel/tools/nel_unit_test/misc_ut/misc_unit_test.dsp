@@ -150,6 +150,10 @@ LINK32=link.exe
 # PROP Default_Filter "cpp;c;cxx;rc;def;r;odl;idl;hpj;bat"
 # Begin Source File
 
+SOURCE=.\binary_log_test.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\co_task_test.cpp
 # End Source File
 # Begin Source File
@@ -162,6 +166,18 @@ SOURCE=.\csstring_test.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\lock_free_buf_fifo_test.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\log_test.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\lz_compressor_test.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\misc_unit_test.cpp
 # End Source File
 # Begin Source File
@@ -170,6 +186,10 @@ SOURCE=.\object_command_test.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\path_test.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\pure_nel_lib_test.cpp
 # End Source File
 # Begin Source File
@@ -188,6 +208,10 @@ SOURCE=.\stream_test.cpp
 
 SOURCE=.\test_pack_file.cpp
 # End Source File
+# Begin Source File
+
+SOURCE=.\thread_cached_allocator_test.cpp
+# End Source File
 # End Group
 # End Target
 # End Project
@@ -0,0 +1,188 @@
+#include "nel/misc/path.h"
+#include "nel/misc/file.h"
+#include "nel/misc/time_nl.h"
+
+#include "cpptest.h"
+
+using namespace std;
+using namespace NLMISC;
+
+// Test suite for the file index of CFileContainer and its path cache
+class CPathTS : public Test::Suite
+{
+	string		_WorkingPath;
+	string		_OldPath;
+public:
+	CPathTS (const std::string &workingPath)
+		: _WorkingPath(workingPath)
+	{
+		TEST_ADD(CPathTS::lookup);
+		TEST_ADD(CPathTS::lookupCompressed);
+		TEST_ADD(CPathTS::fileList);
+		TEST_ADD(CPathTS::pathCache);
+	}
+
+	void setup()
+	{
+		_OldPath = CPath::getCurrentPath();
+		CPath::setCurrentPath(_WorkingPath.c_str());
+
+		// path_test/A_File.txt, path_test/sub/b.txt, path_test/sub/deep/c.TGA
+		CFile::createDirectoryTree("path_test/sub/deep");
+		writeFile("path_test/A_File.txt");
+		writeFile("path_test/sub/b.txt");
+		writeFile("path_test/sub/deep/c.TGA");
+	}
+
+	void tear_down()
+	{
+		vector<string> files;
+		CPath::getPathContent("path_test", true, false, true, files);
+		files.push_back("path_test.cache");
+		for (uint i = 0; i < files.size(); ++i)
+		{
+			if (CFile::fileExists(files[i]))
+				CFile::deleteFile(files[i]);
+		}
+		CFile::deleteDirectory("path_test/sub/deep");
+		CFile::deleteDirectory("path_test/sub");
+		CFile::deleteDirectory("path_test");
+
+		CPath::setCurrentPath(_OldPath.c_str());
+	}
+
+	void lookup()
+	{
+		CFileContainer fc;
+		fc.addSearchPath("path_test", true, false);
+
+		TEST_ASSERT(fc.lookup("a_file.TXT", false, false, false) == "path_test/A_File.txt");
+		TEST_ASSERT(fc.lookup("b.txt", false, false, false) == "path_test/sub/b.txt");
+		TEST_ASSERT(fc.lookup("c.tga", false, false, false) == "path_test/sub/deep/c.TGA");
+		TEST_ASSERT(fc.lookup("d.txt", false, false, false).empty());
+		TEST_ASSERT(fc.exists("B.TXT"));
+	}
+
+	void lookupCompressed()
+	{
+		CFileContainer fc;
+		fc.remapExtension("tga", "dds", true);
+		fc.addSearchPath("path_test", true, false);
+		fc.memoryCompress();
+
+		TEST_ASSERT(fc.lookup("a_file.TXT", false, false, false) == "path_test/A_File.txt");
+		TEST_ASSERT(fc.lookup("B.txt", false, false, false) == "path_test/sub/b.txt");
+		TEST_ASSERT(fc.lookup("c.dds", false, false, false) == "path_test/sub/deep/c.TGA");
+		TEST_ASSERT(fc.lookup("d.txt", false, false, false).empty());
+		TEST_ASSERT(fc.exists("C.TGA"));
+		TEST_ASSERT(!fc.exists("c.txt"));
+
+		fc.memoryUncompress();
+		TEST_ASSERT(fc.lookup("b.txt", false, false, false) == "path_test/sub/b.txt");
+	}
+
+	void fileList()
+	{
+		writeFile("path_test/sub/deep/g.txt");
+		writeFile("path_test/f.txt");
+		writeFile("path_test/sub/e.txt");
+
+		CFileContainer fc;
+		fc.addSearchPath("path_test", true, false);
+
+		// the names are sorted, and appended to the list
+		vector<string> files;
+		files.push_back("z.txt");
+		fc.getFileList("txt", files);
+		TEST_ASSERT(files.size() == 6);
+		TEST_ASSERT(files[0] == "z.txt");
+		TEST_ASSERT(files[1] == "a_file.txt");
+		TEST_ASSERT(files[5] == "g.txt");
+		TEST_ASSERT(isSorted(files, 1));
+
+		fc.memoryCompress();
+		files.clear();
+		fc.getFileList("", files);
+		TEST_ASSERT(files.size() == 6);
+		TEST_ASSERT(isSorted(files, 0));
+		files.clear();
+		fc.getFileListByName("txt", "e", files);
+		TEST_ASSERT(files.size() == 2);
+		TEST_ASSERT(files[1] == "e.txt");
+		TEST_ASSERT(isSorted(files, 0));
+	}
+
+	void pathCache()
+	{
+		// the directories modified in the second of the scan are not trusted
+		uint32 date = CTime::getSecondsSince1970() - 10;
+		setDirectoriesDate(date);
+
+		{
+			CFileContainer fc;
+			TEST_ASSERT(!fc.loadPathCache("path_test.cache"));
+			fc.addSearchPath("path_test", true, false);
+			TEST_ASSERT(fc.savePathCache("path_test.cache"));
+		}
+
+		// a file removed without changing the date of its directory is still in the cache
+		CFile::deleteFile("path_test/sub/b.txt");
+		setDirectoriesDate(date);
+		{
+			CFileContainer fc;
+			TEST_ASSERT(fc.loadPathCache("path_test.cache"));
+			fc.addSearchPath("path_test", true, false);
+			TEST_ASSERT(fc.lookup("b.txt", false, false, false) == "path_test/sub/b.txt");
+			TEST_ASSERT(fc.lookup("c.tga", false, false, false) == "path_test/sub/deep/c.TGA");
+
+			// not recursive, not in the cache
+			CFileContainer fc2;
+			TEST_ASSERT(fc2.loadPathCache("path_test.cache"));
+			fc2.addSearchPath("path_test", false, false);
+			TEST_ASSERT(fc2.lookup("a_file.txt", false, false, false) == "path_test/A_File.txt");
+			TEST_ASSERT(fc2.lookup("b.txt", false, false, false).empty());
+		}
+
+		// a new file changes the date of its directory, so it is scanned again
+		writeFile("path_test/sub/d.txt");
+		{
+			CFileContainer fc;
+			TEST_ASSERT(fc.loadPathCache("path_test.cache"));
+			fc.addSearchPath("path_test", true, false);
+			TEST_ASSERT(fc.lookup("b.txt", false, false, false).empty());
+			TEST_ASSERT(fc.lookup("d.txt", false, false, false) == "path_test/sub/d.txt");
+			TEST_ASSERT(fc.lookup("c.tga", false, false, false) == "path_test/sub/deep/c.TGA");
+		}
+	}
+
+private:
+
+	static bool isSorted(const vector<string> &files, uint first)
+	{
+		for (uint i = first + 1; i < files.size(); ++i)
+		{
+			if (files[i - 1] > files[i])
+				return false;
+		}
+		return true;
+	}
+
+	void writeFile(const string &filename)
+	{
+		COFile f(filename);
+		string content = filename;
+		f.serialBuffer((uint8*)content.data(), (uint)content.size());
+	}
+
+	void setDirectoriesDate(uint32 date)
+	{
+		CFile::setFileModificationDate("path_test/sub/deep", date);
+		CFile::setFileModificationDate("path_test/sub", date);
+		CFile::setFileModificationDate("path_test", date);
+	}
+};
+
+Test::Suite *createCPathTS(const std::string &workingPath)
+{
+	return new CPathTS(workingPath);
+}
@@ -2,6 +2,7 @@
 #include "nel/misc/debug.h"
 #include "nel/misc/sstring.h"
 #include "nel/misc/file.h"
+#include "nel/misc/big_file.h"
 
 #include "cpptest.h"
 
@@ -36,6 +37,7 @@ public:
 		TEST_ADD(CPackFileTS::loadFromBnpUncompressed);
 		TEST_ADD(CPackFileTS::loadFromXmlpackUncompressed);
 		TEST_ADD(CPackFileTS::loadXmlpackWithSameName);
+		TEST_ADD(CPackFileTS::loadFromMappedBnp);
 	}
 
 	void setup()
@@ -225,6 +227,39 @@ _CrtCheckMemory();
 
 	}
 
+	void loadFromMappedBnp()
+	{
+		// the same bnp, memory mapped
+		CBigFile::getInstance().remove("files.bnp");
+		TEST_ASSERT(CBigFile::getInstance().add("misc_ut/files/files.bnp", BF_MEMORY_MAPPED));
+
+		vector<string> files;
+		CBigFile::getInstance().list("files.bnp", files);
+		TEST_ASSERT(files.size() == 2);
+
+		TEST_ASSERT(CFile::getFileSize("files.bnp@file2_in_bnp.txt") == 39);
+		loadFromBnp();
+
+		{
+			// seek and read past the end in the view
+			CIFile file1("files.bnp@file1_in_bnp.txt");
+			TEST_ASSERT(file1.seek(4, IStream::begin));
+			char content[7];
+			file1.serialBuffer((uint8*)content, 7);
+			TEST_ASSERT(string(content, 7) == "content");
+			TEST_ASSERT(file1.seek(-4, IStream::end));
+			file1.serialBuffer((uint8*)content, 4);
+			TEST_ASSERT(string(content, 4) == "file");
+			TEST_ASSERT(file1.eof());
+			TEST_THROWS(file1.serialBuffer((uint8*)content, 1), EReadError);
+		}
+
+		// back to the file mode for the other tests
+		CBigFile::getInstance().remove("files.bnp");
+		TEST_ASSERT(CBigFile::getInstance().add("misc_ut/files/files.bnp", BF_ALWAYS_OPENED | BF_CACHE_FILE_ON_OPEN));
+		loadFromBnp();
+	}
+
 };
 
 Test::Suite *createCPackFileTS(const std::string &workingPath)
@@ -0,0 +1,227 @@
+#include "nel/misc/types_nl.h"
+#include "nel/misc/thread_cached_allocator.h"
+#include "nel/misc/lock_free_buf_fifo.h"
+#include "nel/misc/thread.h"
+
+#include "cpptest.h"
+
+using namespace std;
+using namespace NLMISC;
+
+// Allocates blocks of different sizes, fills them and sends them to another thread through a fifo
+class CAllocProducer : public IRunnable
+{
+public:
+	CAllocProducer(CThreadCachedAllocator &allocator, CLockFreeBufFIFO &fifo, uint nb)
+		: Allocator(allocator), Fifo(fifo), Nb(nb)
+	{
+	}
+
+	virtual void run()
+	{
+		for (uint i=0; i<Nb; ++i)
+		{
+			uint size = 1 + (i * 7) % 200;
+			uint8 *block = (uint8*)Allocator.alloc(size);
+			memset(block, (uint8)size, size);
+			Fifo.push((uint8*)&block, sizeof(block));
+		}
+		Allocator.releaseThreadCache();
+	}
+
+	CThreadCachedAllocator	&Allocator;
+	CLockFreeBufFIFO		&Fifo;
+	uint					Nb;
+};
+
+// Checks and frees the blocks of the fifo
+class CAllocConsumer : public IRunnable
+{
+public:
+	CAllocConsumer(CThreadCachedAllocator &allocator, CLockFreeBufFIFO &fifo, uint nb)
+		: Allocator(allocator), Fifo(fifo), Nb(nb), Valid(true)
+	{
+	}
+
+	virtual void run()
+	{
+		for (uint i=0; i<Nb; )
+		{
+			if (Fifo.empty())
+			{
+				nlSleep(0);
+				continue;
+			}
+			uint8 *buffer;
+			uint32 bufferSize;
+			Fifo.front(buffer, bufferSize);
+			uint8 *block;
+			memcpy(&block, buffer, sizeof(block));
+			Fifo.pop();
+			uint size = 1 + (i * 7) % 200;
+			for (uint k=0; k<size; ++k)
+			{
+				if (block[k] != (uint8)size)
+					Valid = false;
+			}
+			// the local blocks are allocated and freed between
+			void *local = Allocator.alloc(size);
+			Allocator.free(local);
+			Allocator.free(block);
+			++i;
+		}
+		Allocator.releaseThreadCache();
+	}
+
+	CThreadCachedAllocator	&Allocator;
+	CLockFreeBufFIFO		&Fifo;
+	uint					Nb;
+	bool					Valid;
+};
+
+// Test suite for CThreadCachedAllocator
+class CThreadCachedAllocatorTS : public Test::Suite
+{
+public:
+	CThreadCachedAllocatorTS()
+	{
+		TEST_ADD(CThreadCachedAllocatorTS::allocFree);
+		TEST_ADD(CThreadCachedAllocatorTS::stats);
+		TEST_ADD(CThreadCachedAllocatorTS::crossThreads);
+	}
+
+	void allocFree()
+	{
+		CThreadCachedAllocator allocator(256);
+
+		vector<uint8*> blocks;
+		bool aligned = true;
+		for (uint i=0; i<2000; ++i)
+		{
+			uint size = i % 300;
+			uint8 *block = (uint8*)allocator.alloc(size);
+			if (((size_t)block & 7) != 0)
+				aligned = false;
+			memset(block, (uint8)i, size);
+			blocks.push_back(block);
+		}
+		TEST_ASSERT(aligned);
+
+		// no block overlaps another one
+		bool valid = true;
+		for (uint i=0; i<blocks.size(); ++i)
+		{
+			uint size = i % 300;
+			for (uint k=0; k<size; ++k)
+			{
+				if (blocks[i][k] != (uint8)i)
+					valid = false;
+			}
+		}
+		TEST_ASSERT(valid);
+
+		// the freed blocks are reused from the cache of the thread
+		void *block = allocator.alloc(40);
+		allocator.free(block);
+		TEST_ASSERT(allocator.alloc(40) == block);
+		allocator.free(block);
+
+		for (uint i=0; i<blocks.size(); ++i)
+			allocator.free(blocks[i]);
+		allocator.free(NULL);
+	}
+
+	void stats()
+	{
+		CThreadCachedAllocator allocator(256);
+		CThreadCachedAllocator::CStats stats;
+
+		allocator.getStats(stats);
+		TEST_ASSERT(stats.SizeClasses.empty());
+		TEST_ASSERT(stats.getFragmentation() == 0.f);
+
+		vector<void*> blocks;
+		for (uint i=0; i<1000; ++i)
+			blocks.push_back(allocator.alloc(24));
+		for (uint i=0; i<3; ++i)
+			blocks.push_back(allocator.alloc(1000));
+
+		allocator.getStats(stats);
+		TEST_ASSERT(stats.SizeClasses.size() == 1);
+		if (stats.SizeClasses.size() == 1)
+		{
+			TEST_ASSERT(stats.SizeClasses[0].BlockSize == 24);
+			TEST_ASSERT(stats.SizeClasses[0].NumUsedBlocks == 1000);
+			TEST_ASSERT(stats.SizeClasses[0].NumChunks > 0);
+		}
+		TEST_ASSERT(stats.NumLargeBlocks == 3);
+		TEST_ASSERT(stats.NumThreadCaches == 1);
+		TEST_ASSERT(stats.UsedBytes == 1000*24);
+		TEST_ASSERT(stats.ReservedBytes > stats.UsedBytes);
+
+		// the free blocks are cached or go back to the chunks, the fragmentation grows
+		float fragmentation = stats.getFragmentation();
+		for (uint i=0; i<blocks.size(); i+=2)
+			allocator.free(blocks[i]);
+		allocator.getStats(stats);
+		TEST_ASSERT(stats.SizeClasses.size() == 1 && stats.SizeClasses[0].NumUsedBlocks == 500);
+		TEST_ASSERT(stats.NumLargeBlocks == 1);
+		TEST_ASSERT(stats.getFragmentation() > fragmentation);
+
+		for (uint i=1; i<blocks.size(); i+=2)
+			allocator.free(blocks[i]);
+		allocator.releaseThreadCache();
+		allocator.getStats(stats);
+		TEST_ASSERT(stats.NumThreadCaches == 0);
+		TEST_ASSERT(stats.SizeClasses.size() == 1 && stats.SizeClasses[0].NumUsedBlocks == 0);
+		TEST_ASSERT(stats.NumLargeBlocks == 0);
+	}
+
+	void crossThreads()
+	{
+		const uint NbPairs = 4;
+		const uint NbPerPair = 20000;
+
+		CThreadCachedAllocator allocator(256);
+		vector<CLockFreeBufFIFO*> fifos;
+		vector<IRunnable*> runnables;
+		vector<IThread*> threads;
+		for (uint i=0; i<NbPairs; ++i)
+		{
+			fifos.push_back(new CLockFreeBufFIFO(1 << 16));
+			runnables.push_back(new CAllocProducer(allocator, *fifos.back(), NbPerPair));
+			runnables.push_back(new CAllocConsumer(allocator, *fifos.back(), NbPerPair));
+		}
+		for (uint i=0; i<runnables.size(); ++i)
+		{
+			threads.push_back(IThread::create(runnables[i]));
+			threads.back()->start();
+		}
+		bool valid = true;
+		for (uint i=0; i<threads.size(); ++i)
+		{
+			threads[i]->wait();
+			delete threads[i];
+			if (i & 1)
+				valid = valid && static_cast<CAllocConsumer*>(runnables[i])->Valid;
+			delete runnables[i];
+		}
+		for (uint i=0; i<fifos.size(); ++i)
+			delete fifos[i];
+		TEST_ASSERT(valid);
+
+		// all the blocks are back
+		CThreadCachedAllocator::CStats stats;
+		allocator.getStats(stats);
+		uint numUsed = 0;
+		for (uint i=0; i<stats.SizeClasses.size(); ++i)
+			numUsed += stats.SizeClasses[i].NumUsedBlocks;
+		TEST_ASSERT(numUsed == 0);
+		TEST_ASSERT(stats.NumThreadCaches == 0);
+	}
+};
+
+Test::Suite *createCThreadCachedAllocatorTS()
+{
+	return new CThreadCachedAllocatorTS;
+}
@@ -22,6 +22,9 @@ using namespace NLNET;
  */
 
 uint16 TestPort1 = 56000;
+uint16 TestPort2 = 56001;
+uint16 TestPort3 = 56002;
+uint16 TestPort4 = 56003;
 
 uint NbTestReceived = 0;
 
@@ -80,6 +83,20 @@ static TCallbackItem CallbackArray[] =
 	{ "TEST_50", cbTest }
 };
 
+// Layer 1 connection events
+vector<TSockId> L1Connected;
+uint NbL1Disconnections = 0;
+
+void cbL1Connection( TSockId from, void *arg )
+{
+	L1Connected.push_back( from );
+}
+
+void cbL1Disconnection( TSockId from, void *arg )
+{
+	++NbL1Disconnections;
+}
+
 
 // Test suite for layer 3
 // ! not complete at all at time of writing !
@@ -93,6 +110,9 @@ public:
 		_Server = NULL;
 		_Client = NULL;
 		TEST_ADD(CLayer3TS::sendReceiveUpdate);
+		TEST_ADD(CLayer3TS::sharedReceiveEngine);
+		TEST_ADD(CLayer3TS::fullReceiveQueue);
+		TEST_ADD(CLayer3TS::stalledSharedClient);
 
 	}
 
@@ -200,6 +220,216 @@ public:
 		}
 	}
 
+	// Many clients multiplexed on the shared receive threads
+	void sharedReceiveEngine()
+	{
+		CBufClient::TReceiveEngine prevEngine = CBufClient::defaultReceiveEngine();
+		CBufClient::setDefaultReceiveEngine( CBufClient::SharedEngine );
+		CBufClient::setNbSharedReceiveThreads( 2 );
+
+		CCallbackServer server;
+		server.init( TestPort2 );
+		server.addCallbackArray( CallbackArray, sizeof(CallbackArray)/sizeof(TCallbackItem) );
+
+		const uint nbClients = 50;
+		vector<CCallbackClient*> clients;
+		for ( uint i=0; i!=nbClients; ++i )
+		{
+			CCallbackClient *client = new CCallbackClient();
+			client->addCallbackArray( CallbackArray, sizeof(CallbackArray)/sizeof(TCallbackItem) );
+			client->connect( CInetAddress( "localhost", TestPort2 ) );
+			clients.push_back( client );
+		}
+
+		// TEST: every client gets its answer
+		NbTestReceived = 0;
+		for ( uint i=0; i!=nbClients; ++i )
+			clients[i]->send( msgoutExpectingAnswer0 );
+		for ( uint loop=0; (loop!=100) && (NbTestReceived < 2*nbClients); ++loop )
+		{
+			for ( uint i=0; i!=nbClients; ++i )
+				clients[i]->update();
+			server.update();
+			nlSleep( 10 );
+		}
+		TEST_ASSERT( NbTestReceived == 2*nbClients );
+
+		// TEST: a client can be disconnected and reconnected while the others keep receiving
+		clients[0]->disconnect();
+		clients[0]->connect( CInetAddress( "localhost", TestPort2 ) );
+		delete clients[1];
+		clients.erase( clients.begin() + 1 );
+		NbTestReceived = 0;
+		for ( uint i=0; i!=clients.size(); ++i )
+			clients[i]->send( msgoutExpectingAnswer0 );
+		for ( uint loop=0; (loop!=100) && (NbTestReceived < 2*clients.size()); ++loop )
+		{
+			for ( uint i=0; i!=clients.size(); ++i )
+				clients[i]->update();
+			server.update();
+			nlSleep( 10 );
+		}
+		TEST_ASSERT( NbTestReceived == 2*clients.size() );
+
+		for ( uint i=0; i!=clients.size(); ++i )
+			delete clients[i];
+		CBufClient::setNbSharedReceiveThreads( 1 );
+		CBufClient::setDefaultReceiveEngine( prevEngine );
+	}
+
+	// A disconnection detected by the user thread while the receive queue is full
+	void fullReceiveQueue()
+	{
+		CBufServer server;
+		server.setConnectionCallback( cbL1Connection, NULL );
+		server.setDisconnectionCallback( cbL1Disconnection, NULL );
+		server.init( TestPort3 );
+		L1Connected.clear();
+		NbL1Disconnections = 0;
+
+		// The first connection is the one that will be disconnected
+		CBufClient other, flooder;
+		other.connect( CInetAddress( "localhost", TestPort3 ) );
+		for ( uint loop=0; (loop!=100) && (L1Connected.size() < 1); ++loop )
+		{
+			server.update();
+			server.dataAvailable();
+			nlSleep( 10 );
+		}
+		flooder.connect( CInetAddress( "localhost", TestPort3 ) );
+		for ( uint loop=0; (loop!=100) && (L1Connected.size() < 2); ++loop )
+		{
+			server.update();
+			server.dataAvailable();
+			nlSleep( 10 );
+		}
+		TEST_ASSERT( L1Connected.size() == 2 );
+		if ( L1Connected.size() != 2 )
+			return;
+
+		// Fill the receive queue of the server, that does not receive anything meanwhile
+		const uint nbBlocks = CBufNetBase::ServerReceiveQueueCapacity + 1000;
+		CMemStream block;
+		uint32 value = 0;
+		block.serial( value );
+		for ( uint i=0; i!=nbBlocks; ++i )
+			flooder.send( block );
+		uint32 prevSize = 0;
+		for ( uint loop=0; loop!=500; ++loop )
+		{
+			flooder.update();
+			nlSleep( 10 );
+			uint32 size = server.getReceiveQueueSize();
+			if ( (size != 0) && (size == prevSize) )
+				break;
+			prevSize = size;
+		}
+
+		// TEST: the disconnection is advertised by update() without waiting for room in the queue
+		server.disconnect( L1Connected[0] );
+		server.update();
+
+		// TEST: all the blocks and then the disconnection event are received
+		uint nbReceived = 0;
+		for ( uint loop=0; (loop!=500) && ((nbReceived < nbBlocks) || (NbL1Disconnections == 0)); ++loop )
+		{
+			CMemStream buffer;
+			TSockId from;
+			while ( server.dataAvailable() )
+			{
+				server.receive( buffer, &from );
+				++nbReceived;
+			}
+			flooder.update();
+			server.update();
+			nlSleep( 10 );
+		}
+		TEST_ASSERT( nbReceived == nbBlocks );
+		TEST_ASSERT( NbL1Disconnections == 1 );
+
+		flooder.disconnect();
+	}
+
+	// A client of the shared receive thread whose receive queue is full
+	void stalledSharedClient()
+	{
+		CBufClient::TReceiveEngine prevEngine = CBufClient::defaultReceiveEngine();
+		CBufClient::setDefaultReceiveEngine( CBufClient::SharedEngine );
+
+		CBufServer server;
+		server.setConnectionCallback( cbL1Connection, NULL );
+		server.setDisconnectionCallback( cbL1Disconnection, NULL );
+		server.init( TestPort4 );
+		L1Connected.clear();
+		NbL1Disconnections = 0;
+
+		// Both connections are read by the same thread
+		CBufClient *slow = new CBufClient();
+		CBufClient fast;
+		slow->connect( CInetAddress( "localhost", TestPort4 ) );
+		for ( uint loop=0; (loop!=100) && (L1Connected.size() < 1); ++loop )
+		{
+			server.update();
+			server.dataAvailable();
+			nlSleep( 10 );
+		}
+		fast.connect( CInetAddress( "localhost", TestPort4 ) );
+		for ( uint loop=0; (loop!=100) && (L1Connected.size() < 2); ++loop )
+		{
+			server.update();
+			server.dataAvailable();
+			nlSleep( 10 );
+		}
+		TEST_ASSERT( L1Connected.size() == 2 );
+		if ( L1Connected.size() != 2 )
+		{
+			delete slow;
+			CBufClient::setDefaultReceiveEngine( prevEngine );
+			return;
+		}
+
+		// Fill the receive queue of the slow client, that does not receive anything
+		const uint nbBlocks = CBufNetBase::ClientReceiveQueueCapacity + 1000;
+		CMemStream block;
+		uint32 value = 0;
+		block.serial( value );
+		for ( uint i=0; i!=nbBlocks; ++i )
+			server.send( block, L1Connected[0] );
+		uint32 prevSize = 0;
+		for ( uint loop=0; loop!=500; ++loop )
+		{
+			server.update();
+			nlSleep( 10 );
+			uint32 size = slow->getReceiveQueueSize();
+			if ( (size != 0) && (size == prevSize) )
+				break;
+			prevSize = size;
+		}
+
+		// TEST: the other client still receives
+		server.send( block, L1Connected[1] );
+		bool received = false;
+		for ( uint loop=0; (loop!=100) && (! received); ++loop )
+		{
+			server.update();
+			if ( fast.dataAvailable() )
+			{
+				CMemStream buffer;
+				fast.receive( buffer );
+				received = true;
+			}
+			nlSleep( 10 );
+		}
+		TEST_ASSERT( received );
+
+		// TEST: the slow client can be disconnected and deleted
+		slow->disconnect();
+		delete slow;
+
+		fast.disconnect();
+		CBufClient::setDefaultReceiveEngine( prevEngine );
+	}
+
 private:
 	CCallbackServer *_Server;
 	CCallbackClient *_Client;
@@ -0,0 +1,198 @@
+#include "nel/net/message_recorder.h"
+#include "nel/misc/file.h"
+#include "nel/misc/path.h"
+#include "nel/misc/debug.h"
+#include "cpptest.h"
+
+using namespace std;
+using namespace NLMISC;
+using namespace NLNET;
+
+// Test suite for the record files of CMessageRecorder
+class CMessageRecorderTS : public Test::Suite
+{
+public:
+	CMessageRecorderTS(const std::string &workingPath)
+	{
+		_FileName = workingPath + "/message_recorder_test.nmr";
+
+		TEST_ADD(CMessageRecorderTS::writeAndRead);
+		TEST_ADD(CMessageRecorderTS::seek);
+		TEST_ADD(CMessageRecorderTS::truncatedFile);
+		TEST_ADD(CMessageRecorderTS::replayer);
+	}
+
+	~CMessageRecorderTS()
+	{
+		if (CFile::fileExists(_FileName))
+			CFile::deleteFile(_FileName);
+	}
+
+	// Record NbRecords messages, 3 by update counter, on 2 sockets, in small blocks
+	void record(bool compress)
+	{
+		_Buffers.clear();
+		CMessageRecordWriter writer;
+		TEST_ASSERT(writer.open(_FileName, compress, 256));
+		for (uint32 i=0; i<NbRecords; ++i)
+		{
+			CMessage msg("TEST");
+			string s("some text to compress");
+			msg.serial(i);
+			msg.serial(s);
+			_Buffers.push_back(vector<uint8>(msg.buffer(), msg.buffer() + msg.length()));
+			TSockId sock = (TSockId)(size_t)((i % 2) ? 0x1000 : 0x2000);
+			writer.write(i / 3, 1000 + i * 10, (i % 2) ? Receiving : Sending, sock, msg);
+		}
+		TEST_ASSERT(writer.getNbRecords() == NbRecords);
+		writer.close();
+	}
+
+	// Check that a read record is the i-th one recorded
+	bool check(const TMessageRecord &record, uint32 i)
+	{
+		return (record.UpdateCounter == i / 3)
+			&& (record.Time == (TTime)(1000 + i * 10))
+			&& (record.Event == ((i % 2) ? Receiving : Sending))
+			&& (record.SockId == (TSockId)(size_t)((i % 2) ? 2 : 1))
+			&& (record.Message.length() == _Buffers[i].size())
+			&& (memcmp(record.Message.buffer(), &_Buffers[i][0], _Buffers[i].size()) == 0);
+	}
+
+	void writeAndRead()
+	{
+		for (uint c=0; c<2; ++c)
+		{
+			record(c == 1);
+
+			CMessageRecordReader reader;
+			TEST_ASSERT(reader.open(_FileName));
+			TEST_ASSERT(reader.getNbBlocks() > 1);
+			TEST_ASSERT(reader.getFirstUpdateCounter() == 0);
+			TEST_ASSERT(reader.getLastUpdateCounter() == (NbRecords - 1) / 3);
+
+			TMessageRecord record(true);
+			uint32 nbRead = 0;
+			bool ok = true;
+			while (reader.readNext(record))
+			{
+				if (nbRead >= NbRecords || !check(record, nbRead))
+					ok = false;
+				++nbRead;
+			}
+			TEST_ASSERT(ok);
+			TEST_ASSERT(nbRead == NbRecords);
+		}
+
+		// compressed blocks are smaller
+		record(false);
+		uint32 rawSize = CFile::getFileSize(_FileName);
+		record(true);
+		TEST_ASSERT(CFile::getFileSize(_FileName) < rawSize);
+	}
+
+	void seek()
+	{
+		record(true);
+		CMessageRecordReader reader;
+		TEST_ASSERT(reader.open(_FileName));
+
+		TMessageRecord record(true);
+		TEST_ASSERT(reader.seek(200));
+		TEST_ASSERT(reader.readNext(record));
+		TEST_ASSERT(check(record, 600));
+
+		// backward, and to the first record of a block
+		TEST_ASSERT(reader.seek(0));
+		TEST_ASSERT(reader.readNext(record));
+		TEST_ASSERT(check(record, 0));
+		TEST_ASSERT(reader.seek(5));
+		TEST_ASSERT(reader.readNext(record));
+		TEST_ASSERT(check(record, 15));
+		TEST_ASSERT(reader.readNext(record));
+		TEST_ASSERT(check(record, 16));
+
+		TEST_ASSERT(!reader.seek(NbRecords));
+		TEST_ASSERT(!reader.readNext(record));
+	}
+
+	void truncatedFile()
+	{
+		// a service that did not stop its recording leaves a file without index
+		record(true);
+		uint32 size = CFile::getFileSize(_FileName);
+		vector<uint8> content(size);
+		{
+			CIFile f;
+			TEST_ASSERT(f.open(_FileName));
+			f.serialBuffer(&content[0], size);
+		}
+		{
+			COFile f;
+			TEST_ASSERT(f.open(_FileName));
+			f.serialBuffer(&content[0], size / 2);
+		}
+
+		CMessageRecordReader reader;
+		TEST_ASSERT(reader.open(_FileName));
+		TEST_ASSERT(reader.getNbBlocks() > 0);
+		TMessageRecord record(true);
+		uint32 nbRead = 0;
+		bool ok = true;
+		while (reader.readNext(record))
+		{
+			if (!check(record, nbRead))
+				ok = false;
+			++nbRead;
+		}
+		TEST_ASSERT(ok);
+		TEST_ASSERT(nbRead > 0 && nbRead < NbRecords);
+
+		TEST_ASSERT(reader.seek(10));
+		TEST_ASSERT(reader.readNext(record));
+		TEST_ASSERT(check(record, 30));
+	}
+
+	static void cbRecord(const TMessageRecord &record, void *arg)
+	{
+		static_cast<vector<sint64>*>(arg)->push_back(record.UpdateCounter);
+	}
+
+	void replayer()
+	{
+		record(true);
+		CMessageReplayer replayer;
+		TEST_ASSERT(replayer.open(_FileName));
+		TEST_ASSERT(replayer.seek(100));
+
+		// with no wait, one update counter by update
+		vector<sint64> counters;
+		replayer.setSpeed(0);
+		TEST_ASSERT(replayer.update(cbRecord, &counters) == 3);
+		TEST_ASSERT(replayer.update(cbRecord, &counters) == 3);
+		TEST_ASSERT(counters.size() == 6 && counters[0] == 100 && counters[5] == 101);
+
+		// 10 ms between the records, 100 times faster: everything in 100 ms
+		replayer.setSpeed(100.0f);
+		uint32 nbRecords = 0;
+		TTime start = CTime::getLocalTime();
+		while (!replayer.finished() && CTime::getLocalTime() - start < 5000)
+		{
+			nbRecords += replayer.update(cbRecord, &counters);
+			nlSleep(1);
+		}
+		TEST_ASSERT(replayer.finished());
+		TEST_ASSERT(nbRecords == NbRecords - 306);
+	}
+
+private:
+	enum { NbRecords = 1000 };
+
+	string					_FileName;
+	vector<vector<uint8> >	_Buffers;
+};
+
+Test::Suite *createMessageRecorderTS(const std::string &workingPath)
+{
+	return new CMessageRecorderTS(workingPath);
+}
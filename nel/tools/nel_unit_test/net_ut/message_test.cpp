@@ -18,6 +18,7 @@ public:
 		TEST_ADD(CMessageTS::messageSwap);
 		TEST_ADD(CMessageTS::lockSubMEssage);
 		TEST_ADD(CMessageTS::lockSubMEssageWithLongName);
+		TEST_ADD(CMessageTS::typeId);
 
 	}
 
@@ -289,6 +290,72 @@ public:
 		msg2.serial(s);
 		TEST_ASSERT(s == "foo2");
 	}
+
+	void typeId()
+	{
+		uint32 id = CMessage::registerTypeName("ID_MSG");
+		TEST_ASSERT(id == CMessage::hashTypeName("ID_MSG"));
+		TEST_ASSERT(CMessage::getTypeNameFromId(id) == "ID_MSG");
+
+		// long format: the id is computed from the name
+		CMessage longMsg("ID_MSG");
+		uint32 longSize = longMsg.length();
+		TEST_ASSERT(longMsg.getTypeId() == id);
+		longMsg.invert();
+		TEST_ASSERT(longMsg.getTypeId() == id);
+
+		// short format: the id is in the header, and the name is found from the registered names
+		CMessage::setDefaultIdMode(true);
+		CMessage shortMsg("ID_MSG", false, CMessage::UseDefault);
+		CMessage unknownMsg("UNKNOWN_ID_MSG");
+		CMessage::setDefaultIdMode(false);
+
+		TEST_ASSERT(shortMsg.length() == 1 + sizeof(uint32));
+		TEST_ASSERT(shortMsg.length() < longSize);
+		uint32 v = 1234;
+		shortMsg.serial(v);
+		shortMsg.invert();
+		TEST_ASSERT(shortMsg.getTypeId() == id);
+		CMessage copyMsg(shortMsg); // the name is not known yet
+		TEST_ASSERT(shortMsg.getName() == "ID_MSG");
+		TEST_ASSERT(copyMsg.getName() == "ID_MSG");
+		TEST_ASSERT(copyMsg.toString() == "('ID_MSG')");
+		shortMsg.serial(v);
+		TEST_ASSERT(v == 1234);
+
+		unknownMsg.invert();
+		TEST_ASSERT(unknownMsg.getTypeId() == CMessage::hashTypeName("UNKNOWN_ID_MSG"));
+		TEST_ASSERT(unknownMsg.getName() == toString("#%08X", unknownMsg.getTypeId()));
+
+		// two names with the same id are told apart by the name received with the message
+		TEST_ASSERT(CMessage::hashTypeName("costarring") == CMessage::hashTypeName("liquid"));
+		CMessage namedMsg("liquid");
+		namedMsg.invert();
+		TEST_ASSERT(namedMsg.getTypeId() == CMessage::hashTypeName("costarring"));
+		TEST_ASSERT(namedMsg.typeNameMatches("liquid"));
+		TEST_ASSERT(!namedMsg.typeNameMatches("costarring"));
+		CMessage::setDefaultIdMode(true);
+		CMessage idMsg("ID_MSG");
+		CMessage::setDefaultIdMode(false);
+		idMsg.invert();
+		TEST_ASSERT(idMsg.typeNameMatches("ID_MSG"));
+
+		// a sub message in short format
+		CMessage master("MASTER");
+		CMessage::setDefaultIdMode(true);
+		CMessage sub("ID_MSG");
+		CMessage::setDefaultIdMode(false);
+		sub.serial(v);
+		master.serialMessage(sub);
+		master.invert();
+		uint32 subSize;
+		master.serial(subSize);
+		TEST_ASSERT(master.lockSubMessage(subSize) == "ID_MSG");
+		TEST_ASSERT(master.getTypeId() == id);
+		master.serial(v);
+		TEST_ASSERT(v == 1234);
+		master.unlockSubMessage();
+	}
 };
 
 Test::Suite *createCMessageTS()
@@ -26,6 +26,10 @@ public:
 
 	set<TModuleProxyPtr>	ModuleType0;
 
+	// a request answered after its processing
+	IModuleProxy	*LateRequester;
+	TRequestId		LateRequestId;
+
 	uint32	ModuleUpCalled;
 	uint32	ModuleDownCalled;
 	uint32	ProcessMessageCalled;
@@ -34,7 +38,9 @@ public:
 
 	CModuleType0()
 		: PingCount(0),
-		ResponseReceived(0)
+		ResponseReceived(0),
+		LateRequester(NULL),
+		LateRequestId(InvalidRequestId)
 	{
 		ModuleUpCalled = 0;
 		ModuleDownCalled = 0;
@@ -101,6 +107,13 @@ public:
 			PingCount++;
 			return true;
 		}
+		else if (message.getName() == "HELLO_LATE")
+		{
+			// keep the request, answerLateRequest() will send the response
+			LateRequester = senderModuleProxy;
+			LateRequestId = getCurrentRequestId();
+			return true;
+		}
 		else if (message.getName() == "HELLO")
 		{
 			CMessage ping("DEBUG_MOD_PING");
@@ -188,6 +201,92 @@ public:
 		}
 	}
 
+	void startTaskC()
+	{
+		// start a task on module
+		NLNET_START_MODULE_TASK(CModuleType0, taskC);
+	}
+
+	// test task C
+	void		taskC()
+	{
+		// use the first like me in the list
+		nlassert(!ModuleType0.empty());
+
+		TModuleProxyPtr proxy = *ModuleType0.begin();
+
+		// pipeline several requests, then wait for all the responses
+		CMessage msg;
+		msg.setType("HELLO", CMessage::Request);
+		vector<TRequestId> requests;
+		for (uint i=0; i<3; ++i)
+			requests.push_back(sendModuleRequest(proxy, msg));
+
+		for (uint i=0; i<requests.size(); ++i)
+		{
+			CMessage resp;
+			awaitModuleResponse(requests[i], resp);
+			if (resp.getName() == "HELLO_RESP")
+				ResponseReceived++;
+		}
+
+		// a request that no module processes
+		CMessage unknown;
+		unknown.setType("UNKNOWN", CMessage::Request);
+		TRequestId requestId = sendModuleRequest(proxy, unknown);
+		try
+		{
+			CMessage resp;
+			awaitModuleResponse(requestId, resp);
+		}
+		catch(IModule::EInvokeFailed)
+		{
+			ResponseReceived++;
+		}
+	}
+
+	// send a request that is processed without response
+	TRequestId sendPingRequest(uint32 timeout)
+	{
+		nlassert(!ModuleType0.empty());
+
+		CMessage msg;
+		msg.setType("DEBUG_MOD_PING", CMessage::Request);
+		return sendModuleRequest(*ModuleType0.begin(), msg, timeout);
+	}
+
+	// send a request that is answered later by answerLateRequest()
+	TRequestId sendLateRequest()
+	{
+		nlassert(!ModuleType0.empty());
+
+		CMessage msg;
+		msg.setType("HELLO_LATE", CMessage::Request);
+		return sendModuleRequest(*ModuleType0.begin(), msg);
+	}
+
+	bool answerLateRequest()
+	{
+		if (LateRequester == NULL)
+			return false;
+
+		CMessage resp;
+		resp.setType("HELLO_RESP", CMessage::Response);
+		sendModuleResponse(LateRequester, LateRequestId, resp);
+		LateRequester = NULL;
+		return true;
+	}
+
+	TRequestState pollRequest(TRequestId requestId)
+	{
+		CMessage resp;
+		return pollModuleResponse(requestId, resp);
+	}
+
+	void cancelRequest(TRequestId requestId)
+	{
+		cancelModuleRequest(requestId);
+	}
 };
 
 NLNET_REGISTER_MODULE_FACTORY(CModuleType0, "ModuleType0");
@@ -524,6 +623,7 @@ public:
 		TEST_ADD(CModuleTS::connectGateways);
 		TEST_ADD(CModuleTS::moduleDisclosure);
 		TEST_ADD(CModuleTS::moduleMessaging);
+		TEST_ADD(CModuleTS::shmTransport);
 		TEST_ADD(CModuleTS::localMessageQueing);
 		TEST_ADD(CModuleTS::uniqueNameGenerator);
 		TEST_ADD(CModuleTS::gwPlugUnplug);
@@ -532,6 +632,7 @@ public:
 		TEST_ADD(CModuleTS::distanceAndConnectionLoop);
 		TEST_ADD(CModuleTS::securityPlugin);
 		TEST_ADD(CModuleTS::synchronousMessaging);
+		TEST_ADD(CModuleTS::asynchronousRequests);
 		TEST_ADD(CModuleTS::layer3Autoconnect);
 		TEST_ADD(CModuleTS::interceptorTest);
 	}
@@ -749,6 +850,80 @@ public:
 		mm.deleteModule(gw2);
 	}
 
+	void asynchronousRequests()
+	{
+		// check the pipelined requests with correlation ids, timeouts and cancellation
+
+		IModuleManager &mm = IModuleManager::getInstance();
+		CCommandRegistry &cr = CCommandRegistry::getInstance();
+
+		// create the modules
+		IModule *gw = mm.createModule("StandardGateway", "gw", "");
+		IModule *m1 = mm.createModule("ModuleType0", "m1", "");
+		IModule *m2 = mm.createModule("ModuleType0", "m2", "");
+
+		// plug the two modules in the gateway
+		cr.execute("m1.plug gw", InfoLog());
+		cr.execute("m2.plug gw", InfoLog());
+
+		// update the network
+		for (uint i=0; i<15; ++i)
+		{
+			mm.updateModules();
+			nlSleep(40);
+		}
+
+		CModuleType0 *mod1 = dynamic_cast<CModuleType0 *>(m1);
+
+		// start a task on module 1 that sends 3 requests then 1 unknown request
+		mod1->startTaskC();
+
+		// update the network
+		for (uint i=0; i<10; ++i)
+		{
+			mm.updateModules();
+			nlSleep(40);
+		}
+
+		TEST_ASSERT(mod1->PingCount == 12);
+		TEST_ASSERT(mod1->ResponseReceived == 4);
+
+		// a request without response times out
+		IModule::TRequestId requestId = mod1->sendPingRequest(100);
+		TEST_ASSERT(mod1->pollRequest(requestId) == IModule::rs_pending);
+		nlSleep(200);
+		TEST_ASSERT(mod1->pollRequest(requestId) == IModule::rs_timeout);
+		// the result is retrieved only once
+		TEST_ASSERT(mod1->pollRequest(requestId) == IModule::rs_unknown);
+
+		// a request answered after its processing is completed by the response
+		CModuleType0 *mod2 = dynamic_cast<CModuleType0 *>(m2);
+		requestId = mod1->sendLateRequest();
+		for (uint i=0; i<5; ++i)
+		{
+			mm.updateModules();
+			nlSleep(40);
+		}
+		TEST_ASSERT(mod1->pollRequest(requestId) == IModule::rs_pending);
+		TEST_ASSERT(mod1->answerLateRequest() || mod2->answerLateRequest());
+		for (uint i=0; i<5; ++i)
+		{
+			mm.updateModules();
+			nlSleep(40);
+		}
+		TEST_ASSERT(mod1->pollRequest(requestId) == IModule::rs_response);
+
+		// a cancelled request is forgotten
+		requestId = mod1->sendPingRequest(0);
+		TEST_ASSERT(mod1->pollRequest(requestId) == IModule::rs_pending);
+		mod1->cancelRequest(requestId);
+		TEST_ASSERT(mod1->pollRequest(requestId) == IModule::rs_unknown);
+
+		mm.deleteModule(m1);
+		mm.deleteModule(m2);
+		mm.deleteModule(gw);
+	}
+
 	void synchronousMessaging()
 	{
 		// check that the synchronous messaging is working
@@ -2404,6 +2579,109 @@ public:
 		TEST_ASSERT(mm.getLocalModule("gwc") == NULL);
 	}
 
+	void shmTransport()
+	{
+		IModuleManager &mm = IModuleManager::getInstance();
+		CCommandRegistry &cr = CCommandRegistry::getInstance();
+
+		// create two gateways connected by shared memory and plug them on themselves
+		IModule *mods = mm.createModule("StandardGateway", "gws", "");
+		TEST_ASSERT(mods != NULL);
+		IModuleGateway *gws = dynamic_cast<IModuleGateway*>(mods);
+		TEST_ASSERT(gws != NULL);
+		IModuleSocket *socketGws = mm.getModuleSocket("gws");
+		TEST_ASSERT(socketGws != NULL);
+		mods->plugModule(socketGws);
+
+		// small rings, so that a big message is split and waits for room in the ring
+		string cmd = "gws.transportAdd ShmServer shms";
+		TEST_ASSERT(cr.execute(cmd, InfoLog()));
+		cmd = "gws.transportCmd shms(open key=6185 slots=2 ringSize=4096)";
+		TEST_ASSERT(cr.execute(cmd, InfoLog()));
+
+		IModule *modc = mm.createModule("StandardGateway", "gwc", "");
+		TEST_ASSERT(modc != NULL);
+		IModuleGateway *gwc = dynamic_cast<IModuleGateway*>(modc);
+		TEST_ASSERT(gwc != NULL);
+		cmd = "gwc.transportAdd ShmClient shmc";
+		TEST_ASSERT(cr.execute(cmd, InfoLog()));
+		cmd = "gwc.transportCmd shmc(connect key=6185)";
+		TEST_ASSERT(cr.execute(cmd, InfoLog()));
+		IModuleSocket *socketGwc = mm.getModuleSocket("gwc");
+		TEST_ASSERT(socketGwc != NULL);
+		modc->plugModule(socketGwc);
+
+		for (uint i=0; i<4; ++i)
+		{
+			mm.updateModules();
+			nlSleep(100);
+		}
+
+		TEST_ASSERT(gws->getRouteCount() == 1);
+		TEST_ASSERT(gwc->getRouteCount() == 1);
+
+		vector<IModuleProxy*>	proxiesS;
+		gws->getModuleProxyList(proxiesS);
+		TEST_ASSERT(proxiesS.size() == 2);
+		TEST_ASSERT(lookForModuleProxy(proxiesS, "gwc"));
+		vector<IModuleProxy*>	proxiesC;
+		gwc->getModuleProxyList(proxiesC);
+		TEST_ASSERT(proxiesC.size() == 2);
+		TEST_ASSERT(lookForModuleProxy(proxiesC, "gws"));
+
+		// send crossing messages
+		CMessage aMessage("DEBUG_MOD_PING");
+		proxiesS[1]->sendModuleMessage(mods, aMessage);
+		proxiesC[1]->sendModuleMessage(modc, aMessage);
+
+		// and a message bigger than the ring, followed by a small one
+		CMessage bigMessage("DEBUG_MOD_PING");
+		vector<uint8> payload(20000, 0x55);
+		bigMessage.serialCont(payload);
+		proxiesS[1]->sendModuleMessage(mods, bigMessage);
+		proxiesS[1]->sendModuleMessage(mods, aMessage);
+
+		for (uint i=0; i<10; ++i)
+		{
+			mm.updateModules();
+			nlSleep(10);
+		}
+
+		TEST_ASSERT(gwc->getReceivedPingCount() == 3);
+		TEST_ASSERT(gws->getReceivedPingCount() == 1);
+
+		cmd = "gws.dump";
+		TEST_ASSERT(cr.execute(cmd, InfoLog()));
+		cmd = "gwc.dump";
+		TEST_ASSERT(cr.execute(cmd, InfoLog()));
+
+		// close the client, the server frees the slot
+		cmd = "gwc.transportCmd shmc(close key=6185)";
+		TEST_ASSERT(cr.execute(cmd, InfoLog()));
+		mm.updateModules();
+		TEST_ASSERT(gwc->getRouteCount() == 0);
+		TEST_ASSERT(gws->getRouteCount() == 0);
+
+		// reconnect, then close the server
+		cmd = "gwc.transportCmd shmc(connect key=6185)";
+		TEST_ASSERT(cr.execute(cmd, InfoLog()));
+		mm.updateModules();
+		TEST_ASSERT(gwc->getRouteCount() == 1);
+		TEST_ASSERT(gws->getRouteCount() == 1);
+
+		cmd = "gws.transportCmd shms(close)";
+		TEST_ASSERT(cr.execute(cmd, InfoLog()));
+		mm.updateModules();
+		TEST_ASSERT(gws->getRouteCount() == 0);
+		TEST_ASSERT(gwc->getRouteCount() == 0);
+
+		// cleanup modules
+		mm.deleteModule(mods);
+		TEST_ASSERT(mm.getLocalModule("gws") == NULL);
+		mm.deleteModule(modc);
+		TEST_ASSERT(mm.getLocalModule("gwc") == NULL);
+	}
+
 	void moduleDisclosure()
 	{
 		IModuleManager &mm = IModuleManager::getInstance();
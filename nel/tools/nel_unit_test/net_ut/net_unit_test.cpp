@@ -24,6 +24,10 @@ Test::Suite *createModuleTS(const std::string &workingPath);
 Test::Suite *createCMessageTS();
 Test::Suite *createServiceAndModuleTS(const std::string &workingPath);
 Test::Suite *createLayer3TS(const std::string &workingPath);
+Test::Suite *createMessageRecorderTS(const std::string &workingPath);
+Test::Suite *createTransportClassTS();
+Test::Suite *createUdpTransportTS();
+Test::Suite *createShardedBufServerTS();
 
 // global test for any misc feature
 class CNetTS : public Test::Suite
@@ -38,6 +42,10 @@ public:
 		add(auto_ptr<Test::Suite>(createModuleTS(workingPath)));
 		add(auto_ptr<Test::Suite>(createServiceAndModuleTS(workingPath)));
 		add(auto_ptr<Test::Suite>(createLayer3TS(workingPath)));
+		add(auto_ptr<Test::Suite>(createMessageRecorderTS(workingPath)));
+		add(auto_ptr<Test::Suite>(createTransportClassTS()));
+		add(auto_ptr<Test::Suite>(createUdpTransportTS()));
+		add(auto_ptr<Test::Suite>(createShardedBufServerTS()));
 		
 		// initialise the application context
 		NLMISC::CApplicationContext::getInstance();
@@ -154,6 +154,10 @@ SOURCE=.\layer3_test.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\message_recorder_test.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\message_test.cpp
 # End Source File
 # Begin Source File
@@ -168,6 +172,18 @@ SOURCE=.\net_unit_test.cpp
 
 SOURCE=.\service_and_module_test.cpp
 # End Source File
+# Begin Source File
+
+SOURCE=.\sharded_buf_server_test.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\transport_class_test.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\udp_transport_test.cpp
+# End Source File
 # End Group
 # Begin Group "Header Files"
 
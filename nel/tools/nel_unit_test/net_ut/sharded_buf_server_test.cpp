@@ -0,0 +1,267 @@
+#include "nel/net/sharded_buf_server.h"
+#include "nel/net/buf_client.h"
+#include "nel/misc/atomic.h"
+#include "nel/misc/time_nl.h"
+#include "nel/misc/debug.h"
+#include "cpptest.h"
+
+#include <map>
+#include <set>
+
+using namespace std;
+using namespace NLMISC;
+using namespace NLNET;
+
+// The shard processed by the test thread when the connection callbacks are called
+static CBufServer *CurrentShard = NULL;
+
+// The shard of each connection, as seen by the connection callback
+static map<TSockId, CBufServer*> ConnectedShards;
+static set<TSockId> DisconnectedSockIds;
+static uint NbShardDisconnections = 0;
+static uint NbWrongShardDisconnections = 0;
+
+static void cbShardConnection( TSockId from, void *arg )
+{
+	ConnectedShards[from] = CurrentShard;
+}
+
+static void cbShardDisconnection( TSockId from, void *arg )
+{
+	++NbShardDisconnections;
+	DisconnectedSockIds.insert( from );
+	if ( (CBufServer::ownerOf( from ) != CurrentShard) || (ConnectedShards[from] != CurrentShard) )
+		++NbWrongShardDisconnections;
+}
+
+// Called in the shard threads: echoes the message
+static volatile uint32 NbShardMessages = 0;
+static volatile uint32 NbWrongShardMessages = 0;
+
+static void cbShardMessage( CBufServer *shard, CMemStream& buffer, TSockId from, void *arg )
+{
+	atomicFetchAdd( &NbShardMessages, 1 );
+	if ( CBufServer::ownerOf( from ) != shard )
+		atomicFetchAdd( &NbWrongShardMessages, 1 );
+
+	uint32 index;
+	buffer.serial( index );
+	CMemStream reply;
+	reply.serial( index );
+	shard->send( reply, from );
+}
+
+// Test suite for CShardedBufServer: several shards listening on the same port
+class CShardedBufServerTS : public Test::Suite
+{
+public:
+	CShardedBufServerTS ()
+	{
+		TEST_ADD(CShardedBufServerTS::connectionsAndSend);
+		TEST_ADD(CShardedBufServerTS::shardThreads);
+		TEST_ADD(CShardedBufServerTS::disconnections);
+	}
+
+	void setup ()
+	{
+		CurrentShard = NULL;
+		ConnectedShards.clear();
+		DisconnectedSockIds.clear();
+		NbShardDisconnections = 0;
+		NbWrongShardDisconnections = 0;
+		NbShardMessages = 0;
+		NbWrongShardMessages = 0;
+
+		_Server = new CShardedBufServer( NbShards );
+		_Server->setConnectionCallback( cbShardConnection, NULL );
+		_Server->setDisconnectionCallback( cbShardDisconnection, NULL );
+		_Server->init( Port );
+
+		for ( uint i=0; i!=NbClients; ++i )
+		{
+			_Clients[i] = new CBufClient();
+			_Clients[i]->connect( CInetAddress( "localhost", Port ) );
+		}
+		for ( uint loop=0; (loop!=200) && (ConnectedShards.size() < NbClients); ++loop )
+		{
+			pumpServer();
+			nlSleep( 10 );
+		}
+	}
+
+	void tear_down ()
+	{
+		for ( uint i=0; i!=NbClients; ++i )
+		{
+			if ( _Clients[i]->connected() )
+				_Clients[i]->disconnect();
+			delete _Clients[i];
+		}
+		delete _Server;
+	}
+
+	void connectionsAndSend ()
+	{
+		TEST_ASSERT( ConnectedShards.size() == NbClients );
+		_Server->update();
+		TEST_ASSERT( _Server->nbConnections() == NbClients );
+
+		// TEST: each connection belongs to the shard that accepted it, and the kernel spreads them
+		set<CBufServer*> usedShards;
+		bool sameShard = true;
+		for ( map<TSockId, CBufServer*>::iterator it=ConnectedShards.begin(); it!=ConnectedShards.end(); ++it )
+		{
+			if ( _Server->shardOf( (*it).first ) != (*it).second )
+				sameShard = false;
+			usedShards.insert( (*it).second );
+		}
+		TEST_ASSERT( sameShard );
+		if ( _Server->nbShards() > 1 )
+			TEST_ASSERT( usedShards.size() > 1 );
+
+		// TEST: the messages are received by the shard of the sender, and the replies reach the sender
+		for ( uint32 i=0; i!=NbClients; ++i )
+		{
+			CMemStream msg;
+			msg.serial( i );
+			_Clients[i]->send( msg );
+			_Clients[i]->update();
+		}
+		uint nbReceived = 0;
+		bool rightShard = true;
+		for ( uint loop=0; (loop!=200) && (nbReceived < NbClients); ++loop )
+		{
+			for ( uint s=0; s!=_Server->nbShards(); ++s )
+			{
+				CBufServer *shard = _Server->shard( s );
+				CurrentShard = shard;
+				while ( shard->dataAvailable() )
+				{
+					CMemStream buffer( true );
+					TSockId from;
+					shard->receive( buffer, &from );
+					if ( ConnectedShards[from] != shard )
+						rightShard = false;
+					uint32 index;
+					buffer.serial( index );
+					CMemStream reply;
+					reply.serial( index );
+					_Server->send( reply, from );
+					++nbReceived;
+				}
+			}
+			_Server->update();
+			nlSleep( 10 );
+		}
+		TEST_ASSERT( nbReceived == NbClients );
+		TEST_ASSERT( rightShard );
+		TEST_ASSERT( receiveReplies() == NbClients );
+	}
+
+	void shardThreads ()
+	{
+		TEST_ASSERT( ConnectedShards.size() == NbClients );
+		_Server->startThreads( cbShardMessage, NULL );
+		TEST_ASSERT( _Server->threadsRunning() );
+
+		// TEST: each message is processed by the thread of its shard, that replies to the sender
+		for ( uint32 i=0; i!=NbClients; ++i )
+		{
+			CMemStream msg;
+			msg.serial( i );
+			_Clients[i]->send( msg );
+			_Clients[i]->update();
+		}
+		TEST_ASSERT( receiveReplies() == NbClients );
+		TEST_ASSERT( NbShardMessages == NbClients );
+		TEST_ASSERT( NbWrongShardMessages == 0 );
+
+		_Server->stopThreads();
+		TEST_ASSERT( ! _Server->threadsRunning() );
+	}
+
+	void disconnections ()
+	{
+		TEST_ASSERT( ConnectedShards.size() == NbClients );
+
+		// TEST: the disconnection callbacks are called by the shard of each connection,
+		// for the connections closed by the clients
+		for ( uint i=0; i!=NbClients/2; ++i )
+			_Clients[i]->disconnect();
+		for ( uint loop=0; (loop!=200) && (NbShardDisconnections < NbClients/2); ++loop )
+		{
+			pumpServer();
+			nlSleep( 10 );
+		}
+		TEST_ASSERT( NbShardDisconnections == NbClients/2 );
+
+		// and for the ones closed by the server
+		for ( map<TSockId, CBufServer*>::iterator it=ConnectedShards.begin(); it!=ConnectedShards.end(); ++it )
+		{
+			if ( DisconnectedSockIds.find( (*it).first ) == DisconnectedSockIds.end() )
+				_Server->disconnect( (*it).first );
+		}
+		for ( uint loop=0; (loop!=200) && (NbShardDisconnections < NbClients); ++loop )
+		{
+			pumpServer();
+			nlSleep( 10 );
+		}
+		TEST_ASSERT( NbShardDisconnections == NbClients );
+		TEST_ASSERT( NbWrongShardDisconnections == 0 );
+		_Server->update();
+		TEST_ASSERT( _Server->nbConnections() == 0 );
+	}
+
+private:
+
+	enum { Port = 56020, NbShards = 4, NbClients = 16 };
+
+	// Processes the connection events of every shard
+	void pumpServer()
+	{
+		for ( uint s=0; s!=_Server->nbShards(); ++s )
+		{
+			CurrentShard = _Server->shard( s );
+			CurrentShard->update();
+			CurrentShard->dataAvailable();
+		}
+	}
+
+	// Returns the number of clients that received their own index, flushing the server meanwhile
+	uint receiveReplies()
+	{
+		vector<bool> replied( NbClients, false );
+		uint nbReplied = 0;
+		for ( uint loop=0; (loop!=200) && (nbReplied < NbClients); ++loop )
+		{
+			for ( uint32 i=0; i!=NbClients; ++i )
+			{
+				while ( _Clients[i]->dataAvailable() )
+				{
+					CMemStream buffer( true );
+					_Clients[i]->receive( buffer );
+					uint32 index;
+					buffer.serial( index );
+					if ( (index == i) && (! replied[i]) )
+					{
+						replied[i] = true;
+						++nbReplied;
+					}
+				}
+			}
+			// The shard threads flush their shard if running (update() waits for the time trigger)
+			if ( ! _Server->threadsRunning() )
+				_Server->update();
+			nlSleep( 10 );
+		}
+		return nbReplied;
+	}
+
+	CShardedBufServer	*_Server;
+	CBufClient			*_Clients [NbClients];
+};
+
+Test::Suite *createShardedBufServerTS()
+{
+	return new CShardedBufServerTS;
+}
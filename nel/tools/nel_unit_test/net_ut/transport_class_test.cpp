@@ -0,0 +1,231 @@
+#include "nel/net/transport_class.h"
+#include "nel/net/unified_network.h"
+#include "nel/misc/debug.h"
+#include "cpptest.h"
+
+using namespace std;
+using namespace NLMISC;
+using namespace NLNET;
+
+namespace NLNET
+{
+	// callbacks of the transport class messages (called by CUnifiedNetwork)
+	void cbTCReceiveMessage (CMessage &msgin, const std::string &name, TServiceId sid);
+	void cbTCReceiveIndexedMessage (CMessage &msgin, const std::string &name, TServiceId sid);
+	void cbTCReceiveOtherSideClass (CMessage &msgin, const std::string &name, TServiceId sid);
+	void cbTCDownService (const std::string &serviceName, TServiceId sid, void *arg);
+}
+
+uint NbTCReceived = 0;
+
+// A transport class with all the kinds of properties
+struct CTestTC : public CTransportClass
+{
+	uint8			U8;
+	sint16			S16;
+	uint32			U32;
+	uint64			U64;
+	bool			B;
+	float			F;
+	double			D;
+	string			Str;
+	vector<uint32>	Cont;
+
+	CTestTC () : U8(0), S16(0), U32(0), U64(0), B(false), F(0), D(0) { }
+
+	void set (uint32 i)
+	{
+		U8 = (uint8)i;
+		S16 = -(sint16)i;
+		U32 = i * 1000;
+		U64 = (uint64)i << 40;
+		B = (i % 2) == 1;
+		F = i * 0.5f;
+		D = i * 0.25;
+		Str = toString ("str%u", i);
+		Cont.clear ();
+		for (uint j = 0; j < i % 5; j++)
+			Cont.push_back (j);
+	}
+
+	bool equals (const CTestTC &o) const
+	{
+		return U8 == o.U8 && S16 == o.S16 && U32 == o.U32 && U64 == o.U64 && B == o.B
+			&& F == o.F && D == o.D && Str == o.Str && Cont == o.Cont;
+	}
+
+	virtual void description ()
+	{
+		className ("TestTC");
+		property ("u8", PropUInt8, (uint8)1, U8);
+		property ("s16", PropSInt16, (sint16)2, S16);
+		property ("u32", PropUInt32, (uint32)3, U32);
+		property ("u64", PropUInt64, (uint64)4, U64);
+		property ("b", PropBool, true, B);
+		property ("f", PropFloat, 6.0f, F);
+		property ("d", PropDouble, 7.0, D);
+		property ("str", PropString, string("default"), Str);
+		propertyCont ("cont", PropUInt32, Cont);
+	}
+
+	virtual void callback (const string &name, TServiceId sid)
+	{
+		++NbTCReceived;
+	}
+
+	// Give the message that would be sent to the service (as received by the other side)
+	CMessage encode (TServiceId sid)
+	{
+		CMessage msg (write (sid));
+		msg.invert ();
+		return msg;
+	}
+
+	// Give the description of our classes (as received by the other side)
+	static CMessage localClassMessage ()
+	{
+		createLocalRegisteredClassMessage ();
+		CMessage msg (TempMessage);
+		msg.invert ();
+		return msg;
+	}
+};
+
+CTestTC TestTC;
+
+// Test suite for CTransportClass
+class CTransportClassTS : public Test::Suite
+{
+public:
+	CTransportClassTS ()
+	{
+		TEST_ADD(CTransportClassTS::sameClass);
+		TEST_ADD(CTransportClassTS::differentClass);
+		TEST_ADD(CTransportClassTS::serviceDown);
+	}
+
+	void setup ()
+	{
+		CTransportClass::init ();
+		CTransportClass::registerClass (TestTC);
+		NbTCReceived = 0;
+	}
+
+	void tear_down ()
+	{
+		TransportClassCodec = true;
+		CTransportClass::release ();
+	}
+
+	// Receive a message as if sent by sid
+	void receive (CMessage msg, TServiceId sid)
+	{
+		if (msg.getName () == "CT_MSGI")
+			cbTCReceiveIndexedMessage (msg, "TEST", sid);
+		else
+			cbTCReceiveMessage (msg, "TEST", sid);
+	}
+
+	void sameClass ()
+	{
+		TServiceId sid (5);
+		CTestTC sent;
+		sent.set (3);
+
+		// a copy of the registered instance is sent with the codec, as with description()
+		CTestTC copy = TestTC;
+		copy.set (3);
+		TransportClassCodec = false;
+		CMessage byDescription = copy.encode (sid);
+		TransportClassCodec = true;
+		CMessage byCodec = copy.encode (sid);
+		TEST_ASSERT (byCodec.getName () == "CT_MSG");
+		TEST_ASSERT (byCodec.length () == byDescription.length ());
+		TEST_ASSERT (memcmp (byCodec.buffer (), byDescription.buffer (), byCodec.length ()) == 0);
+
+		// an instance that is not a copy is sent with description()
+		CMessage byOther = sent.encode (sid);
+		TEST_ASSERT (byOther.length () == byDescription.length ());
+
+		// the service sends its description: it can receive by index
+		CMessage lrc = CTestTC::localClassMessage ();
+		cbTCReceiveOtherSideClass (lrc, "TEST", sid);
+		CMessage indexed = copy.encode (sid);
+		TEST_ASSERT (indexed.getName () == "CT_MSGI");
+		TEST_ASSERT (copy.encode (TServiceId (6)).getName () == "CT_MSG");
+
+		// receive both kinds
+		TestTC.set (0);
+		receive (indexed, sid);
+		TEST_ASSERT (NbTCReceived == 1);
+		TEST_ASSERT (TestTC.equals (sent));
+		TestTC.set (0);
+		receive (byCodec, sid);
+		TEST_ASSERT (NbTCReceived == 2);
+		TEST_ASSERT (TestTC.equals (sent));
+		TestTC.set (0);
+		TransportClassCodec = false;
+		receive (byCodec, sid);
+		TransportClassCodec = true;
+		TEST_ASSERT (NbTCReceived == 3);
+		TEST_ASSERT (TestTC.equals (sent));
+	}
+
+	void differentClass ()
+	{
+		// an older service: another order, a missing property, an unknown one, and no CT_MSGI
+		TServiceId sid (7);
+		CMessage lrc ("CT_LRC");
+		uint32 nbClass = 1, nbProp = 4;
+		string className ("TestTC");
+		lrc.serial (nbClass);
+		lrc.serial (className);
+		lrc.serial (nbProp);
+		string names [] = { "str", "unknown", "u8", "u32" };
+		CTransportClass::TProp types [] = { CTransportClass::PropString, CTransportClass::PropUInt16, CTransportClass::PropUInt8, CTransportClass::PropUInt32 };
+		for (uint i = 0; i < nbProp; i++)
+		{
+			lrc.serial (names[i]);
+			lrc.serialEnum (types[i]);
+		}
+		lrc.invert ();
+		cbTCReceiveOtherSideClass (lrc, "TEST", sid);
+		TEST_ASSERT (TestTC.encode (sid).getName () == "CT_MSG");
+
+		CMessage msg ("CT_MSG");
+		string str ("old"), str2 ("old2");
+		uint16 unknown = 77;
+		uint8 u8 = 8;
+		uint32 u32 = 32;
+		msg.serial (className, str, unknown);
+		msg.serial (u8, u32);
+		msg.invert ();
+
+		for (uint c = 0; c < 2; c++)
+		{
+			TransportClassCodec = (c == 0);
+			TestTC.set (2);
+			receive (msg, sid);
+			TEST_ASSERT (NbTCReceived == c + 1);
+			TEST_ASSERT (TestTC.Str == "old" && TestTC.U8 == 8 && TestTC.U32 == 32);
+			TEST_ASSERT (TestTC.S16 == 2 && TestTC.U64 == 4 && TestTC.B && TestTC.F == 6.0f && TestTC.D == 7.0 && TestTC.Cont.empty ());
+		}
+	}
+
+	void serviceDown ()
+	{
+		TServiceId sid (9);
+		CMessage lrc = CTestTC::localClassMessage ();
+		cbTCReceiveOtherSideClass (lrc, "TEST", sid);
+		TEST_ASSERT (TestTC.encode (sid).getName () == "CT_MSGI");
+
+		// the next service with this id may be an older one
+		cbTCDownService ("TEST", sid, NULL);
+		TEST_ASSERT (TestTC.encode (sid).getName () == "CT_MSG");
+	}
+};
+
+Test::Suite *createTransportClassTS ()
+{
+	return new CTransportClassTS;
+}
@@ -0,0 +1,232 @@
+#include "nel/net/udp_transport.h"
+#include "nel/net/sock.h"
+#include "nel/misc/time_nl.h"
+#include "nel/misc/debug.h"
+#include "cpptest.h"
+
+using namespace std;
+using namespace NLMISC;
+using namespace NLNET;
+
+static uint NbUdpConnections = 0;
+static uint NbUdpDisconnections = 0;
+
+static void cbUdpConnection (CUdpConnection *connection, void *arg)
+{
+	++NbUdpConnections;
+}
+
+static void cbUdpDisconnection (CUdpConnection *connection, void *arg)
+{
+	++NbUdpDisconnections;
+}
+
+// Test suite for the channels of CUdpTransport, with the losses of CUdpSimSock
+class CUdpTransportTS : public Test::Suite
+{
+public:
+	CUdpTransportTS ()
+	{
+		TEST_ADD(CUdpTransportTS::channels);
+		TEST_ADD(CUdpTransportTS::lossesAndLag);
+		TEST_ADD(CUdpTransportTS::messageTooBig);
+		TEST_ADD(CUdpTransportTS::disconnection);
+		TEST_ADD(CUdpTransportTS::spoofedSession);
+	}
+
+	void setup ()
+	{
+		CUdpSimSock::setSimValues (0, 0, 0, 0, 0, 0);
+		NbUdpConnections = 0;
+		NbUdpDisconnections = 0;
+
+		_Server = new CUdpTransport;
+		_Server->init (Port, true);
+		_Server->setConnectionCallback (cbUdpConnection, NULL);
+		_Server->setDisconnectionCallback (cbUdpDisconnection, NULL);
+		_Client = new CUdpTransport;
+		_Client->init (0, false);
+		_Connection = _Client->connect (CInetAddress ("127.0.0.1", Port));
+	}
+
+	void tear_down ()
+	{
+		delete _Client;
+		delete _Server;
+		CUdpSimSock::setSimValues (0, 0, 0, 0, 0, 0);
+	}
+
+	void channels ()
+	{
+		exchange (300, 10000);
+
+		TEST_ASSERT (NbUdpConnections == 1);
+		TEST_ASSERT (_Connection->getRTT () > 0.0f);
+		TEST_ASSERT (_Connection->getSendQueueSize () == 0);
+		TEST_ASSERT (_Connection->getNbDatagramsLost () == 0);
+	}
+
+	void lossesAndLag ()
+	{
+		// 10% lost each way, 150 ms later and disordered from the client
+		CUdpSimSock::setSimValues (0, 10, 150, 10, 5, 20);
+		exchange (1000, 60000);
+
+		TEST_ASSERT (_Connection->getNbDatagramsLost () > 0);
+		TEST_ASSERT (_Connection->getNbRetransmissions () > 0);
+		TEST_ASSERT (_Connection->getRTT () >= 150.0f);
+	}
+
+	void messageTooBig ()
+	{
+		vector<uint8> big (CUdpConnection::MaxMessageSize + 1, 1);
+		TEST_ASSERT (!_Connection->send (&big[0], (uint32)big.size (), CUdpConnection::ReliableOrdered));
+		TEST_ASSERT (_Connection->send (&big[0], CUdpConnection::MaxMessageSize, CUdpConnection::ReliableOrdered));
+
+		CMemStream msg;
+		CUdpConnection *from = NULL;
+		TTime end = CTime::getLocalTime () + 5000;
+		while (!_Server->receive (msg, &from) && CTime::getLocalTime () < end)
+			update ();
+		TEST_ASSERT (from != NULL);
+		TEST_ASSERT (msg.length () == CUdpConnection::MaxMessageSize);
+	}
+
+	void disconnection ()
+	{
+		uint32 i = 0;
+		_Connection->send ((uint8*)&i, sizeof (i), CUdpConnection::ReliableOrdered);
+		TTime end = CTime::getLocalTime () + 5000;
+		while (_Server->getNbConnections () == 0 && CTime::getLocalTime () < end)
+			update ();
+		TEST_ASSERT (_Server->getNbConnections () == 1);
+
+		// the server is told at once, without waiting for the timeout
+		_Client->disconnect (_Connection);
+		end = CTime::getLocalTime () + 5000;
+		while (_Server->getNbConnections () != 0 && CTime::getLocalTime () < end)
+			update ();
+		TEST_ASSERT (_Server->getNbConnections () == 0);
+		TEST_ASSERT (NbUdpDisconnections == 1);
+		TEST_ASSERT (_Client->getNbConnections () == 0);
+	}
+
+	void spoofedSession ()
+	{
+		uint32 i = 0;
+		_Connection->send ((uint8*)&i, sizeof (i), CUdpConnection::ReliableOrdered);
+		TTime end = CTime::getLocalTime () + 5000;
+		while (_Server->getNbConnections () == 0 && CTime::getLocalTime () < end)
+			update ();
+		TEST_ASSERT (_Server->getNbConnections () == 1);
+
+		// an opening datagram of another session from the address of the live connection
+		CMemStream out;
+		uint32 session = 0x12345678, seq = 1, zero = 0;
+		uint8 flags = 5; // AckEliciting | OpenFlag
+		uint16 zero16 = 0;
+		uint8 nbMessages = 0;
+		out.serial (session, flags, seq);
+		out.serial (zero, zero, zero16, nbMessages);
+		uint32 len = out.length ();
+		_Client->sock ().sendTo (out.buffer (), len, CInetAddress ("127.0.0.1", Port));
+
+		// the connection is kept and still works
+		_Connection->send ((uint8*)&i, sizeof (i), CUdpConnection::ReliableOrdered);
+		CMemStream msg;
+		uint nbReceived = 0;
+		end = CTime::getLocalTime () + 1000;
+		while (CTime::getLocalTime () < end)
+		{
+			update ();
+			CUdpConnection *from;
+			while (_Server->receive (msg, &from))
+				nbReceived++;
+		}
+		TEST_ASSERT (nbReceived == 2);
+		TEST_ASSERT (_Server->getNbConnections () == 1);
+		TEST_ASSERT (NbUdpConnections == 1);
+		TEST_ASSERT (NbUdpDisconnections == 0);
+	}
+
+private:
+
+	enum { Port = 56010 };
+
+	void update ()
+	{
+		_Client->update ();
+		_Server->update ();
+		nlSleep (1);
+	}
+
+	// Send nb messages on each channel, check the server receives them as their channel says
+	void exchange (uint32 nb, uint32 timeout)
+	{
+		for (uint32 i = 0; i < nb; i++)
+		{
+			CMemStream msg;
+			msg.serial (i);
+			_Connection->send (msg, CUdpConnection::ReliableOrdered);
+			_Connection->send (msg, CUdpConnection::ReliableUnordered);
+			_Connection->send (msg, CUdpConnection::UnreliableSequenced);
+		}
+
+		uint32 nbOrdered = 0;
+		vector<bool> unordered (nb, false);
+		uint32 nbUnordered = 0;
+		sint32 lastUnreliable = -1;
+		bool ordered = true, sequenced = true, duplicated = false;
+
+		TTime end = CTime::getLocalTime () + timeout;
+		while ((nbOrdered < nb || nbUnordered < nb) && CTime::getLocalTime () < end)
+		{
+			update ();
+
+			CMemStream msg;
+			CUdpConnection *from;
+			CUdpConnection::TChannel channel;
+			while (_Server->receive (msg, &from, &channel))
+			{
+				uint32 i;
+				msg.serial (i);
+				switch (channel)
+				{
+				case CUdpConnection::ReliableOrdered:
+					if (i != nbOrdered)
+						ordered = false;
+					nbOrdered++;
+					break;
+				case CUdpConnection::ReliableUnordered:
+					if (i >= nb || unordered[i])
+						duplicated = true;
+					else
+						unordered[i] = true;
+					nbUnordered++;
+					break;
+				default:
+					if ((sint32)i <= lastUnreliable)
+						sequenced = false;
+					lastUnreliable = (sint32)i;
+					break;
+				}
+			}
+		}
+
+		TEST_ASSERT (nbOrdered == nb);
+		TEST_ASSERT (ordered);
+		TEST_ASSERT (nbUnordered == nb);
+		TEST_ASSERT (!duplicated);
+		TEST_ASSERT (sequenced);
+		TEST_ASSERT (lastUnreliable >= 0);
+	}
+
+	CUdpTransport	*_Server;
+	CUdpTransport	*_Client;
+	CUdpConnection	*_Connection;
+};
+
+Test::Suite *createUdpTransportTS ()
+{
+	return new CUdpTransportTS;
+}
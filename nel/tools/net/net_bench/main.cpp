@@ -0,0 +1,884 @@
+/** \file net_bench/main.cpp
+ * Loopback throughput and latency benchmark of the NeL network layers:
+ * layer 1 (CBufServer/CBufClient), layer 3 (CCallbackServer/CCallbackClient),
+ * layer 5 (CUnifiedNetwork) and the module gateway (L3 and shared memory transports)
+ *
+ * $Id$
+ */
+
+/* Copyright, 2001 Nevrax Ltd.
+ *
+ * This file is part of NEVRAX NEL.
+ * NEVRAX NEL is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+
+ * NEVRAX NEL is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with NEVRAX NEL; see the file COPYING. If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#include "nel/misc/types_nl.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vector>
+#include <algorithm>
+
+#include "nel/misc/debug.h"
+#include "nel/misc/common.h"
+#include "nel/misc/command.h"
+#include "nel/misc/time_nl.h"
+#include "nel/misc/app_context.h"
+#include "nel/net/tcp_sock.h"
+#include "nel/net/buf_server.h"
+#include "nel/net/buf_client.h"
+#include "nel/net/callback_server.h"
+#include "nel/net/callback_client.h"
+#include "nel/net/unified_network.h"
+#include "nel/net/module.h"
+#include "nel/net/module_manager.h"
+#include "nel/net/module_socket.h"
+#include "nel/net/module_gateway.h"
+#include "nel/net/module_builder_parts.h"
+
+using namespace std;
+using namespace NLMISC;
+using namespace NLNET;
+
+// ---------------------------------------------------------------------------
+
+/* Each connection keeps Window pings in flight. The other side sends every ping back,
+ * and the round trip time is measured from the send time written at the beginning
+ * of the payload. The messages/sec are the round trips per second, the bytes/sec
+ * are the payload bytes echoed per second.
+ * A run lasts Duration seconds, the first fifth is not measured (warm up).
+ */
+
+/// Size of the send time at the beginning of the payload
+const uint32 StampSize = sizeof(TTicks);
+
+/// Result of a run
+struct TBenchResult
+{
+	double	MsgPerSec;
+	double	BytesPerSec;
+	// round trip time percentiles, in microseconds
+	double	P50;
+	double	P99;
+	double	P999;
+};
+
+/// Round trip times of a run
+class CLatencyStats
+{
+public:
+
+	void	clear() { _Samples.clear(); }
+
+	void	add( TTicks sendTime ) { _Samples.push_back( CTime::getPerformanceTime() - sendTime ); }
+
+	uint32	size() const { return (uint32)_Samples.size(); }
+
+	/// Returns the p-th percentile (0 <= p <= 1) in microseconds. The samples are sorted.
+	double	percentile( double p )
+	{
+		if ( _Samples.empty() )
+			return 0;
+		sort( _Samples.begin(), _Samples.end() );
+		uint32 index = std::min( (uint32)(p * _Samples.size()), (uint32)_Samples.size() - 1 );
+		return CTime::ticksToSecond( _Samples[index] ) * 1000000.0;
+	}
+
+private:
+
+	vector<TTicks>	_Samples;
+};
+
+/// State of the current run, fed by the layers when a pong is received
+class CBenchRun
+{
+public:
+
+	CBenchRun( uint nbConnections ) : Outstanding( nbConnections, 0 ), Measuring( false ), NbPongs( 0 ) {}
+
+	void	onPong( uint connection, const uint8 *payload, uint32 size )
+	{
+		nlassert( (connection < Outstanding.size()) && (size >= StampSize) );
+		--Outstanding[connection];
+		if ( Measuring )
+		{
+			TTicks sendTime;
+			memcpy( &sendTime, payload, StampSize );
+			Stats.add( sendTime );
+			++NbPongs;
+		}
+	}
+
+	/// Number of pings in flight, by connection
+	vector<uint>	Outstanding;
+	bool			Measuring;
+	uint32			NbPongs;
+	CLatencyStats	Stats;
+};
+
+CBenchRun *CurrentRun = NULL;
+
+// ---------------------------------------------------------------------------
+
+/// A network layer under test, with a server side that echoes the pings
+class IBenchLayer
+{
+public:
+
+	virtual ~IBenchLayer() {}
+
+	/// Name displayed in the results
+	virtual const char	*getName() const = 0;
+
+	/// Max number of connections supported (0 for no limit)
+	virtual uint		getMaxConnections() const { return 0; }
+
+	/// Open the server and the connections. Returns false if the connections can't be established.
+	virtual bool		open( uint16 port, uint nbConnections ) = 0;
+
+	/// Send a ping from a connection
+	virtual void		sendPing( uint connection, const uint8 *payload, uint32 size ) = 0;
+
+	/// Update both sides, the pongs are given to CurrentRun
+	virtual void		update() = 0;
+
+	/// Close the connections and the server
+	virtual void		close() = 0;
+
+	/// Update until cond() is true or the timeout expires
+	template <class T>
+	bool	waitFor( T cond, TTime timeout=5000 )
+	{
+		TTime end = CTime::getLocalTime() + timeout;
+		while ( ! cond() )
+		{
+			if ( CTime::getLocalTime() > end )
+				return false;
+			update();
+			nlSleep( 1 );
+		}
+		return true;
+	}
+};
+
+// ---------------------------------------------------------------------------
+
+/// Layer 1: the messages are raw CMemStream blocks
+class CLayer1Bench : public IBenchLayer
+{
+public:
+
+	CLayer1Bench() : _Server( NULL ) {}
+
+	const char	*getName() const { return "L1 CBufServer"; }
+
+	bool	open( uint16 port, uint nbConnections )
+	{
+		_Server = new CBufServer();
+		_Server->init( port );
+		_Server->setConnectionCallback( cbConnection, _Server );
+		for ( uint i=0; i!=nbConnections; ++i )
+		{
+			_Clients.push_back( new CBufClient() );
+			_Clients.back()->connect( CInetAddress( "localhost", port ) );
+			_Clients.back()->setTimeFlushTrigger( 0 );
+		}
+		return waitFor( CAllConnected( *_Server, nbConnections ) );
+	}
+
+	void	sendPing( uint connection, const uint8 *payload, uint32 size )
+	{
+		CMemStream ping;
+		ping.serialBuffer( const_cast<uint8*>(payload), size );
+		_Clients[connection]->send( ping );
+	}
+
+	void	update()
+	{
+		// echo
+		TSockId from;
+		while ( _Server->dataAvailable() )
+		{
+			_Server->receive( _Buffer, &from );
+			_Server->send( _Buffer, from );
+		}
+		_Server->update();
+
+		for ( uint i=0; i!=_Clients.size(); ++i )
+		{
+			_Clients[i]->update();
+			while ( _Clients[i]->dataAvailable() )
+			{
+				_Clients[i]->receive( _Buffer );
+				CurrentRun->onPong( i, _Buffer.buffer(), _Buffer.length() );
+			}
+		}
+	}
+
+	void	close()
+	{
+		for ( uint i=0; i!=_Clients.size(); ++i )
+		{
+			delete _Clients[i];
+		}
+		_Clients.clear();
+		delete _Server;
+		_Server = NULL;
+	}
+
+private:
+
+	/// Send at each update(), the default time trigger would add up to 20 ms to the round trip
+	static void	cbConnection( TSockId from, void *arg )
+	{
+		((CBufServer*)arg)->setTimeFlushTrigger( from, 0 );
+	}
+
+	struct CAllConnected
+	{
+		CAllConnected( CBufServer &server, uint nb ) : Server( server ), Nb( nb ) {}
+		bool operator() () { return Server.nbConnections() == Nb; }
+		CBufServer	&Server;
+		uint		Nb;
+	};
+
+	CBufServer			*_Server;
+	vector<CBufClient*>	_Clients;
+	CMemStream			_Buffer;
+};
+
+// ---------------------------------------------------------------------------
+
+/// Layer 3: the messages are CMessage dispatched to callbacks
+class CLayer3Bench : public IBenchLayer
+{
+public:
+
+	CLayer3Bench() : _Server( NULL ), _NbConnected( 0 ) { Instance = this; }
+
+	const char	*getName() const { return "L3 CCallbackServer"; }
+
+	bool	open( uint16 port, uint nbConnections )
+	{
+		_NbConnected = 0;
+		_Server = new CCallbackServer();
+		_Server->init( port );
+		_Server->addCallbackArray( ServerCallbacks, 1 );
+		_Server->setConnectionCallback( cbConnection, this );
+		for ( uint i=0; i!=nbConnections; ++i )
+		{
+			_Clients.push_back( new CCallbackClient() );
+			_Clients.back()->addCallbackArray( ClientCallbacks, 1 );
+			_Clients.back()->connect( CInetAddress( "localhost", port ) );
+			_Clients.back()->setTimeFlushTrigger( 0 );
+		}
+		return waitFor( CAllConnected( _NbConnected, nbConnections ) );
+	}
+
+	void	sendPing( uint connection, const uint8 *payload, uint32 size )
+	{
+		CMessage ping( "NB_PING" );
+		ping.serialBuffer( const_cast<uint8*>(payload), size );
+		_Clients[connection]->send( ping );
+	}
+
+	void	update()
+	{
+		_Server->update();
+		for ( uint i=0; i!=_Clients.size(); ++i )
+		{
+			_Clients[i]->update();
+		}
+	}
+
+	void	close()
+	{
+		for ( uint i=0; i!=_Clients.size(); ++i )
+		{
+			delete _Clients[i];
+		}
+		_Clients.clear();
+		delete _Server;
+		_Server = NULL;
+	}
+
+private:
+
+	struct CAllConnected
+	{
+		CAllConnected( uint &nbConnected, uint nb ) : NbConnected( nbConnected ), Nb( nb ) {}
+		bool operator() () { return NbConnected == Nb; }
+		uint	&NbConnected;
+		uint	Nb;
+	};
+
+	static void	cbConnection( TSockId from, void *arg )
+	{
+		// send at each update(), as the layer 1
+		((CLayer3Bench*)arg)->_Server->setTimeFlushTrigger( from, 0 );
+		++((CLayer3Bench*)arg)->_NbConnected;
+	}
+
+	static void	cbPing( CMessage &msgin, TSockId from, CCallbackNetBase &netbase )
+	{
+		CMessage pong( "NB_PONG" );
+		pong.serialBuffer( const_cast<uint8*>(msgin.buffer()) + msgin.getPos(), msgin.length() - msgin.getPos() );
+		netbase.send( pong, from );
+	}
+
+	static void	cbPong( CMessage &msgin, TSockId from, CCallbackNetBase &netbase )
+	{
+		vector<CCallbackClient*> &clients = Instance->_Clients;
+		uint connection = (uint)(find( clients.begin(), clients.end(), &netbase ) - clients.begin());
+		CurrentRun->onPong( connection, msgin.buffer() + msgin.getPos(), msgin.length() - msgin.getPos() );
+	}
+
+	static TCallbackItem	ServerCallbacks [1];
+	static TCallbackItem	ClientCallbacks [1];
+
+	CCallbackServer			*_Server;
+	vector<CCallbackClient*>	_Clients;
+	uint					_NbConnected;
+
+public:
+
+	static CLayer3Bench		*Instance;
+};
+
+TCallbackItem CLayer3Bench::ServerCallbacks [1] = { { "NB_PING", CLayer3Bench::cbPing } };
+TCallbackItem CLayer3Bench::ClientCallbacks [1] = { { "NB_PONG", CLayer3Bench::cbPong } };
+CLayer3Bench *CLayer3Bench::Instance = NULL;
+
+// ---------------------------------------------------------------------------
+
+/** Layer 5: the unified network is a singleton, so the pings are echoed by another
+ * process (this program run with -l5echo), connected as a service would be.
+ * It is opened once, with one connection, and stopped at exit.
+ */
+class CLayer5Bench : public IBenchLayer
+{
+public:
+
+	CLayer5Bench( const char *programName ) : _ProgramName( programName ), _Opened( false ), _EchoUp( false ) {}
+
+	~CLayer5Bench()
+	{
+		if ( _Opened )
+		{
+			CUnifiedNetwork::getInstance()->send( _EchoSId, CMessage( "NB_QUIT" ) );
+			CUnifiedNetwork::getInstance()->release();
+		}
+	}
+
+	const char	*getName() const { return "L5 CUnifiedNetwork"; }
+
+	uint		getMaxConnections() const { return 1; }
+
+	bool	open( uint16 port, uint nbConnections )
+	{
+		CUnifiedNetwork *un = CUnifiedNetwork::getInstance();
+		if ( ! _Opened )
+		{
+			if ( ! launchProgram( _ProgramName, toString( "-l5echo %u", port ) ) )
+				return false;
+
+			TServiceId sid( 1 );
+			un->init( NULL, CCallbackNetBase::Off, "NB_L5", 0, sid );
+			un->addCallbackArray( Callbacks, 1 );
+			un->setServiceUpCallback( "NB_ECHO", cbServiceUp, this );
+			// wait for the echo service to listen
+			CInetAddress addr( "localhost", port );
+			TTime timeout = CTime::getLocalTime() + 10000;
+			for (;;)
+			{
+				try
+				{
+					CTcpSock sock;
+					sock.connect( addr );
+					break;
+				}
+				catch ( const ESocket & )
+				{
+					if ( CTime::getLocalTime() > timeout )
+						return false;
+					nlSleep( 100 );
+				}
+			}
+			un->addService( "NB_ECHO", addr );
+			_Opened = true;
+		}
+		return waitFor( CEchoUp( _EchoUp ), 10000 );
+	}
+
+	void	sendPing( uint connection, const uint8 *payload, uint32 size )
+	{
+		CMessage ping( "NB_PING" );
+		ping.serialBuffer( const_cast<uint8*>(payload), size );
+		CUnifiedNetwork::getInstance()->send( _EchoSId, ping );
+	}
+
+	void	update()
+	{
+		CUnifiedNetwork::getInstance()->update();
+	}
+
+	void	close()
+	{
+		// kept open for the next sizes
+	}
+
+	/// Main loop of the echo process
+	static void	runEcho( uint16 port )
+	{
+		CUnifiedNetwork *un = CUnifiedNetwork::getInstance();
+		TServiceId sid( 2 );
+		un->init( NULL, CCallbackNetBase::Off, "NB_ECHO", port, sid );
+		un->addCallbackArray( EchoCallbacks, 2 );
+		un->setServiceUpCallback( "*", cbEchoServiceUp );
+		un->setServiceDownCallback( "*", cbEchoServiceDown );
+
+		// stop when the benchmark is done, or has not connected in time
+		TTime timeout = CTime::getLocalTime() + 20000;
+		while ( ! _QuitEcho && (_EchoConnected || (CTime::getLocalTime() < timeout)) )
+		{
+			// sleeps until a message comes, as a service does
+			un->update( 100 );
+		}
+		un->release();
+	}
+
+private:
+
+	struct CEchoUp
+	{
+		CEchoUp( bool &up ) : Up( up ) {}
+		bool operator() () { return Up; }
+		bool	&Up;
+	};
+
+	static void	cbServiceUp( const std::string &serviceName, TServiceId sid, void *arg )
+	{
+		((CLayer5Bench*)arg)->_EchoSId = sid;
+		((CLayer5Bench*)arg)->_EchoUp = true;
+	}
+
+	static void	cbPing( CMessage &msgin, const std::string &serviceName, TServiceId sid )
+	{
+		CMessage pong( "NB_PONG" );
+		pong.serialBuffer( const_cast<uint8*>(msgin.buffer()) + msgin.getPos(), msgin.length() - msgin.getPos() );
+		CUnifiedNetwork::getInstance()->send( sid, pong );
+	}
+
+	static void	cbEchoServiceUp( const std::string &serviceName, TServiceId sid, void *arg )
+	{
+		_EchoConnected = true;
+	}
+
+	static void	cbEchoServiceDown( const std::string &serviceName, TServiceId sid, void *arg )
+	{
+		_QuitEcho = true;
+	}
+
+	static void	cbQuit( CMessage &msgin, const std::string &serviceName, TServiceId sid )
+	{
+		_QuitEcho = true;
+	}
+
+	static void	cbPong( CMessage &msgin, const std::string &serviceName, TServiceId sid )
+	{
+		CurrentRun->onPong( 0, msgin.buffer() + msgin.getPos(), msgin.length() - msgin.getPos() );
+	}
+
+	static TUnifiedCallbackItem	Callbacks [1];
+	static TUnifiedCallbackItem	EchoCallbacks [2];
+	static bool					_QuitEcho;
+	static bool					_EchoConnected;
+
+	string		_ProgramName;
+	bool		_Opened;
+	bool		_EchoUp;
+	TServiceId	_EchoSId;
+};
+
+TUnifiedCallbackItem CLayer5Bench::Callbacks [1] =
+{
+	{ "NB_PONG", CLayer5Bench::cbPong },
+};
+
+TUnifiedCallbackItem CLayer5Bench::EchoCallbacks [2] =
+{
+	{ "NB_PING", CLayer5Bench::cbPing },
+	{ "NB_QUIT", CLayer5Bench::cbQuit },
+};
+
+bool CLayer5Bench::_QuitEcho = false;
+bool CLayer5Bench::_EchoConnected = false;
+
+// ---------------------------------------------------------------------------
+
+/// Module that echoes the pings ("nb_echo") or receives the pongs ("nb_ping")
+class CBenchModule : public CEmptyModuleServiceBehav<CEmptyModuleCommBehav<CEmptySocketBehav<CModuleBase> > >
+{
+public:
+
+	CBenchModule() : Peer( NULL ) {}
+
+	std::string	buildModuleManifest() const { return ""; }
+
+	void	onModuleUp( IModuleProxy *moduleProxy )
+	{
+		if ( (moduleProxy->getModuleClassName() == getModuleClassName()) && (moduleProxy->getModuleName() != getModuleFullyQualifiedName()) )
+			Peer = moduleProxy;
+	}
+
+	void	onModuleDown( IModuleProxy *moduleProxy )
+	{
+		if ( moduleProxy == Peer )
+			Peer = NULL;
+	}
+
+	bool	onProcessModuleMessage( IModuleProxy *senderModuleProxy, const CMessage &message )
+	{
+		if ( message.getName() == "NB_PING" )
+		{
+			CMessage pong( "NB_PONG" );
+			pong.serialBuffer( const_cast<uint8*>(message.buffer()) + message.getPos(), message.length() - message.getPos() );
+			senderModuleProxy->sendModuleMessage( this, pong );
+			return true;
+		}
+		else if ( message.getName() == "NB_PONG" )
+		{
+			CurrentRun->onPong( 0, message.buffer() + message.getPos(), message.length() - message.getPos() );
+			return true;
+		}
+		return false;
+	}
+
+	/// The other bench module
+	IModuleProxy	*Peer;
+};
+
+NLNET_REGISTER_MODULE_FACTORY(CBenchModule, "NetBenchModule");
+
+/// Module layer: two gateways connected by a transport, a bench module plugged in each
+class CGatewayBench : public IBenchLayer
+{
+public:
+
+	CGatewayBench( const char *name, const char *serverTransport, const char *clientTransport )
+		: _Name( name ), _ServerTransport( serverTransport ), _ClientTransport( clientTransport ),
+		_ServerGw( NULL ), _ClientGw( NULL ), _Echo( NULL ), _Ping( NULL )
+	{
+	}
+
+	const char	*getName() const { return _Name; }
+
+	uint		getMaxConnections() const { return 1; }
+
+	bool	open( uint16 port, uint nbConnections )
+	{
+		IModuleManager &mm = IModuleManager::getInstance();
+		CCommandRegistry &cr = CCommandRegistry::getInstance();
+
+		_ServerGw = mm.createModule( "StandardGateway", "nb_gws", "" );
+		_ClientGw = mm.createModule( "StandardGateway", "nb_gwc", "" );
+		_Echo = mm.createModule( "NetBenchModule", "nb_echo", "" );
+		_Ping = mm.createModule( "NetBenchModule", "nb_ping", "" );
+		if ( (_ServerGw == NULL) || (_ClientGw == NULL) || (_Echo == NULL) || (_Ping == NULL) )
+			return false;
+		_Echo->plugModule( mm.getModuleSocket( "nb_gws" ) );
+		_Ping->plugModule( mm.getModuleSocket( "nb_gwc" ) );
+
+		// the shared memory transports use the port as segment key
+		string serverCmd, clientCmd;
+		if ( string( _ServerTransport ) == "L3Server" )
+		{
+			serverCmd = toString( "nb_gws.transportCmd s(open port=%u)", port );
+			clientCmd = toString( "nb_gwc.transportCmd c(connect addr=localhost:%u)", port );
+		}
+		else
+		{
+			serverCmd = toString( "nb_gws.transportCmd s(open key=%u)", port );
+			clientCmd = toString( "nb_gwc.transportCmd c(connect key=%u)", port );
+		}
+		cr.execute( toString( "nb_gws.transportAdd %s s", _ServerTransport ), *InfoLog );
+		cr.execute( serverCmd, *InfoLog );
+		cr.execute( toString( "nb_gwc.transportAdd %s c", _ClientTransport ), *InfoLog );
+		cr.execute( clientCmd, *InfoLog );
+
+		return waitFor( CPeerUp( *static_cast<CBenchModule*>(_Ping) ) );
+	}
+
+	void	sendPing( uint connection, const uint8 *payload, uint32 size )
+	{
+		CMessage ping( "NB_PING" );
+		ping.serialBuffer( const_cast<uint8*>(payload), size );
+		static_cast<CBenchModule*>(_Ping)->Peer->sendModuleMessage( _Ping, ping );
+	}
+
+	void	update()
+	{
+		IModuleManager::getInstance().updateModules();
+	}
+
+	void	close()
+	{
+		IModuleManager &mm = IModuleManager::getInstance();
+		if ( _Ping != NULL )
+			mm.deleteModule( _Ping );
+		if ( _Echo != NULL )
+			mm.deleteModule( _Echo );
+		if ( _ClientGw != NULL )
+			mm.deleteModule( _ClientGw );
+		if ( _ServerGw != NULL )
+			mm.deleteModule( _ServerGw );
+		_ServerGw = _ClientGw = _Echo = _Ping = NULL;
+	}
+
+private:
+
+	struct CPeerUp
+	{
+		CPeerUp( CBenchModule &module ) : Module( module ) {}
+		bool operator() () { return Module.Peer != NULL; }
+		CBenchModule	&Module;
+	};
+
+	const char	*_Name;
+	const char	*_ServerTransport;
+	const char	*_ClientTransport;
+	IModule		*_ServerGw;
+	IModule		*_ClientGw;
+	IModule		*_Echo;
+	IModule		*_Ping;
+};
+
+// ---------------------------------------------------------------------------
+
+/// True when no ping is in flight
+struct CAllBack
+{
+	CAllBack( CBenchRun &run ) : Run( run ) {}
+	bool operator () () const
+	{
+		for ( uint c=0; c!=Run.Outstanding.size(); ++c )
+			if ( Run.Outstanding[c] != 0 )
+				return false;
+		return true;
+	}
+	CBenchRun &Run;
+};
+
+/// Do a first round trip on each connection, the first messages of a new connection can be slow to come back
+bool warmUp( IBenchLayer &layer, uint nbConnections )
+{
+	CBenchRun run( nbConnections );
+	CurrentRun = &run;
+	for ( uint c=0; c!=nbConnections; ++c )
+	{
+		TTicks sendTime = CTime::getPerformanceTime();
+		layer.sendPing( c, (const uint8*)&sendTime, StampSize );
+		++run.Outstanding[c];
+	}
+	bool back = layer.waitFor( CAllBack( run ), 10000 );
+	CurrentRun = NULL;
+	return back;
+}
+
+/// Run the ping/pong loop on an open layer
+TBenchResult runBench( IBenchLayer &layer, uint nbConnections, uint32 size, uint window, float duration )
+{
+	CBenchRun run( nbConnections );
+	CurrentRun = &run;
+
+	vector<uint8> payload( std::max( size, StampSize ) );
+	for ( uint i=StampSize; i<payload.size(); ++i )
+		payload[i] = (uint8)i;
+
+	TTicks start = CTime::getPerformanceTime();
+	TTicks measureStart = start;
+	TTicks now = start;
+	while ( CTime::ticksToSecond( now - start ) < duration )
+	{
+		if ( ! run.Measuring && (CTime::ticksToSecond( now - start ) >= duration / 5.0f) )
+		{
+			run.Measuring = true;
+			measureStart = now;
+		}
+
+		for ( uint c=0; c!=nbConnections; ++c )
+		{
+			while ( run.Outstanding[c] < window )
+			{
+				TTicks sendTime = CTime::getPerformanceTime();
+				memcpy( &payload[0], &sendTime, StampSize );
+				layer.sendPing( c, &payload[0], (uint32)payload.size() );
+				++run.Outstanding[c];
+			}
+		}
+		layer.update();
+		now = CTime::getPerformanceTime();
+	}
+	run.Measuring = false;
+	double elapsed = CTime::ticksToSecond( now - measureStart );
+
+	// let the pings in flight come back before the next run
+	layer.waitFor( CAllBack( run ), 2000 );
+
+	TBenchResult result;
+	result.MsgPerSec = run.NbPongs / elapsed;
+	result.BytesPerSec = result.MsgPerSec * payload.size();
+	result.P50 = run.Stats.percentile( 0.5 );
+	result.P99 = run.Stats.percentile( 0.99 );
+	result.P999 = run.Stats.percentile( 0.999 );
+	CurrentRun = NULL;
+	return result;
+}
+
+// ---------------------------------------------------------------------------
+
+void usage()
+{
+	printf( "Usage: net_bench [-layers l1,l3,l5,gw,shm] [-sizes 16,256,4096,65536] [-connections 1,8,32]\n" );
+	printf( "                 [-window <pingsInFlightPerConnection>] [-duration <secondsPerRun>] [-port <firstPort>]\n" );
+	printf( "The layer 5 and module gateway layers (gw: L3 transport, shm: shared memory transport) use one connection.\n" );
+}
+
+/// Parse a comma separated list of numbers
+void parseList( const char *arg, vector<uint> &result )
+{
+	vector<string> items;
+	explode( string( arg ), string( "," ), items, true );
+	result.clear();
+	for ( uint i=0; i!=items.size(); ++i )
+		result.push_back( atoi( items[i].c_str() ) );
+}
+
+int main( int argc, char **argv )
+{
+	CApplicationContext appContext;
+	createDebug();
+	// the network layers are verbose on connection, keep the results readable
+	DebugLog->removeDisplayer( "DEFAULT_SD" );
+	InfoLog->removeDisplayer( "DEFAULT_SD" );
+
+	CSock::initNetwork();
+
+	// echo process of the layer 5 benchmark
+	if ( (argc == 3) && (string( argv[1] ) == "-l5echo") )
+	{
+		CLayer5Bench::runEcho( (uint16)atoi( argv[2] ) );
+		return 0;
+	}
+
+	vector<string> layers;
+	explode( string( "l1,l3,l5,gw,shm" ), string( "," ), layers );
+	vector<uint> sizes, connections;
+	parseList( "16,256,4096,65536", sizes );
+	parseList( "1,8,32", connections );
+	uint window = 4;
+	float duration = 2.0f;
+	uint16 port = 48000;
+
+	for ( sint i=1; i<argc; ++i )
+	{
+		string arg( argv[i] );
+		if ( (i+1 < argc) && (arg == "-layers") )
+		{
+			layers.clear();
+			explode( string( argv[++i] ), string( "," ), layers, true );
+		}
+		else if ( (i+1 < argc) && (arg == "-sizes") )
+			parseList( argv[++i], sizes );
+		else if ( (i+1 < argc) && (arg == "-connections") )
+			parseList( argv[++i], connections );
+		else if ( (i+1 < argc) && (arg == "-window") )
+			window = std::max( atoi( argv[++i] ), 1 );
+		else if ( (i+1 < argc) && (arg == "-duration") )
+			duration = (float)atof( argv[++i] );
+		else if ( (i+1 < argc) && (arg == "-port") )
+			port = (uint16)atoi( argv[++i] );
+		else
+		{
+			usage();
+			return arg == "-h" ? 0 : 1;
+		}
+	}
+
+	IModuleManager::getInstance();
+
+	printf( "%u pings in flight per connection, %.1f seconds per run\n\n", window, duration );
+	printf( "%-24s %6s %8s %12s %12s %10s %10s %10s\n", "Layer", "Conns", "Size", "Msgs/sec", "MB/sec", "p50 (us)", "p99 (us)", "p999 (us)" );
+
+	for ( uint l=0; l!=layers.size(); ++l )
+	{
+		IBenchLayer *layer;
+		if ( layers[l] == "l1" )
+			layer = new CLayer1Bench();
+		else if ( layers[l] == "l3" )
+			layer = new CLayer3Bench();
+		else if ( layers[l] == "l5" )
+			layer = new CLayer5Bench( argv[0] );
+		else if ( layers[l] == "gw" )
+			layer = new CGatewayBench( "Gateway L3 transport", "L3Server", "L3Client" );
+		else if ( layers[l] == "shm" )
+			layer = new CGatewayBench( "Gateway shm transport", "ShmServer", "ShmClient" );
+		else
+		{
+			printf( "Unknown layer '%s'\n", layers[l].c_str() );
+			continue;
+		}
+
+		for ( uint c=0; c!=connections.size(); ++c )
+		{
+			uint nbConnections = connections[c];
+			if ( (nbConnections == 0) || ((layer->getMaxConnections() != 0) && (nbConnections > layer->getMaxConnections())) )
+				continue;
+
+			// a new port each time, the previous one may still be in TIME_WAIT
+			bool opened;
+			try
+			{
+				opened = layer->open( port++, nbConnections ) && warmUp( *layer, nbConnections );
+			}
+			catch ( const Exception &e )
+			{
+				printf( "%-24s %6u: %s\n", layer->getName(), nbConnections, e.what() );
+				opened = false;
+			}
+			if ( ! opened )
+			{
+				printf( "%-24s %6u: connection failed\n", layer->getName(), nbConnections );
+				layer->close();
+				continue;
+			}
+
+			for ( uint s=0; s!=sizes.size(); ++s )
+			{
+				TBenchResult result = runBench( *layer, nbConnections, sizes[s], window, duration );
+				printf( "%-24s %6u %8u %12.0f %12.2f %10.1f %10.1f %10.1f\n",
+					layer->getName(), nbConnections, std::max( sizes[s], StampSize ),
+					result.MsgPerSec, result.BytesPerSec / (1024.0 * 1024.0),
+					result.P50, result.P99, result.P999 );
+				fflush( stdout );
+			}
+			layer->close();
+		}
+		delete layer;
+	}
+	return 0;
+}
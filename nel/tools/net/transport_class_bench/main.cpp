@@ -0,0 +1,195 @@
+/** \file transport_class_bench/main.cpp
+ * Encode and decode cost of CTransportClass: description() path with the
+ * temporary message against the codecs compiled from the class descriptions
+ *
+ * $Id$
+ */
+
+/* Copyright, 2001 Nevrax Ltd.
+ *
+ * This file is part of NEVRAX NEL.
+ * NEVRAX NEL is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+
+ * NEVRAX NEL is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with NEVRAX NEL; see the file COPYING. If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#include "nel/misc/types_nl.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "nel/misc/debug.h"
+#include "nel/misc/common.h"
+#include "nel/misc/time_nl.h"
+#include "nel/misc/app_context.h"
+
+#include "nel/net/transport_class.h"
+
+using namespace std;
+using namespace NLMISC;
+using namespace NLNET;
+
+namespace NLNET
+{
+	// callbacks of the transport class messages, called directly to measure the decoding only
+	void cbTCReceiveMessage (CMessage &msgin, const std::string &name, TServiceId sid);
+	void cbTCReceiveIndexedMessage (CMessage &msgin, const std::string &name, TServiceId sid);
+	void cbTCReceiveOtherSideClass (CMessage &msgin, const std::string &name, TServiceId sid);
+}
+
+const TServiceId	OtherService (1);
+uint32				NbReceived = 0;
+
+
+/*
+ * A typical gameplay transport class: a few ids, a position, a name and a list
+ */
+class CBenchTC : public CTransportClass
+{
+public:
+
+	uint32			EntityId;
+	uint16			SheetIndex;
+	sint32			X, Y, Z;
+	float			Heading;
+	uint8			Mode;
+	bool			Visible;
+	uint64			Money;
+	string			Name;
+	vector<uint32>	Items;
+
+	CBenchTC () : EntityId(0), SheetIndex(0), X(0), Y(0), Z(0), Heading(0), Mode(0), Visible(false), Money(0) { }
+
+	virtual void description ()
+	{
+		className ("BenchTC");
+		property ("entity", PropUInt32, (uint32)0, EntityId);
+		property ("sheet", PropUInt16, (uint16)0, SheetIndex);
+		property ("x", PropSInt32, (sint32)0, X);
+		property ("y", PropSInt32, (sint32)0, Y);
+		property ("z", PropSInt32, (sint32)0, Z);
+		property ("heading", PropFloat, 0.0f, Heading);
+		property ("mode", PropUInt8, (uint8)0, Mode);
+		property ("visible", PropBool, false, Visible);
+		property ("money", PropUInt64, (uint64)0, Money);
+		property ("name", PropString, string(), Name);
+		propertyCont ("items", PropUInt32, Items);
+	}
+
+	virtual void callback (const string &name, TServiceId sid)
+	{
+		++NbReceived;
+	}
+
+	/// The message sent to OtherService, or to any service
+	const CMessage &encode (bool toOtherService)
+	{
+		return toOtherService ? write (OtherService) : write ();
+	}
+
+	/// Our class descriptions, as the other service receives them
+	static CMessage localClassMessage ()
+	{
+		createLocalRegisteredClassMessage ();
+		CMessage msg (TempMessage);
+		msg.invert ();
+		return msg;
+	}
+};
+
+CBenchTC	BenchTC;
+
+
+// Run the encoding nbLoop times with a copy of the registered instance, returns the ns by message
+double benchEncode (uint nbLoop, bool toOtherService, uint32 &size, string &type)
+{
+	CBenchTC tc (BenchTC);
+	TTicks start = CTime::getPerformanceTime ();
+	for (uint i = 0; i < nbLoop; i++)
+	{
+		tc.X = i;
+		size = tc.encode (toOtherService).length ();
+	}
+	TTicks end = CTime::getPerformanceTime ();
+	type = tc.encode (toOtherService).getName ();
+	return CTime::ticksToSecond (end - start) * 1e9 / nbLoop;
+}
+
+// Run the decoding of msg nbLoop times, returns the ns by message
+double benchDecode (uint nbLoop, CMessage msg)
+{
+	msg.invert ();
+	sint32 pos = msg.getPos ();
+	bool indexed = (msg.getName () == "CT_MSGI");
+	NbReceived = 0;
+	TTicks start = CTime::getPerformanceTime ();
+	for (uint i = 0; i < nbLoop; i++)
+	{
+		msg.seek (pos, IStream::begin);
+		if (indexed)
+			cbTCReceiveIndexedMessage (msg, "BENCH", OtherService);
+		else
+			cbTCReceiveMessage (msg, "BENCH", OtherService);
+	}
+	TTicks end = CTime::getPerformanceTime ();
+	nlassert (NbReceived == nbLoop);
+	return CTime::ticksToSecond (end - start) * 1e9 / nbLoop;
+}
+
+void bench (const char *title, uint nbLoop, bool codec, bool toOtherService)
+{
+	TransportClassCodec = codec;
+
+	uint32 size;
+	string type;
+	double encode = benchEncode (nbLoop, toOtherService, size, type);
+	CBenchTC tc (BenchTC);
+	double decode = benchDecode (nbLoop, tc.encode (toOtherService));
+
+	printf ("%-24s %-8s %8u %12.1f %12.1f\n", title, type.c_str(), size, encode, decode);
+}
+
+int main (int argc, char **argv)
+{
+	CApplicationContext appContext;
+	createDebug ();
+	DebugLog->removeDisplayer ("DEFAULT_SD");
+	InfoLog->removeDisplayer ("DEFAULT_SD");
+
+	uint nbLoop = 1000000;
+	if (argc > 1)
+		nbLoop = max (atoi (argv[1]), 1);
+
+	// the per message logs would be the only thing measured
+	VerboseNETTC = false;
+
+	CTransportClass::init ();
+	BenchTC.Name = "a player name";
+	for (uint i = 0; i < 8; i++)
+		BenchTC.Items.push_back (i * 1000);
+	CTransportClass::registerClass (BenchTC);
+
+	// the other service has the same classes, as sent when it comes up
+	CMessage lrc = CBenchTC::localClassMessage ();
+	cbTCReceiveOtherSideClass (lrc, "BENCH", OtherService);
+
+	printf ("%u messages\n", nbLoop);
+	printf ("%-24s %-8s %8s %12s %12s\n", "path", "message", "bytes", "encode ns", "decode ns");
+	bench ("description", nbLoop, false, false);
+	bench ("codec", nbLoop, true, false);
+	bench ("codec, by index", nbLoop, true, true);
+
+	CTransportClass::release ();
+	return 0;
+}
@@ -53,6 +53,8 @@
 
 #include <string>
 #include <list>
+#include <map>
+#include <set>
 
 #include "nel/misc/debug.h"
 #include "nel/misc/system_info.h"
@@ -105,6 +107,14 @@ struct CRequest
 	TAdminViewResult Answers;
 };
 
+struct CViewWaiter
+{
+	CViewWaiter(uint32 rid, const vector<string> &vars) : Rid(rid), Vars(vars) { }
+
+	uint32			Rid;
+	vector<string>	Vars;	// variables of the view, the answer is built from the view cache of the service
+};
+
 struct CService
 {
 	CService() { reset(); }
@@ -126,6 +136,15 @@ struct CService
 
 	vector<uint32>	WaitingRequestId;		/// contains all request that the server hasn't reply yet
 
+	// views on the variables of the service are batched in one GET_VIEW by update and their values cached (see ViewCacheTTL)
+	map<string, pair<string, TTime> >	ViewCache;	/// value of the variables and when they were received
+	string			ViewServiceName;		/// "service" column of the views
+	set<string>		PendingViewVars;		/// variables to ask in the next fetch
+	set<string>		FetchingViewVars;		/// variables asked in the fetch in progress
+	uint32			ViewFetchId;			/// request id of the fetch in progress, 0 if none
+	uint32			ViewFetchTime;			/// when the fetch was sent (in seconds)
+	list<CViewWaiter>	ViewWaiters;		/// requests waiting for variables of the service
+
 	string toString() const
 	{
 		return getServiceUnifiedName();
@@ -154,6 +173,13 @@ struct CService
 		Relaunch = false;
 		LastPing = 0;
 		WaitingRequestId.clear();
+		ViewCache.clear();
+		ViewServiceName.clear();
+		PendingViewVars.clear();
+		FetchingViewVars.clear();
+		ViewFetchId = 0;
+		ViewFetchTime = 0;
+		ViewWaiters.clear();
 	}
 
 	std::string getServiceUnifiedName() const
@@ -185,6 +211,7 @@ CVariable<uint32> RequestTimeout("aes","RequestTimeout", "in seconds, time befor
 CVariable<uint32> PingTimeout("aes","PingTimeout", "in seconds, time before services have to answer the ping message or will be killed", 900, 0, true);		// in seconds, timeout before killing the service
 CVariable<uint32> PingFrequency("aes","PingFrequency", "in seconds, time between each ping message", 60, 0, true);		// in seconds, frequency of the send ping to services
 CVariable<bool>   KillServicesOnDisconnect("aes","KillServicesOnDisconnect", "if set, call killProgram on services as they disconnect", false, 0, true);
+CVariable<uint32> ViewCacheTTL("aes","ViewCacheTTL", "in ms, time the value of a service variable is reused for the views, 0 to ask the service for each view", 1000, 0, true);
 
 //
 // Global Variables (containers)
@@ -210,6 +237,10 @@ vector<string> AllGraphUpdates;	// contains *all* the graph updates
 
 uint32 LastPing = 0;		// contains the date of the last ping sent to the services
 
+uint32 NextViewFetchId = 0x80000000;	// request ids of the view fetches, far from the ones of the AS
+uint32 NbViewFetches = 0;				// number of GET_VIEW sent for the batched views
+uint32 NbViewCacheHits = 0;				// number of views answered from the cache without waiting
+
 
 //
 // Alarms
@@ -690,6 +721,204 @@ void aesAddRequestAnswer(uint32 rid, TAdminViewVarNames& varNames, const TAdminV
 	nlwarning("Receive an answer for unknown request %d", rid);
 }
 
+//
+// View batching
+//
+
+// Give the variables of the view if it can be read from the view cache: only variables of the service, no command nor assignment
+bool getCacheableViewVars(const CService &service, CVarPath &varpath, vector<string> &vars)
+{
+	if (varpath.Destination.empty() || !varpath.isFinal())
+		return false;
+
+	vars.clear();
+	for (uint k = 0; k < varpath.Destination.size(); k++)
+	{
+		const string &name = varpath.Destination[k].first;
+		if (name.empty() || name.find('=') != string::npos)
+			return false;
+
+		uint c;
+		for (c = 0; c < service.Commands.size(); c++)
+		{
+			if (service.Commands[c].Name == name)
+				break;
+		}
+		if (c == service.Commands.size() || service.Commands[c].Type != ICommand::Variable)
+			return false;
+
+		vars.push_back(name);
+	}
+	return true;
+}
+
+bool isViewCached(const CService &service, const string &var, TTime now)
+{
+	map<string, pair<string, TTime> >::const_iterator it = service.ViewCache.find(var);
+	return it != service.ViewCache.end() && now < (*it).second.second + ViewCacheTTL.get();
+}
+
+bool isViewCached(const CService &service, const vector<string> &vars, TTime now)
+{
+	for (uint i = 0; i < vars.size(); i++)
+	{
+		if (!isViewCached(service, vars[i], now))
+			return false;
+	}
+	return true;
+}
+
+// Answer the view of the request with the cached values
+void answerViewFromCache(CService &service, uint32 rid, const vector<string> &vars)
+{
+	TAdminViewVarNames varNames;
+	TAdminViewValues values;
+
+	// same row as serviceGetView()
+	varNames.push_back("service");
+	values.push_back(service.ViewServiceName);
+	for (uint i = 0; i < vars.size(); i++)
+	{
+		varNames.push_back(vars[i]);
+		values.push_back(service.ViewCache[vars[i]].first);
+	}
+	aesAddRequestAnswer(rid, varNames, values);
+
+	// the service doesn't have to answer this view anymore
+	vector<uint32>::iterator it = find(service.WaitingRequestId.begin(), service.WaitingRequestId.end(), rid);
+	if (it != service.WaitingRequestId.end())
+		service.WaitingRequestId.erase(it);
+}
+
+// Ask the variables that are not cached for the waiting requests
+void addPendingViewVars(CService &service, const vector<string> &vars, TTime now)
+{
+	for (uint i = 0; i < vars.size(); i++)
+	{
+		if (!isViewCached(service, vars[i], now) && service.FetchingViewVars.find(vars[i]) == service.FetchingViewVars.end())
+			service.PendingViewVars.insert(vars[i]);
+	}
+}
+
+// Answer the view of a request now if the variables are cached, with the next fetch otherwise
+void addViewWaiter(CService &service, uint32 rid, const vector<string> &vars)
+{
+	TTime now = CTime::getLocalTime();
+	if (isViewCached(service, vars, now))
+	{
+		NbViewCacheHits++;
+		answerViewFromCache(service, rid, vars);
+		nlinfo("REQUEST: Answered view of service '%s' from the cache", service.toString().c_str());
+		return;
+	}
+
+	service.ViewWaiters.push_back(CViewWaiter(rid, vars));
+	addPendingViewVars(service, vars, now);
+}
+
+void removeViewWaiters(CService &service, uint32 rid)
+{
+	for (list<CViewWaiter>::iterator it = service.ViewWaiters.begin(); it != service.ViewWaiters.end();)
+	{
+		if ((*it).Rid == rid)
+			it = service.ViewWaiters.erase(it);
+		else
+			it++;
+	}
+}
+
+// Send one GET_VIEW by service with the variables asked since its last fetch
+void fetchViews()
+{
+	uint32 currentTime = CTime::getSecondsSince1970();
+
+	for (uint i = 0; i < Services.size(); i++)
+	{
+		CService &service = Services[i];
+		if (!service.Connected)
+			continue;
+
+		// the service didn't answer the fetch, ask again
+		if (service.ViewFetchId != 0 && currentTime >= service.ViewFetchTime + RequestTimeout)
+		{
+			nlwarning("REQUEST: View fetch %u of service '%s' timeouted", service.ViewFetchId, service.toString().c_str());
+			service.PendingViewVars.insert(service.FetchingViewVars.begin(), service.FetchingViewVars.end());
+			service.FetchingViewVars.clear();
+			service.ViewFetchId = 0;
+		}
+
+		if (service.ViewFetchId != 0 || service.PendingViewVars.empty())
+			continue;
+
+		string view = "[";
+		for (set<string>::iterator it = service.PendingViewVars.begin(); it != service.PendingViewVars.end(); it++)
+		{
+			if (it != service.PendingViewVars.begin())
+				view += ",";
+			view += *it;
+		}
+		view += "]";
+
+		if (++NextViewFetchId == 0)
+			NextViewFetchId = 0x80000000;
+		service.ViewFetchId = NextViewFetchId;
+		service.ViewFetchTime = currentTime;
+		service.FetchingViewVars.swap(service.PendingViewVars);
+		service.PendingViewVars.clear();
+
+		CMessage msgout("GET_VIEW");
+		msgout.serial(service.ViewFetchId);
+		msgout.serial(view);
+		CUnifiedNetwork::getInstance()->send(service.ServiceId, msgout);
+		NbViewFetches++;
+		nlinfo("REQUEST: Sent view fetch '%s' to service '%s' for %u requests", view.c_str(), service.toString().c_str(), (uint)service.ViewWaiters.size());
+	}
+}
+
+// Cache the values of a fetch and answer the waiting requests
+void receiveViewFetch(CService &service, const TAdminViewResult &answer)
+{
+	TTime now = CTime::getLocalTime();
+
+	for (uint r = 0; r < answer.size(); r++)
+	{
+		if (answer[r].VarNames.size() != answer[r].Values.size())
+			continue;
+
+		for (uint k = 0; k < answer[r].VarNames.size(); k++)
+		{
+			if (answer[r].VarNames[k] == "service")
+				service.ViewServiceName = answer[r].Values[k];
+			else
+				service.ViewCache[answer[r].VarNames[k]] = make_pair(answer[r].Values[k], now);
+		}
+	}
+
+	// the variables the service didn't give are unknown until the next fetch
+	for (set<string>::iterator it = service.FetchingViewVars.begin(); it != service.FetchingViewVars.end(); it++)
+	{
+		if (!isViewCached(service, *it, now))
+			service.ViewCache[*it] = make_pair(string("???"), now);
+	}
+	service.FetchingViewVars.clear();
+	service.ViewFetchId = 0;
+
+	for (list<CViewWaiter>::iterator it = service.ViewWaiters.begin(); it != service.ViewWaiters.end();)
+	{
+		if (isViewCached(service, (*it).Vars, now))
+		{
+			answerViewFromCache(service, (*it).Rid, (*it).Vars);
+			it = service.ViewWaiters.erase(it);
+		}
+		else
+		{
+			// some variables of an older fetch are too old now
+			addPendingViewVars(service, (*it).Vars, now);
+			it++;
+		}
+	}
+}
+
 void cleanRequests()
 {
 	uint32 currentTime = CTime::getSecondsSince1970();
@@ -752,6 +981,7 @@ void cleanRequests()
 							values.clear();
 							values.push_back(s);
 							aesAddRequestAnswer(Requests[i].Id, varNames, values);
+							removeViewWaiters(Services[j], Requests[i].Id);
 							break;
 						}
 					}
@@ -923,7 +1153,15 @@ void treatRequestForRunnignService(uint32 rid, TServices::iterator sit, const st
 		}
 	}
 
-	if (send)
+	vector<string> vars;
+	if (send && ViewCacheTTL.get() != 0 && getCacheableViewVars(*sit, subvarpath, vars))
+	{
+		// the view is answered from the cache, or with the other views of the service at the next update
+		addRequestWaitingNb(rid);
+		sit->WaitingRequestId.push_back(rid);
+		addViewWaiter(*sit, rid, vars);
+	}
+	else if (send)
 	{
 		// now send the request to the service
 		addRequestWaitingNb(rid);
@@ -1278,6 +1516,13 @@ static void cbView(CMessage &msgin, const std::string &serviceName, TServiceId s
 		}
 		answer.push_back(SAdminViewRow(varNames,values));
 	}
+
+	if (rid != 0 && rid == (*sit).ViewFetchId)
+	{
+		receiveViewFetch(*sit, answer);
+		return;
+	}
+
 	aesAddRequestAnswer(rid, answer);
 	
 	// remove the waiting request
@@ -1478,6 +1723,7 @@ public:
 
 	bool update()
 	{
+		fetchViews();
 		cleanRequests();
 		checkWaitingServices();
 		checkPingPong();
@@ -1535,6 +1781,9 @@ NLMISC_COMMAND(displayRequests, "display all pending requests", "")
 	return true;
 }
 
+NLMISC_VARIABLE(uint32, NbViewFetches, "number of GET_VIEW sent to the services for the batched views");
+NLMISC_VARIABLE(uint32, NbViewCacheHits, "number of views answered from the cache without asking the service");
+
 NLMISC_COMMAND(sendAdminEmail, "Send an email to admin", "<text>")
 {
 	if(args.size() <= 0)
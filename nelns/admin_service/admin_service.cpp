@@ -59,6 +59,7 @@
 #include <mysql.h>
 
 #include "connection_web.h"
+#include "time_series.h"
 
 
 //
@@ -394,48 +395,84 @@ static void cbAdminEmail (CMessage &msgin, const std::string &serviceName, TServ
 	sendAdminAlert (str.c_str());
 }
 
+// the graph variables are stored by the admin service, and by rrdtool for the web pages unless UseRRDTool is 0
+CTimeSeriesStore GraphStore;
+static bool UseRRDTool = true;
+
+static void rrdUpdate (const string &name, const string &var, uint32 time, sint32 val)
+{
+	string path = CPath::standardizePath (IService::getInstance()->ConfigFile.getVar("RRDVarPath").asString());
+	string rrdfilename = path + name + ".rrd";
+
+	string arg;
+	
+	if (!NLMISC::CFile::fileExists(rrdfilename))
+	{
+		MYSQL_ROW row = sqlQuery ("select graph_update from variable where path like '%%%s' and graph_update!=0", var.c_str());
+		if (row != NULL)
+		{
+			uint32 freq = atoi(row[0]);
+			arg = "create "+rrdfilename+" --step "+toString(freq)+" DS:var:GAUGE:"+toString(freq*2)+":U:U RRA:AVERAGE:0.5:1:1000 RRA:AVERAGE:0.5:10:1000 RRA:AVERAGE:0.5:100:1000";
+			launchProgram(IService::getInstance()->ConfigFile.getVar("RRDToolPath").asString(), arg);
+		}
+		else
+		{
+			nlwarning ("Can't create the rrd because no graph_update in database");
+		}
+		sqlFlushResult();
+	}
+
+	arg = "update " + rrdfilename + " " + toString (time) + ":" + toString(val);
+	launchProgram(IService::getInstance()->ConfigFile.getVar("RRDToolPath").asString(), arg);
+}
+
+static void graphUpdate (const string &name, const string &var, uint32 time, sint32 val)
+{
+	CTimeSeries *series = GraphStore.get (name);
+	if (series == NULL)
+	{
+		// first sample of the variable, the database gives its frequency
+		MYSQL_ROW row = sqlQuery ("select graph_update from variable where path like '%%%s' and graph_update!=0", var.c_str());
+		if (row != NULL)
+		{
+			uint32 freq = atoi(row[0]);
+			if (freq != 0)
+				series = GraphStore.create (name, freq);
+		}
+		else
+		{
+			nlwarning ("Can't create the graph because no graph_update in database");
+		}
+		sqlFlushResult();
+	}
+
+	if (series != NULL)
+		series->update (time, (double)val);
+}
+
 static void cbGraphUpdate (CMessage &msgin, const std::string &serviceName, TServiceId sid)
 {
 	uint32 CurrentTime;
 	msgin.serial (CurrentTime);
 
+	AESIT aesit = findAES (sid);
+
 	while (msgin.getPos() < (sint32)msgin.length())
 	{
 		string var, service;
 		sint32 val;
 		msgin.serial (service, var, val);
 
-		AESIT aesit = findAES (sid);
-		
 		string shard, server;
 		shard = (*aesit).Shard;
 		server = (*aesit).Name;
 		
 		if (!shard.empty() && !server.empty() && !service.empty() && !var.empty())
 		{
-			string path = CPath::standardizePath (IService::getInstance()->ConfigFile.getVar("RRDVarPath").asString());
-			string rrdfilename = path + shard+"."+server+"."+service+"."+var+".rrd";
-
-			string arg;
-			
-			if (!NLMISC::CFile::fileExists(rrdfilename))
-			{
-				MYSQL_ROW row = sqlQuery ("select graph_update from variable where path like '%%%s' and graph_update!=0", var.c_str());
-				if (row != NULL)
-				{
-					uint32 freq = atoi(row[0]);
-					arg = "create "+rrdfilename+" --step "+toString(freq)+" DS:var:GAUGE:"+toString(freq*2)+":U:U RRA:AVERAGE:0.5:1:1000 RRA:AVERAGE:0.5:10:1000 RRA:AVERAGE:0.5:100:1000";
-					launchProgram(IService::getInstance()->ConfigFile.getVar("RRDToolPath").asString(), arg);
-				}
-				else
-				{
-					nlwarning ("Can't create the rrd because no graph_update in database");
-				}
-				sqlFlushResult();
-			}
-
-			arg = "update " + rrdfilename + " " + toString (CurrentTime) + ":" + toString(val);
-			launchProgram(IService::getInstance()->ConfigFile.getVar("RRDToolPath").asString(), arg);
+			string name = shard+"."+server+"."+service+"."+var;
+			graphUpdate (name, var, CurrentTime, val);
+			if (UseRRDTool)
+				rrdUpdate (name, var, CurrentTime, val);
 		}
 		else
 		{
@@ -444,6 +481,32 @@ static void cbGraphUpdate (CMessage &msgin, const std::string &serviceName, TSer
 	}
 }
 
+/*
+ * Get the values of a graph variable (shard.server.service.var) of the last seconds,
+ * one "time value" line by row of the graph, an unknown value is "nan"
+ */
+string getGraph (const string &name, uint32 seconds)
+{
+	CTimeSeries *series = GraphStore.get (name);
+	if (series == NULL)
+		return "";
+
+	uint32 now = CTime::getSecondsSince1970 ();
+	CTimeSeries::TValues values;
+	series->fetch ((seconds < now) ? now - seconds : 0, now, values);
+
+	string res;
+	for (uint i = 0; i < values.size (); i++)
+	{
+		// NaN is the only value that is not equal to itself
+		if (values[i].second == values[i].second)
+			res += toString ("%u %g\n", values[i].first, values[i].second);
+		else
+			res += toString ("%u nan\n", values[i].first);
+	}
+	return res;
+}
+
 
 //
 // Request functions
@@ -1165,6 +1228,13 @@ public:
 
 		sqlInit ();
 
+		if (ConfigFile.exists ("UseRRDTool"))
+			UseRRDTool = ConfigFile.getVar ("UseRRDTool").asBool ();
+		uint32 flushPeriod = 60;
+		if (ConfigFile.exists ("GraphFlushPeriod"))
+			flushPeriod = ConfigFile.getVar ("GraphFlushPeriod").asInt ();
+		GraphStore.init (ConfigFile.getVar ("RRDVarPath").asString (), flushPeriod);
+
 		connectionWebInit ();
 
 		//CVarPath toto ("[toto");
@@ -1192,12 +1262,14 @@ public:
 		connectionWebUpdate ();
 		
 		updateSendAdminAlert ();
+		GraphStore.update ();
 		return true;
 	}
 
 	void release ()
 	{
 		connectionWebRelease ();
+		GraphStore.release ();
 	}
 };
 
@@ -1258,3 +1330,21 @@ NLMISC_COMMAND (generateAlert, "generate an alert", "<text>")
 
 	return true;
 }
+
+NLMISC_COMMAND (displayGraph, "display the values of a graph variable", "<shard.server.service.var> [<seconds>]")
+{
+	if(args.size() != 1 && args.size() != 2) return false;
+
+	uint32 seconds = 1200;
+	if (args.size() == 2)
+		seconds = atoi (args[1].c_str());
+
+	string res = getGraph (args[0], seconds);
+	vector<string> lines;
+	explode (res, string("\n"), lines, true);
+	log.displayNL ("Display %d values of '%s'", lines.size (), args[0].c_str ());
+	for (uint i = 0; i < lines.size (); i++)
+		log.displayNL ("%s", lines[i].c_str ());
+
+	return true;
+}
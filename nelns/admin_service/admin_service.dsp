@@ -164,5 +164,13 @@ SOURCE=.\connection_web.cpp
 
 SOURCE=.\connection_web.h
 # End Source File
+# Begin Source File
+
+SOURCE=.\time_series.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\time_series.h
+# End Source File
 # End Target
 # End Project
@@ -30,6 +30,7 @@
 #include "nel/net/service.h"
 
 void addRequest (const std::string &rawvarpath, NLNET::TSockId from);
+std::string getGraph (const std::string &name, uint32 seconds);
 
 #endif // NL_ADMIN_SERVICE_H
 
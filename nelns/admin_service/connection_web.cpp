@@ -42,6 +42,7 @@
 #include "nel/net/service.h"
 
 #include "admin_service.h"
+#include "connection_web.h"
 
 //
 // Namespaces
@@ -70,11 +71,21 @@ void cbGetRequest (CMemStream &msgin, TSockId host)
 	addRequest (rawvarpath, host);
 }
 
+void cbGetGraph (CMemStream &msgin, TSockId host)
+{
+	string name;
+	uint32 seconds;
+	msgin.serial (name);
+	msgin.serial (seconds);
+	sendString (host, getGraph (name, seconds));
+}
+
 typedef void (*WebCallback)(CMemStream &msgin, TSockId host);
 
 WebCallback WebCallbackArray[] =
 {
 	cbGetRequest,
+	cbGetGraph,
 };
 
 //
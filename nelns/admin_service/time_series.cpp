@@ -0,0 +1,347 @@
+/** \file time_series.cpp
+ * Round robin time series stored in memory mapped files, for the graphs of the admin service
+ *
+ * $Id$
+ */
+
+/* Copyright, 2001 Nevrax Ltd.
+ *
+ * This file is part of NEVRAX NeL Network Services.
+ * NEVRAX NeL Network Services is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+
+ * NEVRAX NeL Network Services is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with NEVRAX NeL Network Services; see the file COPYING. If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#include "nel/misc/types_nl.h"
+
+#include <math.h>
+#include <string.h>
+#include <limits>
+
+#ifdef NL_OS_WINDOWS
+#	define NOMINMAX
+#	include <windows.h>
+#else
+#	include <sys/types.h>
+#	include <sys/stat.h>
+#	include <sys/mman.h>
+#	include <fcntl.h>
+#	include <unistd.h>
+#	include <errno.h>
+#endif
+
+#include "nel/misc/debug.h"
+#include "nel/misc/path.h"
+#include "nel/misc/time_nl.h"
+
+#include "time_series.h"
+
+
+//
+// Namespaces
+//
+
+using namespace std;
+using namespace NLMISC;
+
+
+//
+// Variables
+//
+
+static const char	TimeSeriesMagic[4] = { 'N', 'L', 'T', 'S' };
+static const uint32	TimeSeriesVersion = 1;
+
+// like rrdtool, rows of 1, 10 and 100 steps
+static const uint32	StepsByRow[CTimeSeries::NbArchives] = { 1, 10, 100 };
+
+
+//
+// CTimeSeries
+//
+
+CTimeSeries::CTimeSeries () : _Header(NULL)
+{
+#ifdef NL_OS_WINDOWS
+	_File = INVALID_HANDLE_VALUE;
+	_Mapping = NULL;
+#endif // NL_OS_WINDOWS
+}
+
+CTimeSeries::~CTimeSeries ()
+{
+	close ();
+}
+
+bool CTimeSeries::map (const string &filename, bool create)
+{
+	close ();
+	_FileName = filename;
+
+#ifdef NL_OS_WINDOWS
+	_File = CreateFileA (filename.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, create ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (_File == INVALID_HANDLE_VALUE)
+	{
+		nlwarning ("TS: Can't open '%s'", filename.c_str());
+		return false;
+	}
+	if (!create && GetFileSize (_File, NULL) != FileSize)
+	{
+		nlwarning ("TS: '%s' is not a time series file", filename.c_str());
+		close ();
+		return false;
+	}
+	_Mapping = CreateFileMapping (_File, NULL, PAGE_READWRITE, 0, FileSize, NULL);
+	if (_Mapping != NULL)
+		_Header = (CHeader*)MapViewOfFile (_Mapping, FILE_MAP_ALL_ACCESS, 0, 0, FileSize);
+#else
+	int fd = ::open (filename.c_str(), create ? (O_RDWR | O_CREAT | O_TRUNC) : O_RDWR, 0644);
+	if (fd == -1)
+	{
+		nlwarning ("TS: Can't open '%s': %s", filename.c_str(), strerror(errno));
+		return false;
+	}
+	struct stat st;
+	if (create ? (ftruncate (fd, FileSize) != 0) : (fstat (fd, &st) != 0 || st.st_size != FileSize))
+	{
+		nlwarning ("TS: '%s' is not a time series file", filename.c_str());
+		::close (fd);
+		return false;
+	}
+	void *data = mmap (NULL, FileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	// the mapping stays valid without the file descriptor
+	::close (fd);
+	if (data != MAP_FAILED)
+		_Header = (CHeader*)data;
+#endif // NL_OS_WINDOWS
+
+	if (_Header == NULL)
+	{
+		nlwarning ("TS: Can't map '%s'", filename.c_str());
+		close ();
+		return false;
+	}
+	return true;
+}
+
+bool CTimeSeries::create (const string &filename, uint32 step)
+{
+	nlassert (step > 0);
+	if (!map (filename, true))
+		return false;
+
+	memcpy (_Header->Magic, TimeSeriesMagic, sizeof(TimeSeriesMagic));
+	_Header->Version = TimeSeriesVersion;
+	_Header->Step = step;
+	_Header->NbArchives = NbArchives;
+	_Header->NbRows = NbRows;
+	_Header->Padding = 0;
+	for (uint a = 0; a < NbArchives; a++)
+	{
+		CArchive &archive = _Header->Archives[a];
+		archive.Sum = 0.0;
+		archive.StepsByRow = StepsByRow[a];
+		archive.CurrentRow = 0;
+		archive.Count = 0;
+		archive.Padding = 0;
+
+		double *r = rows (a);
+		for (uint i = 0; i < NbRows; i++)
+			r[i] = numeric_limits<double>::quiet_NaN ();
+	}
+	return true;
+}
+
+bool CTimeSeries::open (const string &filename)
+{
+	if (!map (filename, false))
+		return false;
+
+	if (memcmp (_Header->Magic, TimeSeriesMagic, sizeof(TimeSeriesMagic)) != 0 || _Header->Version != TimeSeriesVersion
+		|| _Header->NbArchives != NbArchives || _Header->NbRows != NbRows || _Header->Step == 0)
+	{
+		nlwarning ("TS: '%s' is not a time series file or has another version", filename.c_str());
+		close ();
+		return false;
+	}
+	return true;
+}
+
+void CTimeSeries::close ()
+{
+#ifdef NL_OS_WINDOWS
+	if (_Header != NULL)
+		UnmapViewOfFile (_Header);
+	if (_Mapping != NULL)
+		CloseHandle (_Mapping);
+	if (_File != INVALID_HANDLE_VALUE)
+		CloseHandle (_File);
+	_Mapping = NULL;
+	_File = INVALID_HANDLE_VALUE;
+#else
+	if (_Header != NULL)
+		munmap (_Header, FileSize);
+#endif // NL_OS_WINDOWS
+	_Header = NULL;
+}
+
+void CTimeSeries::update (uint32 time, double value)
+{
+	nlassert (_Header != NULL);
+
+	for (uint a = 0; a < NbArchives; a++)
+	{
+		CArchive &archive = _Header->Archives[a];
+		uint32 row = time / (_Header->Step * archive.StepsByRow);
+
+		if (row < archive.CurrentRow)
+			continue;
+
+		if (row > archive.CurrentRow)
+		{
+			double *r = rows (a);
+
+			// finish the current row, the rows without sample are unknown
+			if (archive.Count != 0)
+				r[archive.CurrentRow % NbRows] = archive.Sum / archive.Count;
+			uint32 last = std::min (row, archive.CurrentRow + NbRows);
+			for (uint32 i = archive.CurrentRow + 1; i < last; i++)
+				r[i % NbRows] = numeric_limits<double>::quiet_NaN ();
+
+			archive.CurrentRow = row;
+			archive.Sum = 0.0;
+			archive.Count = 0;
+		}
+
+		archive.Sum += value;
+		archive.Count++;
+	}
+}
+
+void CTimeSeries::fetch (uint32 start, uint32 end, TValues &values) const
+{
+	nlassert (_Header != NULL);
+	values.clear ();
+	if (end < start)
+		return;
+
+	// the finest archive that still has start, the coarsest one otherwise
+	uint a;
+	for (a = 0; a < NbArchives - 1; a++)
+	{
+		const CArchive &archive = _Header->Archives[a];
+		if (start / (_Header->Step * archive.StepsByRow) + NbRows > archive.CurrentRow)
+			break;
+	}
+
+	const CArchive &archive = _Header->Archives[a];
+	const double *r = rows (a);
+	uint32 rowDuration = _Header->Step * archive.StepsByRow;
+	uint32 last = std::min (end / rowDuration, archive.CurrentRow);
+	for (uint32 row = start / rowDuration; row <= last; row++)
+	{
+		double value;
+		if (row == archive.CurrentRow)
+			value = (archive.Count != 0) ? archive.Sum / archive.Count : numeric_limits<double>::quiet_NaN ();
+		else if (row + NbRows > archive.CurrentRow)
+			value = r[row % NbRows];
+		else
+			value = numeric_limits<double>::quiet_NaN ();
+		values.push_back (make_pair (row * rowDuration, value));
+	}
+}
+
+void CTimeSeries::flush ()
+{
+	if (_Header == NULL)
+		return;
+
+#ifdef NL_OS_WINDOWS
+	FlushViewOfFile (_Header, FileSize);
+#else
+	msync (_Header, FileSize, MS_ASYNC);
+#endif // NL_OS_WINDOWS
+}
+
+
+//
+// CTimeSeriesStore
+//
+
+void CTimeSeriesStore::init (const string &path, uint32 flushPeriod)
+{
+	_Path = CPath::standardizePath (path);
+	_FlushPeriod = flushPeriod;
+	_LastFlush = CTime::getSecondsSince1970 ();
+}
+
+void CTimeSeriesStore::release ()
+{
+	for (map<string, CTimeSeries*>::iterator it = _Series.begin(); it != _Series.end(); ++it)
+	{
+		(*it).second->flush ();
+		delete (*it).second;
+	}
+	_Series.clear ();
+}
+
+CTimeSeries *CTimeSeriesStore::get (const string &name)
+{
+	map<string, CTimeSeries*>::iterator it = _Series.find (name);
+	if (it != _Series.end())
+		return (*it).second;
+
+	string filename = getFileName (name);
+	if (!CFile::fileExists (filename))
+		return NULL;
+
+	CTimeSeries *series = new CTimeSeries;
+	if (!series->open (filename))
+	{
+		delete series;
+		return NULL;
+	}
+	_Series.insert (make_pair (name, series));
+	return series;
+}
+
+CTimeSeries *CTimeSeriesStore::create (const string &name, uint32 step)
+{
+	map<string, CTimeSeries*>::iterator it = _Series.find (name);
+	if (it != _Series.end())
+	{
+		delete (*it).second;
+		_Series.erase (it);
+	}
+
+	CTimeSeries *series = new CTimeSeries;
+	if (!series->create (getFileName (name), step))
+	{
+		delete series;
+		return NULL;
+	}
+	_Series.insert (make_pair (name, series));
+	return series;
+}
+
+void CTimeSeriesStore::update ()
+{
+	uint32 now = CTime::getSecondsSince1970 ();
+	if (now < _LastFlush + _FlushPeriod)
+		return;
+	_LastFlush = now;
+
+	for (map<string, CTimeSeries*>::iterator it = _Series.begin(); it != _Series.end(); ++it)
+		(*it).second->flush ();
+}
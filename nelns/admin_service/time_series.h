@@ -0,0 +1,154 @@
+/** \file time_series.h
+ * Round robin time series stored in memory mapped files, for the graphs of the admin service
+ *
+ * $Id$
+ */
+
+/* Copyright, 2001 Nevrax Ltd.
+ *
+ * This file is part of NEVRAX NeL Network Services.
+ * NEVRAX NeL Network Services is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+
+ * NEVRAX NeL Network Services is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with NEVRAX NeL Network Services; see the file COPYING. If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#ifndef NL_TIME_SERIES_H
+#define NL_TIME_SERIES_H
+
+#include "nel/misc/types_nl.h"
+
+#include <string>
+#include <vector>
+#include <map>
+
+
+/**
+ * A variable sampled every step seconds, averaged in NbArchives round robin
+ * archives of NbRows rows, of 1, 10 and 100 steps by row (the archives of
+ * the rrd files the admin service created with rrdtool).
+ *
+ * The file is memory mapped: an update only writes in memory, the system
+ * writes the pages back, flush() asks it to do it now. The file is in the
+ * byte order of the host.
+ *
+ * Row b of an archive with rows of r seconds averages the samples of
+ * [b*r, (b+1)*r[ and is stored at b % NbRows. The current row isn't
+ * finished, its sum is kept in the archive header.
+ */
+class CTimeSeries
+{
+public:
+
+	enum { NbArchives = 3, NbRows = 1000 };
+
+	typedef std::vector<std::pair<uint32, double> >	TValues;
+
+	CTimeSeries ();
+	~CTimeSeries ();
+
+	/// Create the file, a sample every step seconds
+	bool		create (const std::string &filename, uint32 step);
+	/// Open an existing file
+	bool		open (const std::string &filename);
+	void		close ();
+
+	/// Add a sample at time (in seconds), the samples older than the current rows are ignored
+	void		update (uint32 time, double value);
+
+	/** Get the values between start and end, from the finest archive that has start.
+	 * The time of a value is the start of its row, an unknown value is NaN.
+	 */
+	void		fetch (uint32 start, uint32 end, TValues &values) const;
+
+	/// Ask the system to write the modified pages, without waiting
+	void		flush ();
+
+	uint32		getStep () const { return _Header->Step; }
+	const std::string &getFileName () const { return _FileName; }
+
+private:
+
+	struct CArchive
+	{
+		double	Sum;
+		uint32	StepsByRow;
+		uint32	CurrentRow;
+		uint32	Count;
+		uint32	Padding;
+	};
+
+	struct CHeader
+	{
+		char		Magic[4];
+		uint32		Version;
+		uint32		Step;
+		uint32		NbArchives;
+		uint32		NbRows;
+		uint32		Padding;
+		CArchive	Archives[CTimeSeries::NbArchives];
+	};
+
+	enum { FileSize = sizeof(CHeader) + NbArchives * NbRows * sizeof(double) };
+
+	bool		map (const std::string &filename, bool create);
+
+	double		*rows (uint archive) const { return (double*)(_Header + 1) + archive * NbRows; }
+
+	std::string	_FileName;
+	CHeader		*_Header;
+#ifdef NL_OS_WINDOWS
+	void		*_File;
+	void		*_Mapping;
+#endif // NL_OS_WINDOWS
+};
+
+
+/**
+ * The time series of a directory, opened on their first use.
+ */
+class CTimeSeriesStore
+{
+public:
+
+	CTimeSeriesStore () : _FlushPeriod(60), _LastFlush(0) { }
+	~CTimeSeriesStore () { release (); }
+
+	/// The series are in path, flushed every flushPeriod seconds
+	void		init (const std::string &path, uint32 flushPeriod);
+	void		release ();
+
+	/// Get the series, opened if its file exists, NULL otherwise
+	CTimeSeries	*get (const std::string &name);
+	/// Create the series, a sample every step seconds
+	CTimeSeries	*create (const std::string &name, uint32 step);
+
+	/// Flush the series when the period is elapsed, called by the service update
+	void		update ();
+
+	uint		getNbSeries () const { return (uint)_Series.size (); }
+
+private:
+
+	std::string	getFileName (const std::string &name) const { return _Path + name + ".nts"; }
+
+	std::map<std::string, CTimeSeries*>	_Series;
+	std::string							_Path;
+	uint32								_FlushPeriod;
+	uint32								_LastFlush;
+};
+
+
+#endif // NL_TIME_SERIES_H
+
+/* End of time_series.h */
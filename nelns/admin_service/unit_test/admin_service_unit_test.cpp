@@ -0,0 +1,180 @@
+#include "nel/misc/types_nl.h"
+#include "nel/misc/debug.h"
+#include "nel/misc/path.h"
+#include "nel/misc/file.h"
+#include "nel/misc/dynloadlib.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include "cpptest.h"
+
+#include "time_series.h"
+
+using namespace std;
+using namespace NLMISC;
+
+// Test library of the admin service, to load from the TestDllList of the nel_unit_test test_suite.cfg
+class CAdminServiceUnitTestNelLibrary : public INelLibrary {
+	void onLibraryLoaded(bool firstTime) { }
+	void onLibraryUnloaded(bool lastTime) { }
+};
+NLMISC_DECL_PURE_LIB(CAdminServiceUnitTestNelLibrary);
+
+// Test suite for the time series of the graphs
+class CTimeSeriesTS : public Test::Suite
+{
+public:
+	CTimeSeriesTS(const std::string &workingPath)
+	{
+		_WorkingPath = workingPath;
+		TEST_ADD(CTimeSeriesTS::wrapAround);
+		TEST_ADD(CTimeSeriesTS::consolidation);
+		TEST_ADD(CTimeSeriesTS::reopen);
+	}
+
+private:
+
+	enum { Step = 10 };
+
+	string	_RestorePath;
+	string	_WorkingPath;
+	string	_FileName;
+
+	void setup()
+	{
+		_RestorePath = CPath::getCurrentPath();
+		CPath::setCurrentPath(_WorkingPath.c_str());
+		_FileName = "test_series.nts";
+	}
+
+	void tear_down()
+	{
+		CFile::deleteFile(_FileName);
+		CPath::setCurrentPath(_RestorePath.c_str());
+	}
+
+	static bool isUnknown(double value)
+	{
+		return value != value;
+	}
+
+	// A sample every step during 3 times the rows of the finest archive, the value is its row
+	void fill(CTimeSeries &series)
+	{
+		for (uint32 t = 0; t < 3 * CTimeSeries::NbRows * Step; t += Step)
+			series.update(t, (double)(t / Step));
+	}
+
+	void wrapAround()
+	{
+		CTimeSeries series;
+		TEST_ASSERT(series.create(_FileName, Step));
+		fill(series);
+
+		// the last rows, stored over the first ones
+		CTimeSeries::TValues values;
+		uint32 last = 3 * CTimeSeries::NbRows - 1;
+		series.fetch((last - 99) * Step, last * Step, values);
+		TEST_ASSERT(values.size() == 100);
+		bool same = true;
+		for (uint i = 0; i < values.size(); i++)
+		{
+			if (values[i].first != (last - 99 + i) * Step || values[i].second != (double)(last - 99 + i))
+				same = false;
+		}
+		TEST_ASSERT(same);
+
+		// the oldest row still in the finest archive
+		series.fetch((last + 1 - CTimeSeries::NbRows) * Step, (last + 1 - CTimeSeries::NbRows) * Step, values);
+		TEST_ASSERT(values.size() == 1);
+		TEST_ASSERT(values[0].second == (double)(last + 1 - CTimeSeries::NbRows));
+
+		// the rows without sample are unknown
+		uint32 next = (last + 51) * Step;
+		series.update(next, 7.0);
+		series.fetch(last * Step, next, values);
+		TEST_ASSERT(values.size() == 52);
+		TEST_ASSERT(values[0].second == (double)last);
+		TEST_ASSERT(isUnknown(values[1].second));
+		TEST_ASSERT(isUnknown(values[50].second));
+		TEST_ASSERT(values[51].second == 7.0);
+	}
+
+	void consolidation()
+	{
+		CTimeSeries series;
+		TEST_ASSERT(series.create(_FileName, Step));
+
+		// the samples of a row are averaged
+		series.update(1000, 1.0);
+		series.update(1005, 3.0);
+		series.update(1010, 5.0);
+		CTimeSeries::TValues values;
+		series.fetch(1000, 1010, values);
+		TEST_ASSERT(values.size() == 2);
+		TEST_ASSERT(values[0].first == 1000);
+		TEST_ASSERT(values[0].second == 2.0);
+		TEST_ASSERT(values[1].second == 5.0);
+
+		// the rows too old for the finest archive come from the rows of 10 steps
+		TEST_ASSERT(series.create(_FileName, Step));
+		fill(series);
+		series.fetch(1000 * Step, 1099 * Step, values);
+		TEST_ASSERT(values.size() == 10);
+		TEST_ASSERT(values[0].first == 1000 * Step);
+		TEST_ASSERT(values[0].second == 1004.5);
+		TEST_ASSERT(values[9].first == 1090 * Step);
+		TEST_ASSERT(values[9].second == 1094.5);
+
+		// and the first rows from the rows of 100 steps
+		series.update(12000 * Step, 0.0);
+		series.fetch(0, 99 * Step, values);
+		TEST_ASSERT(values.size() == 1);
+		TEST_ASSERT(values[0].second == 49.5);
+	}
+
+	void reopen()
+	{
+		{
+			CTimeSeries series;
+			TEST_ASSERT(series.create(_FileName, Step));
+			series.update(1000, 4.0);
+			series.update(1010, 6.0);
+			series.flush();
+		}
+
+		// the rows and the current row are kept in the file
+		CTimeSeries series;
+		TEST_ASSERT(series.open(_FileName));
+		TEST_ASSERT(series.getStep() == Step);
+		CTimeSeries::TValues values;
+		series.fetch(1000, 1010, values);
+		TEST_ASSERT(values.size() == 2);
+		TEST_ASSERT(values[0].second == 4.0);
+		TEST_ASSERT(values[1].second == 6.0);
+
+		series.update(1015, 8.0);
+		series.fetch(1010, 1010, values);
+		TEST_ASSERT(values.size() == 1);
+		TEST_ASSERT(values[0].second == 7.0);
+		series.close();
+
+		// a file of another size is not a time series
+		{
+			COFile f(_FileName);
+			uint32 i = 0;
+			f.serial(i);
+		}
+		TEST_ASSERT(!series.open(_FileName));
+		TEST_ASSERT(!series.open("unknown_series.nts"));
+	}
+};
+
+
+auto_ptr<Test::Suite> intRegisterTestSuite(const std::string &workingPath)
+{
+	return auto_ptr<Test::Suite>(static_cast<Test::Suite*>(new CTimeSeriesTS(workingPath)));
+}
+
+NL_LIB_EXPORT_SYMBOL(registerTestSuite, void, intRegisterTestSuite);
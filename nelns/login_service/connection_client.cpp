@@ -76,228 +76,332 @@ void sendToClient(CMessage &msgout, TSockId sockId)
 	ClientsServer->send(msgout, sockId);
 }
 
-void string_escape(string &str)
+// client connections by socket, a database job checks that its client is still the same one
+static map<TSockId, uint32> ConnectedClients;
+static uint32 NextClientConnection = 0;
+
+static uint32 getClientConnection(TSockId from)
+{
+	map<TSockId, uint32>::iterator it = ConnectedClients.find(from);
+	return (it == ConnectedClients.end()) ? 0 : (*it).second;
+}
+
+// Find the client that has the address of a login cookie
+static TSockId findClient(uint32 userAddr)
 {
-	string::size_type pos = 0;
-	while((pos=str.find('\'')) != string::npos)
+	for (map<TSockId, uint32>::iterator it = ConnectedClients.begin(); it != ConnectedClients.end(); ++it)
 	{
-		str.replace(pos, 1, " ");
+		if ((uint32)(uintptr_t)(*it).first == userAddr)
+			return (*it).first;
 	}
+	return InvalidSockId;
 }
 
-static void cbClientVerifyLoginPassword(CMessage &msgin, TSockId from, CCallbackNetBase &netbase)
+// Cookies of a client, for a "like" query
+static string cookiePattern(uint32 userAddr)
 {
-	//
-	// S03: check the validity of the client login/password and send "VLP" message to client
-	//
+	return toString("%08X|%%", userAddr);
+}
 
-	// reason is empty if everything goes right or contains the reason of the failure
-	string reason;
-	sint32 uid = -1;
-	ucstring login;
-	string cpassword, application;
-	msgin.serial (login);
-	msgin.serial (cpassword);
-	msgin.serial (application);
+// Key of the database jobs of a client (its cookie address): the jobs of a client are run in the order
+// of its messages, so that its disconnection can't be written before its login, and the disconnection
+// of a client is written before the login of a new client that gets the same TSockId
+static uint32 clientJobKey(TSockId from)
+{
+	return (uint32)(uintptr_t)from;
+}
+
+/*
+ * A database job started by a client message, the answer is sent only if the client is still connected
+ */
+class CClientSqlJob : public ISqlJob
+{
+protected:
+	CClientSqlJob(TSockId from) : From(from), Connection(getClientConnection(from)) { }
+
+	bool isClientConnected() const { return Connection != 0 && getClientConnection(From) == Connection; }
+
+	TSockId	From;
+	uint32	Connection;
+	/// reason is empty if everything goes right or contains the reason of the failure
+	string	Reason;
+};
+
+class CVerifyLoginPasswordJob : public CClientSqlJob
+{
+public:
+	CVerifyLoginPasswordJob(TSockId from, const ucstring &login, const string &cpassword, const string &application)
+		: CClientSqlJob(from), Login(login), CPassword(cpassword), Application(application), UId(-1), AlreadyConnected(false)
+	{
+		AcceptUnknownUsers = (IService::getInstance ()->ConfigFile.getVar("AcceptUnknownUsers").asInt () == 1);
+		CookieKey = rand();
+	}
 
-	breakable
+	virtual void run(CSqlConnection &db)
 	{
-		CMysqlResult result;
-		MYSQL_ROW row;
-		sint32 nbrow;
-		const CInetAddress &ia = netbase.hostAddress (from);
-retry:
-		reason = sqlQuery("select * from user where Login='"+login.toUtf8()+"'", nbrow, row, result);
-		if(!reason.empty()) break;
-
-		if(nbrow == 0)
+		breakable
 		{
-			if(IService::getInstance ()->ConfigFile.getVar("AcceptUnknownUsers").asInt () == 1)
+			CSqlResult result;
+			if (!db.execute(CSqlQuery("select UId, Password, State from user where Login=?") << Login.toUtf8(), result))
 			{
+				Reason = result.Error;
+				break;
+			}
+
+			if(result.Rows.empty())
+			{
+				if(!AcceptUnknownUsers)
+				{
+					Reason = toString("Login '%s' doesn't exist", Login.toUtf8().c_str());
+					break;
+				}
+
 				// we accept new users, add it
-				string query = "insert into user (Login, Password) values ('"+login.toUtf8()+"', '"+cpassword+"')";
-				reason = sqlQuery(query, nbrow, row, result);
-				if (!reason.empty()) break;
-				nlinfo("The user %s was inserted in the database for the application '%s'!", login.toUtf8().c_str(), application.c_str());
-				goto retry;
+				if (!db.execute(CSqlQuery("insert into user (Login, Password) values (?, ?)") << Login.toUtf8() << CPassword, result))
+				{
+					Reason = result.Error;
+					break;
+				}
+				nlinfo("The user %s was inserted in the database for the application '%s'!", Login.toUtf8().c_str(), Application.c_str());
+
+				if (!db.execute(CSqlQuery("select UId, Password, State from user where Login=?") << Login.toUtf8(), result))
+				{
+					Reason = result.Error;
+					break;
+				}
 			}
-			else
+
+			if(result.Rows.size() != 1)
 			{
-				reason = toString("Login '%s' doesn't exist", login.toUtf8().c_str());
+				Reason = toString("Too much login '%s' exists", Login.toUtf8().c_str());
 				break;
 			}
-		}
 
-		if(nbrow != 1)
-		{
-			reason = toString("Too much login '%s' exists", login.toUtf8().c_str());
-			break;
-		}
+			// now the user is on the database
 
-		// now the user is on the database
+			const CSqlResult::TRow &user = result.Rows[0];
+			UId = atoi(user[0].c_str());
 
-		uid = atoi(row[0]);
+			if(CPassword != user[1])
+			{
+				Reason = toString("Bad password");
+				break;
+			}
 
-		if(cpassword != row[2])
-		{
-			reason = toString("Bad password");
-			break;
+			if(user[2] != "Offline")
+			{
+				// 2 players are trying to play with the same id, the already connected one is disconnected in done()
+				AlreadyConnected = true;
+				Reason = "You are already connected.";
+				break;
+			}
+
+			CLoginCookie c;
+			c.set((uint32)(uintptr_t)From, CookieKey, UId);
+
+			if (!db.execute(CSqlQuery("update user set State='Authorized', Cookie=? where UId=?") << c.setToString() << UId, result))
+			{
+				Reason = result.Error;
+				break;
+			}
+
+			if (!db.execute(CSqlQuery("select ShardId, NbPlayers, Name from shard where Online>0 and ClientApplication=?") << Application, Shards))
+			{
+				Reason = Shards.Error;
+				break;
+			}
 		}
+	}
 
-		if(row[4] != string("Offline"))
+	virtual void done()
+	{
+		if (AlreadyConnected)
 		{
-			// 2 players are trying to play with the same id, disconnect all
-			//reason = sqlQuery(string("update user set state='Offline', ShardId=-1 where UId=")+uid);
-			//if(!reason.empty()) break;
-
 			// send a message to the already connected player to disconnect
 			CMessage msgout("DC");
-			msgout.serial(uid);
+			msgout.serial(UId);
 			CUnifiedNetwork::getInstance()->send("WS", msgout);
-
-			reason = "You are already connected.";
-			break;
 		}
 
-		CLoginCookie c;
-		c.set((uint32)(uintptr_t)from, rand(), uid);
-
-		reason = sqlQuery("update user set state='Authorized', Cookie='"+c.setToString()+"' where UId="+uid);
-		if(!reason.empty()) break;
+		if (!isClientConnected())
+			return;
 
-		reason = sqlQuery("select * from shard where Online>0 and ClientApplication='"+application+"'", nbrow, row, result);
-		if(!reason.empty()) break;
-
-		// Send success message
-		CMessage msgout ("VLP");
-		msgout.serial(reason);
-		msgout.serial(nbrow);
-		
-		// send address and name of all online shards
-		while(row != 0)
+		if (Reason.empty())
 		{
-			// serial the name of the shard
-			ucstring shardname;
-			shardname.fromUtf8(row[3]);
-			uint8 nbplayers = atoi(row[2]);
-			uint32 sid = atoi(row[0]);
-			msgout.serial (shardname, nbplayers, sid);
-			row = mysql_fetch_row(result);
+			// Send success message
+			CMessage msgout ("VLP");
+			msgout.serial(Reason);
+			sint32 nbrow = (sint32)Shards.Rows.size();
+			msgout.serial(nbrow);
+
+			// send address and name of all online shards
+			for (uint i = 0; i < Shards.Rows.size(); i++)
+			{
+				// serial the name of the shard
+				ucstring shardname;
+				shardname.fromUtf8(Shards.Rows[i][2]);
+				uint8 nbplayers = atoi(Shards.Rows[i][1].c_str());
+				uint32 sid = atoi(Shards.Rows[i][0].c_str());
+				msgout.serial (shardname, nbplayers, sid);
+			}
+			ClientsServer->send (msgout, From);
+			ClientsServer->authorizeOnly ("CS", From);
+			return;
 		}
-		netbase.send (msgout, from);
-		netbase.authorizeOnly ("CS", from);
 
-		return;
+		// Manage error
+		CMessage msgout("VLP");
+		msgout.serial(Reason);
+		ClientsServer->send(msgout, From);
+		// FIX: On GNU/Linux, when we disconnect now, sometime the other side doesn't receive the message sent just before.
+		//      So it is the other side to disconnect
+		//		netbase.disconnect (from);
 	}
 
-	// Manage error
-	CMessage msgout("VLP");
-	if(reason.empty()) reason = "Unknown error";
-	msgout.serial(reason);
-	netbase.send(msgout, from);
-	// FIX: On GNU/Linux, when we disconnect now, sometime the other side doesn't receive the message sent just before.
-	//      So it is the other side to disconnect
-	//		netbase.disconnect (from);
-}
+private:
+	ucstring	Login;
+	string		CPassword, Application;
+	bool		AcceptUnknownUsers;
+	uint32		CookieKey;
 
-static void cbClientChooseShard(CMessage &msgin, TSockId from, CCallbackNetBase &netbase)
+	sint32		UId;
+	bool		AlreadyConnected;
+	CSqlResult	Shards;
+};
+
+static void cbClientVerifyLoginPassword(CMessage &msgin, TSockId from, CCallbackNetBase &netbase)
 {
 	//
-	// S06: receive "CS" message from client
+	// S03: check the validity of the client login/password and send "VLP" message to client
 	//
 
-	string reason;
+	ucstring login;
+	string cpassword, application;
+	msgin.serial (login);
+	msgin.serial (cpassword);
+	msgin.serial (application);
+
+	SqlExecutor.push(new CVerifyLoginPasswordJob(from, login, cpassword, application), clientJobKey(from));
+}
 
-	breakable
+class CChooseShardJob : public CClientSqlJob
+{
+public:
+	CChooseShardJob(TSockId from, sint32 shardId) : CClientSqlJob(from), ShardId(shardId)
 	{
-		CMysqlResult result;
-		MYSQL_ROW row;
-		sint32 nbrow;
-		reason = sqlQuery("select UId, Cookie, Privilege, ExtendedPrivilege from user where State='Authorized'", nbrow, row, result);
-		if(!reason.empty()) break;
+		// the shard internal id is checked after the database in run()
+		sint32 s = findShard (shardId);
+		ShardFound = (s != -1);
+		if (ShardFound)
+			ShardSId = Shards[s].SId;
+	}
 
-		if(nbrow == 0)
+	virtual void run(CSqlConnection &db)
+	{
+		breakable
 		{
-			reason = "You are not authorized to select a shard";
-			break;
-		}
+			CSqlResult result;
+			if (!db.execute(CSqlQuery("select UId, Cookie, Privilege, ExtendedPrivilege from user where State='Authorized' and Cookie like ?") << cookiePattern((uint32)(uintptr_t)From), result))
+			{
+				Reason = result.Error;
+				break;
+			}
 
-		bool ok = false;
-		while(row != 0)
-		{
-			CLoginCookie lc;
-			lc.setFromString(row[1]);
-			if(lc.getUserAddr() == (uint32)(uintptr_t)from)
+			if(result.Rows.empty())
 			{
-				ok = true;
+				Reason = "You are not authorized to select a shard";
+				break;
+			}
+
+			uint32 uid = atoui(result.Rows[0][0].c_str());
+			Cookie = result.Rows[0][1];
+			Priv = result.Rows[0][2];
+			ExPriv = result.Rows[0][3];
+
+			// it is ok, so we find the wanted shard
+			if (!db.execute(CSqlQuery("select ShardId from shard where ShardId=?") << ShardId, result))
+			{
+				Reason = result.Error;
+				break;
+			}
+
+			if(result.Rows.empty())
+			{
+				Reason = "This shard is not available";
 				break;
 			}
-			row = mysql_fetch_row(result);
-		}
-	
-		if(!ok)
-		{
-			reason = "You are not authorized to select a shard";
-			break;
-		}
 
-		string uid = row[0];
-		string cookie = row[1];
-		string priv = row[2];
-		string expriv = row[3];
+			if (!ShardFound)
+			{
+				Reason = "Cannot find the shard internal id";
+				break;
+			}
+
+			if (!db.execute(CSqlQuery("update user set State='Waiting', ShardId=? where UId=?") << ShardId << uid, result))
+			{
+				Reason = result.Error;
+				break;
+			}
 
-		// it is ok, so we find the wanted shard
-		sint32 shardid;
-		msgin.serial(shardid);
+			if (!db.execute(CSqlQuery("select Login from user where UId=?") << uid, result))
+			{
+				Reason = result.Error;
+				break;
+			}
 
-		reason = sqlQuery("select * from shard where ShardId="+toString(shardid), nbrow, row, result);
-		if(!reason.empty()) break;
+			if(result.Rows.empty())
+			{
+				Reason = "Cannot retrieve the username";
+				break;
+			}
 
-		if(nbrow == 0)
-		{
-			reason = "This shard is not available";
-			break;
+			Name.fromUtf8(result.Rows[0][0]);
 		}
+	}
 
-		sint32 s = findShard (shardid);
-		if (s == -1)
+	virtual void done()
+	{
+		if (Reason.empty())
 		{
-			reason = "Cannot find the shard internal id";
-			break;
+			CLoginCookie lc;
+			lc.setFromString(Cookie);
+			CMessage msgout("CS");
+			msgout.serial(lc, Name, Priv, ExPriv);
+			CUnifiedNetwork::getInstance()->send(ShardSId, msgout);
+			return;
 		}
-		TServiceId sid = Shards[s].SId;
 
-		reason = sqlQuery("update user set State='Waiting', ShardId="+toString(shardid)+" where UId="+uid);
-		if(!reason.empty()) break;
+		if (!isClientConnected())
+			return;
 
-		reason = sqlQuery("select Login from user where UId="+uid, nbrow, row, result);
-		if(!reason.empty()) break;
+		// Manage error
+		CMessage msgout("SCS");
+		msgout.serial(Reason);
+		ClientsServer->send(msgout, From);
+		// FIX: On GNU/Linux, when we disconnect now, sometime the other side doesn't receive the message sent just before.
+		//      So it's the other side to disconnect
+		//			netbase.disconnect (from);
+	}
 
-		if(nbrow == 0)
-		{
-			reason = "Cannot retrieve the username";
-			break;
-		}
+private:
+	sint32		ShardId;
+	bool		ShardFound;
+	TServiceId	ShardSId;
 
-		ucstring name;
-		name.fromUtf8(row[0]);
+	string		Cookie, Priv, ExPriv;
+	ucstring	Name;
+};
 
-		CLoginCookie lc;
-		lc.setFromString(cookie);
-		CMessage msgout("CS");
-		msgout.serial(lc, name, priv, expriv);
-		CUnifiedNetwork::getInstance()->send(sid, msgout);
+static void cbClientChooseShard(CMessage &msgin, TSockId from, CCallbackNetBase &netbase)
+{
+	//
+	// S06: receive "CS" message from client
+	//
 
-		return;
-	}
+	sint32 shardid;
+	msgin.serial(shardid);
 
-	// Manage error
-	CMessage msgout("SCS");
-	msgout.serial(reason);
-	netbase.send(msgout, from);
-	// FIX: On GNU/Linux, when we disconnect now, sometime the other side doesn't receive the message sent just before.
-	//      So it's the other side to disconnect
-	//			netbase.disconnect (from);
+	SqlExecutor.push(new CChooseShardJob(from, shardid), clientJobKey(from));
 }
 
 static void cbClientConnection (TSockId from, void *arg)
@@ -307,8 +411,32 @@ static void cbClientConnection (TSockId from, void *arg)
 	nldebug("new client connection: %s", ia.asString ().c_str ());
 	Output->displayNL ("CCC: Connection from %s", ia.asString ().c_str ());
 	cnb->authorizeOnly ("VLP", from);
+
+	if (++NextClientConnection == 0)
+		++NextClientConnection;
+	ConnectedClients[from] = NextClientConnection;
 }
 
+/*
+ * A client that is disconnected before choosing a shard is offline again
+ */
+class CClientDisconnectionJob : public ISqlJob
+{
+public:
+	CClientDisconnectionJob(TSockId from) : From(from) { }
+
+	virtual void run(CSqlConnection &db)
+	{
+		CSqlResult result;
+		db.execute(CSqlQuery("update user set State='Offline', ShardId=-1, Cookie='' where State='Authorized' and Cookie like ?") << cookiePattern((uint32)(uintptr_t)From), result);
+	}
+
+	virtual void done() { }
+
+private:
+	TSockId	From;
+};
+
 static void cbClientDisconnection (TSockId from, void *arg)
 {
 	CCallbackNetBase *cnb = ClientsServer;
@@ -316,36 +444,9 @@ static void cbClientDisconnection (TSockId from, void *arg)
 
 	nldebug("new client disconnection: %s", ia.asString ().c_str ());
 
-	string reason;
-	
-	CMysqlResult result;
-	MYSQL_ROW row;
-	sint32 nbrow;
-	reason = sqlQuery("select UId, State, Cookie from user where State!='Offline'", nbrow, row, result);
-	if(!reason.empty()) return;
-		
-	if(nbrow == 0)
-	{
-		return;
-	}
-	
-	while(row != 0)
-	{
-		CLoginCookie lc;
-		string str = row[2];
-		if(!str.empty())
-		{
-			lc.setFromString(str);
-			if(lc.getUserAddr() == (uint32)(uintptr_t)from)
-			{
-				// got it, if he is not in waiting state, it s not normal, remove all
-				if(row[1] == string("Authorized"))
-					sqlQuery("update user set state='Offline', ShardId=-1, Cookie='' where UId="+string(row[0]));
-				return;
-			}
-		}
-		row = mysql_fetch_row(result);
-	}
+	ConnectedClients.erase(from);
+
+	SqlExecutor.push(new CClientDisconnectionJob(from), clientJobKey(from));
 }
 
 
@@ -356,60 +457,84 @@ const TCallbackItem ClientCallbackArray[] =
 };
 
 
-static void cbWSShardChooseShard (CMessage &msgin, const std::string &serviceName, TServiceId sid)
+class CWSChooseShardJob : public ISqlJob
 {
-	//
-	// S10: receive "SCS" message from WS
-	//
-	CMessage msgout("SCS");
-
-	CLoginCookie cookie;
-	string reason;
+public:
+	CWSChooseShardJob(const string &reason, const CLoginCookie &cookie, const string &addr) : Reason(reason), Cookie(cookie), Addr(addr) { }
 
-	breakable
+	virtual void run(CSqlConnection &db)
 	{
-		msgin.serial (reason);
-		msgin.serial (cookie);
-
-		if(!reason.empty())
+		CSqlResult result;
+		if(!Reason.empty())
 		{
-			nldebug("SCS from WS failed: %s", reason.c_str());
-			sqlQuery("update user set state='Offline', ShardId=-1, Cookie='' where Cookie='" + cookie.setToString() + "'");
-			break;
+			db.execute(CSqlQuery("update user set State='Offline', ShardId=-1, Cookie='' where Cookie=?") << Cookie.setToString(), result);
+			return;
 		}
 
-		CMysqlResult result;
-		MYSQL_ROW row;
-		sint32 nbrow;
-		reason = sqlQuery("select UId, Cookie, Privilege, ExtendedPrivilege from user where Cookie='"+cookie.setToString()+"'", nbrow, row, result);
-		if(!reason.empty()) break;
-		if(nbrow != 1)
+		if (!db.execute(CSqlQuery("select UId from user where Cookie=?") << Cookie.setToString(), result))
 		{
-			reason = "More than one row was found";
+			Reason = result.Error;
+			return;
+		}
+		if(result.Rows.size() != 1)
+		{
+			Reason = "More than one row was found";
 			nldebug("SCS from WS failed with duplicate cookies, sending disconnect messages.");
-			// disconnect them all
-			while(row != 0)
-			{
-				CMessage msgout("DC");
-				uint32 uid = atoui(row[0]);
-				msgout.serial(uid);
-				CUnifiedNetwork::getInstance()->send("WS", msgout);
-				row = mysql_fetch_row(result);
-			}
-			break;
+			// disconnect them all in done()
+			for (uint i = 0; i < result.Rows.size(); i++)
+				Disconnect.push_back(atoui(result.Rows[i][0].c_str()));
 		}
+	}
 
-		msgout.serial(reason);
-		string str = cookie.setToString ();
-		msgout.serial (str);
-		string addr;
-		msgin.serial (addr);
-		msgout.serial (addr);
-		ClientsServer->send (msgout, (TSockId)cookie.getUserAddr ());
-		return;
+	virtual void done()
+	{
+		for (uint i = 0; i < Disconnect.size(); i++)
+		{
+			CMessage msgout("DC");
+			msgout.serial(Disconnect[i]);
+			CUnifiedNetwork::getInstance()->send("WS", msgout);
+		}
+
+		TSockId from = findClient(Cookie.getUserAddr ());
+		if (from == InvalidSockId)
+			return;
+
+		CMessage msgout("SCS");
+		msgout.serial(Reason);
+		if (Reason.empty())
+		{
+			string str = Cookie.setToString ();
+			msgout.serial (str);
+			msgout.serial (Addr);
+		}
+		ClientsServer->send (msgout, from);
 	}
-	msgout.serial(reason);
-	ClientsServer->send (msgout, (TSockId)cookie.getUserAddr ());
+
+private:
+	string			Reason;
+	CLoginCookie	Cookie;
+	string			Addr;
+	vector<uint32>	Disconnect;
+};
+
+static void cbWSShardChooseShard (CMessage &msgin, const std::string &serviceName, TServiceId sid)
+{
+	//
+	// S10: receive "SCS" message from WS
+	//
+
+	CLoginCookie cookie;
+	string reason, addr;
+
+	msgin.serial (reason);
+	msgin.serial (cookie);
+	if (reason.empty())
+		msgin.serial (addr);
+	else
+		nldebug("SCS from WS failed: %s", reason.c_str());
+
+	// after the "CS" job of the client
+	SqlExecutor.push(new CWSChooseShardJob(reason, cookie, addr), cookie.isValid() ? cookie.getUserAddr() : 0);
 }
 
 static const TUnifiedCallbackItem WSCallbackArray[] =
@@ -458,6 +583,7 @@ void connectionClientRelease ()
 {
 	nlassert(ClientsServer != 0);
 	
+	ConnectedClients.clear();
 	delete ClientsServer;
 	ClientsServer = 0;
 }
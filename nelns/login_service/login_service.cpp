@@ -337,6 +337,9 @@ public:
 
 	bool update ()
 	{
+		// answer the finished database jobs
+		sqlUpdate ();
+
 		connectionWSUpdate ();
 		if(UseDirectClient)
 			connectionClientUpdate ();
@@ -348,6 +351,9 @@ public:
 	/// release the service, save the universal time
 	void release ()
 	{
+		// the database jobs use the connections
+		sqlRelease ();
+
 		connectionWSRelease ();
 		if(UseDirectClient)
 			connectionClientRelease ();
@@ -26,11 +26,14 @@
 
 #include "nel/misc/types_nl.h"
 
+#include "nel/misc/command.h"
+
 #include "nel/net/service.h"
 
 #include "mysql_helper.h"
 
 #include "mysql_version.h"
+#include "errmsg.h"
 
 
 //
@@ -50,6 +53,8 @@ static string DatabaseName, DatabaseHost, DatabaseLogin, DatabasePassword;
 
 MYSQL *DatabaseConnection = NULL;
 
+CSqlExecutor SqlExecutor;
+
 
 //
 // Functions
@@ -104,6 +109,380 @@ string sqlQuery(const string &query, sint32 &nbRow, MYSQL_ROW &firstRow, CMysqlR
 	return "";
 }
 
+
+//
+// CSqlConnection
+//
+
+bool CSqlConnection::connect(const string &host, const string &login, const string &password, const string &name)
+{
+	close();
+
+	MYSQL *db = mysql_init(0);
+	if(db == 0)
+	{
+		nlwarning("mysql_init() failed");
+		return false;
+	}
+
+	my_bool opt = true;
+	if (mysql_options (db, MYSQL_OPT_RECONNECT, &opt))
+	{
+		nlwarning("mysql_options() failed for database connection to '%s'", host.c_str());
+		mysql_close(db);
+		return false;
+	}
+
+	if (mysql_real_connect(db, host.c_str(), login.c_str(), password.c_str(), name.c_str(),0,0,0) != db)
+	{
+		nlwarning("mysql_real_connect() failed to '%s' with login '%s' and database name '%s': %s", host.c_str(), login.c_str(), name.c_str(), mysql_error(db));
+		mysql_close(db);
+		return false;
+	}
+
+	_Db = db;
+	mysql_query(_Db, "set names utf8");
+	return true;
+}
+
+void CSqlConnection::close()
+{
+	closeStatements();
+	if (_Db)
+	{
+		mysql_close(_Db);
+		_Db = NULL;
+	}
+}
+
+void CSqlConnection::closeStatements()
+{
+	for (map<string, MYSQL_STMT*>::iterator it = _Statements.begin(); it != _Statements.end(); ++it)
+		mysql_stmt_close((*it).second);
+	_Statements.clear();
+}
+
+MYSQL_STMT *CSqlConnection::getStatement(const string &statement, string &error)
+{
+	map<string, MYSQL_STMT*>::iterator it = _Statements.find(statement);
+	if (it != _Statements.end())
+		return (*it).second;
+
+	MYSQL_STMT *stmt = mysql_stmt_init(_Db);
+	if (stmt == NULL)
+	{
+		error = toString("mysql_stmt_init() failed: '%s' (%s)", mysql_error(_Db), statement.c_str());
+		return NULL;
+	}
+	if (mysql_stmt_prepare(stmt, statement.c_str(), (unsigned long)statement.size()) != 0)
+	{
+		error = toString("mysql_stmt_prepare() failed: '%s' (%s)", mysql_stmt_error(stmt), statement.c_str());
+		mysql_stmt_close(stmt);
+		return NULL;
+	}
+
+	// the max length of the fields gives the size of the result buffers
+	my_bool update = true;
+	mysql_stmt_attr_set(stmt, STMT_ATTR_UPDATE_MAX_LENGTH, &update);
+
+	_Statements.insert(make_pair(statement, stmt));
+	return stmt;
+}
+
+bool CSqlConnection::execute(const CSqlQuery &query, CSqlResult &result)
+{
+	result = CSqlResult();
+	if (_Db == NULL)
+	{
+		result.Error = toString("not connected to the database (%s)", query.Statement.c_str());
+		return false;
+	}
+
+	for (uint retry = 0; retry < 2; ++retry)
+	{
+		MYSQL_STMT *stmt = getStatement(query.Statement, result.Error);
+		if (stmt != NULL && executeStatement(stmt, query, result))
+			return true;
+
+		// the statements are lost with the connection, prepare them again after the reconnection
+		uint err = mysql_errno(_Db);
+		if (stmt != NULL)
+			err = mysql_stmt_errno(stmt);
+		if (err != CR_SERVER_GONE_ERROR && err != CR_SERVER_LOST)
+			break;
+		closeStatements();
+		if (mysql_ping(_Db) != 0)
+			break;
+		result.Error.clear();
+	}
+
+	nlwarning("%s", result.Error.c_str());
+	return false;
+}
+
+bool CSqlConnection::executeStatement(MYSQL_STMT *stmt, const CSqlQuery &query, CSqlResult &result)
+{
+	if (mysql_stmt_param_count(stmt) != query.Params.size())
+	{
+		result.Error = toString("%u parameters given instead of %u (%s)", (uint)query.Params.size(), (uint)mysql_stmt_param_count(stmt), query.Statement.c_str());
+		return false;
+	}
+
+	// all the parameters are sent as strings, the server converts them
+	vector<MYSQL_BIND> params(query.Params.size());
+	vector<unsigned long> paramLengths(query.Params.size());
+	uint i;
+	for (i = 0; i < query.Params.size(); ++i)
+	{
+		memset(&params[i], 0, sizeof(MYSQL_BIND));
+		paramLengths[i] = (unsigned long)query.Params[i].size();
+		params[i].buffer_type = MYSQL_TYPE_STRING;
+		params[i].buffer = (void*)query.Params[i].data();
+		params[i].buffer_length = paramLengths[i];
+		params[i].length = &paramLengths[i];
+	}
+
+	if ((!params.empty() && mysql_stmt_bind_param(stmt, &params[0]) != 0) || mysql_stmt_execute(stmt) != 0)
+	{
+		result.Error = toString("mysql_stmt_execute() failed: '%s' (%s)", mysql_stmt_error(stmt), query.Statement.c_str());
+		return false;
+	}
+
+	MYSQL_RES *meta = mysql_stmt_result_metadata(stmt);
+	if (meta == NULL)
+	{
+		// not a select
+		result.AffectedRows = mysql_stmt_affected_rows(stmt);
+		result.InsertId = mysql_stmt_insert_id(stmt);
+		return true;
+	}
+
+	bool ok = (mysql_stmt_store_result(stmt) == 0);
+	if (!ok)
+		result.Error = toString("mysql_stmt_store_result() failed: '%s' (%s)", mysql_stmt_error(stmt), query.Statement.c_str());
+
+	uint nbFields = mysql_num_fields(meta);
+	MYSQL_FIELD *fields = mysql_fetch_fields(meta);
+	vector<MYSQL_BIND> columns(nbFields);
+	vector<vector<char> > buffers(nbFields);
+	vector<unsigned long> lengths(nbFields);
+	vector<my_bool> isNull(nbFields);
+	for (i = 0; ok && i < nbFields; ++i)
+	{
+		memset(&columns[i], 0, sizeof(MYSQL_BIND));
+		buffers[i].resize(max((unsigned long)fields[i].max_length, 32UL) + 1);
+		columns[i].buffer_type = MYSQL_TYPE_STRING;
+		columns[i].buffer = &buffers[i][0];
+		columns[i].buffer_length = (unsigned long)buffers[i].size();
+		columns[i].length = &lengths[i];
+		columns[i].is_null = &isNull[i];
+	}
+	if (ok && nbFields > 0 && mysql_stmt_bind_result(stmt, &columns[0]) != 0)
+	{
+		result.Error = toString("mysql_stmt_bind_result() failed: '%s' (%s)", mysql_stmt_error(stmt), query.Statement.c_str());
+		ok = false;
+	}
+
+	while (ok)
+	{
+		int ret = mysql_stmt_fetch(stmt);
+		if (ret == MYSQL_NO_DATA)
+			break;
+		if (ret != 0 && ret != MYSQL_DATA_TRUNCATED)
+		{
+			result.Error = toString("mysql_stmt_fetch() failed: '%s' (%s)", mysql_stmt_error(stmt), query.Statement.c_str());
+			ok = false;
+			break;
+		}
+
+		result.Rows.push_back(CSqlResult::TRow(nbFields));
+		CSqlResult::TRow &row = result.Rows.back();
+		for (i = 0; i < nbFields; ++i)
+		{
+			if (isNull[i])
+				continue;
+			if (lengths[i] >= buffers[i].size())
+			{
+				// truncated, get the whole field
+				buffers[i].resize(lengths[i] + 1);
+				columns[i].buffer = &buffers[i][0];
+				columns[i].buffer_length = (unsigned long)buffers[i].size();
+				mysql_stmt_fetch_column(stmt, &columns[i], i, 0);
+			}
+			row[i].assign(&buffers[i][0], lengths[i]);
+		}
+	}
+
+	mysql_stmt_free_result(stmt);
+	mysql_free_result(meta);
+	return ok;
+}
+
+
+//
+// CSqlExecutor
+//
+
+/*
+ * Worker thread of CSqlExecutor, with its own connection
+ */
+class CSqlWorker : public IRunnable
+{
+public:
+	CSqlWorker(CSqlExecutor &executor) : Jobs("CSqlWorker::Jobs"), _Executor(executor), _ExitRequired(false) { }
+
+	void requireExit() { _ExitRequired = true; }
+
+	virtual void getName (std::string &result) const { result = "CSqlWorker"; }
+
+	virtual void run()
+	{
+		mysql_thread_init();
+		while (!_ExitRequired)
+		{
+			ISqlJob *job = NULL;
+			{
+				CSqlExecutor::TJobs::CAccessor acc(&Jobs);
+				if (!acc.value().empty())
+				{
+					job = acc.value().front();
+					acc.value().pop_front();
+				}
+			}
+			if (job == NULL)
+			{
+				nlSleep(1);
+				continue;
+			}
+
+			checkConnection();
+			job->run(_Db);
+
+			CSqlExecutor::TDoneJobs::CAccessor acc(&_Executor._DoneJobs);
+			acc.value().push_back(job);
+		}
+		_Db.close();
+		mysql_thread_end();
+	}
+
+	/// The jobs of this worker, run in order
+	CSqlExecutor::TJobs	Jobs;
+
+private:
+
+	// Connect if the database changed or if the last connection failed
+	void checkConnection()
+	{
+		CSqlExecutor::CDatabase database;
+		{
+			CSqlExecutor::TDatabase::CAccessor acc(&_Executor._Database);
+			if (_Db.isConnected() && _Db._Generation == acc.value().Generation)
+				return;
+			database = acc.value();
+		}
+		_Db.connect(database.Host, database.Login, database.Password, database.Name);
+		_Db._Generation = database.Generation;
+	}
+
+	CSqlExecutor	&_Executor;
+	CSqlConnection	_Db;
+	volatile bool	_ExitRequired;
+};
+
+void CSqlExecutor::init(uint nbThreads)
+{
+	nlassert(_Workers.empty());
+	nlinfo("Starting %u database threads", nbThreads);
+	for (uint i = 0; i < nbThreads; ++i)
+	{
+		CSqlWorker *worker = new CSqlWorker(*this);
+		IThread *thread = IThread::create(worker);
+		thread->start();
+		_Workers.push_back(worker);
+		_Threads.push_back(thread);
+	}
+}
+
+void CSqlExecutor::release()
+{
+	uint i;
+	for (i = 0; i < _Workers.size(); ++i)
+		_Workers[i]->requireExit();
+	for (i = 0; i < _Threads.size(); ++i)
+	{
+		_Threads[i]->wait();
+		delete _Threads[i];
+
+		TJobs::CAccessor acc(&_Workers[i]->Jobs);
+		for (deque<ISqlJob*>::iterator it = acc.value().begin(); it != acc.value().end(); ++it)
+			delete *it;
+		acc.value().clear();
+	}
+	for (i = 0; i < _Workers.size(); ++i)
+		delete _Workers[i];
+	_Threads.clear();
+	_Workers.clear();
+
+	{
+		TDoneJobs::CAccessor acc(&_DoneJobs);
+		for (list<ISqlJob*>::iterator it = acc.value().begin(); it != acc.value().end(); ++it)
+			delete *it;
+		acc.value().clear();
+	}
+	_NbPending = 0;
+}
+
+void CSqlExecutor::setDatabase(const string &host, const string &login, const string &password, const string &name)
+{
+	TDatabase::CAccessor acc(&_Database);
+	acc.value().Host = host;
+	acc.value().Login = login;
+	acc.value().Password = password;
+	acc.value().Name = name;
+	++acc.value().Generation;
+}
+
+void CSqlExecutor::push(ISqlJob *job, uint32 key)
+{
+	nlassert(job != NULL);
+	nlassert(!_Workers.empty());
+	++_NbPending;
+
+	// The same key always goes to the same worker. The keys are often aligned
+	// addresses, so they are mixed before choosing the worker
+	uint worker = ((key * 2654435761U) >> 16) % _Workers.size();
+	TJobs::CAccessor acc(&_Workers[worker]->Jobs);
+	acc.value().push_back(job);
+}
+
+void CSqlExecutor::update()
+{
+	list<ISqlJob*> doneJobs;
+	{
+		TDoneJobs::CAccessor acc(&_DoneJobs);
+		doneJobs.swap(acc.value());
+	}
+
+	for (list<ISqlJob*>::iterator it = doneJobs.begin(); it != doneJobs.end(); ++it)
+	{
+		--_NbPending;
+		(*it)->done();
+		delete *it;
+	}
+}
+
+NLMISC_DYNVARIABLE(uint, SqlPendingJobs, "number of database jobs not finished")
+{
+	// we can only read the value
+	if (get)
+		*pointer = SqlExecutor.getNbPendingJobs();
+}
+
+
+//
+// Functions
+//
+
 string resetDatabase()
 {
 	// Reset all shards database
@@ -124,6 +503,9 @@ static void cbDatabaseVar(CConfigFile::CVar &var)
 	DatabaseLogin = IService::getInstance()->ConfigFile.getVar("DatabaseLogin").asString ();
 	DatabasePassword = IService::getInstance()->ConfigFile.getVar("DatabasePassword").asString ();
 
+	// the executor connections follow the service one
+	SqlExecutor.setDatabase(DatabaseHost, DatabaseLogin, DatabasePassword, DatabaseName);
+
 	if(DatabaseConnection)
 	{
 		mysql_close(DatabaseConnection);
@@ -175,4 +557,19 @@ void sqlInit()
 	IService::getInstance()->ConfigFile.setCallback ("ForceDatabaseReconnection", cbDatabaseVar);
 	cbDatabaseVar (IService::getInstance()->ConfigFile.getVar ("ForceDatabaseReconnection"));
 	resetDatabase();
+
+	uint nbThreads = 4;
+	if (IService::getInstance()->ConfigFile.exists("DatabaseThreads"))
+		nbThreads = max(IService::getInstance()->ConfigFile.getVar("DatabaseThreads").asInt(), 1);
+	SqlExecutor.init(nbThreads);
+}
+
+void sqlUpdate()
+{
+	SqlExecutor.update();
+}
+
+void sqlRelease()
+{
+	SqlExecutor.release();
 }
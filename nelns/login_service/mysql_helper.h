@@ -40,6 +40,14 @@
 #include <mysql.h>
 
 #include "nel/misc/types_nl.h"
+#include "nel/misc/common.h"
+#include "nel/misc/mutex.h"
+#include "nel/misc/thread.h"
+
+#include <map>
+#include <list>
+#include <deque>
+#include <vector>
 
 
 //
@@ -84,11 +92,164 @@ private:
 };
 
 
+class CSqlWorker;
+
+/**
+ * A query with '?' placeholders and its parameters, run as a prepared statement
+ * by CSqlConnection. Values never need to be escaped.
+ *
+ *	db.execute(CSqlQuery("select UId from user where Login=?") << login, result);
+ */
+class CSqlQuery
+{
+public:
+	explicit CSqlQuery(const char *statement) : Statement(statement) { }
+
+	CSqlQuery &operator<<(const std::string &value) { Params.push_back(value); return *this; }
+	CSqlQuery &operator<<(sint32 value) { Params.push_back(NLMISC::toString(value)); return *this; }
+	CSqlQuery &operator<<(uint32 value) { Params.push_back(NLMISC::toString(value)); return *this; }
+
+	std::string					Statement;
+	std::vector<std::string>	Params;
+};
+
+/**
+ * Result of a CSqlQuery. The rows are copied, so the result can be given
+ * to another thread.
+ */
+struct CSqlResult
+{
+	CSqlResult() : AffectedRows(0), InsertId(0) { }
+
+	typedef std::vector<std::string>	TRow;
+
+	/// Empty if the query succeeded
+	std::string			Error;
+	/// Rows of a select, a NULL field is an empty string
+	std::vector<TRow>	Rows;
+	/// Rows changed by an insert, update or delete
+	uint64				AffectedRows;
+	uint64				InsertId;
+};
+
+/**
+ * A database connection of the CSqlExecutor pool, only used by the worker
+ * thread that owns it. The prepared statements are kept by connection.
+ */
+class CSqlConnection
+{
+public:
+	CSqlConnection() : _Db(NULL), _Generation(0) { }
+	~CSqlConnection() { close(); }
+
+	/// Run the query, returns false and fills result.Error if it failed
+	bool execute(const CSqlQuery &query, CSqlResult &result);
+
+	bool isConnected() const { return _Db != NULL; }
+
+private:
+	friend class CSqlWorker;
+
+	bool connect(const std::string &host, const std::string &login, const std::string &password, const std::string &name);
+	void close();
+	void closeStatements();
+
+	/// Returns the prepared statement of the query, prepared on the first call
+	MYSQL_STMT *getStatement(const std::string &statement, std::string &error);
+	bool executeStatement(MYSQL_STMT *stmt, const CSqlQuery &query, CSqlResult &result);
+
+	MYSQL								*_Db;
+	std::map<std::string, MYSQL_STMT*>	_Statements;
+	/// Generation of the connection parameters used by this connection
+	uint32								_Generation;
+};
+
+/**
+ * A database job: the queries are run by a worker thread of CSqlExecutor,
+ * then done() is called by the service thread. run() must only use the
+ * connection and the members of the job.
+ */
+class ISqlJob
+{
+public:
+	virtual ~ISqlJob() { }
+
+	/// Run the queries, called by a worker thread
+	virtual void run(CSqlConnection &db) = 0;
+	/// Use the results, called by CSqlExecutor::update() in the service thread. The job is deleted after
+	virtual void done() = 0;
+};
+
+/**
+ * Pool of database connections, each one used by its own worker thread,
+ * so that a slow query doesn't stop the service loop. A job is run by
+ * one worker, its queries are sent in order on the same connection.
+ *
+ * Each worker has its own queue, and a job goes to the worker chosen by the
+ * key given to push(): the jobs pushed with the same key (for example the
+ * address of a client) are run one after the other, in the order of push().
+ * The jobs with different keys may run in any order.
+ */
+class CSqlExecutor
+{
+public:
+	CSqlExecutor() : _DoneJobs("CSqlExecutor::_DoneJobs"), _Database("CSqlExecutor::_Database"), _NbPending(0) { }
+	~CSqlExecutor() { release(); }
+
+	/// Start the worker threads
+	void init(uint nbThreads);
+	/// Stop the workers when they have finished their current job, the other jobs are deleted without being run
+	void release();
+
+	/// Set the database, the workers connect again before their next job
+	void setDatabase(const std::string &host, const std::string &login, const std::string &password, const std::string &name);
+
+	/// Queue a job, run after the jobs previously pushed with the same key. The executor deletes it
+	void push(ISqlJob *job, uint32 key);
+	/// Call done() of the finished jobs, to call in the service update
+	void update();
+
+	/// Number of jobs whose done() wasn't called yet
+	uint getNbPendingJobs() const { return _NbPending; }
+
+private:
+	friend class CSqlWorker;
+
+	struct CDatabase
+	{
+		CDatabase() : Generation(0) { }
+		std::string	Host, Login, Password, Name;
+		uint32		Generation;
+	};
+
+	typedef NLMISC::CSynchronized<std::deque<ISqlJob*> >	TJobs;
+	typedef NLMISC::CSynchronized<std::list<ISqlJob*> >		TDoneJobs;
+	typedef NLMISC::CSynchronized<CDatabase>				TDatabase;
+
+	TDoneJobs							_DoneJobs;
+	TDatabase							_Database;
+	/// Only used by the service thread
+	uint								_NbPending;
+
+	std::vector<CSqlWorker*>			_Workers;
+	std::vector<NLMISC::IThread*>		_Threads;
+};
+
+
+//
+// Variables
+//
+
+extern CSqlExecutor SqlExecutor;
+
+
 //
 // Functions
 //
 
 void sqlInit();
+void sqlUpdate();
+void sqlRelease();
 std::string sqlQuery(const std::string &query);
 std::string sqlQuery(const std::string &query, sint32 &nbRow, MYSQL_ROW &firstRow, CMysqlResult &result);
 
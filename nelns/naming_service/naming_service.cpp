@@ -43,7 +43,10 @@
 #include "nel/misc/types_nl.h"
 
 #include <list>
+#include <map>
+#include <set>
 #include <string>
+#include <vector>
 
 #include "nel/misc/debug.h"
 #include "nel/misc/command.h"
@@ -93,9 +96,11 @@ struct CServiceEntry
 
 	bool				WaitingUnregistration;			// true if this service is in unregistration process (wait other service ACK)
 	TTime				WaitingUnregistrationTime;		// time of the beginning of the inregistration process
-	list<TServiceId>	WaitingUnregistrationServices;	// list of service that we wait the answer
+	set<TServiceId>		WaitingUnregistrationServices;	// list of service that we wait the answer
 };
 
+typedef list<CServiceEntry>::iterator	TServiceIt;
+
 
 
 // Helper that emulates layer5's send()
@@ -107,6 +112,9 @@ string getServiceName( TServiceId  sid );
 // Helper that returns the first address of a service
 CInetAddress getHostAddress( TServiceId  sid );
 
+// Helper that returns the ids of the registered services of a name
+void getServiceIds( const string& name, vector<TServiceId>& sids );
+
 // Asks a service to stop and tell every one
 void doUnregisterService (TServiceId sid);
 
@@ -182,12 +190,13 @@ bool		CServiceInstanceManager::queryStartService( const std::string& serviceName
 	if ( ius != _UniqueServices.end() )
 	{
 		// Service is restricted
-		set< TServiceId >::iterator ios;
+		vector< TServiceId > sids;
+		getServiceIds( serviceName, sids );
+		vector< TServiceId >::iterator ios;
 		bool uniqueOnShard = (*ius).second;
-		for ( ios=_OnlineServices.begin(); ios!=_OnlineServices.end(); ++ios )
+		for ( ios=sids.begin(); ios!=sids.end(); ++ios )
 		{
-			string name = getServiceName( *ios );
-			if ( name == serviceName )
+			if ( _OnlineServices.find( *ios ) != _OnlineServices.end() )
 			{
 				if ( uniqueOnShard )
 				{
@@ -283,6 +292,22 @@ uint16				MaxBasePort = 52000;	/// (note: in this implementation there can be no
 
 const TServiceId	BaseSId(128);			/// Allocated SIds begin at 128 (except for Agent Service)
 
+// Indexes of RegisteredServices, updated by addService(), doRemove() and effectivelyRemove()
+typedef multimap<TServiceId, TServiceIt>	TServicesBySId;
+typedef multimap<string, TServiceIt>		TServicesByName;
+typedef multimap<TSockId, TServiceIt>		TServicesBySockId;
+
+TServicesBySId		ServicesBySId;			/// Sorted by sid (a provided sid can be registered again while the previous one waits its unregistration)
+TServicesByName		ServicesByName;			/// Sorted by name
+TServicesBySockId	ServicesBySockId;		/// Sorted by connection, without the services waiting their unregistration
+map<uint16, uint>	UsedPorts;				/// Number of services by port of their first address
+list<TServiceIt>	WaitingServices;		/// Services waiting the ACK of their unregistration
+
+set<TServiceId>		FreeSIds;				/// Released sids lower than NextSId
+uint32				NextSId = BaseSId.get();	/// Sids from here were never allocated
+
+vector<TServiceIt>	PendingRegistrations;	/// Registered services not broadcasted yet, see broadcastRegistrations()
+
 const TTime			UnregisterTimeout = 10000;	/// After 10s we remove an unregister service if every server didn't ACK the message
 
 CCallbackServer		*CallbackServer = NULL;
@@ -345,13 +370,148 @@ void displayRegisteredServices (CLog *log = InfoLog)
 }
 
 
+template <class T>
+void eraseIndex (multimap<T, TServiceIt> &index, const T &key, TServiceIt it)
+{
+	typename multimap<T, TServiceIt>::iterator iti, last = index.upper_bound (key);
+	for (iti = index.lower_bound (key); iti != last; iti++)
+	{
+		if ((*iti).second == it)
+		{
+			index.erase (iti);
+			return;
+		}
+	}
+	nlwarning ("Service %s-%hu not found in an index", (*it).Name.c_str(), it->SId.get());
+}
+
+TServiceIt addService (TSockId from, const vector<CInetAddress> &addr, const string &name, TServiceId sid)
+{
+	TServiceIt it = RegisteredServices.insert (RegisteredServices.end (), CServiceEntry(from, addr, name, sid));
+
+	ServicesBySId.insert (make_pair (sid, it));
+	ServicesByName.insert (make_pair (name, it));
+	ServicesBySockId.insert (make_pair (from, it));
+	if (!addr.empty ())
+		UsedPorts[addr[0].port ()]++;
+
+	return it;
+}
+
+TServiceIt findService (TServiceId sid)
+{
+	TServicesBySId::iterator it = ServicesBySId.find (sid);
+	return (it == ServicesBySId.end ()) ? RegisteredServices.end () : (*it).second;
+}
+
+/*
+ * Give the lowest free sid from BaseSId, false if there is no more sid
+ */
+bool allocateSId (TServiceId &sid)
+{
+	while (!FreeSIds.empty ())
+	{
+		sid = *FreeSIds.begin ();
+		FreeSIds.erase (FreeSIds.begin ());
+		// it can be used by a service that provided it
+		if (ServicesBySId.find (sid) == ServicesBySId.end ())
+			return true;
+	}
+
+	while (NextSId <= 0xFFFF)
+	{
+		sid.set ((uint16)NextSId++);
+		if (ServicesBySId.find (sid) == ServicesBySId.end ())
+			return true;
+	}
+
+	return false;
+}
+
 list<CServiceEntry>::iterator effectivelyRemove (list<CServiceEntry>::iterator &it)
 {
 	// remove the service from the registered service list
 	nlinfo ("Effectively remove the service %s-%hu", (*it).Name.c_str(), it->SId.get());
+
+	TServiceId sid = (*it).SId;
+	eraseIndex (ServicesBySId, sid, it);
+	eraseIndex (ServicesByName, (*it).Name, it);
+	if ((*it).SockId != NULL)
+		eraseIndex (ServicesBySockId, (*it).SockId, it);
+	if (!(*it).Addr.empty ())
+	{
+		map<uint16, uint>::iterator itp = UsedPorts.find ((*it).Addr[0].port ());
+		if (itp != UsedPorts.end () && --(*itp).second == 0)
+			UsedPorts.erase (itp);
+	}
+	if ((*it).WaitingUnregistration)
+		WaitingServices.remove (it);
+
+	if (ServicesBySId.find (sid) == ServicesBySId.end ())
+	{
+		// Release from the service instance manager
+		SIMInstance->releaseService (sid);
+
+		if (sid.get() >= BaseSId.get() && sid.get() < NextSId)
+			FreeSIds.insert (sid);
+	}
+
 	return RegisteredServices.erase (it);
 }
 
+/*
+ * Broadcast the registrations since the last call, with one RGB by service.
+ * A service registered since the last call already got the previous ones in its RG answer.
+ */
+void broadcastRegistrations ()
+{
+	if (PendingRegistrations.empty ())
+		return;
+
+	map<const CServiceEntry *, uint> positions;
+	for (uint i = 0; i < PendingRegistrations.size (); i++)
+		positions.insert (make_pair (&*PendingRegistrations[i], i));
+
+	vector<CInetAddress> accessibleAddress;
+	vector<TServiceIt> registered;
+	for (TServiceIt it = RegisteredServices.begin(); it != RegisteredServices.end (); it++)
+	{
+		if ((*it).WaitingUnregistration)
+			continue;
+
+		uint first = 0;
+		map<const CServiceEntry *, uint>::iterator itp = positions.find (&*it);
+		if (itp != positions.end ())
+			first = (*itp).second + 1;
+
+		registered.clear ();
+		for (uint i = first; i < PendingRegistrations.size (); i++)
+		{
+			// send only services that can be accessed
+			if (canAccess ((*PendingRegistrations[i]).Addr, (*it), accessibleAddress))
+				registered.push_back (PendingRegistrations[i]);
+		}
+		if (registered.empty ())
+			continue;
+
+		CMessage msgout ("RGB");
+		TServiceId::size_type s = (TServiceId::size_type)registered.size ();
+		msgout.serial (s);
+		for (uint i = 0; i < registered.size (); i++)
+		{
+			msgout.serial ((*registered[i]).Name);
+			msgout.serial ((*registered[i]).SId);
+			// we need to send all addr to all services even if the service can't access because we use the address index
+			// to know which connection comes.
+			msgout.serialCont ((*registered[i]).Addr);
+		}
+		CallbackServer->send (msgout, (*it).SockId);
+		nldebug ("Broadcast %u registrations to %s-%hu", registered.size (), (*it).Name.c_str(), it->SId.get());
+	}
+
+	PendingRegistrations.clear ();
+}
+
 /*
  * Helper procedure for cbLookupAlternate and cbUnregister.
  * Note: name is used for a LOGS.
@@ -359,6 +519,9 @@ list<CServiceEntry>::iterator effectivelyRemove (list<CServiceEntry>::iterator &
 list<CServiceEntry>::iterator doRemove (list<CServiceEntry>::iterator it)
 {
 	nldebug ("Unregister the service %s-%hu '%s'", (*it).Name.c_str(), it->SId.get(), (*it).Addr[0].asString().c_str());
+
+	// the services must receive the registration of the service before its unregistration
+	broadcastRegistrations ();
 	
 	// tell to everybody that this service is unregistered
 
@@ -382,25 +545,19 @@ list<CServiceEntry>::iterator doRemove (list<CServiceEntry>::iterator it)
 	// the service, before, we tag the service as 'wait before unregister'
 	// if everybody didn't answer before the time out, we remove it
 
+	if ((*it).SockId != NULL)
+		eraseIndex (ServicesBySockId, (*it).SockId, it);
 	(*it).SockId = NULL;
 
+	if (!(*it).WaitingUnregistration)
+		WaitingServices.push_back (it);
 	(*it).WaitingUnregistration = true;
 	(*it).WaitingUnregistrationTime = CTime::getLocalTime();
 
 	// we remove all services awaiting his ACK because this service is down so it'll never ACK
-	for (list<CServiceEntry>::iterator itr = RegisteredServices.begin(); itr != RegisteredServices.end (); itr++)
+	for (list<TServiceIt>::iterator itw = WaitingServices.begin(); itw != WaitingServices.end (); itw++)
 	{
-		for (list<TServiceId>::iterator itw = (*itr).WaitingUnregistrationServices.begin(); itw != (*itr).WaitingUnregistrationServices.end ();)
-		{
-			if ((*itw) == (*it).SId)
-			{
-				itw = (*itr).WaitingUnregistrationServices.erase (itw);
-			}
-			else
-			{
-				itw++;
-			}
-		}
+		(**itw).WaitingUnregistrationServices.erase ((*it).SId);
 	}
 
 	string res;
@@ -408,7 +565,7 @@ list<CServiceEntry>::iterator doRemove (list<CServiceEntry>::iterator it)
 	{
 		if (!(*it2).WaitingUnregistration)
 		{
-			(*it).WaitingUnregistrationServices.push_back ((*it2).SId);
+			(*it).WaitingUnregistrationServices.insert ((*it2).SId);
 			res += toString((*it2).SId.get()) + " ";
 		}
 	}
@@ -423,41 +580,39 @@ list<CServiceEntry>::iterator doRemove (list<CServiceEntry>::iterator it)
 	{
 		return ++it;
 	}
-
-	// Release from the service instance manager
-	SIMInstance->releaseService( (*it).SId );
 }
 
 void doUnregisterService (TServiceId sid)
 {
-	list<CServiceEntry>::iterator it;
-	for (it = RegisteredServices.begin(); it != RegisteredServices.end (); it++)
+	TServicesBySId::iterator it, last = ServicesBySId.upper_bound (sid);
+	for (it = ServicesBySId.lower_bound (sid); it != last; it++)
 	{
-		if ((*it).SId == sid)
+		if (!(*(*it).second).WaitingUnregistration)
 		{
 			// found it, remove it
-			doRemove (it);
+			doRemove ((*it).second);
 			return;
 		}
 	}
-	nlwarning ("Service %hu not found", sid.get());
+	if (ServicesBySId.find (sid) != ServicesBySId.end ())
+		nlwarning ("Service %hu is already unregistering", sid.get());
+	else
+		nlwarning ("Service %hu not found", sid.get());
 }
 
 void doUnregisterService (TSockId from)
 {
-	list<CServiceEntry>::iterator it;
-	for (it = RegisteredServices.begin(); it != RegisteredServices.end ();)
+	// it's possible that one "from" have more than one registred service
+	vector<TServiceIt> services;
+	TServicesBySockId::iterator it, last = ServicesBySockId.upper_bound (from);
+	for (it = ServicesBySockId.lower_bound (from); it != last; it++)
 	{
-		if ((*it).SockId == from)
-		{
-			// it's possible that one "from" have more than one registred service, so we have to find in all the list
-			// found it, remove it
-			it = doRemove (it);
-		}
-		else
-		{
-			it++;
-		}
+		services.push_back ((*it).second);
+	}
+
+	for (uint i = 0; i < services.size (); i++)
+	{
+		doRemove (services[i]);
 	}
 }
 
@@ -512,55 +667,23 @@ bool doRegister (const string &name, const vector<CInetAddress> &addr, TServiceI
 
 	if (needRegister)
 	{
-		if (sid.get() == 0)
+		bool allocated = (sid.get() == 0);
+		if (allocated)
 		{
 			// we have to find a sid
-			sid = BaseSId;
-			bool found = false;
-			while (!found)
+			if (!allocateSId (sid))
 			{
-				list<CServiceEntry>::iterator it;
-				for (it = RegisteredServices.begin(); it != RegisteredServices.end (); it++)
-				{
-					if ((*it).SId == sid)
-					{
-						break;
-					}
-				}
-				if (it == RegisteredServices.end ())
-				{
-					// ok, we have an empty sid
-					found = true;
-				}
-				else
-				{
-					sid.set(sid.get()+1);
-					if (sid.get() == 0) // round the clock
-					{
-						nlwarning ("Service identifier allocation overflow");
-						ok = false;
-						break;
-					}
-				}
+				nlwarning ("Service identifier allocation overflow");
+				sid.set (0);
+				ok = false;
 			}
-
 		}
 		else
 		{
-			// we have to check that the user provided sid is available
-			list<CServiceEntry>::iterator it;
-			for (it = RegisteredServices.begin(); it != RegisteredServices.end (); it++)
-			{
-				if ((*it).SId == sid)
-				{
-					nlwarning ("Sid %d already used by another service", sid.get());
-					ok = false;
-					break;
-				}
-			}
-			if (it != RegisteredServices.end ())
+			// we have to check that the user provided sid is available, it's accepted anyway
+			if (ServicesBySId.find (sid) != ServicesBySId.end ())
 			{
-				ok = true;
+				nlwarning ("Sid %d already used by another service", sid.get());
 			}
 		}
 
@@ -571,32 +694,13 @@ bool doRegister (const string &name, const vector<CInetAddress> &addr, TServiceI
 			if ( SIMInstance->queryStartService( name, sid, addr, reason ) )
 			{
 				// add him in the registered list
-				RegisteredServices.push_back (CServiceEntry(from, addr, name, sid));
+				TServiceIt it = addService (from, addr, name, sid);
 
-				// tell to everybody but not him that this service is registered
+				// tell to everybody but not him that this service is registered, at the end of the update
 				if (!reconnection)
 				{
-					CMessage msgout ("RGB");
-					TServiceId::size_type s = 1;
-					msgout.serial (s);
-					msgout.serial (const_cast<string &>(name));
-					msgout.serial (sid);
-					// we need to send all addr to all services even if the service can't access because we use the address index
-					// to know which connection comes.
-					msgout.serialCont (const_cast<vector<CInetAddress> &>(addr));
 					nlinfo ("The service is %s-%d, broadcast the Registration to everybody", name.c_str(), sid.get());
-
-					vector<CInetAddress> accessibleAddress;
-					for (list<CServiceEntry>::iterator it3 = RegisteredServices.begin(); it3 != RegisteredServices.end (); it3++)
-					{
-						// send only services that can be accessed and not itself
-						if ((*it3).SId != sid && canAccess(addr, (*it3), accessibleAddress))
-						{
-							CallbackServer->send (msgout, (*it3).SockId);
-							//CNetManager::send ("NS", msgout, (*it3).SockId);
-							nldebug ("Broadcast to %s-%hu", (*it3).Name.c_str(), it3->SId.get());
-						}
-					}
+					PendingRegistrations.push_back (it);
 				}
 
 				// set the sid only if it s ok
@@ -606,6 +710,8 @@ bool doRegister (const string &name, const vector<CInetAddress> &addr, TServiceI
 			{
 				// Reply "startup denied", and do not send registration to other services
 				ok = false;
+				if (allocated)
+					FreeSIds.insert (sid);
 			}
 		}
 
@@ -620,27 +726,24 @@ bool doRegister (const string &name, const vector<CInetAddress> &addr, TServiceI
 				msgout.serial (sid);
 
 				// send him all services available (also itself)
-				TServiceId::size_type nb = 0;
-
 				vector<CInetAddress> accessibleAddress;
+				vector<TServiceIt> available;
 
 				for (list<CServiceEntry>::iterator it2 = RegisteredServices.begin(); it2 != RegisteredServices.end (); it2++)
 				{
 					// send only services that are available
 					if (canAccess(addr, (*it2), accessibleAddress))
-						nb++;
+						available.push_back (it2);
 				}
+
+				TServiceId::size_type nb = (TServiceId::size_type)available.size ();
 				msgout.serial (nb);
 
-				for (list<CServiceEntry>::iterator it = RegisteredServices.begin(); it != RegisteredServices.end (); it++)
+				for (uint i = 0; i < available.size (); i++)
 				{
-					// send only services that are available
-					if (canAccess(addr, (*it), accessibleAddress))
-					{
-						msgout.serial ((*it).Name);
-						msgout.serial ((*it).SId);
-						msgout.serialCont ((*it).Addr);
-					}
+					msgout.serial ((*available[i]).Name);
+					msgout.serial ((*available[i]).SId);
+					msgout.serialCont ((*available[i]).Addr);
 				}
 			}
 			else
@@ -660,9 +763,12 @@ bool doRegister (const string &name, const vector<CInetAddress> &addr, TServiceI
 
 void checkWaitingUnregistrationServices ()
 {
-	for (list<CServiceEntry>::iterator it = RegisteredServices.begin(); it != RegisteredServices.end ();)
+	TTime now = CTime::getLocalTime();
+	for (list<TServiceIt>::iterator itw = WaitingServices.begin(); itw != WaitingServices.end ();)
 	{
-		if ((*it).WaitingUnregistration && ((*it).WaitingUnregistrationServices.empty() || CTime::getLocalTime() > (*it).WaitingUnregistrationTime + UnregisterTimeout))
+		// effectivelyRemove() removes it from WaitingServices
+		TServiceIt it = *itw++;
+		if ((*it).WaitingUnregistrationServices.empty() || now > (*it).WaitingUnregistrationTime + UnregisterTimeout)
 		{
 			if ((*it).WaitingUnregistrationServices.empty())
 			{
@@ -671,17 +777,13 @@ void checkWaitingUnregistrationServices ()
 			else
 			{
 				string res;
-				for (list<TServiceId>::iterator it2 = (*it).WaitingUnregistrationServices.begin(); it2 != (*it).WaitingUnregistrationServices.end (); it2++)
+				for (set<TServiceId>::iterator it2 = (*it).WaitingUnregistrationServices.begin(); it2 != (*it).WaitingUnregistrationServices.end (); it2++)
 				{
 					res += toString(it2->get()) + " ";
 				}
 				nlwarning ("Removing the service %s-%hu because time out occurs (service numbers %s didn't ACK)", (*it).Name.c_str(), (*it).SId.get(), res.c_str());
 			}
-			it = effectivelyRemove (it);
-		}
-		else
-		{
-			it++;
+			effectivelyRemove (it);
 		}
 	}
 }
@@ -695,20 +797,19 @@ static void cbACKUnregistration (CMessage& msgin, TSockId from, CCallbackNetBase
 	TServiceId sid;
 	msgin.serial (sid);
 
-	for (list<CServiceEntry>::iterator it = RegisteredServices.begin(); it != RegisteredServices.end (); it++)
+	TServicesBySId::iterator iti, last = ServicesBySId.upper_bound (sid);
+	for (iti = ServicesBySId.lower_bound (sid); iti != last; iti++)
 	{
-		if ((*it).SId == sid && (*it).WaitingUnregistration)
+		TServiceIt it = (*iti).second;
+		// remove the acked service
+		if ((*it).WaitingUnregistration && (*it).WaitingUnregistrationServices.erase (TServiceId(uint16(from->appId()))) != 0)
 		{
-			for (list<TServiceId>::iterator it2 = (*it).WaitingUnregistrationServices.begin(); it2 != (*it).WaitingUnregistrationServices.end (); it2++)
+			if ((*it).WaitingUnregistrationServices.empty())
 			{
-				if (*it2 == TServiceId(uint16(from->appId())))
-				{
-					// remove the acked service
-					(*it).WaitingUnregistrationServices.erase (it2);
-					checkWaitingUnregistrationServices ();
-					return;
-				}
+				nlinfo ("Removing the service %s-%hu because all services ACKd the removal", (*it).Name.c_str(), (*it).SId.get());
+				effectivelyRemove (it);
 			}
+			return;
 		}
 	}
 }
@@ -783,22 +884,10 @@ uint16 doAllocatePort (const CInetAddress &addr)
 
 	if (nextAvailablePort >= MaxBasePort) nextAvailablePort = MinBasePort;
 
-	bool ok;
-	do
+	while (UsedPorts.find (nextAvailablePort) != UsedPorts.end ())
 	{
-		ok = true;
-		list<CServiceEntry>::iterator it;
-		for (it = RegisteredServices.begin(); it != RegisteredServices.end (); it++)
-		{
-			if ((*it).Addr[0].port () == nextAvailablePort)
-			{
-				nextAvailablePort++;
-				ok = false;
-				break;
-			}
-		}
+		nextAvailablePort++;
 	}
-	while (!ok);
 
 	return nextAvailablePort++;
 }
@@ -915,15 +1004,10 @@ static void cbRegisteredServices(CMessage& msgin, TSockId from, CCallbackNetBase
  */
 string getServiceName( TServiceId  sid )
 {
-	list<CServiceEntry>::iterator it;
-	for (it = RegisteredServices.begin(); it != RegisteredServices.end (); it++)
-	{
-		if ((*it).SId == sid)
-		{
-			return (*it).Name;
-		}
-	}
-	return ""; // not found
+	TServiceIt it = findService (sid);
+	if (it == RegisteredServices.end ())
+		return ""; // not found
+	return (*it).Name;
 }
 
 
@@ -932,15 +1016,24 @@ string getServiceName( TServiceId  sid )
  */
 CInetAddress getHostAddress( TServiceId  sid )
 {
-	list<CServiceEntry>::iterator it;
-	for (it = RegisteredServices.begin(); it != RegisteredServices.end (); it++)
+	TServiceIt it = findService (sid);
+	if (it == RegisteredServices.end ())
+		return CInetAddress();
+	return (*it).Addr[0];
+}
+
+
+/*
+ * Helper that returns the ids of the registered services of a name
+ */
+void getServiceIds( const string& name, vector<TServiceId>& sids )
+{
+	sids.clear ();
+	TServicesByName::iterator it, last = ServicesByName.upper_bound (name);
+	for (it = ServicesByName.lower_bound (name); it != last; it++)
 	{
-		if ((*it).SId == sid)
-		{
-			return (*it).Addr[0];
-		}
+		sids.push_back ((*(*it).second).SId);
 	}
-	return CInetAddress();
 }
 
 
@@ -1048,6 +1141,8 @@ public:
 
 		CallbackServer->update ();
 
+		broadcastRegistrations ();
+
 		return true;
 	}
 
@@ -1126,20 +1221,13 @@ NLMISC_COMMAND (kill, "kill a service and send an unregister broadcast to other
 	if(sid.get() == 0)
 	{
 		// not a number, try a name
-		list<CServiceEntry>::iterator it;
-		for (it = RegisteredServices.begin(); it != RegisteredServices.end (); it++)
-		{
-			if ((*it).Name == args[0])
-			{
-				sid = (*it).SId;
-				break;
-			}
-		}
-		if (it == RegisteredServices.end())
+		TServicesByName::iterator it = ServicesByName.find (args[0]);
+		if (it == ServicesByName.end())
 		{
 			log.displayNL ("Bad service name or id '%s'", args[0].c_str());
 			return false;
 		}
+		sid = (*(*it).second).SId;
 	}
 
 	doUnregisterService (sid);
@@ -43,6 +43,7 @@
 #include <math.h>
 
 #include <list>
+#include <deque>
 
 #include "nel/misc/debug.h"
 #include "nel/misc/config_file.h"
@@ -52,6 +53,7 @@
 #include "nel/misc/log.h"
 #include "nel/misc/file.h"
 #include "nel/misc/path.h"
+#include "nel/misc/time_nl.h"
 
 #include "nel/net/service.h"
 #include "nel/net/unified_network.h"
@@ -79,6 +81,9 @@ void	cbShardOpenStateFile(IVariable &var);
 // Forward declaration of callback cbUsePatchMode
 void	cbUsePatchMode(IVariable &var);
 
+// Forward declaration of callback cbFSPlacement
+void	cbFSPlacement(IVariable &var);
+
 // Types of open state
 enum TShardOpenState
 {
@@ -112,13 +117,36 @@ CVariable<string>	OpenGroups("ws", "OpenGroups", "list of groups allowed at Shar
 /**
  * OpenFrontEndThreshold
  * The FS balance algorithm works like this:
- * - select the least loaded frontend
- * - if this frontend has more than the OpenFrontEndThreshold
+ * - select the least loaded frontend (see FSPlacement)
+ * - if this frontend is full (it has more than the OpenFrontEndThreshold players with the "players" placement)
  *   - try to open a new frontend
  *   - reselect least loaded frontend
  */
 CVariable<uint>		OpenFrontEndThreshold("ws", "OpenFrontEndThreshold", "Limit number of players on all FS to decide to open a new FS", 800,	0, true );
 
+/**
+ * FSPlacement
+ * Name of the placement engine that gives the load of the frontends (see IFSPlacement):
+ * "players" uses the players only, "resources" also uses the cpu, bandwidth and tick lag reported by the frontends
+ */
+CVariable<string>	FSPlacement("ws", "FSPlacement", "Placement engine of the new users on the frontends (players or resources)", "players", 0, true, cbFSPlacement);
+
+/**
+ * Full frontend for the "resources" placement, 0 to ignore the resource
+ */
+CVariable<float>	FSMaxCpuLoad("ws", "FSMaxCpuLoad", "Part of the cpu used by a full FS (0 to ignore the cpu)", 0.8f, 0, true);
+CVariable<uint>		FSMaxBandwidth("ws", "FSMaxBandwidth", "Bytes by second sent by a full FS (0 to ignore the bandwidth)", 0, 0, true);
+CVariable<uint>		FSMaxTickLag("ws", "FSMaxTickLag", "Tick lag in ms of a full FS (0 to ignore the tick lag)", 200, 0, true);
+CVariable<uint>		FSLoadTimeout("ws", "FSLoadTimeout", "Seconds after which the load reported by a FS is ignored", 30, 0, true);
+
+/**
+ * Admission of the users: a token bucket that lets AdmissionRate users by second go to the frontends,
+ * AdmissionBurst at once, the other ones wait in a queue of AdmissionQueueSize users (the next ones are rejected)
+ */
+CVariable<float>	AdmissionRate("ws", "AdmissionRate", "Users sent to the frontends by second (0 for unlimited)", 0.0f, 0, true);
+CVariable<uint>		AdmissionBurst("ws", "AdmissionBurst", "Users sent to the frontends at once after a quiet period", 20, 0, true);
+CVariable<uint>		AdmissionQueueSize("ws", "AdmissionQueueSize", "Max number of users waiting their admission", 500, 0, true);
+
 
 /**
  * Use Patch mode
@@ -279,7 +307,7 @@ enum TFSState
 
 struct CFS
 {
-	CFS (TServiceId sid) : SId(sid), NbPendingUsers(0), NbUser(0), State(PatchOnly) { }
+	CFS (TServiceId sid) : SId(sid), NbPendingUsers(0), NbUser(0), State(PatchOnly), CpuLoad(0), Bandwidth(0), TickLag(0), LastLoadReport(0) { }
 
 	TServiceId	SId;				// Connection to the front end
 	uint32		NbPendingUsers;		// Number of not yet connected users (but rooted to this frontend)
@@ -288,11 +316,21 @@ struct CFS
 	TFSState	State;				// State of frontend (patching/accepting clients)
 	std::string	PatchAddress;		// Address of frontend patching server
 
+	float		CpuLoad;			// Part of the cpu used by the frontend (FS_LOAD message)
+	uint32		Bandwidth;			// Bytes by second sent to the clients
+	uint32		TickLag;			// Ms the frontend is late on the ticks
+	TTime		LastLoadReport;		// Local time of the last FS_LOAD, 0 if none
+
 	uint32		getUsersCountHeuristic() const
 	{
 		return NbUser + NbPendingUsers;
 	}
 
+	bool		hasLoadReport() const
+	{
+		return LastLoadReport != 0 && CTime::getLocalTime() - LastLoadReport < (TTime)FSLoadTimeout.get() * 1000;
+	}
+
 	void		setToAcceptClients()
 	{
 		if (State == AcceptClientOnly)
@@ -333,23 +371,136 @@ struct CFS
 
 list<CFS> FSList;
 
+CFS *getFS (TServiceId sid)
+{
+	for (list<CFS>::iterator it = FSList.begin(); it != FSList.end(); it++)
+	{
+		if ((*it).SId == sid)
+			return &(*it);
+	}
+	return NULL;
+}
+
+
+/**
+ * Placement engine of the new users on the frontends: it gives the load of a frontend,
+ * the users go to the least loaded frontend and a new frontend is open when it is full.
+ * An engine registers itself at its construction, it is selected by the FSPlacement variable.
+ */
+class IFSPlacement
+{
+public:
+
+	IFSPlacement (const std::string &name) : _Name(name)
+	{
+		getPlacements().insert (make_pair (name, this));
+	}
+
+	virtual ~IFSPlacement ()
+	{
+		getPlacements().erase (_Name);
+	}
+
+	/// Load of the frontend, it is full at 1
+	virtual float	getLoad (const CFS &fs) const = 0;
+
+	const std::string &getName () const { return _Name; }
+
+	/// Find a placement engine by its name, NULL if unknown
+	static IFSPlacement *find (const std::string &name)
+	{
+		std::map<std::string, IFSPlacement*>::iterator it = getPlacements().find (name);
+		return (it == getPlacements().end()) ? NULL : (*it).second;
+	}
+
+private:
+
+	static std::map<std::string, IFSPlacement*> &getPlacements ()
+	{
+		static std::map<std::string, IFSPlacement*> placements;
+		return placements;
+	}
+
+	std::string		_Name;
+};
+
+/// The players and the pending users against OpenFrontEndThreshold
+class CPlayersFSPlacement : public IFSPlacement
+{
+public:
+	CPlayersFSPlacement () : IFSPlacement("players") { }
+
+	virtual float	getLoad (const CFS &fs) const
+	{
+		if (OpenFrontEndThreshold.get() == 0)
+			return 1.0f;
+		return (float)fs.getUsersCountHeuristic() / (float)OpenFrontEndThreshold.get();
+	}
+};
+
+CPlayersFSPlacement		PlayersFSPlacement;
+
+/// The load of the most used resource of the frontend: the players, and the reported cpu, bandwidth and tick lag
+class CResourcesFSPlacement : public IFSPlacement
+{
+public:
+	CResourcesFSPlacement () : IFSPlacement("resources") { }
+
+	virtual float	getLoad (const CFS &fs) const
+	{
+		float load = PlayersFSPlacement.getLoad (fs);
+
+		// without recent report, the players only
+		if (!fs.hasLoadReport())
+			return load;
+
+		if (FSMaxCpuLoad.get() > 0.0f)
+			load = max (load, fs.CpuLoad / FSMaxCpuLoad.get());
+		if (FSMaxBandwidth.get() != 0)
+			load = max (load, (float)fs.Bandwidth / (float)FSMaxBandwidth.get());
+		if (FSMaxTickLag.get() != 0)
+			load = max (load, (float)fs.TickLag / (float)FSMaxTickLag.get());
+		return load;
+	}
+};
+
+CResourcesFSPlacement	ResourcesFSPlacement;
+
+IFSPlacement *getFSPlacement ()
+{
+	IFSPlacement *placement = IFSPlacement::find (FSPlacement.get());
+	return (placement == NULL) ? &PlayersFSPlacement : placement;
+}
+
+void	cbFSPlacement(IVariable &var)
+{
+	if (IFSPlacement::find (var.toString()) == NULL)
+		nlwarning ("Unknown FSPlacement '%s', using 'players'", var.toString().c_str());
+}
+
 /*
  * Find the best front end service for a new connecting user (return NULL if there is no suitable FS).
- * Additionally, calculate totalNbUsers.
+ * Additionally, calculate totalNbUsers and the load of the best FS.
  */
-CFS *findBestFS ( uint& totalNbUsers )
+CFS *findBestFS ( uint& totalNbUsers, float& bestLoad )
 {
 	totalNbUsers = 0;
+	bestLoad = 0.0f;
 
 	CFS*	best = NULL;
+	IFSPlacement *placement = getFSPlacement();
 
 	for (list<CFS>::iterator it=FSList.begin(); it!=FSList.end(); ++it)
 	{
 		CFS &fs = *it;
 		if (fs.State == AcceptClientOnly)
 		{
-			if (best == NULL || best->getUsersCountHeuristic() > fs.getUsersCountHeuristic())
+			float load = placement->getLoad (fs);
+			if (best == NULL || load < bestLoad || (load == bestLoad && best->getUsersCountHeuristic() > fs.getUsersCountHeuristic()))
+			{
 				best = &fs;
+				bestLoad = load;
+			}
 
 			totalNbUsers += fs.NbUser;
 		}
@@ -686,6 +837,22 @@ void	cbFSNbPlayers2(CMessage &msgin, const std::string &serviceName, TServiceId
 		CWelcomeServiceMod::getInstance()->updateConnectedPlayerCount(totalNbOnlineUsers, totalNbPendingUsers);
 }
 
+// This function is called by FS to report its load (see CLoginServer::reportLoad())
+void	cbFSLoad(CMessage &msgin, const std::string &serviceName, TServiceId  sid)
+{
+	CFS *fs = getFS (sid);
+	if (fs == NULL)
+	{
+		nlwarning("Load reported by %s-%hu that is not a frontend", serviceName.c_str(), sid.get());
+		return;
+	}
+
+	msgin.serial(fs->CpuLoad);
+	msgin.serial(fs->Bandwidth);
+	msgin.serial(fs->TickLag);
+	fs->LastLoadReport = CTime::getLocalTime();
+}
+
 /*
  * Set Shard open state
  */
@@ -879,6 +1046,7 @@ TUnifiedCallbackItem FSCallbackArray[] =
 	{ "FEPA",				cbFSPatchAddress },
 	{ "NBPLAYERS",			cbFSNbPlayers },
 	{ "NBPLAYERS2",			cbFSNbPlayers2 },
+	{ "FS_LOAD",			cbFSLoad },
 
 	{ "SET_SHARD_OPEN",		cbSetShardOpen },
 	{ "RESTORE_SHARD_OPEN",	cbRestoreShardOpen },
@@ -924,16 +1092,17 @@ void cbLSChooseShard (CMessage &msgin, const std::string &serviceName, TServiceI
 		nlwarning ("LS didn't give me the extended data for user '%s', set to empty", userName.toUtf8().c_str());
 	}
 
-	string ret = lsChooseShard(userName.toUtf8(), cookie, userPriv, userExtended, WS::TUserRole::ur_player, 0xffffffff, ~0);
+	CChooseShardRequest request;
+	request.UserName = userName.toUtf8();
+	request.Cookie = cookie;
+	request.UserPriv = userPriv;
+	request.UserExtended = userExtended;
+	request.UserRole = WS::TUserRole::ur_player;
+	request.InstanceId = 0xffffffff;
+	request.CharSlot = ~0;
+	request.LSSId = sid;
 
-	if (!ret.empty())
-	{
-		// send back an error message to LS
-		CMessage msgout ("SCS");
-		msgout.serial (ret);
-		msgout.serial (cookie);
-		CUnifiedNetwork::getInstance()->send(sid, msgout);
-	}
+	admitUser(request);
 }
 
 //void cbLSChooseShard (CMessage &msgin, const std::string &serviceName, uint16 sid)
@@ -946,16 +1115,17 @@ std::string lsChooseShard (const std::string &userName,
 					uint32 charSlot)
 {
 	uint	totalNbUsers;
-	CFS*	best = findBestFS( totalNbUsers );
+	float	bestLoad;
+	CFS*	best = findBestFS( totalNbUsers, bestLoad );
 
-	// could not find a good FS or best FS has more players than balance limit
-	if (best == NULL || best->getUsersCountHeuristic() >= OpenFrontEndThreshold)
+	// could not find a good FS or best FS is full
+	if (best == NULL || bestLoad >= 1.0f)
 	{
 		// open a new frontend
 		openNewFS();
 
 		// reselect best FS (will return newly open FS, or previous if no more FS available)
-		best = findBestFS(totalNbUsers);
+		best = findBestFS(totalNbUsers, bestLoad);
 
 		// check there is a FS available
 		if (best == NULL)
@@ -1022,6 +1192,119 @@ std::string lsChooseShard (const std::string &userName,
 	return "";
 }
 
+/**
+ * Token bucket: tokens are added at a rate by second, up to a burst
+ */
+class CTokenBucket
+{
+public:
+
+	CTokenBucket () : _Tokens(0.0f), _LastRefill(0) { }
+
+	/// Add the tokens since the last call
+	void	refill (float rate, uint burst)
+	{
+		TTime now = CTime::getLocalTime();
+		float maxTokens = (float)max (burst, 1u);
+		if (_LastRefill == 0)
+			_Tokens = maxTokens;
+		else
+			_Tokens = min (maxTokens, _Tokens + rate * (float)(now - _LastRefill) / 1000.0f);
+		_LastRefill = now;
+	}
+
+	/// Take a token if there is one
+	bool	take ()
+	{
+		if (_Tokens < 1.0f)
+			return false;
+		_Tokens -= 1.0f;
+		return true;
+	}
+
+private:
+
+	float	_Tokens;
+	TTime	_LastRefill;
+};
+
+CTokenBucket					AdmissionBucket;
+deque<CChooseShardRequest>		AdmissionQueue;
+uint32							NbRejectedAdmissions = 0;
+
+// Answer the module of the user, or its LS if the user can't go to a frontend
+void answerChooseShard (const CChooseShardRequest &request, const string &ret)
+{
+	if (request.WaiterModule != NULL)
+	{
+		if (CWelcomeServiceMod::isInitialized() != NULL)
+			CWelcomeServiceMod::getInstance()->welcomeUserResult(request, ret);
+	}
+	else if (!ret.empty())
+	{
+		// send back an error message to LS
+		CMessage msgout ("SCS");
+		msgout.serial (const_cast<string&>(ret));
+		msgout.serial (const_cast<CLoginCookie&>(request.Cookie));
+		CUnifiedNetwork::getInstance()->send(request.LSSId, msgout);
+	}
+}
+
+// Send the user to a frontend
+void chooseShard (const CChooseShardRequest &request)
+{
+	string ret = lsChooseShard(request.UserName, request.Cookie, request.UserPriv, request.UserExtended, request.UserRole, request.InstanceId, request.CharSlot);
+	answerChooseShard(request, ret);
+}
+
+/*
+ * Send the user to a frontend if the admission rate allows it, queue it otherwise (see AdmissionRate).
+ * The devs are never delayed.
+ */
+void admitUser (const CChooseShardRequest &request)
+{
+	if (AdmissionRate.get() <= 0.0f || request.UserPriv == ":DEV:")
+	{
+		chooseShard(request);
+		return;
+	}
+
+	AdmissionBucket.refill(AdmissionRate.get(), AdmissionBurst.get());
+	if (AdmissionQueue.empty() && AdmissionBucket.take())
+	{
+		chooseShard(request);
+		return;
+	}
+
+	if (AdmissionQueue.size() >= AdmissionQueueSize.get())
+	{
+		nlinfo("Admission queue full (%u users), rejecting user '%s'", AdmissionQueue.size(), request.UserName.c_str());
+		NbRejectedAdmissions++;
+		answerChooseShard(request, "The shard is busy, please try again in a few moments.");
+		return;
+	}
+
+	AdmissionQueue.push_back(request);
+}
+
+// Send the queued users the admission rate allows, called by the service update
+void updateAdmission ()
+{
+	if (AdmissionQueue.empty())
+		return;
+
+	bool unlimited = (AdmissionRate.get() <= 0.0f);
+	if (!unlimited)
+		AdmissionBucket.refill(AdmissionRate.get(), AdmissionBurst.get());
+
+	while (!AdmissionQueue.empty() && (unlimited || AdmissionBucket.take()))
+	{
+		CChooseShardRequest request = AdmissionQueue.front();
+		AdmissionQueue.pop_front();
+		chooseShard(request);
+	}
+}
+
 void cbFailed (CMessage &msgin, const std::string &serviceName, TServiceId  sid)
 {
 	// I can't connect to the Login Service, just nlerror ();
@@ -1323,6 +1606,8 @@ public:
 		else if (ShardOpen == 2)
 			addStatusTag("Open");
 
+		updateAdmission();
+
 		return true; 
 	}
 
@@ -1464,31 +1749,39 @@ namespace WS
 	void CWelcomeServiceMod::welcomeUser(NLNET::IModuleProxy *sender, uint32 charId, const std::string &userName, const CLoginCookie &cookie, const std::string &priviledge, const std::string &exPriviledge, WS::TUserRole mode, uint32 instanceId)
 	{
 		nldebug( "ERLOG: welcomeUser(%u,%s,%s,%s,%s,%u,%u)", charId, userName.c_str(), cookie.toString().c_str(), priviledge.c_str(), exPriviledge.c_str(), (uint)mode.getValue(), instanceId );
-		string ret = lsChooseShard(userName,
-									cookie,
-									priviledge, 
-									exPriviledge, 
-									mode,
-									instanceId,
-									charId & 0xF);
-
-		uint32 userId = charId >> 4;
+
+		CChooseShardRequest request;
+		request.UserName = userName;
+		request.Cookie = cookie;
+		request.UserPriv = priviledge;
+		request.UserExtended = exPriviledge;
+		request.UserRole = mode;
+		request.InstanceId = instanceId;
+		request.CharSlot = charId & 0xF;
+		request.WaiterModule = sender;
+		request.UserId = charId >> 4;
+
+		admitUser(request);
+	}
+
+	void CWelcomeServiceMod::welcomeUserResult(const CChooseShardRequest &request, const std::string &ret)
+	{
 		if (!ret.empty())
 		{
 			nldebug( "ERLOG: lsChooseShard returned an error => welcomeUserResult");
 			// TODO : correct this
 			string fsAddr;
-			CWelcomeServiceClientProxy wsc(sender);
-			wsc.welcomeUserResult(this, userId, false, fsAddr, ret);
+			CWelcomeServiceClientProxy wsc(request.WaiterModule);
+			wsc.welcomeUserResult(this, request.UserId, false, fsAddr, ret);
 		}
 		else
 		{
 			nldebug( "ERLOG: lsChooseShard OK => adding to pending");
 			TPendingFEResponseInfo pfri;
 			pfri.WSMod = this;
-			pfri.UserId = userId;
-			pfri.WaiterModule = sender;
-			PendingFeResponse.insert(make_pair(cookie, pfri));
+			pfri.UserId = request.UserId;
+			pfri.WaiterModule = request.WaiterModule;
+			PendingFeResponse.insert(make_pair(request.Cookie, pfri));
 		}
 	}
 
@@ -1541,16 +1834,27 @@ NLMISC_COMMAND (frontends, "displays the list of all registered front ends", "")
 	for (list<CFS>::iterator it = FSList.begin(); it != FSList.end (); it++)
 	{
 //		log.displayNL ("> FE %u: nb estimated users: %u nb users: %u, nb pending users : %u", 
-		log.displayNL ("> FE %u: nb users: %u, nb pending users : %u", 
+		log.displayNL ("> FE %u: nb users: %u, nb pending users : %u, load: %.2f", 
 			it->SId.get(), 
 			it->NbUser,
-			it->NbPendingUsers);
+			it->NbPendingUsers,
+			getFSPlacement()->getLoad(*it));
+		if (it->hasLoadReport())
+			log.displayNL ("    cpu: %.2f, bandwidth: %u B/s, tick lag: %u ms", it->CpuLoad, it->Bandwidth, it->TickLag);
 	}
 	log.displayNL ("End ot the list");
 
 	return true;
 }
 
+NLMISC_DYNVARIABLE(uint32, AdmissionQueueLength, "number of users waiting their admission")
+{
+	if (get)
+		*pointer = (uint32)AdmissionQueue.size();
+}
+
+NLMISC_VARIABLE(uint32, NbRejectedAdmissions, "number of users rejected because the admission queue was full");
+
 NLMISC_COMMAND (users, "displays the list of all registered users", "")
 {
 	if(args.size() != 0) return false;
@@ -46,6 +46,25 @@ bool disconnectClient(uint32 userId);
 
 namespace WS
 {
+	// a user to send to a frontend, from the LS or from a module (see admitUser())
+	struct CChooseShardRequest
+	{
+		CChooseShardRequest() : InstanceId(0), CharSlot(0), UserId(0) { }
+
+		std::string				UserName;
+		NLNET::CLoginCookie		Cookie;
+		std::string				UserPriv;
+		std::string				UserExtended;
+		WS::TUserRole			UserRole;
+		uint32					InstanceId;
+		uint32					CharSlot;
+
+		// the LS that waits the answer, or the module and the user id
+		NLNET::TServiceId		LSSId;
+		NLNET::TModuleProxyPtr	WaiterModule;
+		uint32					UserId;
+	};
+
 	// welcome service module
 	class CWelcomeServiceMod : 
 		public NLNET::CEmptyModuleCommBehav<NLNET::CEmptyModuleServiceBehav<NLNET::CEmptySocketBehav<NLNET::CModuleBase> > >,
@@ -107,6 +126,9 @@ namespace WS
 
 		// inform the LS that a pending client is lost
 		void pendingUserLost(const NLNET::CLoginCookie &cookie);
+
+		// answer the module that asked to welcome a user (ret is empty if the user was sent to a frontend)
+		void welcomeUserResult(const CChooseShardRequest &request, const std::string &ret);
 	};
 
 	struct TPendingFEResponseInfo
@@ -120,3 +142,6 @@ namespace WS
 	TPendingFeReponses	PendingFeResponse;
 
 } // namespace WS
+
+// send the user to a frontend, or queue it until the admission rate allows it
+void admitUser(const WS::CChooseShardRequest &request);
@@ -0,0 +1,418 @@
+/** \file bot.cpp
+ * Headless player simulated with the Snowballs client protocol, for the load tests of the shard
+ *
+ * $Id$
+ */
+
+/* Copyright, 2001 Nevrax Ltd.
+ *
+ * This file is part of NEVRAX SNOWBALLS.
+ * NEVRAX SNOWBALLS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+
+ * NEVRAX SNOWBALLS is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with NEVRAX SNOWBALLS; see the file COPYING. If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+//
+// Includes
+//
+
+#include <nel/misc/types_nl.h>
+
+#include <math.h>
+#include <stdlib.h>
+#include <algorithm>
+
+#include <nel/misc/common.h>
+#include <nel/misc/debug.h>
+
+#include <nel/net/callback_client.h>
+#include <nel/net/login_cookie.h>
+
+#include "bot.h"
+
+//
+// Namespaces
+//
+
+using namespace std;
+using namespace NLMISC;
+using namespace NLNET;
+
+//
+// Variables
+//
+
+CBotConfig	BotConfig;
+CBotStats	BotStats;
+
+CBotConfig::CBotConfig () :
+	FSHost("localhost:37000"), PosPeriod(500), ThrowPeriod(5000), ReconnectDelay(5000),
+	WalkRadius(50.0f), WalkSpeed(10.0f), SnowballSpeed(15.0f), SnowballRadius(3.0f)
+{
+#ifdef NL_OS_UNIX
+	DataAvailablePipe[0] = DataAvailablePipe[1] = -1;
+#endif
+}
+
+void CBotStats::clear ()
+{
+	NbLogins = 0;
+	NbLoginFailures = 0;
+	NbDisconnections = 0;
+	NbPosSent = 0;
+	NbSnowballsSent = 0;
+	NbMessagesReceived = 0;
+	NbHits = 0;
+	NbPosLost = 0;
+	PosRoundTrip.clear ();
+	Login.clear ();
+}
+
+//
+// CLatencyStats
+//
+
+double CLatencyStats::percentile (double p)
+{
+	if (_Samples.empty ())
+		return 0.0;
+
+	if (!_Sorted)
+	{
+		sort (_Samples.begin (), _Samples.end ());
+		_Sorted = true;
+	}
+
+	// nearest rank
+	uint rank = (uint)ceil (p / 100.0 * _Samples.size ());
+	return _Samples[max (rank, 1U) - 1];
+}
+
+string CLatencyStats::toString ()
+{
+	return NLMISC::toString ("p50 %.1f p90 %.1f p99 %.1f max %.1f ms (%u)",
+		percentile (50.0), percentile (90.0), percentile (99.0), percentile (100.0), size ());
+}
+
+//
+// Callbacks
+//
+
+static CBot *getBot (TSockId from)
+{
+	return (CBot *)(uintptr_t)from->appId ();
+}
+
+static void cbShardValidation (CMessage &msgin, TSockId from, CCallbackNetBase &netbase)
+{
+	string reason;
+	msgin.serial (reason);
+	getBot (from)->onShardValidation (reason);
+}
+
+static void cbIdentification (CMessage &msgin, TSockId from, CCallbackNetBase &netbase)
+{
+	uint32 id;
+	msgin.serial (id);
+	getBot (from)->onIdentification (id);
+}
+
+static void cbAddEntity (CMessage &msgin, TSockId from, CCallbackNetBase &netbase)
+{
+	uint32 id;
+	string name;
+	uint8 race;
+	CVector start;
+	msgin.serial (id, name, race, start);
+	getBot (from)->onAddEntity (id, start);
+}
+
+static void cbEntityPos (CMessage &msgin, TSockId from, CCallbackNetBase &netbase)
+{
+	uint32 id;
+	CVector position;
+	float angle;
+	uint32 state;
+	msgin.serial (id, position, angle, state);
+	getBot (from)->onEntityPos (id, state);
+}
+
+static void cbHit (CMessage &msgin, TSockId from, CCallbackNetBase &netbase)
+{
+	uint32 sid, eid;
+	bool direct;
+	msgin.serial (sid, eid, direct);
+	getBot (from)->onHit (eid);
+}
+
+// the other messages are only counted
+static void cbOther (CMessage &msgin, TSockId from, CCallbackNetBase &netbase)
+{
+	BotStats.NbMessagesReceived++;
+}
+
+static void cbDisconnection (TSockId from, void *arg)
+{
+	((CBot *)arg)->onDisconnection ();
+}
+
+// Array that contains all callback that could comes from the server
+static TCallbackItem BotCallbackArray[] =
+{
+	{ "SV", cbShardValidation },
+	{ "IDENTIFICATION", cbIdentification },
+	{ "ADD_ENTITY", cbAddEntity },
+	{ "REMOVE_ENTITY", cbOther },
+	{ "ENTITY_POS", cbEntityPos },
+	{ "ENTITY_TP", cbOther },
+	{ "HIT", cbHit },
+	{ "CHAT", cbOther },
+	{ "SNOWBALL", cbOther },
+};
+
+//
+// CBot
+//
+
+CBot::CBot (uint index) :
+	_State(Offline), _Id(0), _NextConnection(0), _LoginStart(0), _Angle(0.0f),
+	_LastWalk(0), _NextPos(0), _NextThrow(0), _NextSeq(0)
+{
+	_Name = toString ("bot%u", index);
+	for (uint i = 0; i < NbPendingPos; i++)
+	{
+		_PendingSeq[i] = 0;
+		_PendingTime[i] = 0;
+	}
+
+#ifdef NL_OS_UNIX
+	// all the bots share the pipe of the main loop instead of 2 file descriptors each
+	_Connection = new CCallbackClient (CCallbackNetBase::Off, "", true, false);
+	_Connection->setExternalPipeForDataAvailable (BotConfig.DataAvailablePipe);
+#else
+	_Connection = new CCallbackClient;
+#endif
+	_Connection->addCallbackArray (BotCallbackArray, sizeof (BotCallbackArray) / sizeof (BotCallbackArray[0]));
+	_Connection->setDisconnectionCallback (cbDisconnection, this);
+	_Connection->id ()->setAppId ((uint64)(uintptr_t)this);
+}
+
+CBot::~CBot ()
+{
+	disconnect ();
+	delete _Connection;
+}
+
+void CBot::connect (TTime now)
+{
+	_LoginStart = CTime::getPerformanceTime ();
+	try
+	{
+		_Connection->connect (CInetAddress (BotConfig.FSHost));
+	}
+	catch (ESocket &e)
+	{
+		nlwarning ("BOT: %s can't connect to %s: %s", _Name.c_str (), BotConfig.FSHost.c_str (), e.what ());
+		BotStats.NbLoginFailures++;
+		_NextConnection = now + BotConfig.ReconnectDelay;
+		return;
+	}
+
+	// the frontend accepts the invalid cookies (AcceptInvalidCookie) and gives us a random user id
+	CLoginCookie cookie;
+	cookie.set (0, 0, 0);
+	CMessage msgout ("SV");
+	msgout.serial (cookie);
+	_Connection->send (msgout);
+
+	_State = Validating;
+}
+
+void CBot::disconnect ()
+{
+	if (_Connection->connected ())
+		_Connection->disconnect ();
+	onDisconnection ();
+}
+
+void CBot::onDisconnection ()
+{
+	if (_State == Offline)
+		return;
+
+	if (_State == Online)
+		BotStats.NbDisconnections++;
+	else
+		BotStats.NbLoginFailures++;
+
+	_State = Offline;
+	_NextConnection = CTime::getLocalTime () + BotConfig.ReconnectDelay;
+	for (uint i = 0; i < NbPendingPos; i++)
+		_PendingTime[i] = 0;
+}
+
+void CBot::onShardValidation (const string &reason)
+{
+	BotStats.NbMessagesReceived++;
+	if (_State != Validating)
+		return;
+
+	if (!reason.empty ())
+	{
+		nlwarning ("BOT: %s refused by the frontend: %s", _Name.c_str (), reason.c_str ());
+		disconnect ();
+		return;
+	}
+	_State = Identifying;
+}
+
+void CBot::onIdentification (uint32 id)
+{
+	BotStats.NbMessagesReceived++;
+	if (_State != Identifying)
+		return;
+
+	// the position service adds our entity and sends it back with its start position
+	_Id = id;
+	uint8 race = 1;
+	CMessage msgout ("ADD_ENTITY");
+	msgout.serial (_Id, _Name, race);
+	_Connection->send (msgout);
+
+	_State = Joining;
+}
+
+void CBot::onAddEntity (uint32 id, const CVector &start)
+{
+	BotStats.NbMessagesReceived++;
+	if (_State != Joining || id != _Id)
+		return;
+
+	_Start = start;
+	_Position = start;
+	_Angle = frand ((float)Pi * 2.0f);
+	_State = Online;
+
+	BotStats.NbLogins++;
+	BotStats.Login.add (CTime::ticksToSecond (CTime::getPerformanceTime () - _LoginStart) * 1000.0);
+
+	// spread the messages of the bots over the periods
+	TTime now = CTime::getLocalTime ();
+	_LastWalk = now;
+	_NextPos = now + rand () % max (BotConfig.PosPeriod, (uint32)1);
+	_NextThrow = now + rand () % max (BotConfig.ThrowPeriod, (uint32)1);
+}
+
+void CBot::onEntityPos (uint32 id, uint32 state)
+{
+	BotStats.NbMessagesReceived++;
+	if (_State != Online || id != _Id)
+		return;
+
+	uint16 seq = (uint16)(state >> 16);
+	uint i = seq % NbPendingPos;
+	if (_PendingSeq[i] == seq && _PendingTime[i] != 0)
+	{
+		BotStats.PosRoundTrip.add (CTime::ticksToSecond (CTime::getPerformanceTime () - _PendingTime[i]) * 1000.0);
+		_PendingTime[i] = 0;
+	}
+}
+
+void CBot::onHit (uint32 victimId)
+{
+	BotStats.NbMessagesReceived++;
+	if (_State == Online && victimId == _Id)
+		BotStats.NbHits++;
+}
+
+void CBot::walk (TTime now)
+{
+	float dt = (float)(now - _LastWalk) / 1000.0f;
+	_LastWalk = now;
+
+	// wander, and go back to the start when too far
+	CVector toStart = _Start - _Position;
+	toStart.z = 0.0f;
+	if (toStart.norm () > BotConfig.WalkRadius)
+		_Angle = (float)atan2 (toStart.y, toStart.x);
+	else
+		_Angle += (frand (1.0f) - 0.5f) * dt;
+
+	_Position.x += (float)cos (_Angle) * BotConfig.WalkSpeed * dt;
+	_Position.y += (float)sin (_Angle) * BotConfig.WalkSpeed * dt;
+}
+
+void CBot::sendEntityPos ()
+{
+	uint16 seq = _NextSeq++;
+	uint i = seq % NbPendingPos;
+	if (_PendingTime[i] != 0)
+		BotStats.NbPosLost++;
+	_PendingSeq[i] = seq;
+	_PendingTime[i] = CTime::getPerformanceTime ();
+
+	uint32 state = (uint32)seq << 16;
+	CMessage msgout ("ENTITY_POS");
+	msgout.serial (_Id, _Position, _Angle, state);
+	_Connection->send (msgout);
+
+	BotStats.NbPosSent++;
+}
+
+void CBot::throwSnowball ()
+{
+	CVector direction ((float)cos (_Angle), (float)sin (_Angle), 0.0f);
+	CVector start = _Position + direction;
+	CVector target = _Position + direction * (5.0f + frand (15.0f));
+
+	CMessage msgout ("SNOWBALL");
+	msgout.serial (_Id, start, target, BotConfig.SnowballSpeed, BotConfig.SnowballRadius);
+	_Connection->send (msgout);
+
+	BotStats.NbSnowballsSent++;
+}
+
+void CBot::update (TTime now)
+{
+	if (_State == Offline)
+	{
+		if (now >= _NextConnection)
+			connect (now);
+		return;
+	}
+
+	// calls the callbacks of the received messages
+	_Connection->update ();
+
+	if (_State != Online)
+		return;
+
+	walk (now);
+
+	if (now >= _NextPos)
+	{
+		sendEntityPos ();
+		_NextPos += BotConfig.PosPeriod;
+		if (_NextPos < now)
+			_NextPos = now + BotConfig.PosPeriod;
+	}
+
+	if (BotConfig.ThrowPeriod != 0 && now >= _NextThrow)
+	{
+		throwSnowball ();
+		_NextThrow = now + BotConfig.ThrowPeriod / 2 + rand () % max (BotConfig.ThrowPeriod, (uint32)1);
+	}
+}
+
+/* End of bot.cpp */
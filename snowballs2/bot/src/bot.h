@@ -0,0 +1,203 @@
+/** \file bot.h
+ * Headless player simulated with the Snowballs client protocol, for the load tests of the shard
+ *
+ * $Id$
+ */
+
+/* Copyright, 2001 Nevrax Ltd.
+ *
+ * This file is part of NEVRAX SNOWBALLS.
+ * NEVRAX SNOWBALLS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+
+ * NEVRAX SNOWBALLS is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with NEVRAX SNOWBALLS; see the file COPYING. If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#ifndef BOT_H
+#define BOT_H
+
+//
+// Includes
+//
+
+#include <string>
+#include <vector>
+
+#include <nel/misc/types_nl.h>
+#include <nel/misc/time_nl.h>
+#include <nel/misc/vector.h>
+
+//
+// External definitions
+//
+
+namespace NLNET
+{
+	class CCallbackClient;
+}
+
+//
+// External classes
+//
+
+/// The behaviour of the bots, read from the config file by main.cpp
+struct CBotConfig
+{
+	CBotConfig ();
+
+	/// Address of the frontend service
+	std::string		FSHost;
+	/// Milliseconds between two positions sent by a walking bot
+	uint32			PosPeriod;
+	/// Milliseconds between two snowballs thrown by a bot, 0 to never throw
+	uint32			ThrowPeriod;
+	/// Milliseconds before reconnecting a disconnected bot
+	uint32			ReconnectDelay;
+	/// The bots walk in a circle of this radius around their start position
+	float			WalkRadius;
+	float			WalkSpeed;
+	float			SnowballSpeed;
+	float			SnowballRadius;
+#ifdef NL_OS_UNIX
+	/// Pipe written by the receive threads of all the bots, see CBufNetBase::setExternalPipeForDataAvailable()
+	int				DataAvailablePipe [2];
+#endif
+};
+
+extern CBotConfig	BotConfig;
+
+
+/**
+ * Samples of a latency, in milliseconds
+ */
+class CLatencyStats
+{
+public:
+
+	CLatencyStats () : _Sorted(true) { }
+
+	void		add (double ms) { _Samples.push_back (ms); _Sorted = false; }
+	void		clear () { _Samples.clear (); _Sorted = true; }
+	uint		size () const { return (uint)_Samples.size (); }
+
+	/// The percentile p (between 0 and 100) of the samples, 0 if there is none
+	double		percentile (double p);
+
+	/// "p50 x p90 x p99 x max x ms (n)"
+	std::string	toString ();
+
+private:
+
+	std::vector<double>	_Samples;
+	bool				_Sorted;
+};
+
+
+/// The counters of all the bots, cleared by main.cpp after each report
+struct CBotStats
+{
+	CBotStats () { clear (); }
+	void			clear ();
+
+	uint32			NbLogins;
+	uint32			NbLoginFailures;
+	uint32			NbDisconnections;
+	uint32			NbPosSent;
+	uint32			NbSnowballsSent;
+	uint32			NbMessagesReceived;
+	uint32			NbHits;
+	uint32			NbPosLost;
+
+	/// Time between sending a position and receiving it back from the position service
+	CLatencyStats	PosRoundTrip;
+	/// Time between the connection and the bot entity added by the position service
+	CLatencyStats	Login;
+};
+
+extern CBotStats	BotStats;
+
+
+/**
+ * A player without display: logs in the frontend like the client, walks at random
+ * around its start position and throws snowballs in front of it.
+ *
+ * The position sent carries a sequence number in the high 16 bits of its state (the
+ * client only looks at the bit 0), the position service sends it back to all the
+ * clients, the bot that sent it measures the round trip of the shard.
+ *
+ * update() runs the behaviour and the callbacks of the messages, it must be called
+ * often by the only thread that uses the bots. The bots receive on the threads of
+ * layer 1 (CBufClient::SharedEngine), they all signal their messages in
+ * BotConfig.DataAvailablePipe.
+ */
+class CBot
+{
+public:
+
+	enum TState { Offline, Validating, Identifying, Joining, Online };
+
+	CBot (uint index);
+	~CBot ();
+
+	/// Process the received messages and run the behaviour, now is the local time
+	void			update (NLMISC::TTime now);
+
+	/// Disconnect from the frontend, the bot reconnects after BotConfig.ReconnectDelay
+	void			disconnect ();
+
+	TState			getState () const { return _State; }
+	uint32			getId () const { return _Id; }
+	const std::string &getName () const { return _Name; }
+
+	/// Callbacks of the messages of the frontend
+	void			onShardValidation (const std::string &reason);
+	void			onIdentification (uint32 id);
+	void			onAddEntity (uint32 id, const NLMISC::CVector &start);
+	void			onEntityPos (uint32 id, uint32 state);
+	void			onHit (uint32 victimId);
+	void			onDisconnection ();
+
+private:
+
+	enum { NbPendingPos = 64 };
+
+	void			connect (NLMISC::TTime now);
+	void			walk (NLMISC::TTime now);
+	void			sendEntityPos ();
+	void			throwSnowball ();
+
+	NLNET::CCallbackClient	*_Connection;
+	std::string		_Name;
+	TState			_State;
+	uint32			_Id;
+
+	NLMISC::TTime	_NextConnection;
+	NLMISC::TTicks	_LoginStart;
+
+	NLMISC::CVector	_Start;
+	NLMISC::CVector	_Position;
+	float			_Angle;
+	NLMISC::TTime	_LastWalk;
+	NLMISC::TTime	_NextPos;
+	NLMISC::TTime	_NextThrow;
+
+	/// Send time of the positions not received back yet, by sequence number modulo NbPendingPos
+	uint16			_NextSeq;
+	uint16			_PendingSeq [NbPendingPos];
+	NLMISC::TTicks	_PendingTime [NbPendingPos];
+};
+
+
+#endif // BOT_H
+
+/* End of bot.h */
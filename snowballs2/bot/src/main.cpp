@@ -0,0 +1,260 @@
+/*
+ * This file contain the Snowballs headless bots, to load test the shard.
+ *
+ * $Id$
+ */
+
+/*
+ * Copyright, 2000 - 2001 Nevrax Ltd.
+ *
+ * This file is part of NEVRAX SNOWBALLS.
+ * NEVRAX SNOWBALLS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * NEVRAX SNOWBALLS is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NEVRAX SNOWBALLS; see the file COPYING. If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif // HAVE_CONFIG_H
+
+#ifndef SNOWBALLS_CONFIG
+#define SNOWBALLS_CONFIG ""
+#endif // SNOWBALLS_CONFIG
+
+// This include is mandatory to use NeL. It include NeL types.
+#include <nel/misc/types_nl.h>
+
+#include <stdlib.h>
+#include <time.h>
+
+#ifdef NL_OS_UNIX
+#	include <unistd.h>
+#	include <sys/time.h>
+#	include <sys/resource.h>
+#	include <sys/select.h>
+#endif
+
+#include <nel/misc/app_context.h>
+#include <nel/misc/config_file.h>
+#include <nel/misc/debug.h>
+#include <nel/misc/file.h>
+#include <nel/misc/time_nl.h>
+
+#include <nel/net/buf_client.h>
+#include <nel/net/sock.h>
+
+#include "bot.h"
+
+using namespace NLMISC;
+using namespace NLNET;
+using namespace std;
+
+// The bots of the process, all updated by the main loop
+vector<CBot*> Bots;
+
+
+/****************************************************************************
+ * loadConfig
+ *
+ * Read the config file, the variables that are not in it keep their default.
+ ****************************************************************************/
+static void loadConfig (CConfigFile &cf, uint &nbBots, uint &connectionRate, uint &nbReceiveThreads, uint &reportPeriod, uint &duration)
+{
+	CConfigFile::CVar *var;
+	if ((var = cf.getVarPtr ("FSHost")) != NULL)
+		BotConfig.FSHost = var->asString ();
+	if (BotConfig.FSHost.find (":") == string::npos)
+		BotConfig.FSHost += ":37000";
+
+	if ((var = cf.getVarPtr ("NbBots")) != NULL)
+		nbBots = var->asInt ();
+	if ((var = cf.getVarPtr ("ConnectionRate")) != NULL)
+		connectionRate = var->asInt ();
+	if ((var = cf.getVarPtr ("ReceiveThreads")) != NULL)
+		nbReceiveThreads = var->asInt ();
+	if ((var = cf.getVarPtr ("ReportPeriod")) != NULL)
+		reportPeriod = var->asInt ();
+	if ((var = cf.getVarPtr ("Duration")) != NULL)
+		duration = var->asInt ();
+
+	if ((var = cf.getVarPtr ("PosPeriod")) != NULL)
+		BotConfig.PosPeriod = max (var->asInt (), 1);
+	if ((var = cf.getVarPtr ("ThrowPeriod")) != NULL)
+		BotConfig.ThrowPeriod = var->asInt ();
+	if ((var = cf.getVarPtr ("ReconnectDelay")) != NULL)
+		BotConfig.ReconnectDelay = var->asInt ();
+	if ((var = cf.getVarPtr ("WalkRadius")) != NULL)
+		BotConfig.WalkRadius = var->asFloat ();
+	if ((var = cf.getVarPtr ("WalkSpeed")) != NULL)
+		BotConfig.WalkSpeed = var->asFloat ();
+
+	if ((var = cf.getVarPtr ("NegFiltersDebug")) != NULL)
+		for (uint i = 0; i < var->size (); i++)
+			DebugLog->addNegativeFilter (var->asString (i).c_str ());
+	if ((var = cf.getVarPtr ("NegFiltersInfo")) != NULL)
+		for (uint i = 0; i < var->size (); i++)
+			InfoLog->addNegativeFilter (var->asString (i).c_str ());
+}
+
+
+/****************************************************************************
+ * report
+ *
+ * Display the counters and the latencies since the previous report.
+ ****************************************************************************/
+static void report (uint seconds)
+{
+	uint nbOnline = 0;
+	for (uint i = 0; i < Bots.size (); i++)
+	{
+		if (Bots[i]->getState () == CBot::Online)
+			nbOnline++;
+	}
+	seconds = max (seconds, 1U);
+
+	nlinfo ("BOT: %u/%u online, %u logins, %u login failures, %u disconnections",
+		nbOnline, Bots.size (), BotStats.NbLogins, BotStats.NbLoginFailures, BotStats.NbDisconnections);
+	nlinfo ("BOT: by second: %u positions and %u snowballs sent, %u messages received, %u hits",
+		BotStats.NbPosSent / seconds, BotStats.NbSnowballsSent / seconds, BotStats.NbMessagesReceived / seconds, BotStats.NbHits / seconds);
+	nlinfo ("BOT: position round trip %s, %u lost", BotStats.PosRoundTrip.toString ().c_str (), BotStats.NbPosLost);
+	nlinfo ("BOT: login %s", BotStats.Login.toString ().c_str ());
+
+	BotStats.clear ();
+}
+
+
+/****************************************************************************
+ * waitMessages
+ *
+ * Wait until a bot received a message, at most timeout ms.
+ ****************************************************************************/
+static void waitMessages (uint timeout)
+{
+#ifdef NL_OS_UNIX
+	// the pipe keeps a byte by message not read yet
+	fd_set readers;
+	FD_ZERO (&readers);
+	FD_SET (BotConfig.DataAvailablePipe[0], &readers);
+	timeval tv;
+	tv.tv_sec = 0;
+	tv.tv_usec = timeout * 1000;
+	::select (BotConfig.DataAvailablePipe[0] + 1, &readers, NULL, NULL, &tv);
+#else
+	nlSleep (timeout);
+#endif
+}
+
+
+/****************************************************************************
+ * main
+ ****************************************************************************/
+int main (int argc, char **argv)
+{
+	CApplicationContext appContext;
+	createDebug ();
+
+	srand ((uint)time (NULL));
+
+	string configFileName = "snowballs_bot.cfg";
+	if (argc > 1)
+		configFileName = argv[1];
+	else if (!CFile::fileExists (configFileName) && CFile::fileExists (string (SNOWBALLS_CONFIG) + configFileName))
+		configFileName = string (SNOWBALLS_CONFIG) + configFileName;
+
+	uint nbBots = 100;
+	uint connectionRate = 100;
+	uint nbReceiveThreads = 2;
+	uint reportPeriod = 10;
+	uint duration = 0;
+
+	CConfigFile cf;
+	try
+	{
+		cf.load (configFileName);
+		loadConfig (cf, nbBots, connectionRate, nbReceiveThreads, reportPeriod, duration);
+	}
+	catch (Exception &e)
+	{
+		nlwarning ("BOT: Can't load '%s' (%s), using the default values", configFileName.c_str (), e.what ());
+	}
+
+	CSock::initNetwork ();
+
+	// thousands of bots don't fit in a receive thread each
+	CBufClient::setDefaultReceiveEngine (CBufClient::SharedEngine);
+	CBufClient::setNbSharedReceiveThreads (nbReceiveThreads);
+
+#ifdef NL_OS_UNIX
+	// a socket by bot
+	rlimit rl;
+	if (getrlimit (RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max)
+	{
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit (RLIMIT_NOFILE, &rl);
+	}
+	if (getrlimit (RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY && rl.rlim_cur < nbBots + 64)
+		nlwarning ("BOT: %u file descriptors for %u bots, raise the limit (ulimit -n)", (uint)rl.rlim_cur, nbBots);
+
+	if (::pipe (BotConfig.DataAvailablePipe) != 0)
+		nlerror ("BOT: Can't create the pipe of the main loop");
+#endif
+
+	nlinfo ("BOT: %u bots to %s, %u connections by second, %s receive engine",
+		nbBots, BotConfig.FSHost.c_str (), connectionRate,
+		(CBufClient::defaultReceiveEngine () == CBufClient::SharedEngine) ? "shared" : "thread");
+
+	TTime start = CTime::getLocalTime ();
+	TTime lastReport = start;
+	for (;;)
+	{
+		TTime now = CTime::getLocalTime ();
+		if (duration != 0 && now >= start + (TTime)duration * 1000)
+			break;
+
+		// ramp up: the new bots connect at their first update
+		uint nbExpected = nbBots;
+		if (connectionRate != 0)
+			nbExpected = (uint)min ((TTime)nbBots, (now - start) * connectionRate / 1000 + 1);
+		while (Bots.size () < nbExpected)
+			Bots.push_back (new CBot ((uint)Bots.size ()));
+
+		for (uint i = 0; i < Bots.size (); i++)
+			Bots[i]->update (now);
+
+		if (reportPeriod != 0 && now >= lastReport + (TTime)reportPeriod * 1000)
+		{
+			report ((uint)((now - lastReport) / 1000));
+			lastReport = now;
+		}
+
+		// the bots move and send every few ms at most
+		waitMessages (5);
+	}
+
+	report ((uint)((CTime::getLocalTime () - lastReport) / 1000));
+
+	for (uint i = 0; i < Bots.size (); i++)
+		delete Bots[i];
+	Bots.clear ();
+
+#ifdef NL_OS_UNIX
+	::close (BotConfig.DataAvailablePipe[0]);
+	::close (BotConfig.DataAvailablePipe[1]);
+#endif
+
+	CSock::releaseNetwork ();
+	return 0;
+}
+
+/* End of main.cpp */